@@ -30,54 +30,79 @@
 
 #define rol(bits, value) (((value) << (bits)) | ((value) >> (32 - (bits))))
 
-static void SHA1_transform(SHA_CTX *ctx) {
-    uint32_t W[80];
-    uint32_t A, B, C, D, E;
-    uint8_t *p = ctx->buf;
-    int t;
-
-    for(t = 0; t < 16; ++t) {
-        uint32_t tmp =  *p++ << 24;
-        tmp |= *p++ << 16;
-        tmp |= *p++ << 8;
-        tmp |= *p++;
-        W[t] = tmp;
-    }
-
-    for(; t < 80; t++) {
-        W[t] = rol(1,W[t-3] ^ W[t-8] ^ W[t-14] ^ W[t-16]);
+#define K0 0x5A827999
+#define K1 0x6ED9EBA1
+#define K2 0x8F1BBCDC
+#define K3 0xCA62C1D6
+
+#define F0(b, c, d) ((d) ^ ((b) & ((c) ^ (d))))
+#define F1(b, c, d) ((b) ^ (c) ^ (d))
+#define F2(b, c, d) (((b) & (c)) | ((d) & ((b) | (c))))
+#define F3(b, c, d) ((b) ^ (c) ^ (d))
+
+/* The message schedule is kept in a 16-word ring, expanded one word
+** ahead of the round that uses it, instead of a precomputed W[80].
+*/
+#define LOAD(t) (W[t] = ((uint32_t)data[4*(t)] << 24) |             \
+                        ((uint32_t)data[4*(t)+1] << 16) |           \
+                        ((uint32_t)data[4*(t)+2] << 8) |            \
+                        (uint32_t)data[4*(t)+3])
+#define EXPAND(t) (W[(t) & 15] = rol(1, W[((t)+13) & 15] ^           \
+                                        W[((t)+8) & 15] ^            \
+                                        W[((t)+2) & 15] ^ W[(t) & 15]))
+
+/* One round, with the working variables rotated by renaming. */
+#define ROUND(a, b, c, d, e, f, k, w) do {                  \
+        e += rol(5, a) + f(b, c, d) + k + (w);              \
+        b = rol(30, b);                                     \
+    } while (0)
+
+#define R5(f, k, w0, w1, w2, w3, w4) do {                   \
+        ROUND(A, B, C, D, E, f, k, w0);                     \
+        ROUND(E, A, B, C, D, f, k, w1);                     \
+        ROUND(D, E, A, B, C, f, k, w2);                     \
+        ROUND(C, D, E, A, B, f, k, w3);                     \
+        ROUND(B, C, D, E, A, f, k, w4);                     \
+    } while (0)
+
+/* Transform "blocks" whole 64-byte blocks starting at data. */
+static void SHA1_transform(SHA_CTX *ctx, const uint8_t *data, int blocks) {
+    uint32_t W[16];
+
+    while (blocks--) {
+        uint32_t A = ctx->state[0];
+        uint32_t B = ctx->state[1];
+        uint32_t C = ctx->state[2];
+        uint32_t D = ctx->state[3];
+        uint32_t E = ctx->state[4];
+
+        R5(F0, K0, LOAD(0), LOAD(1), LOAD(2), LOAD(3), LOAD(4));
+        R5(F0, K0, LOAD(5), LOAD(6), LOAD(7), LOAD(8), LOAD(9));
+        R5(F0, K0, LOAD(10), LOAD(11), LOAD(12), LOAD(13), LOAD(14));
+        R5(F0, K0, LOAD(15), EXPAND(16), EXPAND(17), EXPAND(18), EXPAND(19));
+
+        R5(F1, K1, EXPAND(20), EXPAND(21), EXPAND(22), EXPAND(23), EXPAND(24));
+        R5(F1, K1, EXPAND(25), EXPAND(26), EXPAND(27), EXPAND(28), EXPAND(29));
+        R5(F1, K1, EXPAND(30), EXPAND(31), EXPAND(32), EXPAND(33), EXPAND(34));
+        R5(F1, K1, EXPAND(35), EXPAND(36), EXPAND(37), EXPAND(38), EXPAND(39));
+
+        R5(F2, K2, EXPAND(40), EXPAND(41), EXPAND(42), EXPAND(43), EXPAND(44));
+        R5(F2, K2, EXPAND(45), EXPAND(46), EXPAND(47), EXPAND(48), EXPAND(49));
+        R5(F2, K2, EXPAND(50), EXPAND(51), EXPAND(52), EXPAND(53), EXPAND(54));
+        R5(F2, K2, EXPAND(55), EXPAND(56), EXPAND(57), EXPAND(58), EXPAND(59));
+
+        R5(F3, K3, EXPAND(60), EXPAND(61), EXPAND(62), EXPAND(63), EXPAND(64));
+        R5(F3, K3, EXPAND(65), EXPAND(66), EXPAND(67), EXPAND(68), EXPAND(69));
+        R5(F3, K3, EXPAND(70), EXPAND(71), EXPAND(72), EXPAND(73), EXPAND(74));
+        R5(F3, K3, EXPAND(75), EXPAND(76), EXPAND(77), EXPAND(78), EXPAND(79));
+
+        ctx->state[0] += A;
+        ctx->state[1] += B;
+        ctx->state[2] += C;
+        ctx->state[3] += D;
+        ctx->state[4] += E;
+        data += 64;
     }
-
-    A = ctx->state[0];
-    B = ctx->state[1];
-    C = ctx->state[2];
-    D = ctx->state[3];
-    E = ctx->state[4];
-
-    for(t = 0; t < 80; t++) {
-        uint32_t tmp = rol(5,A) + E + W[t];
-
-        if (t < 20)
-            tmp += (D^(B&(C^D))) + 0x5A827999;
-        else if ( t < 40)
-            tmp += (B^C^D) + 0x6ED9EBA1;
-        else if ( t < 60)
-            tmp += ((B&C)|(D&(B|C))) + 0x8F1BBCDC;
-        else
-            tmp += (B^C^D) + 0xCA62C1D6;
-
-        E = D;
-        D = C;
-        C = rol(30,B);
-        B = A;
-        A = tmp;
-    }
-
-    ctx->state[0] += A;
-    ctx->state[1] += B;
-    ctx->state[2] += C;
-    ctx->state[3] += D;
-    ctx->state[4] += E;
 }
 
 void SHA_init(SHA_CTX *ctx) {
@@ -93,16 +118,32 @@ void SHA_update(SHA_CTX *ctx, const void *data, int len) {
     int i = ctx->count % sizeof(ctx->buf);
     const uint8_t* p = (const uint8_t*)data;
 
+    if (len <= 0) return;
     ctx->count += len;
 
-    while (len--) {
-        ctx->buf[i++] = *p++;
-        if (i == sizeof(ctx->buf)) {
-            SHA1_transform(ctx);
-            i = 0;
+    /* Top up a partially filled block first. */
+    if (i > 0) {
+        while (len > 0 && i < (int) sizeof(ctx->buf)) {
+            ctx->buf[i++] = *p++;
+            --len;
         }
+        if (i < (int) sizeof(ctx->buf)) return;
+        SHA1_transform(ctx, ctx->buf, 1);
+    }
+
+    /* Whole blocks are transformed straight from the input. */
+    if (len >= (int) sizeof(ctx->buf)) {
+        int blocks = len / sizeof(ctx->buf);
+        SHA1_transform(ctx, p, blocks);
+        p += blocks * sizeof(ctx->buf);
+        len -= blocks * sizeof(ctx->buf);
+    }
+
+    for (i = 0; i < len; ++i) {
+        ctx->buf[i] = *p++;
     }
 }
+
 const uint8_t *SHA_final(SHA_CTX *ctx) {
     uint8_t *p = ctx->buf;
     uint64_t cnt = ctx->count * 8;
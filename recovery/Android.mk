@@ -39,7 +39,7 @@ LOCAL_STATIC_LIBRARIES :=
 ifeq ($(TARGET_USERIMAGES_USE_EXT4), true)
 LOCAL_CFLAGS += -DUSE_EXT4
 LOCAL_C_INCLUDES += system/extras/ext4_utils
-LOCAL_STATIC_LIBRARIES += libext4_utils libz
+LOCAL_STATIC_LIBRARIES += libext4_utils
 endif
 
 # This binary is in the recovery ramdisk, which is otherwise a copy of root.
@@ -54,8 +54,18 @@ ifeq ($(TARGET_RECOVERY_UI_LIB),)
 else
   LOCAL_STATIC_LIBRARIES += $(TARGET_RECOVERY_UI_LIB)
 endif
-LOCAL_STATIC_LIBRARIES += libext4_utils libz
-LOCAL_STATIC_LIBRARIES += libminzip libunz libmtdutils libmincrypt
+LOCAL_STATIC_LIBRARIES += libext4_utils
+LOCAL_STATIC_LIBRARIES += libminzip libunz libmtdutils librecovery_crypto
+ifeq ($(TARGET_MINZIP_USE_LIBDEFLATE),true)
+LOCAL_STATIC_LIBRARIES += libdeflate
+endif
+# Only one of these: a static link takes inflate() and friends from
+# whichever comes first.
+ifeq ($(TARGET_MINZIP_USE_ZLIB_NG),true)
+LOCAL_STATIC_LIBRARIES += libz_ng
+else
+LOCAL_STATIC_LIBRARIES += libz
+endif
 LOCAL_STATIC_LIBRARIES += libminui libpixelflinger_static libpng libcutils
 LOCAL_STATIC_LIBRARIES += libstdc++ libc libfw_env
 
@@ -97,6 +107,12 @@ ifeq ($(TARGET_RECOVERY_HAS_SDCARD_ONLY),true)
 LOCAL_CFLAGS += -DRECOVERY_HAS_SDCARD_ONLY
 endif # TARGET_RECOVERY_HAS_SDCARD_ONLY
 
+# Have format_volume() securely discard (BLKSECDISCARD) eMMC volumes
+# where the device supports it, so wiped data can't be recovered.
+ifeq ($(TARGET_RECOVERY_SECURE_DISCARD),true)
+LOCAL_CFLAGS += -DRECOVERY_SECURE_DISCARD
+endif
+
 LOCAL_C_INCLUDES += system/extras/ext4_utils
 
 include $(BUILD_EXECUTABLE)
@@ -112,11 +128,21 @@ LOCAL_FORCE_STATIC_EXECUTABLE := true
 
 LOCAL_MODULE_TAGS := tests
 
-LOCAL_STATIC_LIBRARIES := libmincrypt libcutils libstdc++ libc
+LOCAL_STATIC_LIBRARIES := libminzip librecovery_crypto
+ifeq ($(TARGET_MINZIP_USE_LIBDEFLATE),true)
+LOCAL_STATIC_LIBRARIES += libdeflate
+endif
+ifeq ($(TARGET_MINZIP_USE_ZLIB_NG),true)
+LOCAL_STATIC_LIBRARIES += libz_ng
+else
+LOCAL_STATIC_LIBRARIES += libz
+endif
+LOCAL_STATIC_LIBRARIES += libcutils libstdc++ libc
 
 include $(BUILD_EXECUTABLE)
 
 
+include $(commands_recovery_local_path)/crypto/Android.mk
 include $(commands_recovery_local_path)/minui/Android.mk
 include $(commands_recovery_local_path)/minelf/Android.mk
 include $(commands_recovery_local_path)/minzip/Android.mk
@@ -25,7 +25,7 @@
 #include <fcntl.h>
 #include <unistd.h>
 
-#include "mincrypt/sha.h"
+#include "crypto/sha1.h"
 #include "applypatch.h"
 #include "mtdutils/mtdutils.h"
 #include "edify/expr.h"
@@ -94,7 +94,7 @@ int LoadFileContents(const char* filename, FileContents* file,
         }
     }
 
-    SHA(file->data, file->size, file->sha1);
+    SHA1(file->data, file->size, file->sha1);
     return 0;
 }
 
@@ -219,9 +219,9 @@ static int LoadPartitionContents(const char* filename, FileContents* file) {
             }
     }
 
-    SHA_CTX sha_ctx;
-    SHA_init(&sha_ctx);
-    uint8_t parsed_sha[SHA_DIGEST_SIZE];
+    SHA1_CTX sha_ctx;
+    SHA1_init(&sha_ctx);
+    uint8_t parsed_sha[SHA1_DIGEST_SIZE];
 
     // allocate enough memory to hold the largest size.
     file->data = malloc(size[index[pairs-1]]);
@@ -251,15 +251,15 @@ static int LoadPartitionContents(const char* filename, FileContents* file) {
                 file->data = NULL;
                 return -1;
             }
-            SHA_update(&sha_ctx, p, read);
+            SHA1_update(&sha_ctx, p, read);
             file->size += read;
         }
 
         // Duplicate the SHA context and finalize the duplicate so we can
         // check it against this pair's expected hash.
-        SHA_CTX temp_ctx;
-        memcpy(&temp_ctx, &sha_ctx, sizeof(SHA_CTX));
-        const uint8_t* sha_so_far = SHA_final(&temp_ctx);
+        SHA1_CTX temp_ctx;
+        memcpy(&temp_ctx, &sha_ctx, sizeof(SHA1_CTX));
+        const uint8_t* sha_so_far = SHA1_final(&temp_ctx);
 
         if (ParseSha1(sha1sum[index[i]], parsed_sha) != 0) {
             printf("failed to parse sha1 %s in %s\n",
@@ -269,7 +269,7 @@ static int LoadPartitionContents(const char* filename, FileContents* file) {
             return -1;
         }
 
-        if (memcmp(sha_so_far, parsed_sha, SHA_DIGEST_SIZE) == 0) {
+        if (memcmp(sha_so_far, parsed_sha, SHA1_DIGEST_SIZE) == 0) {
             // we have a match.  stop reading the partition; we'll return
             // the data we've read so far.
             printf("partition read matched size %d sha %s\n",
@@ -301,8 +301,8 @@ static int LoadPartitionContents(const char* filename, FileContents* file) {
         return -1;
     }
 
-    const uint8_t* sha_final = SHA_final(&sha_ctx);
-    for (i = 0; i < SHA_DIGEST_SIZE; ++i) {
+    const uint8_t* sha_final = SHA1_final(&sha_ctx);
+    for (i = 0; i < SHA1_DIGEST_SIZE; ++i) {
         file->sha1[i] = sha_final[i];
     }
 
@@ -446,7 +446,7 @@ int ParseSha1(const char* str, uint8_t* digest) {
     int i;
     const char* ps = str;
     uint8_t* pd = digest;
-    for (i = 0; i < SHA_DIGEST_SIZE * 2; ++i, ++ps) {
+    for (i = 0; i < SHA1_DIGEST_SIZE * 2; ++i, ++ps) {
         int digit;
         if (*ps >= '0' && *ps <= '9') {
             digit = *ps - '0';
@@ -474,10 +474,10 @@ int ParseSha1(const char* str, uint8_t* digest) {
 int FindMatchingPatch(uint8_t* sha1, char** const patch_sha1_str,
                       int num_patches) {
     int i;
-    uint8_t patch_sha1[SHA_DIGEST_SIZE];
+    uint8_t patch_sha1[SHA1_DIGEST_SIZE];
     for (i = 0; i < num_patches; ++i) {
         if (ParseSha1(patch_sha1_str[i], patch_sha1) == 0 &&
-            memcmp(patch_sha1, sha1, SHA_DIGEST_SIZE) == 0) {
+            memcmp(patch_sha1, sha1, SHA1_DIGEST_SIZE) == 0) {
             return i;
         }
     }
@@ -623,7 +623,7 @@ int applypatch(const char* source_filename,
         target_filename = source_filename;
     }
 
-    uint8_t target_sha1[SHA_DIGEST_SIZE];
+    uint8_t target_sha1[SHA1_DIGEST_SIZE];
     if (ParseSha1(target_sha1_str, target_sha1) != 0) {
         printf("failed to parse tgt-sha1 \"%s\"\n", target_sha1_str);
         return 1;
@@ -638,7 +638,7 @@ int applypatch(const char* source_filename,
     // We try to load the target file into the source_file object.
     if (LoadFileContents(target_filename, &source_file,
                          RETOUCH_DO_MASK) == 0) {
-        if (memcmp(source_file.sha1, target_sha1, SHA_DIGEST_SIZE) == 0) {
+        if (memcmp(source_file.sha1, target_sha1, SHA1_DIGEST_SIZE) == 0) {
             // The early-exit case:  the patch was already applied, this file
             // has the desired hash, nothing for us to do.
             printf("\"%s\" is already target; no patch needed\n",
@@ -690,7 +690,7 @@ int applypatch(const char* source_filename,
     }
 
     int retry = 1;
-    SHA_CTX ctx;
+    SHA1_CTX ctx;
     int output;
     MemorySinkInfo msi;
     FileContents* source_to_use;
@@ -830,7 +830,7 @@ int applypatch(const char* source_filename,
         char* header = patch->data;
         ssize_t header_bytes_read = patch->size;
 
-        SHA_init(&ctx);
+        SHA1_init(&ctx);
 
         int result;
 
@@ -868,8 +868,8 @@ int applypatch(const char* source_filename,
         }
     } while (retry-- > 0);
 
-    const uint8_t* current_target_sha1 = SHA_final(&ctx);
-    if (memcmp(current_target_sha1, target_sha1, SHA_DIGEST_SIZE) != 0) {
+    const uint8_t* current_target_sha1 = SHA1_final(&ctx);
+    if (memcmp(current_target_sha1, target_sha1, SHA1_DIGEST_SIZE) != 0) {
         printf("patch did not produce expected sha1\n");
         return 1;
     }
@@ -28,7 +28,7 @@
 
 #include <bzlib.h>
 
-#include "mincrypt/sha.h"
+#include "crypto/sha1.h"
 #include "applypatch.h"
 
 void ShowBSDiffLicense() {
@@ -99,7 +99,7 @@ int FillBuffer(unsigned char* buffer, int size, bz_stream* stream) {
 
 int ApplyBSDiffPatch(const unsigned char* old_data, ssize_t old_size,
                      const Value* patch, ssize_t patch_offset,
-                     SinkFn sink, void* token, SHA_CTX* ctx) {
+                     SinkFn sink, void* token, SHA1_CTX* ctx) {
 
     unsigned char* new_data;
     ssize_t new_size;
@@ -113,7 +113,7 @@ int ApplyBSDiffPatch(const unsigned char* old_data, ssize_t old_size,
         return 1;
     }
     if (ctx) {
-        SHA_update(ctx, new_data, new_size);
+        SHA1_update(ctx, new_data, new_size);
     }
     free(new_data);
 
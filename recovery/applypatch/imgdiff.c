@@ -122,6 +122,7 @@
 #include <sys/types.h>
 
 #include "zlib.h"
+#include "crypto/crc32.h"
 #include "imgdiff.h"
 #include "utils.h"
 
@@ -155,6 +156,7 @@ typedef struct {
   int data_offset;
   int deflate_len;
   int uncomp_len;
+  uint32_t crc;
   char* filename;
 } ZipFileEntry;
 
@@ -220,6 +222,7 @@ unsigned char* ReadZip(const char* filename,
       return NULL;
     }
 
+    uint32_t crc = Read4(cd+16);  // crc of uncompressed data
     int clen = Read4(cd+20);   // compressed len
     int ulen = Read4(cd+24);   // uncompressed len
     int nlen = Read2(cd+28);   // filename len
@@ -257,6 +260,7 @@ unsigned char* ReadZip(const char* filename,
     temp_entries[entrycount].data_offset = hoffset+30+nlen+xlen;
     temp_entries[entrycount].deflate_len = clen;
     temp_entries[entrycount].uncomp_len = ulen;
+    temp_entries[entrycount].crc = crc;
     temp_entries[entrycount].filename = filename;
     ++entrycount;
   }
@@ -326,6 +330,14 @@ unsigned char* ReadZip(const char* filename,
 
       inflateEnd(&strm);
 
+      // A chunk that doesn't inflate to what the zip says would give
+      // a patch that can never apply.
+      if (CRC32_update(0, curr->data, curr->len) !=
+          temp_entries[nextentry].crc) {
+        printf("crc mismatch inflating \"%s\"\n", curr->filename);
+        return NULL;
+      }
+
       pos += curr->deflate_len;
       ++nextentry;
       ++*num_chunks;
@@ -21,7 +21,7 @@
 
 #include "applypatch.h"
 #include "edify/expr.h"
-#include "mincrypt/sha.h"
+#include "crypto/sha1.h"
 
 int CheckMode(int argc, char** argv) {
     if (argc < 3) {
@@ -54,7 +54,7 @@ static int ParsePatchArgs(int argc, char** argv,
     *patches = malloc(*num_patches * sizeof(Value*));
     memset(*patches, 0, *num_patches * sizeof(Value*));
 
-    uint8_t digest[SHA_DIGEST_SIZE];
+    uint8_t digest[SHA1_DIGEST_SIZE];
 
     int i;
     for (i = 0; i < *num_patches; ++i) {
@@ -0,0 +1,48 @@
+LOCAL_PATH := $(call my-dir)
+include $(CLEAR_VARS)
+
+recovery_crypto_src_files := \
+	sha1.c \
+	sha256.c \
+	rsa.c \
+	crc32.c
+
+LOCAL_SRC_FILES := $(recovery_crypto_src_files)
+
+# The ARMv8 SHA transforms are only built when the target compiler
+# enables the crypto extensions (__ARM_FEATURE_CRYPTO), and the ARMv8
+# CRC32 code when it enables __ARM_FEATURE_CRC32; the x86 SHA-NI and
+# PCLMULQDQ code is selected at runtime from cpuid.
+
+LOCAL_MODULE := librecovery_crypto
+
+LOCAL_CFLAGS += -Wall
+
+include $(BUILD_STATIC_LIBRARY)
+
+# For imgdiff, which checks entry CRCs with CRC32_update().
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := $(recovery_crypto_src_files)
+
+LOCAL_MODULE := librecovery_crypto
+
+LOCAL_CFLAGS += -Wall
+
+include $(BUILD_HOST_STATIC_LIBRARY)
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := crypto_bench.c
+
+LOCAL_MODULE := recovery_crypto_bench
+
+LOCAL_FORCE_STATIC_EXECUTABLE := true
+
+LOCAL_MODULE_TAGS := tests
+
+LOCAL_C_INCLUDES += external/zlib
+
+LOCAL_STATIC_LIBRARIES := librecovery_crypto libmincrypt libz libc
+
+include $(BUILD_EXECUTABLE)
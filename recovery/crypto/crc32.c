@@ -0,0 +1,239 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <pthread.h>
+
+#include "crc32.h"
+
+// Three ways to compute the zip CRC, picked the same way as the SHA
+// transforms: the ARMv8 CRC32 instructions when the compiler targets
+// them, PCLMULQDQ folding on x86 CPUs that have it, and otherwise
+// slicing-by-8 tables, which take eight bytes per step instead of
+// zlib's one.  All of them work on the inverted CRC.
+
+#if defined(__ARM_FEATURE_CRC32)
+#define CRC32_HAVE_ARMV8 1
+#include <arm_acle.h>
+#elif (defined(__x86_64__) || defined(__i386__)) && \
+      (defined(__clang__) || __GNUC__ >= 5)
+#define CRC32_HAVE_PCLMUL 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#define CRC32_POLY 0xedb88320   // reflected 0x04c11db7
+
+typedef uint32_t (*CrcFunction)(uint32_t crc, const uint8_t* p, size_t len);
+
+// table[0] is the usual byte-at-a-time table; table[k][b] is the CRC
+// of byte b followed by k zero bytes.
+static uint32_t table[8][256];
+
+static void make_tables(void) {
+    uint32_t i, k, c;
+    for (i = 0; i < 256; ++i) {
+        c = i;
+        for (k = 0; k < 8; ++k) {
+            c = (c & 1) ? (c >> 1) ^ CRC32_POLY : c >> 1;
+        }
+        table[0][i] = c;
+    }
+    for (i = 0; i < 256; ++i) {
+        c = table[0][i];
+        for (k = 1; k < 8; ++k) {
+            c = (c >> 8) ^ table[0][c & 0xff];
+            table[k][i] = c;
+        }
+    }
+}
+
+static uint32_t crc32_slice8(uint32_t crc, const uint8_t* p, size_t len) {
+    // Assembling the words bytewise keeps this independent of
+    // endianness; compilers turn it into a plain load.
+    while (len >= 8) {
+        uint32_t a = crc ^ ((uint32_t)p[0] | (uint32_t)p[1] << 8 |
+                            (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+        uint32_t b = (uint32_t)p[4] | (uint32_t)p[5] << 8 |
+                     (uint32_t)p[6] << 16 | (uint32_t)p[7] << 24;
+        crc = table[7][a & 0xff] ^ table[6][(a >> 8) & 0xff] ^
+              table[5][(a >> 16) & 0xff] ^ table[4][a >> 24] ^
+              table[3][b & 0xff] ^ table[2][(b >> 8) & 0xff] ^
+              table[1][(b >> 16) & 0xff] ^ table[0][b >> 24];
+        p += 8;
+        len -= 8;
+    }
+    while (len--) {
+        crc = table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#ifdef CRC32_HAVE_ARMV8
+
+static uint32_t crc32_armv8(uint32_t crc, const uint8_t* p, size_t len) {
+    while (len > 0 && ((uintptr_t)p & 7) != 0) {
+        crc = __crc32b(crc, *p++);
+        --len;
+    }
+    while (len >= 32) {
+        crc = __crc32d(crc, *(const uint64_t*)p);
+        crc = __crc32d(crc, *(const uint64_t*)(p + 8));
+        crc = __crc32d(crc, *(const uint64_t*)(p + 16));
+        crc = __crc32d(crc, *(const uint64_t*)(p + 24));
+        p += 32;
+        len -= 32;
+    }
+    while (len >= 8) {
+        crc = __crc32d(crc, *(const uint64_t*)p);
+        p += 8;
+        len -= 8;
+    }
+    while (len--) {
+        crc = __crc32b(crc, *p++);
+    }
+    return crc;
+}
+
+#endif  // CRC32_HAVE_ARMV8
+
+#ifdef CRC32_HAVE_PCLMUL
+
+// Fold four 128-bit lanes 64 bytes at a time, then fold them into one
+// and Barrett-reduce to 32 bits ("Fast CRC Computation for Generic
+// Polynomials Using PCLMULQDQ", Intel, 2009).  The constants are
+// x^(4*128+32), x^(4*128-32), x^(128+32), x^(128-32) and x^64 mod P,
+// bit-reflected, then the Barrett constants P' and P.
+#define FOLD(x, k) _mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x00), \
+                                 _mm_clmulepi64_si128(x, k, 0x11))
+
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32_pclmul_blocks(uint32_t crc, const uint8_t* p,
+                                    size_t len) {
+    const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596LL, 0x0154442bd4LL);
+    const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009eLL, 0x01751997d0LL);
+    const __m128i k5 = _mm_set_epi64x(0, 0x0163cd6124LL);
+    const __m128i poly = _mm_set_epi64x(0x01f7011641LL, 0x01db710641LL);
+    const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+    __m128i x1, x2, x3, x4;
+
+    x1 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)p),
+                       _mm_cvtsi32_si128(crc));
+    x2 = _mm_loadu_si128((const __m128i*)(p + 16));
+    x3 = _mm_loadu_si128((const __m128i*)(p + 32));
+    x4 = _mm_loadu_si128((const __m128i*)(p + 48));
+    p += 64;
+    len -= 64;
+
+    while (len >= 64) {
+        x1 = _mm_xor_si128(FOLD(x1, k1k2),
+                           _mm_loadu_si128((const __m128i*)p));
+        x2 = _mm_xor_si128(FOLD(x2, k1k2),
+                           _mm_loadu_si128((const __m128i*)(p + 16)));
+        x3 = _mm_xor_si128(FOLD(x3, k1k2),
+                           _mm_loadu_si128((const __m128i*)(p + 32)));
+        x4 = _mm_xor_si128(FOLD(x4, k1k2),
+                           _mm_loadu_si128((const __m128i*)(p + 48)));
+        p += 64;
+        len -= 64;
+    }
+
+    x1 = _mm_xor_si128(FOLD(x1, k3k4), x2);
+    x1 = _mm_xor_si128(FOLD(x1, k3k4), x3);
+    x1 = _mm_xor_si128(FOLD(x1, k3k4), x4);
+    while (len >= 16) {
+        x1 = _mm_xor_si128(FOLD(x1, k3k4),
+                           _mm_loadu_si128((const __m128i*)p));
+        p += 16;
+        len -= 16;
+    }
+
+    // 128 bits down to 64...
+    x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, mask32);
+    x1 = _mm_xor_si128(_mm_clmulepi64_si128(x1, k5, 0x00), x2);
+
+    // ...and Barrett reduction to 32.
+    x2 = _mm_and_si128(x1, mask32);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+    x2 = _mm_and_si128(x2, mask32);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+    return _mm_extract_epi32(x1, 1);
+}
+
+static uint32_t crc32_pclmul(uint32_t crc, const uint8_t* p, size_t len) {
+    if (len >= 64) {
+        size_t n = len & ~(size_t)15;
+        crc = crc32_pclmul_blocks(crc, p, n);
+        p += n;
+        len -= n;
+    }
+    return crc32_slice8(crc, p, len);
+}
+
+static int cpu_has_pclmul(void) {
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return 0;
+    return (ecx & (1 << 1)) && (ecx & (1 << 19));       // PCLMULQDQ, SSE4.1
+}
+
+#endif  // CRC32_HAVE_PCLMUL
+
+static CrcFunction crc_function = crc32_slice8;
+static const char* crc_name = "slice8";
+static int force_generic = 0;
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+
+static void pick_function(void) {
+    crc_name = "slice8";
+    crc_function = crc32_slice8;
+    if (force_generic) return;
+#if defined(CRC32_HAVE_ARMV8)
+    crc_name = "armv8-crc";
+    crc_function = crc32_armv8;
+#elif defined(CRC32_HAVE_PCLMUL)
+    if (cpu_has_pclmul()) {
+        crc_name = "pclmul";
+        crc_function = crc32_pclmul;
+    }
+#endif
+}
+
+// Several threads may check entries at once, so the tables are built
+// exactly once rather than lazily on first use.
+static void init(void) {
+    make_tables();
+    pick_function();
+}
+
+void CRC32_force_generic(int force) {
+    pthread_once(&init_once, init);
+    force_generic = force;
+    pick_function();
+}
+
+const char* CRC32_backend(void) {
+    pthread_once(&init_once, init);
+    return crc_name;
+}
+
+uint32_t CRC32_update(uint32_t crc, const void *data, size_t len) {
+    pthread_once(&init_once, init);
+    if (len == 0) return crc;
+    return ~crc_function(~crc, (const uint8_t*)data, len);
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _RECOVERY_CRYPTO_CRC32_H
+#define _RECOVERY_CRYPTO_CRC32_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The zip/gzip CRC-32, with the same calling convention as zlib's
+ * crc32(): start from 0 and feed the previous result back in.
+ */
+uint32_t CRC32_update(uint32_t crc, const void *data, size_t len);
+
+/* Name of the implementation in use ("slice8", "armv8-crc",
+ * "pclmul").
+ */
+const char* CRC32_backend(void);
+
+/* Use the portable slicing-by-8 code even if the CPU has CRC or
+ * carry-less multiply instructions (for benchmarking and testing).
+ */
+void CRC32_force_generic(int force);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* _RECOVERY_CRYPTO_CRC32_H */
@@ -0,0 +1,310 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Hashing throughput of the recovery digests, compared against
+// mincrypt's byte-at-a-time SHA-1, and of the zip CRC-32, compared
+// against zlib's.  Every implementation is checked against the others
+// on the same buffer before it is timed.
+//
+// Also times the RSA public operation for each key shape verify_file
+// accepts, with 32-bit limbs and (where available) 64-bit limbs, on
+// synthetic moduli; both must produce the same result.
+//
+//   usage: recovery_crypto_bench [megabytes [chunk_bytes]]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "zlib.h"
+
+#include "crc32.h"
+#include "mincrypt/sha.h"
+#include "rsa.h"
+#include "sha1.h"
+#include "sha256.h"
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+typedef void (*HashFunction)(const unsigned char* data, size_t size,
+                             int chunk, uint8_t* digest);
+
+static void hash_mincrypt(const unsigned char* data, size_t size,
+                          int chunk, uint8_t* digest) {
+    SHA_CTX ctx;
+    size_t pos;
+    SHA_init(&ctx);
+    for (pos = 0; pos < size; pos += chunk) {
+        SHA_update(&ctx, data + pos, size - pos < (size_t)chunk ?
+                   (int)(size - pos) : chunk);
+    }
+    memcpy(digest, SHA_final(&ctx), SHA_DIGEST_SIZE);
+}
+
+static void hash_sha1(const unsigned char* data, size_t size,
+                      int chunk, uint8_t* digest) {
+    SHA1_CTX ctx;
+    size_t pos;
+    SHA1_init(&ctx);
+    for (pos = 0; pos < size; pos += chunk) {
+        SHA1_update(&ctx, data + pos, size - pos < (size_t)chunk ?
+                    (int)(size - pos) : chunk);
+    }
+    memcpy(digest, SHA1_final(&ctx), SHA1_DIGEST_SIZE);
+}
+
+static void hash_sha256(const unsigned char* data, size_t size,
+                        int chunk, uint8_t* digest) {
+    SHA256_CTX ctx;
+    size_t pos;
+    SHA256_init(&ctx);
+    for (pos = 0; pos < size; pos += chunk) {
+        SHA256_update(&ctx, data + pos, size - pos < (size_t)chunk ?
+                      (int)(size - pos) : chunk);
+    }
+    memcpy(digest, SHA256_final(&ctx), SHA256_DIGEST_SIZE);
+}
+
+static void put_crc(uint32_t crc, uint8_t* digest) {
+    digest[0] = crc >> 24;
+    digest[1] = crc >> 16;
+    digest[2] = crc >> 8;
+    digest[3] = crc;
+}
+
+static void crc_zlib(const unsigned char* data, size_t size,
+                     int chunk, uint8_t* digest) {
+    uLong crc = crc32(0L, Z_NULL, 0);
+    size_t pos;
+    for (pos = 0; pos < size; pos += chunk) {
+        crc = crc32(crc, data + pos, size - pos < (size_t)chunk ?
+                    (uInt)(size - pos) : (uInt)chunk);
+    }
+    put_crc(crc, digest);
+}
+
+static void crc_recovery(const unsigned char* data, size_t size,
+                         int chunk, uint8_t* digest) {
+    uint32_t crc = 0;
+    size_t pos;
+    for (pos = 0; pos < size; pos += chunk) {
+        crc = CRC32_update(crc, data + pos, size - pos < (size_t)chunk ?
+                           size - pos : (size_t)chunk);
+    }
+    put_crc(crc, digest);
+}
+
+static double run(const char* name, HashFunction fn, const unsigned char* data,
+                  size_t size, int chunk, uint8_t* digest, int digest_len) {
+    double start = now();
+    fn(data, size, chunk, digest);
+    double elapsed = now() - start;
+    double mbps = size / (1024.0 * 1024.0) / elapsed;
+
+    printf("%-18s %8.1f MB/s  ", name, mbps);
+    int i;
+    for (i = 0; i < digest_len; ++i) printf("%02x", digest[i]);
+    printf("\n");
+    return mbps;
+}
+
+// Fill in a key with a random odd modulus of the given size (top bit
+// set) and its Montgomery constants, the way dumpkey would.
+static void make_rsa_key(RSAKey* key, int words, int exponent, uint32_t* seed) {
+    uint32_t x = *seed;
+    int i, j;
+
+    memset(key, 0, sizeof(*key));
+    key->len = words;
+    key->exponent = exponent;
+    for (i = 0; i < words; ++i) {
+        x = x * 1103515245 + 12345;
+        key->n[i] = (x >> 16) | ((x * 69069) & 0xffff0000);
+    }
+    key->n[0] |= 1;
+    key->n[words - 1] |= 0x80000000;
+    *seed = x;
+
+    // n0inv = -1 / n[0] mod 2^32, by Newton's iteration.
+    uint32_t inv = 1;
+    for (i = 0; i < 5; ++i) inv *= 2 - key->n[0] * inv;
+    key->n0inv = -inv;
+
+    // rr = 2^(64 * words) mod n, by doubling 1 that many times.
+    key->rr[0] = 1;
+    for (i = 0; i < 64 * words; ++i) {
+        uint32_t carry = 0;
+        for (j = 0; j < words; ++j) {
+            uint32_t top = key->rr[j] >> 31;
+            key->rr[j] = (key->rr[j] << 1) | carry;
+            carry = top;
+        }
+        int ge = carry;
+        if (!ge) {
+            j = words - 1;
+            while (j > 0 && key->rr[j] == key->n[j]) --j;
+            ge = key->rr[j] >= key->n[j];
+        }
+        if (ge) {
+            int64_t A = 0;
+            for (j = 0; j < words; ++j) {
+                A += (uint64_t)key->rr[j] - key->n[j];
+                key->rr[j] = (uint32_t)A;
+                A >>= 32;
+            }
+        }
+    }
+
+    RSAKey_precompute(key);
+}
+
+static double run_rsa(const char* name, const RSAKey* key,
+                      const uint8_t* sig, int iterations, uint8_t* out) {
+    int len = key->len * 4;
+    int i;
+    double start = now();
+    for (i = 0; i < iterations; ++i) {
+        RSAKey_public_op(key, sig, len, out);
+    }
+    double elapsed = now() - start;
+    printf("%-18s %8.1f us/op\n", name, elapsed * 1e6 / iterations);
+    return elapsed;
+}
+
+static int bench_rsa(int iterations) {
+    static const struct { int bits; int exponent; } shapes[] = {
+        { 2048, 3 }, { 2048, 65537 }, { 4096, 3 }, { 4096, 65537 },
+    };
+    uint32_t seed = 0x2468ace0;
+    uint8_t sig[RSA_MAX_NUMBYTES];
+    uint8_t out32[RSA_MAX_NUMBYTES];
+    uint8_t out64[RSA_MAX_NUMBYTES];
+    RSAKey key;
+    int failed = 0;
+    unsigned int s;
+
+    printf("rsa public op, %d iterations\n", iterations);
+    for (s = 0; s < sizeof(shapes) / sizeof(shapes[0]); ++s) {
+        int words = shapes[s].bits / 32;
+        char name[32];
+        int i;
+
+        make_rsa_key(&key, words, shapes[s].exponent, &seed);
+        // Any value below the modulus will do as a "signature".
+        for (i = 0; i < words * 4; ++i) {
+            seed = seed * 1103515245 + 12345;
+            sig[i] = seed >> 24;
+        }
+        sig[0] &= 0x7f;
+
+        RSAKey_force_32bit(1);
+        snprintf(name, sizeof(name), "rsa%d e=%d 32", shapes[s].bits,
+                 shapes[s].exponent);
+        run_rsa(name, &key, sig, iterations, out32);
+        RSAKey_force_32bit(0);
+        if (key.n0inv64 != 0) {
+            snprintf(name, sizeof(name), "rsa%d e=%d 64", shapes[s].bits,
+                     shapes[s].exponent);
+            run_rsa(name, &key, sig, iterations, out64);
+            failed |= memcmp(out32, out64, words * 4) != 0;
+        }
+    }
+    return failed;
+}
+
+int main(int argc, char** argv) {
+    size_t megabytes = argc > 1 ? strtoul(argv[1], NULL, 0) : 64;
+    int chunk = argc > 2 ? (int)strtol(argv[2], NULL, 0) : 1024 * 1024;
+    size_t size = megabytes * 1024 * 1024;
+    uint8_t reference[SHA1_DIGEST_SIZE];
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    uint8_t generic256[SHA256_DIGEST_SIZE];
+    int failed = 0;
+
+    if (size == 0 || chunk <= 0) {
+        fprintf(stderr, "usage: %s [megabytes [chunk_bytes]]\n", argv[0]);
+        return 2;
+    }
+
+    unsigned char* data = malloc(size);
+    if (data == NULL) {
+        fprintf(stderr, "can't allocate %zu bytes\n", size);
+        return 1;
+    }
+    size_t i;
+    uint32_t x = 0x12345678;
+    for (i = 0; i < size; ++i) {
+        x = x * 1103515245 + 12345;
+        data[i] = x >> 24;
+    }
+
+    printf("%zu MB in %d-byte updates\n", megabytes, chunk);
+
+    run("sha1 mincrypt", hash_mincrypt, data, size, chunk,
+        reference, SHA1_DIGEST_SIZE);
+
+    SHA1_force_generic(1);
+    run("sha1 generic", hash_sha1, data, size, chunk,
+        digest, SHA1_DIGEST_SIZE);
+    failed |= memcmp(digest, reference, SHA1_DIGEST_SIZE) != 0;
+    SHA1_force_generic(0);
+    if (strcmp(SHA1_backend(), "generic") != 0) {
+        char name[32];
+        snprintf(name, sizeof(name), "sha1 %s", SHA1_backend());
+        run(name, hash_sha1, data, size, chunk, digest, SHA1_DIGEST_SIZE);
+        failed |= memcmp(digest, reference, SHA1_DIGEST_SIZE) != 0;
+    }
+
+    SHA256_force_generic(1);
+    run("sha256 generic", hash_sha256, data, size, chunk,
+        generic256, SHA256_DIGEST_SIZE);
+    SHA256_force_generic(0);
+    if (strcmp(SHA256_backend(), "generic") != 0) {
+        char name[32];
+        snprintf(name, sizeof(name), "sha256 %s", SHA256_backend());
+        run(name, hash_sha256, data, size, chunk, digest, SHA256_DIGEST_SIZE);
+        failed |= memcmp(digest, generic256, SHA256_DIGEST_SIZE) != 0;
+    }
+
+    uint8_t crc_reference[4];
+    run("crc32 zlib", crc_zlib, data, size, chunk, crc_reference, 4);
+    CRC32_force_generic(1);
+    run("crc32 slice8", crc_recovery, data, size, chunk, digest, 4);
+    failed |= memcmp(digest, crc_reference, 4) != 0;
+    CRC32_force_generic(0);
+    if (strcmp(CRC32_backend(), "slice8") != 0) {
+        char name[32];
+        snprintf(name, sizeof(name), "crc32 %s", CRC32_backend());
+        run(name, crc_recovery, data, size, chunk, digest, 4);
+        failed |= memcmp(digest, crc_reference, 4) != 0;
+    }
+
+    free(data);
+    if (bench_rsa(200)) {
+        printf("FAILURE: rsa results differ\n");
+        return 1;
+    }
+    if (failed) {
+        printf("FAILURE: digests differ\n");
+        return 1;
+    }
+    return 0;
+}
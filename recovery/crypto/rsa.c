@@ -0,0 +1,419 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "rsa.h"
+#include "sha1.h"
+
+/* 64-bit limbs halve the number of multiply-accumulate steps in
+** montMulAdd, but need a 64x64->128 multiply to be worthwhile.
+*/
+#if defined(__SIZEOF_INT128__)
+#define RSA_HAVE_64BIT_LIMBS 1
+typedef unsigned __int128 uint128_t;
+#endif
+
+static int force_32bit = 0;
+
+/* a[] -= mod */
+static void subM(const RSAKey *key, uint32_t *a) {
+    int64_t A = 0;
+    int i;
+    for (i = 0; i < key->len; ++i) {
+        A += (uint64_t)a[i] - key->n[i];
+        a[i] = (uint32_t)A;
+        A >>= 32;
+    }
+}
+
+/* return a[] >= mod */
+static int geM(const RSAKey *key, const uint32_t *a) {
+    int i;
+    for (i = key->len; i;) {
+        --i;
+        if (a[i] < key->n[i]) return 0;
+        if (a[i] > key->n[i]) return 1;
+    }
+    return 1;  /* equal */
+}
+
+/* montgomery c[] += a * b[] / R % mod */
+static void montMulAdd(const RSAKey *key,
+                       uint32_t* c,
+                       const uint32_t a,
+                       const uint32_t* b) {
+    uint64_t A = (uint64_t)a * b[0] + c[0];
+    uint32_t d0 = (uint32_t)A * key->n0inv;
+    uint64_t B = (uint64_t)d0 * key->n[0] + (uint32_t)A;
+    int i;
+
+    for (i = 1; i < key->len; ++i) {
+        A = (A >> 32) + (uint64_t)a * b[i] + c[i];
+        B = (B >> 32) + (uint64_t)d0 * key->n[i] + (uint32_t)A;
+        c[i - 1] = (uint32_t)B;
+    }
+
+    A = (A >> 32) + (B >> 32);
+
+    c[i - 1] = (uint32_t)A;
+
+    if (A >> 32) {
+        subM(key, c);
+    }
+}
+
+/* montgomery c[] = a[] * b[] / R % mod */
+static void montMul(const RSAKey *key,
+                    uint32_t* c,
+                    const uint32_t* a,
+                    const uint32_t* b) {
+    int i;
+    for (i = 0; i < key->len; ++i) {
+        c[i] = 0;
+    }
+    for (i = 0; i < key->len; ++i) {
+        montMulAdd(key, c, a[i], b);
+    }
+}
+
+#ifdef RSA_HAVE_64BIT_LIMBS
+/* The same operations as above on n64[], with len/2 limbs.  R is
+** unchanged (2^(32*len) == 2^(64*len/2)), so rr64[] is just rr[]
+** regrouped.
+*/
+
+/* a[] -= mod */
+static void subM64(const RSAKey *key, uint64_t *a) {
+    uint64_t borrow = 0;
+    int i;
+    for (i = 0; i < key->len / 2; ++i) {
+        uint128_t A = (uint128_t)a[i] - key->n64[i] - borrow;
+        a[i] = (uint64_t)A;
+        borrow = (uint64_t)(A >> 64) ? 1 : 0;
+    }
+}
+
+/* return a[] >= mod */
+static int geM64(const RSAKey *key, const uint64_t *a) {
+    int i;
+    for (i = key->len / 2; i;) {
+        --i;
+        if (a[i] < key->n64[i]) return 0;
+        if (a[i] > key->n64[i]) return 1;
+    }
+    return 1;  /* equal */
+}
+
+/* montgomery c[] += a * b[] / R % mod */
+static void montMulAdd64(const RSAKey *key,
+                         uint64_t* c,
+                         const uint64_t a,
+                         const uint64_t* b) {
+    uint128_t A = (uint128_t)a * b[0] + c[0];
+    uint64_t d0 = (uint64_t)A * key->n0inv64;
+    uint128_t B = (uint128_t)d0 * key->n64[0] + (uint64_t)A;
+    int i;
+
+    for (i = 1; i < key->len / 2; ++i) {
+        A = (A >> 64) + (uint128_t)a * b[i] + c[i];
+        B = (B >> 64) + (uint128_t)d0 * key->n64[i] + (uint64_t)A;
+        c[i - 1] = (uint64_t)B;
+    }
+
+    A = (A >> 64) + (B >> 64);
+
+    c[i - 1] = (uint64_t)A;
+
+    if (A >> 64) {
+        subM64(key, c);
+    }
+}
+
+/* montgomery c[] = a[] * b[] / R % mod */
+static void montMul64(const RSAKey *key,
+                      uint64_t* c,
+                      const uint64_t* a,
+                      const uint64_t* b) {
+    int i;
+    for (i = 0; i < key->len / 2; ++i) {
+        c[i] = 0;
+    }
+    for (i = 0; i < key->len / 2; ++i) {
+        montMulAdd64(key, c, a[i], b);
+    }
+}
+
+/* modpow() on 64-bit limbs. */
+static void modpow64(const RSAKey *key,
+                     uint8_t* inout) {
+    uint64_t a[RSA_MAX_NUMWORDS / 2];
+    uint64_t aR[RSA_MAX_NUMWORDS / 2];
+    uint64_t aaR[RSA_MAX_NUMWORDS / 2];
+    uint64_t *aaa;
+    int limbs = key->len / 2;
+    int i, j;
+
+    /* Convert from big endian byte array to little endian limb array. */
+    for (i = 0; i < limbs; ++i) {
+        const uint8_t* p = inout + (limbs - 1 - i) * 8;
+        uint64_t tmp = 0;
+        for (j = 0; j < 8; ++j) {
+            tmp = (tmp << 8) | p[j];
+        }
+        a[i] = tmp;
+    }
+
+    if (key->exponent == 65537) {
+        aaa = aaR;  /* Re-use location. */
+        montMul64(key, aR, a, key->rr64);  /* aR = a * RR / R mod M   */
+        for (i = 0; i < 16; i += 2) {
+            montMul64(key, aaR, aR, aR);  /* aaR = aR * aR / R mod M */
+            montMul64(key, aR, aaR, aaR); /* aR = aaR * aaR / R mod M */
+        }
+        montMul64(key, aaa, aR, a);      /* aaa = aR * a / R mod M */
+    } else {
+        aaa = aR;  /* Re-use location. */
+        montMul64(key, aR, a, key->rr64);  /* aR = a * RR / R mod M   */
+        montMul64(key, aaR, aR, aR);     /* aaR = aR * aR / R mod M */
+        montMul64(key, aaa, aaR, a);     /* aaa = aaR * a / R mod M */
+    }
+
+    /* Make sure aaa < mod; aaa is at most 1x mod too large. */
+    if (geM64(key, aaa)) {
+        subM64(key, aaa);
+    }
+
+    /* Convert to bigendian byte array */
+    for (i = limbs - 1; i >= 0; --i) {
+        uint64_t tmp = aaa[i];
+        for (j = 7; j >= 0; --j) {
+            *inout++ = (uint8_t)(tmp >> (j * 8));
+        }
+    }
+}
+#endif
+
+/* In-place public exponentiation, for e=3 or e=65537.
+** Input and output big-endian byte array in inout.
+*/
+static void modpow(const RSAKey *key,
+                   uint8_t* inout) {
+    uint32_t a[RSA_MAX_NUMWORDS];
+    uint32_t aR[RSA_MAX_NUMWORDS];
+    uint32_t aaR[RSA_MAX_NUMWORDS];
+    uint32_t *aaa;
+    int i;
+
+    /* Convert from big endian byte array to little endian word array. */
+    for (i = 0; i < key->len; ++i) {
+        uint32_t tmp =
+            (inout[((key->len - 1 - i) * 4) + 0] << 24) |
+            (inout[((key->len - 1 - i) * 4) + 1] << 16) |
+            (inout[((key->len - 1 - i) * 4) + 2] << 8) |
+            (inout[((key->len - 1 - i) * 4) + 3] << 0);
+        a[i] = tmp;
+    }
+
+    if (key->exponent == 65537) {
+        aaa = aaR;  /* Re-use location. */
+        montMul(key, aR, a, key->rr);  /* aR = a * RR / R mod M   */
+        for (i = 0; i < 16; i += 2) {
+            montMul(key, aaR, aR, aR);  /* aaR = aR * aR / R mod M */
+            montMul(key, aR, aaR, aaR); /* aR = aaR * aaR / R mod M */
+        }
+        montMul(key, aaa, aR, a);      /* aaa = aR * a / R mod M */
+    } else {
+        aaa = aR;  /* Re-use location. */
+        montMul(key, aR, a, key->rr);  /* aR = a * RR / R mod M   */
+        montMul(key, aaR, aR, aR);     /* aaR = aR * aR / R mod M */
+        montMul(key, aaa, aaR, a);     /* aaa = aaR * a / R mod M */
+    }
+
+    /* Make sure aaa < mod; aaa is at most 1x mod too large. */
+    if (geM(key, aaa)) {
+        subM(key, aaa);
+    }
+
+    /* Convert to bigendian byte array */
+    for (i = key->len - 1; i >= 0; --i) {
+        uint32_t tmp = aaa[i];
+        *inout++ = tmp >> 24;
+        *inout++ = tmp >> 16;
+        *inout++ = tmp >> 8;
+        *inout++ = tmp >> 0;
+    }
+}
+
+/* ASN.1 DigestInfo prefixes, with the 0-length optional parameter
+** encoded (as opposed to the other flavor which omits the optional
+** parameter entirely).  Signatures without the parameter are not
+** accepted.
+*/
+static const uint8_t sha1_digest_info[] = {
+    0x30,0x21,0x30,0x09,0x06,0x05,0x2b,0x0e,0x03,0x02,0x1a,0x05,0x00,
+    0x04,0x14
+};
+
+static const uint8_t sha256_digest_info[] = {
+    0x30,0x31,0x30,0x0d,0x06,0x09,0x60,0x86,0x48,0x01,0x65,0x03,0x04,
+    0x02,0x01,0x05,0x00,0x04,0x20
+};
+
+void RSAKey_force_32bit(int force) {
+    force_32bit = force;
+}
+
+void RSAKey_precompute(RSAKey *key) {
+    uint8_t modulus[RSA_MAX_NUMBYTES];
+    uint8_t digest[SHA1_DIGEST_SIZE];
+    int i;
+
+    key->key_id = 0;
+    key->n0inv64 = 0;
+    if (key->len <= 0 || key->len > (int)RSA_MAX_NUMWORDS) {
+        return;
+    }
+
+    for (i = 0; i < key->len; ++i) {
+        uint32_t tmp = key->n[key->len - 1 - i];
+        modulus[i * 4 + 0] = tmp >> 24;
+        modulus[i * 4 + 1] = tmp >> 16;
+        modulus[i * 4 + 2] = tmp >> 8;
+        modulus[i * 4 + 3] = tmp >> 0;
+    }
+    SHA1(modulus, key->len * 4, digest);
+    key->key_id = ((uint32_t)digest[0] << 24) | ((uint32_t)digest[1] << 16) |
+                  ((uint32_t)digest[2] << 8) | digest[3];
+
+#ifdef RSA_HAVE_64BIT_LIMBS
+    if (key->len % 2 == 0) {
+        /* Newton's iteration: each step doubles the number of correct
+        ** low bits of inv = 1/n mod 2^64, starting from the 32 we have.
+        */
+        uint64_t n0 = key->n[0] | ((uint64_t)key->n[1] << 32);
+        uint64_t inv = (uint32_t)-key->n0inv;
+        inv *= 2 - n0 * inv;
+        for (i = 0; i < key->len / 2; ++i) {
+            key->n64[i] = key->n[2*i] | ((uint64_t)key->n[2*i+1] << 32);
+            key->rr64[i] = key->rr[2*i] | ((uint64_t)key->rr[2*i+1] << 32);
+        }
+        key->n0inv64 = -inv;
+    }
+#endif
+}
+
+int RSAKey_public_op(const RSAKey *key,
+                     const uint8_t *signature,
+                     int len,
+                     uint8_t *out) {
+    int i;
+
+    if (key->len <= 0 || key->len > (int)RSA_MAX_NUMWORDS) {
+        return 0;  /* Wrong key passed in. */
+    }
+    if (key->exponent != 3 && key->exponent != 65537) {
+        return 0;  /* Unsupported exponent. */
+    }
+
+    if (len != key->len * (int)sizeof(uint32_t)) {
+        return 0;  /* Wrong input length. */
+    }
+
+    for (i = 0; i < len; ++i) {
+        out[i] = signature[i];
+    }
+
+#ifdef RSA_HAVE_64BIT_LIMBS
+    if (key->n0inv64 != 0 && !force_32bit) {
+        modpow64(key, out);
+        return 1;
+    }
+#endif
+    modpow(key, out);
+    return 1;
+}
+
+/* Check a PKCS1.5 block against an expected SHA-1 or SHA-256 hash.
+** The padded block must be 00 01 ff .. ff 00 <DigestInfo> <hash>.
+** Returns 0 on failure, 1 on success.
+*/
+int RSAKey_check_padding(const uint8_t *buf,
+                         int len,
+                         const uint8_t *hash,
+                         int hash_len) {
+    const uint8_t* digest_info;
+    int digest_info_len;
+    int padding_len;
+    int i;
+
+    switch (hash_len) {
+        case 20:  /* SHA-1 */
+            digest_info = sha1_digest_info;
+            digest_info_len = sizeof(sha1_digest_info);
+            break;
+        case 32:  /* SHA-256 */
+            digest_info = sha256_digest_info;
+            digest_info_len = sizeof(sha256_digest_info);
+            break;
+        default:
+            return 0;  /* Unknown digest. */
+    }
+
+    /* Check pkcs1.5 padding bytes. */
+    padding_len = len - digest_info_len - hash_len;
+    if (padding_len < 11) {
+        return 0;
+    }
+    if (buf[0] != 0x00 || buf[1] != 0x01) {
+        return 0;
+    }
+    for (i = 2; i < padding_len - 1; ++i) {
+        if (buf[i] != 0xff) {
+            return 0;
+        }
+    }
+    if (buf[i++] != 0x00) {
+        return 0;
+    }
+
+    /* Check the DigestInfo. */
+    for (; i < padding_len + digest_info_len; ++i) {
+        if (buf[i] != digest_info[i - padding_len]) {
+            return 0;
+        }
+    }
+
+    /* Check digest matches. */
+    for (; i < len; ++i) {
+        if (buf[i] != *hash++) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+int RSAKey_verify(const RSAKey *key,
+                  const uint8_t *signature,
+                  int len,
+                  const uint8_t *hash,
+                  int hash_len) {
+    uint8_t buf[RSA_MAX_NUMBYTES];
+
+    if (!RSAKey_public_op(key, signature, len, buf)) {
+        return 0;
+    }
+    return RSAKey_check_padding(buf, len, hash, hash_len);
+}
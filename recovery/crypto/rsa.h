@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _RECOVERY_CRYPTO_RSA_H
+#define _RECOVERY_CRYPTO_RSA_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Like mincrypt's RSAPublicKey, but sized for the largest key we
+ * accept and carrying its public exponent, so 2048- and 4096-bit keys
+ * with e=3 or e=65537 can share one verifier.
+ */
+#define RSA_MAX_NUMBYTES 512      /* 4096 bit key length */
+#define RSA_MAX_NUMWORDS (RSA_MAX_NUMBYTES / sizeof(uint32_t))
+
+typedef struct RSAKey {
+    int len;                       /* Length of n[] in number of uint32_t */
+    uint32_t n0inv;                /* -1 / n[0] mod 2^32 */
+    uint32_t n[RSA_MAX_NUMWORDS];  /* modulus as little endian array */
+    uint32_t rr[RSA_MAX_NUMWORDS]; /* R^2 as little endian array */
+    int exponent;                  /* 3 or 65537 */
+
+    /* Filled in by RSAKey_precompute(); all zero until then. */
+    uint32_t key_id;               /* first 4 bytes of SHA-1(modulus) */
+    uint64_t n0inv64;              /* -1 / n mod 2^64 */
+    uint64_t n64[RSA_MAX_NUMWORDS / 2];  /* n[] as 64-bit limbs */
+    uint64_t rr64[RSA_MAX_NUMWORDS / 2]; /* rr[] as 64-bit limbs */
+} RSAKey;
+
+/* Derive the per-key values used to speed up verification: the key
+ * id and, on targets with a 64x64->128 multiply, the 64-bit-limb
+ * Montgomery constants.  Call once after filling in len, n0inv, n, rr
+ * and exponent.  Keys that haven't been precomputed still verify,
+ * using 32-bit limbs.
+ */
+void RSAKey_precompute(RSAKey *key);
+
+/* Raw public operation: out = signature^e mod n, as big-endian bytes.
+ * len must be key->len * 4.  Returns 0 on failure, 1 on success.
+ */
+int RSAKey_public_op(const RSAKey *key,
+                     const uint8_t *signature,
+                     int len,
+                     uint8_t *out);
+
+/* Check the PKCS#1 v1.5 encoding of "hash" in the output of
+ * RSAKey_public_op.  hash_len selects the DigestInfo: 20 for SHA-1,
+ * 32 for SHA-256.  Returns 0 on failure, 1 on success.
+ */
+int RSAKey_check_padding(const uint8_t *buf,
+                         int len,
+                         const uint8_t *hash,
+                         int hash_len);
+
+/* Verify a PKCS#1 v1.5 signature of len (== key->len * 4) bytes
+ * against an expected digest; RSAKey_public_op followed by
+ * RSAKey_check_padding.  Returns 0 on failure, 1 on success.
+ */
+int RSAKey_verify(const RSAKey *key,
+                  const uint8_t *signature,
+                  int len,
+                  const uint8_t *hash,
+                  int hash_len);
+
+/* Use 32-bit limbs even for precomputed keys (for benchmarking and
+ * testing).
+ */
+void RSAKey_force_32bit(int force);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* _RECOVERY_CRYPTO_RSA_H */
@@ -0,0 +1,334 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <pthread.h>
+#include <string.h>
+
+#include "sha1.h"
+
+// Same structure as sha256.c: whole 64-byte blocks are transformed
+// straight from the caller's buffer by the best transform available
+// (ARMv8 crypto extensions, x86 SHA-NI, or unrolled C), and ctx->buf
+// only holds the partial blocks at either end of an update.
+
+#if defined(__ARM_FEATURE_CRYPTO) || defined(__ARM_FEATURE_SHA2)
+#define SHA1_HAVE_ARMV8_CE 1
+#include <arm_neon.h>
+#elif (defined(__x86_64__) || defined(__i386__)) && \
+      (defined(__clang__) || __GNUC__ >= 5)
+#define SHA1_HAVE_SHA_NI 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+typedef void (*TransformFunction)(uint32_t state[5], const uint8_t* data,
+                                  size_t blocks);
+
+#define rol(bits, value) (((value) << (bits)) | ((value) >> (32 - (bits))))
+
+#define K0 0x5A827999
+#define K1 0x6ED9EBA1
+#define K2 0x8F1BBCDC
+#define K3 0xCA62C1D6
+
+#define F0(b, c, d) ((d) ^ ((b) & ((c) ^ (d))))
+#define F1(b, c, d) ((b) ^ (c) ^ (d))
+#define F2(b, c, d) (((b) & (c)) | ((d) & ((b) | (c))))
+#define F3(b, c, d) ((b) ^ (c) ^ (d))
+
+// The message schedule is kept in a 16-word ring, expanded one word
+// ahead of the round that uses it.
+#define LOAD(t) (W[t] = ((uint32_t)data[4*(t)] << 24) |             \
+                        ((uint32_t)data[4*(t)+1] << 16) |           \
+                        ((uint32_t)data[4*(t)+2] << 8) |            \
+                        (uint32_t)data[4*(t)+3])
+#define EXPAND(t) (W[(t) & 15] = rol(1, W[((t)+13) & 15] ^           \
+                                        W[((t)+8) & 15] ^            \
+                                        W[((t)+2) & 15] ^ W[(t) & 15]))
+
+// One round, with the working variables rotated by renaming.
+#define ROUND(a, b, c, d, e, f, k, w) do {                  \
+        e += rol(5, a) + f(b, c, d) + k + (w);              \
+        b = rol(30, b);                                     \
+    } while (0)
+
+#define R5(f, k, w0, w1, w2, w3, w4) do {                   \
+        ROUND(A, B, C, D, E, f, k, w0);                     \
+        ROUND(E, A, B, C, D, f, k, w1);                     \
+        ROUND(D, E, A, B, C, f, k, w2);                     \
+        ROUND(C, D, E, A, B, f, k, w3);                     \
+        ROUND(B, C, D, E, A, f, k, w4);                     \
+    } while (0)
+
+static void sha1_transform_generic(uint32_t state[5], const uint8_t* data,
+                                   size_t blocks) {
+    uint32_t W[16];
+
+    while (blocks--) {
+        uint32_t A = state[0];
+        uint32_t B = state[1];
+        uint32_t C = state[2];
+        uint32_t D = state[3];
+        uint32_t E = state[4];
+
+        R5(F0, K0, LOAD(0), LOAD(1), LOAD(2), LOAD(3), LOAD(4));
+        R5(F0, K0, LOAD(5), LOAD(6), LOAD(7), LOAD(8), LOAD(9));
+        R5(F0, K0, LOAD(10), LOAD(11), LOAD(12), LOAD(13), LOAD(14));
+        R5(F0, K0, LOAD(15), EXPAND(16), EXPAND(17), EXPAND(18), EXPAND(19));
+
+        R5(F1, K1, EXPAND(20), EXPAND(21), EXPAND(22), EXPAND(23), EXPAND(24));
+        R5(F1, K1, EXPAND(25), EXPAND(26), EXPAND(27), EXPAND(28), EXPAND(29));
+        R5(F1, K1, EXPAND(30), EXPAND(31), EXPAND(32), EXPAND(33), EXPAND(34));
+        R5(F1, K1, EXPAND(35), EXPAND(36), EXPAND(37), EXPAND(38), EXPAND(39));
+
+        R5(F2, K2, EXPAND(40), EXPAND(41), EXPAND(42), EXPAND(43), EXPAND(44));
+        R5(F2, K2, EXPAND(45), EXPAND(46), EXPAND(47), EXPAND(48), EXPAND(49));
+        R5(F2, K2, EXPAND(50), EXPAND(51), EXPAND(52), EXPAND(53), EXPAND(54));
+        R5(F2, K2, EXPAND(55), EXPAND(56), EXPAND(57), EXPAND(58), EXPAND(59));
+
+        R5(F3, K3, EXPAND(60), EXPAND(61), EXPAND(62), EXPAND(63), EXPAND(64));
+        R5(F3, K3, EXPAND(65), EXPAND(66), EXPAND(67), EXPAND(68), EXPAND(69));
+        R5(F3, K3, EXPAND(70), EXPAND(71), EXPAND(72), EXPAND(73), EXPAND(74));
+        R5(F3, K3, EXPAND(75), EXPAND(76), EXPAND(77), EXPAND(78), EXPAND(79));
+
+        state[0] += A;
+        state[1] += B;
+        state[2] += C;
+        state[3] += D;
+        state[4] += E;
+        data += 64;
+    }
+}
+
+#ifdef SHA1_HAVE_ARMV8_CE
+
+static void sha1_transform_armv8(uint32_t state[5], const uint8_t* data,
+                                 size_t blocks) {
+    static const uint32_t K[4] = { K0, K1, K2, K3 };
+    uint32x4_t ABCD = vld1q_u32(&state[0]);
+    uint32_t E0 = state[4];
+    uint32x4_t W[4];
+    int i;
+
+    while (blocks--) {
+        uint32x4_t ABCD_SAVE = ABCD;
+        uint32_t E0_SAVE = E0;
+
+        for (i = 0; i < 4; ++i) {
+            W[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 16 * i)));
+        }
+        for (i = 0; i < 20; ++i) {
+            if (i >= 4) {
+                W[i & 3] = vsha1su1q_u32(
+                    vsha1su0q_u32(W[i & 3], W[(i + 1) & 3], W[(i + 2) & 3]),
+                    W[(i + 3) & 3]);
+            }
+            uint32x4_t wk = vaddq_u32(W[i & 3], vdupq_n_u32(K[i / 5]));
+            uint32_t E1 = vsha1h_u32(vgetq_lane_u32(ABCD, 0));
+            if (i < 5) {
+                ABCD = vsha1cq_u32(ABCD, E0, wk);
+            } else if (i >= 10 && i < 15) {
+                ABCD = vsha1mq_u32(ABCD, E0, wk);
+            } else {
+                ABCD = vsha1pq_u32(ABCD, E0, wk);
+            }
+            E0 = E1;
+        }
+
+        ABCD = vaddq_u32(ABCD, ABCD_SAVE);
+        E0 += E0_SAVE;
+        data += 64;
+    }
+
+    vst1q_u32(&state[0], ABCD);
+    state[4] = E0;
+}
+
+#endif  // SHA1_HAVE_ARMV8_CE
+
+#ifdef SHA1_HAVE_SHA_NI
+
+// sha1rnds4 takes the round function as an immediate, so the 20
+// groups of four rounds are split into four loops of five.
+#define SHA_NI_GROUP(i, func) do {                                          \
+        if ((i) < 4) {                                                      \
+            W[i] = _mm_shuffle_epi8(                                        \
+                _mm_loadu_si128((const __m128i*)(data + 16 * (i))), MASK);  \
+        } else {                                                            \
+            W[(i) & 3] = _mm_sha1msg2_epu32(                                \
+                _mm_xor_si128(_mm_sha1msg1_epu32(W[(i) & 3],                \
+                                                 W[((i) + 1) & 3]),         \
+                              W[((i) + 2) & 3]),                            \
+                W[((i) + 3) & 3]);                                          \
+        }                                                                   \
+        E = (i) == 0 ? _mm_add_epi32(E0, W[0])                              \
+                     : _mm_sha1nexte_epu32(PREV, W[(i) & 3]);               \
+        PREV = ABCD;                                                        \
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E, func);                          \
+    } while (0)
+
+__attribute__((target("sha,sse4.1,ssse3")))
+static void sha1_transform_shani(uint32_t state[5], const uint8_t* data,
+                                 size_t blocks) {
+    const __m128i MASK = _mm_set_epi64x(0x0001020304050607ULL,
+                                        0x08090a0b0c0d0e0fULL);
+    __m128i ABCD, E0, E, PREV;
+    __m128i W[4];
+    int i;
+
+    ABCD = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)state), 0x1B);
+    E0 = _mm_set_epi32(state[4], 0, 0, 0);
+
+    while (blocks--) {
+        __m128i ABCD_SAVE = ABCD;
+        __m128i E0_SAVE = E0;
+
+        for (i = 0; i < 5; ++i) SHA_NI_GROUP(i, 0);
+        for (; i < 10; ++i) SHA_NI_GROUP(i, 1);
+        for (; i < 15; ++i) SHA_NI_GROUP(i, 2);
+        for (; i < 20; ++i) SHA_NI_GROUP(i, 3);
+
+        E0 = _mm_sha1nexte_epu32(PREV, E0_SAVE);
+        ABCD = _mm_add_epi32(ABCD, ABCD_SAVE);
+        data += 64;
+    }
+
+    _mm_storeu_si128((__m128i*)state, _mm_shuffle_epi32(ABCD, 0x1B));
+    state[4] = _mm_extract_epi32(E0, 3);
+}
+
+static int cpu_has_sha_ni(void) {
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return 0;
+    if (!(ecx & (1 << 9)) || !(ecx & (1 << 19))) return 0;  // SSSE3, SSE4.1
+    if (__get_cpuid_max(0, NULL) < 7) return 0;
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    return (ebx & (1 << 29)) != 0;                          // SHA
+}
+
+#endif  // SHA1_HAVE_SHA_NI
+
+static TransformFunction transform = sha1_transform_generic;
+static const char* transform_name = "generic";
+static int force_generic = 0;
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+
+static void pick_transform(void) {
+    transform_name = "generic";
+    transform = sha1_transform_generic;
+    if (force_generic) return;
+#if defined(SHA1_HAVE_ARMV8_CE)
+    transform_name = "armv8-ce";
+    transform = sha1_transform_armv8;
+#elif defined(SHA1_HAVE_SHA_NI)
+    if (cpu_has_sha_ni()) {
+        transform_name = "sha-ni";
+        transform = sha1_transform_shani;
+    }
+#endif
+}
+
+// Packages are hashed from several threads at once, so the transform
+// is picked exactly once rather than lazily on first use.
+void SHA1_force_generic(int force) {
+    pthread_once(&init_once, pick_transform);
+    force_generic = force;
+    pick_transform();
+}
+
+const char* SHA1_backend(void) {
+    pthread_once(&init_once, pick_transform);
+    return transform_name;
+}
+
+void SHA1_init(SHA1_CTX *ctx) {
+    pthread_once(&init_once, pick_transform);
+
+    ctx->state[0] = 0x67452301;
+    ctx->state[1] = 0xEFCDAB89;
+    ctx->state[2] = 0x98BADCFE;
+    ctx->state[3] = 0x10325476;
+    ctx->state[4] = 0xC3D2E1F0;
+    ctx->count = 0;
+}
+
+void SHA1_update(SHA1_CTX *ctx, const void *data, int len) {
+    const uint8_t* p = (const uint8_t*)data;
+    int i = ctx->count % sizeof(ctx->buf);
+
+    if (len <= 0) return;
+    ctx->count += len;
+
+    // Top up a partially filled block first.
+    if (i > 0) {
+        int n = sizeof(ctx->buf) - i;
+        if (n > len) n = len;
+        memcpy(ctx->buf + i, p, n);
+        p += n;
+        len -= n;
+        if (i + n < (int)sizeof(ctx->buf)) return;
+        transform(ctx->state, ctx->buf, 1);
+    }
+
+    // Whole blocks go straight from the input.
+    if (len >= (int)sizeof(ctx->buf)) {
+        size_t blocks = len / sizeof(ctx->buf);
+        transform(ctx->state, p, blocks);
+        p += blocks * sizeof(ctx->buf);
+        len -= blocks * sizeof(ctx->buf);
+    }
+
+    if (len > 0) {
+        memcpy(ctx->buf, p, len);
+    }
+}
+
+const uint8_t* SHA1_final(SHA1_CTX *ctx) {
+    uint8_t *p = ctx->buf;
+    uint64_t cnt = ctx->count * 8;
+    int i = ctx->count % sizeof(ctx->buf);
+
+    ctx->buf[i++] = 0x80;
+    if (i > (int)sizeof(ctx->buf) - 8) {
+        memset(ctx->buf + i, 0, sizeof(ctx->buf) - i);
+        transform(ctx->state, ctx->buf, 1);
+        i = 0;
+    }
+    memset(ctx->buf + i, 0, sizeof(ctx->buf) - 8 - i);
+    for (i = 0; i < 8; ++i) {
+        ctx->buf[sizeof(ctx->buf) - 8 + i] = cnt >> ((7 - i) * 8);
+    }
+    transform(ctx->state, ctx->buf, 1);
+
+    for (i = 0; i < 5; i++) {
+        uint32_t tmp = ctx->state[i];
+        *p++ = tmp >> 24;
+        *p++ = tmp >> 16;
+        *p++ = tmp >> 8;
+        *p++ = tmp >> 0;
+    }
+
+    return ctx->buf;
+}
+
+/* Convenience function */
+const uint8_t* SHA1(const void *data, int len, uint8_t *digest) {
+    SHA1_CTX ctx;
+    SHA1_init(&ctx);
+    SHA1_update(&ctx, data, len);
+    memcpy(digest, SHA1_final(&ctx), SHA1_DIGEST_SIZE);
+    return digest;
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _RECOVERY_CRYPTO_SHA1_H
+#define _RECOVERY_CRYPTO_SHA1_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A faster drop-in for mincrypt's SHA_CTX/SHA_*(), with the same
+ * calling convention.
+ */
+typedef struct SHA1_CTX {
+    uint64_t count;
+    uint8_t buf[64];
+    uint32_t state[5];
+} SHA1_CTX;
+
+void SHA1_init(SHA1_CTX *ctx);
+void SHA1_update(SHA1_CTX *ctx, const void *data, int len);
+const uint8_t* SHA1_final(SHA1_CTX *ctx);
+
+/* Convenience method. Returns digest parameter value. */
+const uint8_t* SHA1(const void *data, int len, uint8_t *digest);
+
+/* Name of the block transform in use ("generic", "sha-ni", "armv8-ce"). */
+const char* SHA1_backend(void);
+
+/* Use the portable transform even if the CPU has SHA instructions
+ * (for benchmarking and testing).
+ */
+void SHA1_force_generic(int force);
+
+#define SHA1_DIGEST_SIZE 20
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* _RECOVERY_CRYPTO_SHA1_H */
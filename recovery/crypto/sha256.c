@@ -0,0 +1,346 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <pthread.h>
+#include <string.h>
+
+#include "sha256.h"
+
+// The block transform is picked once, the first time a context is
+// initialized: the ARMv8 crypto extensions when the compiler targets
+// them, the x86 SHA extensions when the CPU reports them, and a plain
+// C transform otherwise.  Every transform consumes whole 64-byte
+// blocks straight from the caller's buffer; ctx->buf only holds the
+// partial blocks at either end of an update.
+
+#if defined(__ARM_FEATURE_CRYPTO) || defined(__ARM_FEATURE_SHA2)
+#define SHA256_HAVE_ARMV8_CE 1
+#include <arm_neon.h>
+#elif (defined(__x86_64__) || defined(__i386__)) && \
+      (defined(__clang__) || __GNUC__ >= 5)
+#define SHA256_HAVE_SHA_NI 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+typedef void (*TransformFunction)(uint32_t state[8], const uint8_t* data,
+                                  size_t blocks);
+
+static const uint32_t K256[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ror(bits, value) (((value) >> (bits)) | ((value) << (32 - (bits))))
+
+#define S0(x) (ror(2, x) ^ ror(13, x) ^ ror(22, x))
+#define S1(x) (ror(6, x) ^ ror(11, x) ^ ror(25, x))
+#define s0(x) (ror(7, x) ^ ror(18, x) ^ ((x) >> 3))
+#define s1(x) (ror(17, x) ^ ror(19, x) ^ ((x) >> 10))
+
+#define Ch(x, y, z)  ((z) ^ ((x) & ((y) ^ (z))))
+#define Maj(x, y, z) (((x) & (y)) | ((z) & ((x) | (y))))
+
+// One round, with the working variables rotated by renaming rather
+// than by moving them through registers.
+#define ROUND(a, b, c, d, e, f, g, h, i) do {                   \
+        uint32_t t1 = h + S1(e) + Ch(e, f, g) + K256[i] + W[i]; \
+        uint32_t t2 = S0(a) + Maj(a, b, c);                     \
+        d += t1;                                                \
+        h = t1 + t2;                                            \
+    } while (0)
+
+static void sha256_transform_generic(uint32_t state[8], const uint8_t* data,
+                                     size_t blocks) {
+    uint32_t W[64];
+    int t;
+
+    while (blocks--) {
+        for (t = 0; t < 16; ++t) {
+            W[t] = ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) |
+                   ((uint32_t)data[2] << 8) | (uint32_t)data[3];
+            data += 4;
+        }
+        for (; t < 64; ++t) {
+            W[t] = s1(W[t-2]) + W[t-7] + s0(W[t-15]) + W[t-16];
+        }
+
+        uint32_t A = state[0];
+        uint32_t B = state[1];
+        uint32_t C = state[2];
+        uint32_t D = state[3];
+        uint32_t E = state[4];
+        uint32_t F = state[5];
+        uint32_t G = state[6];
+        uint32_t H = state[7];
+
+        for (t = 0; t < 64; t += 8) {
+            ROUND(A, B, C, D, E, F, G, H, t + 0);
+            ROUND(H, A, B, C, D, E, F, G, t + 1);
+            ROUND(G, H, A, B, C, D, E, F, t + 2);
+            ROUND(F, G, H, A, B, C, D, E, t + 3);
+            ROUND(E, F, G, H, A, B, C, D, t + 4);
+            ROUND(D, E, F, G, H, A, B, C, t + 5);
+            ROUND(C, D, E, F, G, H, A, B, t + 6);
+            ROUND(B, C, D, E, F, G, H, A, t + 7);
+        }
+
+        state[0] += A;
+        state[1] += B;
+        state[2] += C;
+        state[3] += D;
+        state[4] += E;
+        state[5] += F;
+        state[6] += G;
+        state[7] += H;
+    }
+}
+
+#ifdef SHA256_HAVE_ARMV8_CE
+
+// ARMv8 keeps the state as {A,B,C,D} {E,F,G,H}, so no shuffling is
+// needed around the block loop.
+static void sha256_transform_armv8(uint32_t state[8], const uint8_t* data,
+                                   size_t blocks) {
+    uint32x4_t STATE0 = vld1q_u32(&state[0]);
+    uint32x4_t STATE1 = vld1q_u32(&state[4]);
+    uint32x4_t W[4];
+    int i;
+
+    while (blocks--) {
+        uint32x4_t ABCD_SAVE = STATE0;
+        uint32x4_t EFGH_SAVE = STATE1;
+
+        for (i = 0; i < 4; ++i) {
+            W[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 16 * i)));
+        }
+        for (i = 0; i < 16; ++i) {
+            if (i >= 4) {
+                W[i & 3] = vsha256su1q_u32(
+                    vsha256su0q_u32(W[i & 3], W[(i + 1) & 3]),
+                    W[(i + 2) & 3], W[(i + 3) & 3]);
+            }
+            uint32x4_t wk = vaddq_u32(W[i & 3], vld1q_u32(&K256[4 * i]));
+            uint32x4_t abcd = STATE0;
+            STATE0 = vsha256hq_u32(STATE0, STATE1, wk);
+            STATE1 = vsha256h2q_u32(STATE1, abcd, wk);
+        }
+
+        STATE0 = vaddq_u32(STATE0, ABCD_SAVE);
+        STATE1 = vaddq_u32(STATE1, EFGH_SAVE);
+        data += 64;
+    }
+
+    vst1q_u32(&state[0], STATE0);
+    vst1q_u32(&state[4], STATE1);
+}
+
+#endif  // SHA256_HAVE_ARMV8_CE
+
+#ifdef SHA256_HAVE_SHA_NI
+
+// The SHA-NI round instructions want the state as {A,B,E,F} {C,D,G,H}
+// (high to low), so it is shuffled into that form once per call.
+__attribute__((target("sha,sse4.1,ssse3")))
+static void sha256_transform_shani(uint32_t state[8], const uint8_t* data,
+                                   size_t blocks) {
+    const __m128i MASK = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+                                        0x0405060700010203ULL);
+    __m128i STATE0, STATE1, TMP, MSG;
+    __m128i W[4];
+    int i;
+
+    TMP = _mm_loadu_si128((const __m128i*)&state[0]);
+    STATE1 = _mm_loadu_si128((const __m128i*)&state[4]);
+    TMP = _mm_shuffle_epi32(TMP, 0xB1);              // CDAB
+    STATE1 = _mm_shuffle_epi32(STATE1, 0x1B);        // EFGH
+    STATE0 = _mm_alignr_epi8(TMP, STATE1, 8);        // ABEF
+    STATE1 = _mm_blend_epi16(STATE1, TMP, 0xF0);     // CDGH
+
+    while (blocks--) {
+        __m128i ABEF_SAVE = STATE0;
+        __m128i CDGH_SAVE = STATE1;
+
+        for (i = 0; i < 16; ++i) {
+            if (i < 4) {
+                W[i] = _mm_shuffle_epi8(
+                    _mm_loadu_si128((const __m128i*)(data + 16 * i)), MASK);
+            } else {
+                TMP = _mm_sha256msg1_epu32(W[i & 3], W[(i + 1) & 3]);
+                TMP = _mm_add_epi32(TMP, _mm_alignr_epi8(W[(i + 3) & 3],
+                                                         W[(i + 2) & 3], 4));
+                W[i & 3] = _mm_sha256msg2_epu32(TMP, W[(i + 3) & 3]);
+            }
+            MSG = _mm_add_epi32(W[i & 3],
+                                _mm_loadu_si128((const __m128i*)&K256[4 * i]));
+            STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);
+            MSG = _mm_shuffle_epi32(MSG, 0x0E);
+            STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);
+        }
+
+        STATE0 = _mm_add_epi32(STATE0, ABEF_SAVE);
+        STATE1 = _mm_add_epi32(STATE1, CDGH_SAVE);
+        data += 64;
+    }
+
+    TMP = _mm_shuffle_epi32(STATE0, 0x1B);           // FEBA
+    STATE1 = _mm_shuffle_epi32(STATE1, 0xB1);        // DCHG
+    STATE0 = _mm_blend_epi16(TMP, STATE1, 0xF0);     // DCBA
+    STATE1 = _mm_alignr_epi8(STATE1, TMP, 8);        // HGFE
+
+    _mm_storeu_si128((__m128i*)&state[0], STATE0);
+    _mm_storeu_si128((__m128i*)&state[4], STATE1);
+}
+
+static int cpu_has_sha_ni(void) {
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return 0;
+    if (!(ecx & (1 << 9)) || !(ecx & (1 << 19))) return 0;  // SSSE3, SSE4.1
+    if (__get_cpuid_max(0, NULL) < 7) return 0;
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    return (ebx & (1 << 29)) != 0;                          // SHA
+}
+
+#endif  // SHA256_HAVE_SHA_NI
+
+static TransformFunction transform = sha256_transform_generic;
+static const char* transform_name = "generic";
+static int force_generic = 0;
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+
+static void pick_transform(void) {
+    transform_name = "generic";
+    transform = sha256_transform_generic;
+    if (force_generic) return;
+#if defined(SHA256_HAVE_ARMV8_CE)
+    transform_name = "armv8-ce";
+    transform = sha256_transform_armv8;
+#elif defined(SHA256_HAVE_SHA_NI)
+    if (cpu_has_sha_ni()) {
+        transform_name = "sha-ni";
+        transform = sha256_transform_shani;
+    }
+#endif
+}
+
+// Packages are hashed from several threads at once, so the transform
+// is picked exactly once rather than lazily on first use.
+void SHA256_force_generic(int force) {
+    pthread_once(&init_once, pick_transform);
+    force_generic = force;
+    pick_transform();
+}
+
+const char* SHA256_backend(void) {
+    pthread_once(&init_once, pick_transform);
+    return transform_name;
+}
+
+void SHA256_init(SHA256_CTX *ctx) {
+    pthread_once(&init_once, pick_transform);
+
+    ctx->state[0] = 0x6a09e667;
+    ctx->state[1] = 0xbb67ae85;
+    ctx->state[2] = 0x3c6ef372;
+    ctx->state[3] = 0xa54ff53a;
+    ctx->state[4] = 0x510e527f;
+    ctx->state[5] = 0x9b05688c;
+    ctx->state[6] = 0x1f83d9ab;
+    ctx->state[7] = 0x5be0cd19;
+    ctx->count = 0;
+}
+
+void SHA256_update(SHA256_CTX *ctx, const void *data, int len) {
+    const uint8_t* p = (const uint8_t*)data;
+    int i = ctx->count % sizeof(ctx->buf);
+
+    if (len <= 0) return;
+    ctx->count += len;
+
+    // Top up a partially filled block first.
+    if (i > 0) {
+        int n = sizeof(ctx->buf) - i;
+        if (n > len) n = len;
+        memcpy(ctx->buf + i, p, n);
+        p += n;
+        len -= n;
+        if (i + n < (int)sizeof(ctx->buf)) return;
+        transform(ctx->state, ctx->buf, 1);
+    }
+
+    // Whole blocks go straight from the input.
+    if (len >= (int)sizeof(ctx->buf)) {
+        size_t blocks = len / sizeof(ctx->buf);
+        transform(ctx->state, p, blocks);
+        p += blocks * sizeof(ctx->buf);
+        len -= blocks * sizeof(ctx->buf);
+    }
+
+    if (len > 0) {
+        memcpy(ctx->buf, p, len);
+    }
+}
+
+const uint8_t* SHA256_final(SHA256_CTX *ctx) {
+    uint8_t *p = ctx->buf;
+    uint64_t cnt = ctx->count * 8;
+    int i = ctx->count % sizeof(ctx->buf);
+
+    ctx->buf[i++] = 0x80;
+    if (i > (int)sizeof(ctx->buf) - 8) {
+        memset(ctx->buf + i, 0, sizeof(ctx->buf) - i);
+        transform(ctx->state, ctx->buf, 1);
+        i = 0;
+    }
+    memset(ctx->buf + i, 0, sizeof(ctx->buf) - 8 - i);
+    for (i = 0; i < 8; ++i) {
+        ctx->buf[sizeof(ctx->buf) - 8 + i] = cnt >> ((7 - i) * 8);
+    }
+    transform(ctx->state, ctx->buf, 1);
+
+    for (i = 0; i < 8; i++) {
+        uint32_t tmp = ctx->state[i];
+        *p++ = tmp >> 24;
+        *p++ = tmp >> 16;
+        *p++ = tmp >> 8;
+        *p++ = tmp >> 0;
+    }
+
+    return ctx->buf;
+}
+
+/* Convenience function */
+const uint8_t* SHA256(const void *data, int len, uint8_t *digest) {
+    SHA256_CTX ctx;
+    SHA256_init(&ctx);
+    SHA256_update(&ctx, data, len);
+    memcpy(digest, SHA256_final(&ctx), SHA256_DIGEST_SIZE);
+    return digest;
+}
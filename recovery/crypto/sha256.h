@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _RECOVERY_CRYPTO_SHA256_H
+#define _RECOVERY_CRYPTO_SHA256_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Same shape and calling convention as SHA1_CTX (sha1.h), so the two
+ * can be driven side by side over the same data.
+ */
+typedef struct SHA256_CTX {
+    uint64_t count;
+    uint8_t buf[64];
+    uint32_t state[8];
+} SHA256_CTX;
+
+void SHA256_init(SHA256_CTX *ctx);
+void SHA256_update(SHA256_CTX *ctx, const void *data, int len);
+const uint8_t* SHA256_final(SHA256_CTX *ctx);
+
+/* Convenience method. Returns digest parameter value. */
+const uint8_t* SHA256(const void *data, int len, uint8_t *digest);
+
+/* Name of the block transform in use ("generic", "sha-ni", "armv8-ce"). */
+const char* SHA256_backend(void);
+
+/* Use the portable transform even if the CPU has SHA instructions
+ * (for benchmarking and testing).
+ */
+void SHA256_force_generic(int force);
+
+#define SHA256_DIGEST_SIZE 32
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* _RECOVERY_CRYPTO_SHA256_H */
@@ -45,6 +45,7 @@ char* MENU_ITEMS[] = { "reboot system now",
 #ifdef RECOVERY_HAS_FACTORY_TEST
                        "reboot into factory test",
 #endif /* RECOVERY_HAS_FACTORY_TEST */
+                       "check update package",
                        NULL };
 
 void device_ui_init(UIParameters* ui_parameters) {
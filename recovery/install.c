@@ -19,12 +19,14 @@
 #include <fcntl.h>
 #include <limits.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
 #include "common.h"
+#include "crypto/sha1.h"
+#include "crypto/sha256.h"
 #include "install.h"
-#include "mincrypt/rsa.h"
 #include "minui/minui.h"
 #include "minzip/SysUtil.h"
 #include "minzip/Zip.h"
@@ -36,6 +38,18 @@
 #define ASSUMED_UPDATE_BINARY_NAME  "META-INF/com/google/android/update-binary"
 #define PUBLIC_KEYS_FILE "/res/keys"
 
+// The updater reads the package through this descriptor (described as
+// "fd:size:dev:ino") instead of opening the path again, so it sees
+// exactly the file that was verified.  Binaries that don't know about
+// it just ignore it.  Keep in sync with updater/updater.c.
+#define PACKAGE_FD_ENV "UPDATE_PACKAGE_FD"
+
+// Set, to the hex SHA-256 of the signed part of the tree, when the
+// package was verified by its hash tree rather than its whole-file
+// signature.  The updater must then check everything it reads against
+// that same tree.  Keep in sync with updater/updater.c.
+#define PACKAGE_HASH_TREE_ENV "UPDATE_PACKAGE_HASH_TREE"
+
 // If the package contains an update binary, extract it and run it.
 static int
 try_update_binary(const char *path, ZipArchive *zip, int* wipe_cache) {
@@ -46,11 +60,39 @@ try_update_binary(const char *path, ZipArchive *zip, int* wipe_cache) {
         return INSTALL_CORRUPT;
     }
 
+    // Keep a descriptor on the verified package for the child; the
+    // archive's own one goes away with mzCloseZipArchive below.
+    char package_token[96];
+    int package_fd = dup(zip->fd);
+    struct stat st;
+    if (package_fd >= 0 && fstat(package_fd, &st) == 0) {
+        snprintf(package_token, sizeof(package_token), "%d:%lld:%llu:%llu",
+                 package_fd, (long long)st.st_size,
+                 (unsigned long long)st.st_dev, (unsigned long long)st.st_ino);
+    } else {
+        LOGW("can't pass package fd to updater (%s)\n", strerror(errno));
+        if (package_fd >= 0) close(package_fd);
+        package_fd = -1;
+    }
+
+    // Pin the hash tree the package was verified with, if any.
+    char tree_token[SHA256_DIGEST_SIZE * 2 + 1];
+    tree_token[0] = '\0';
+    if (zip->pHashTree != NULL) {
+        uint8_t digest[SHA256_DIGEST_SIZE];
+        int i;
+        mzHashTreeDigest(zip->pHashTree, digest);
+        for (i = 0; i < SHA256_DIGEST_SIZE; ++i) {
+            sprintf(tree_token + i * 2, "%02x", digest[i]);
+        }
+    }
+
     char* binary = "/tmp/update_binary";
     unlink(binary);
     int fd = creat(binary, 0755);
     if (fd < 0) {
         mzCloseZipArchive(zip);
+        if (package_fd >= 0) close(package_fd);
         LOGE("Can't make %s\n", binary);
         return INSTALL_ERROR;
     }
@@ -59,6 +101,7 @@ try_update_binary(const char *path, ZipArchive *zip, int* wipe_cache) {
     mzCloseZipArchive(zip);
 
     if (!ok) {
+        if (package_fd >= 0) close(package_fd);
         LOGE("Can't copy %s\n", ASSUMED_UPDATE_BINARY_NAME);
         return INSTALL_ERROR;
     }
@@ -99,6 +142,11 @@ try_update_binary(const char *path, ZipArchive *zip, int* wipe_cache) {
     //
     //   - the name of the package zip file.
     //
+    // and, if set, UPDATE_PACKAGE_FD in the environment names an open
+    // descriptor on that same (already verified) file, and
+    // UPDATE_PACKAGE_HASH_TREE identifies the hash tree its contents
+    // must be checked against as they are read.
+    //
 
     char** args = malloc(sizeof(char*) * 5);
     args[0] = binary;
@@ -111,11 +159,18 @@ try_update_binary(const char *path, ZipArchive *zip, int* wipe_cache) {
     pid_t pid = fork();
     if (pid == 0) {
         close(pipefd[0]);
+        if (package_fd >= 0) {
+            setenv(PACKAGE_FD_ENV, package_token, 1);
+        }
+        if (tree_token[0] != '\0') {
+            setenv(PACKAGE_HASH_TREE_ENV, tree_token, 1);
+        }
         execv(binary, args);
         fprintf(stdout, "E:Can't run %s (%s)\n", binary, strerror(errno));
         _exit(-1);
     }
     close(pipefd[1]);
+    if (package_fd >= 0) close(package_fd);
 
     *wipe_cache = 0;
 
@@ -173,13 +228,25 @@ try_update_binary(const char *path, ZipArchive *zip, int* wipe_cache) {
 // characters the parser expects to find in the file; the ellipses
 // indicate more numbers omitted from this example.)
 //
+// A key in this bare form is a 2048-bit key with exponent 3 that
+// signs SHA-1 digests.  Other kinds of key are preceded by a version
+// identifier, eg:
+//
+//  "v4 {128,0x8a7fbc51,{...},{...}}"
+//
+//    v2: exponent 65537, SHA-1
+//    v3: exponent 3, SHA-256
+//    v4: exponent 65537, SHA-256
+//
+// and may be 2048 (len 64) or 4096 (len 128) bits long.
+//
 // The file may contain multiple keys in this format, separated by
 // commas.  The last key must not be followed by a comma.
 //
 // Returns NULL if the file failed to parse, or if it contain zero keys.
-static RSAPublicKey*
+static Certificate*
 load_keys(const char* filename, int* numKeys) {
-    RSAPublicKey* out = NULL;
+    Certificate* out = NULL;
     *numKeys = 0;
 
     FILE* f = fopen(filename, "r");
@@ -192,14 +259,51 @@ load_keys(const char* filename, int* numKeys) {
     bool done = false;
     while (!done) {
         ++*numKeys;
-        out = realloc(out, *numKeys * sizeof(RSAPublicKey));
-        RSAPublicKey* key = out + (*numKeys - 1);
-        if (fscanf(f, " { %i , 0x%x , { %u",
+        out = realloc(out, *numKeys * sizeof(Certificate));
+        Certificate* cert = out + (*numKeys - 1);
+        RSAKey* key = &cert->public_key;
+
+        char start_char;
+        if (fscanf(f, " %c", &start_char) != 1) goto exit;
+        int version = 1;
+        if (start_char == 'v') {
+            if (fscanf(f, "%d {", &version) != 1) goto exit;
+        } else if (start_char != '{') {
+            LOGE("unexpected character '%c' at start of key\n", start_char);
+            goto exit;
+        }
+        switch (version) {
+            case 1:
+                cert->hash_len = SHA1_DIGEST_SIZE;
+                key->exponent = 3;
+                break;
+            case 2:
+                cert->hash_len = SHA1_DIGEST_SIZE;
+                key->exponent = 65537;
+                break;
+            case 3:
+                cert->hash_len = SHA256_DIGEST_SIZE;
+                key->exponent = 3;
+                break;
+            case 4:
+                cert->hash_len = SHA256_DIGEST_SIZE;
+                key->exponent = 65537;
+                break;
+            default:
+                LOGE("unsupported key version %d\n", version);
+                goto exit;
+        }
+
+        if (fscanf(f, " %i , 0x%x , { %u",
                    &(key->len), &(key->n0inv), &(key->n[0])) != 3) {
             goto exit;
         }
-        if (key->len != RSANUMWORDS) {
-            LOGE("key length (%d) does not match expected size\n", key->len);
+        if (key->len != 64 && key->len != 128) {
+            LOGE("key length (%d) is not 2048 or 4096 bits\n", key->len);
+            goto exit;
+        }
+        if (version == 1 && key->len != 64) {
+            LOGE("unversioned key must be 2048 bits\n");
             goto exit;
         }
         for (i = 1; i < key->len; ++i) {
@@ -210,6 +314,11 @@ load_keys(const char* filename, int* numKeys) {
             if (fscanf(f, " , %u", &(key->rr[i])) != 1) goto exit;
         }
         fscanf(f, " } } ");
+        RSAKey_precompute(key);
+
+        LOGI("read key %d: v%d, %d bits, e=%d, SHA-%d\n", *numKeys - 1,
+             version, key->len * 32, key->exponent,
+             cert->hash_len == SHA1_DIGEST_SIZE ? 1 : 256);
 
         // if the line ends in a comma, this file has more keys.
         switch (fgetc(f)) {
@@ -237,14 +346,13 @@ exit:
     return NULL;
 }
 
+// Open the package at path, verify its signature, and open it as an
+// archive.  The package is read once: the signature is checked over
+// one mapping, the central directory is parsed from it, and the
+// archive keeps the descriptor so the updater can be handed it.
 static int
-really_install_package(const char *path, int* wipe_cache)
+open_verified_package(const char *path, ZipArchive* zip)
 {
-    ui_set_background(BACKGROUND_ICON_INSTALLING);
-    ui_print("Finding update package...\n");
-    ui_show_indeterminate_progress();
-    LOGI("Update location: %s\n", path);
-
     if (ensure_path_mounted(path) != 0) {
         LOGE("Can't mount %s\n", path);
         return INSTALL_CORRUPT;
@@ -252,10 +360,24 @@ really_install_package(const char *path, int* wipe_cache)
 
     ui_print("Opening update package...\n");
 
+    int package_fd = open(path, O_RDONLY);
+    if (package_fd < 0) {
+        LOGE("Can't open %s\n(%s)\n", path, strerror(errno));
+        return INSTALL_CORRUPT;
+    }
+    MemMapping map;
+    if (sysMapFileInShmem(package_fd, &map) != 0) {
+        LOGE("Can't map %s\n", path);
+        close(package_fd);
+        return INSTALL_CORRUPT;
+    }
+
     int numKeys;
-    RSAPublicKey* loadedKeys = load_keys(PUBLIC_KEYS_FILE, &numKeys);
+    Certificate* loadedKeys = load_keys(PUBLIC_KEYS_FILE, &numKeys);
     if (loadedKeys == NULL) {
         LOGE("Failed to load keys\n");
+        sysReleaseShmem(&map);
+        close(package_fd);
         return INSTALL_CORRUPT;
     }
     LOGI("%d key(s) loaded from %s\n", numKeys, PUBLIC_KEYS_FILE);
@@ -266,30 +388,118 @@ really_install_package(const char *path, int* wipe_cache)
             VERIFICATION_PROGRESS_FRACTION,
             VERIFICATION_PROGRESS_TIME);
 
+    // A package with a signed hash tree only needs the tree verified
+    // up front; its blocks are checked as the install reads them.
+    // Otherwise the whole file is hashed now.
     int err;
-    err = verify_file(path, loadedKeys, numKeys);
+    BlockHashTree* tree = NULL;
+    err = verify_hash_tree(map.addr, map.length, loadedKeys, numKeys, &tree);
+    LOGI("verify_hash_tree returned %d\n", err);
+    if (err != VERIFY_SUCCESS) {
+        err = verify_mapped_file(map.addr, map.length, loadedKeys, numKeys);
+        LOGI("verify_file returned %d\n", err);
+    }
     free(loadedKeys);
-    LOGI("verify_file returned %d\n", err);
     if (err != VERIFY_SUCCESS) {
         LOGE("signature verification failed\n");
+        sysReleaseShmem(&map);
+        close(package_fd);
         return INSTALL_CORRUPT;
     }
 
-    /* Try to open the package.
+    /* Try to open the package.  The archive takes over the descriptor,
+     * the mapping and the hash tree.
      */
-    ZipArchive zip;
-    err = mzOpenZipArchive(path, &zip);
+    err = mzOpenZipArchiveWithHashTree(package_fd, &map, tree, zip);
     if (err != 0) {
-        LOGE("Can't open %s\n(%s)\n", path, err != -1 ? strerror(err) : "bad");
+        LOGE("Can't open %s\n(bad)\n", path);
         return INSTALL_CORRUPT;
     }
 
+    HashTableStats hashStats;
+    mzHashTableGetStats(zip->pHash, &hashStats);
+    LOGI("package index: %d entries in %d slots (load %.2f), "
+         "probe max %d avg %.2f\n",
+         hashStats.numEntries, hashStats.tableSize, hashStats.loadFactor,
+         hashStats.maxProbe, hashStats.avgProbe);
+    return INSTALL_SUCCESS;
+}
+
+static int
+really_install_package(const char *path, int* wipe_cache)
+{
+    ui_set_background(BACKGROUND_ICON_INSTALLING);
+    ui_print("Finding update package...\n");
+    ui_show_indeterminate_progress();
+    LOGI("Update location: %s\n", path);
+
+    ZipArchive zip;
+    int status = open_verified_package(path, &zip);
+    if (status != INSTALL_SUCCESS) {
+        return status;
+    }
+
     /* Verify and install the contents of the package.
      */
     ui_print("Installing update...\n");
     return try_update_binary(path, &zip, wipe_cache);
 }
 
+typedef struct {
+    int done;
+    int total;
+} CheckProgress;
+
+static void
+check_entry_done(const ZipEntry* entry, bool intact, void* cookie)
+{
+    CheckProgress* progress = (CheckProgress*) cookie;
+    if (!intact) {
+        ui_print("  %.*s is corrupt\n",
+                 (int) entry->fileNameLen, entry->fileName);
+    }
+    ++progress->done;
+    ui_set_progress((float) progress->done / progress->total);
+}
+
+int
+check_package(const char* path)
+{
+    ui_set_background(BACKGROUND_ICON_INSTALLING);
+    ui_print("Finding update package...\n");
+    ui_show_indeterminate_progress();
+    LOGI("Check location: %s\n", path);
+
+    ZipArchive zip;
+    int status = open_verified_package(path, &zip);
+    if (status != INSTALL_SUCCESS) {
+        return status;
+    }
+
+    // The signature covers the stored bytes; this also inflates every
+    // entry and checks its CRC, which is what an install would do.
+    ui_print("Checking package contents...\n");
+    ui_reset_progress();
+    ui_show_progress(1.0, 0);
+    CheckProgress progress = { 0, mzZipEntryCount(&zip) };
+    struct timeval start, end;
+    gettimeofday(&start, NULL);
+    int bad = mzCheckZipArchive(&zip, 0, check_entry_done, &progress);
+    gettimeofday(&end, NULL);
+    long ms = (end.tv_sec - start.tv_sec) * 1000 +
+              (end.tv_usec - start.tv_usec) / 1000;
+    mzCloseZipArchive(&zip);
+
+    if (bad != 0) {
+        if (bad > 0) {
+            ui_print("%d of %d entries are corrupt\n", bad, progress.total);
+        }
+        return INSTALL_CORRUPT;
+    }
+    ui_print("All %d entries OK (%ld ms)\n", progress.total, ms);
+    return INSTALL_SUCCESS;
+}
+
 int
 install_package(const char* path, int* wipe_cache, const char* install_file)
 {
@@ -26,4 +26,9 @@ enum { INSTALL_SUCCESS, INSTALL_ERROR, INSTALL_CORRUPT };
 int install_package(const char *root_path, int* wipe_cache,
                     const char* install_file);
 
+// Verify the package specified by path and check the CRC of every
+// entry in it, without installing anything.  Returns INSTALL_SUCCESS
+// if the whole package is good.
+int check_package(const char* path);
+
 #endif  // RECOVERY_INSTALL_H_
@@ -1,19 +1,78 @@
 LOCAL_PATH := $(call my-dir)
 include $(CLEAR_VARS)
 
-LOCAL_SRC_FILES := \
+minzip_src_files := \
 	Hash.c \
 	SysUtil.c \
 	DirUtil.c \
 	Inlines.c \
+	HashTree.c \
 	Zip.c
 
+LOCAL_SRC_FILES := $(minzip_src_files)
+
 LOCAL_C_INCLUDES += \
-	external/zlib \
-	external/safe-iop/include
-	
+	external/safe-iop/include \
+	bootable/recovery
+
+# zlib-ng in compat mode is a drop-in replacement for zlib; the
+# executables that link libminzip must link libz_ng instead of libz.
+ifeq ($(TARGET_MINZIP_USE_ZLIB_NG),true)
+LOCAL_C_INCLUDES += external/zlib-ng
+else
+LOCAL_C_INCLUDES += external/zlib
+endif
+
+# libdeflate inflates whole entries in one call when the caller
+# supplies the output buffer (mzExtractZipEntryToBuffer).
+ifeq ($(TARGET_MINZIP_USE_LIBDEFLATE),true)
+LOCAL_C_INCLUDES += external/libdeflate
+LOCAL_CFLAGS += -DMINZIP_USE_LIBDEFLATE
+endif
+
+ifneq ($(TARGET_MINZIP_BUFFER_SIZE),)
+LOCAL_CFLAGS += -DMINZIP_STREAM_BUFFER_SIZE=$(TARGET_MINZIP_BUFFER_SIZE)
+endif
+
 LOCAL_MODULE := libminzip
 
 LOCAL_CFLAGS += -Wall
 
 include $(BUILD_STATIC_LIBRARY)
+
+# For minzip_bench, which times entry extraction on the build host.
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := $(minzip_src_files)
+
+LOCAL_C_INCLUDES += \
+	external/safe-iop/include \
+	external/zlib \
+	bootable/recovery
+
+ifeq ($(TARGET_MINZIP_USE_LIBDEFLATE),true)
+LOCAL_C_INCLUDES += external/libdeflate
+LOCAL_CFLAGS += -DMINZIP_USE_LIBDEFLATE
+endif
+
+LOCAL_MODULE := libminzip
+
+LOCAL_CFLAGS += -Wall
+
+include $(BUILD_HOST_STATIC_LIBRARY)
+
+include $(CLEAR_VARS)
+LOCAL_SRC_FILES := zip_bench.c
+LOCAL_MODULE := minzip_bench
+LOCAL_MODULE_TAGS := tests
+LOCAL_C_INCLUDES += external/zlib
+ifeq ($(TARGET_MINZIP_USE_LIBDEFLATE),true)
+LOCAL_CFLAGS += -DMINZIP_USE_LIBDEFLATE
+endif
+LOCAL_STATIC_LIBRARIES := libminzip librecovery_crypto
+ifeq ($(TARGET_MINZIP_USE_LIBDEFLATE),true)
+LOCAL_STATIC_LIBRARIES += libdeflate
+endif
+LOCAL_STATIC_LIBRARIES += libz
+LOCAL_LDLIBS += -lpthread -lrt
+include $(BUILD_HOST_EXECUTABLE)
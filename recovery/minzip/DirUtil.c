@@ -15,19 +15,93 @@
  */
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdio.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 #include <errno.h>
 #include <dirent.h>
+#include <fcntl.h>
 #include <limits.h>
+#include <pthread.h>
 
 #include "DirUtil.h"
+#include "Hash.h"
 
 typedef enum { DMISSING, DDIR, DILLEGAL } DirStatus;
 
+struct DirCache {
+    HashTable *dirs;    // malloc()ed path strings, no trailing slash
+};
+
+static unsigned int
+computeDirHash(const char *path)
+{
+    unsigned int hash = 2;
+
+    while (*path != '\0') {
+        hash = hash * 31 + *path++;
+    }
+    return hash;
+}
+
+static int
+hashcmpDirPath(const void *tableItem, const void *looseItem)
+{
+    return strcmp((const char *)tableItem, (const char *)looseItem);
+}
+
+DirCache *
+dirCacheCreate(void)
+{
+    DirCache *cache = (DirCache *)malloc(sizeof(*cache));
+    if (cache == NULL) {
+        return NULL;
+    }
+    cache->dirs = mzHashTableCreate(64, free);
+    if (cache->dirs == NULL) {
+        free(cache);
+        return NULL;
+    }
+    return cache;
+}
+
+void
+dirCacheFree(DirCache *cache)
+{
+    if (cache == NULL) {
+        return;
+    }
+    mzHashTableFree(cache->dirs);
+    free(cache);
+}
+
+static bool
+dirCacheContains(DirCache *cache, const char *path)
+{
+    return mzHashTableLookup(cache->dirs, computeDirHash(path),
+            (void *)path, hashcmpDirPath, false) != NULL;
+}
+
+/* Remember that "path" is a directory.  Failing to allocate just
+ * means we'll stat() it again next time, so errors are ignored.
+ */
+static void
+dirCacheAdd(DirCache *cache, const char *path)
+{
+    char *copy = strdup(path);
+    if (copy == NULL) {
+        return;
+    }
+    if (mzHashTableLookup(cache->dirs, computeDirHash(copy), copy,
+            hashcmpDirPath, true) != copy) {
+        free(copy);
+    }
+}
+
 static DirStatus
 getPathDirStatus(const char *path)
 {
@@ -55,6 +129,14 @@ getPathDirStatus(const char *path)
 int
 dirCreateHierarchy(const char *path, int mode,
         const struct utimbuf *timestamp, bool stripFileName)
+{
+    return dirCreateHierarchyCached(NULL, path, mode, timestamp,
+            stripFileName);
+}
+
+int
+dirCreateHierarchyCached(DirCache *cache, const char *path, int mode,
+        const struct utimbuf *timestamp, bool stripFileName)
 {
     DirStatus ds;
 
@@ -99,13 +181,34 @@ dirCreateHierarchy(const char *path, int mode,
         cpath[pathLen + 1] = '\0';
     }
 
-    /* See if it already exists.
-     */
-    ds = getPathDirStatus(cpath);
-    if (ds == DDIR) {
-        return 0;
-    } else if (ds == DILLEGAL) {
-        return -1;
+    if (cache != NULL) {
+        /* Files in the same directory are usually created one
+         * after another, so check the whole path first.  The
+         * key is the path without its trailing slash(es).
+         */
+        char *end = cpath + strlen(cpath);
+        while (end > cpath + 1 && end[-1] == '/') {
+            end--;
+        }
+        char save = *end;
+        *end = '\0';
+        bool known = dirCacheContains(cache, cpath);
+        *end = save;
+        if (known) {
+            free(cpath);
+            return 0;
+        }
+    } else {
+        /* See if it already exists.
+         */
+        ds = getPathDirStatus(cpath);
+        if (ds == DDIR) {
+            free(cpath);
+            return 0;
+        } else if (ds == DILLEGAL) {
+            free(cpath);
+            return -1;
+        }
     }
 
     /* Walk up the path from the root and make each level.
@@ -131,6 +234,13 @@ dirCreateHierarchy(const char *path, int mode,
         }
         *p = '\0';
 
+        /* Parents we've already seen don't need another syscall.
+         */
+        if (cache != NULL && dirCacheContains(cache, cpath)) {
+            *p = '/';
+            continue;
+        }
+
         /* Check this part of the path and make a new directory
          * if necessary.
          */
@@ -155,7 +265,11 @@ dirCreateHierarchy(const char *path, int mode,
             }
         }
         // else, this directory already exists.
-        
+
+        if (cache != NULL) {
+            dirCacheAdd(cache, cpath);
+        }
+
         /* Repair the path and continue.
          */
         *p = '/';
@@ -221,60 +335,316 @@ dirUnlinkHierarchy(const char *path)
     return rmdir(path);
 }
 
-int
-dirSetHierarchyPermissions(const char *path,
-        int uid, int gid, int dirMode, int fileMode)
+/* One record returned by getdents64().  Declared here because the C
+ * library doesn't export it.
+ */
+typedef struct {
+    uint64_t        d_ino;
+    int64_t         d_off;
+    unsigned short  d_reclen;
+    unsigned char   d_type;
+    char            d_name[];
+} DirEnt64;
+
+/* Large enough to read a typical directory in one or two syscalls.
+ */
+#define DIRENT_BUF_SIZE 8192
+
+typedef struct {
+    int uid;
+    int gid;
+    int dirMode;
+    int fileMode;
+} PermArgs;
+
+static int setPermsAt(int parentFd, const char *name, unsigned char type,
+        const PermArgs *args);
+
+/* Apply the permissions to everything in the open directory dirFd.
+ * Stops at the first failure, like the path-based version did.
+ */
+static int
+setPermsInDir(int dirFd, const PermArgs *args)
 {
-    struct stat st;
-    if (lstat(path, &st)) {
+    char *buf = (char *)malloc(DIRENT_BUF_SIZE);
+    if (buf == NULL) {
+        errno = ENOMEM;
         return -1;
     }
 
+    int ret = 0;
+    for (;;) {
+        int n = syscall(__NR_getdents64, dirFd, buf, DIRENT_BUF_SIZE);
+        if (n <= 0) {
+            if (n < 0) {
+                ret = -1;
+            }
+            break;
+        }
+
+        int off;
+        for (off = 0; off < n; ) {
+            const DirEnt64 *de = (const DirEnt64 *)(buf + off);
+            off += de->d_reclen;
+            if (!strcmp(de->d_name, "..") || !strcmp(de->d_name, ".")) {
+                continue;
+            }
+            if (setPermsAt(dirFd, de->d_name, de->d_type, args)) {
+                ret = -1;
+                break;
+            }
+        }
+        if (ret != 0) {
+            break;
+        }
+    }
+
+    int save = errno;
+    free(buf);
+    errno = save;
+    return ret;
+}
+
+/* Apply the permissions to "name" in parentFd, and to its contents
+ * if it's a directory.  "type" is the getdents64() d_type, which
+ * saves a stat() when the filesystem fills it in; pass DT_UNKNOWN
+ * to have it looked up.
+ */
+static int
+setPermsAt(int parentFd, const char *name, unsigned char type,
+        const PermArgs *args)
+{
+    if (type == DT_UNKNOWN) {
+        struct stat st;
+        if (fstatat(parentFd, name, &st, AT_SYMLINK_NOFOLLOW)) {
+            return -1;
+        }
+        if (S_ISLNK(st.st_mode)) {
+            type = DT_LNK;
+        } else if (S_ISDIR(st.st_mode)) {
+            type = DT_DIR;
+        } else {
+            type = DT_REG;
+        }
+    }
+
     /* ignore symlinks */
-    if (S_ISLNK(st.st_mode)) {
+    if (type == DT_LNK) {
         return 0;
     }
 
     /* directories and files get different permissions */
-    if (chown(path, uid, gid) ||
-        chmod(path, S_ISDIR(st.st_mode) ? dirMode : fileMode)) {
+    if (type != DT_DIR) {
+        if (fchownat(parentFd, name, args->uid, args->gid,
+                    AT_SYMLINK_NOFOLLOW) ||
+            fchmodat(parentFd, name, args->fileMode, 0)) {
+            return -1;
+        }
+        return 0;
+    }
+
+    int fd = openat(parentFd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+    if (fd < 0) {
         return -1;
     }
+    int ret = -1;
+    if (fchown(fd, args->uid, args->gid) == 0 &&
+        fchmod(fd, args->dirMode) == 0) {
+        /* recurse over directory components */
+        ret = setPermsInDir(fd, args);
+    }
+    int save = errno;
+    close(fd);
+    errno = save;
+    return ret;
+}
+
+int
+dirSetHierarchyPermissions(const char *path,
+        int uid, int gid, int dirMode, int fileMode)
+{
+    PermArgs args = { uid, gid, dirMode, fileMode };
+    return setPermsAt(AT_FDCWD, path, DT_UNKNOWN, &args);
+}
 
-    /* recurse over directory components */
-    if (S_ISDIR(st.st_mode)) {
-        DIR *dir = opendir(path);
-        if (dir == NULL) {
+/* Work shared by the dirSetHierarchyPermissionsParallel() threads:
+ * the entries of the top-level directory, handed out one at a time.
+ */
+typedef struct {
+    int rootFd;
+    const PermArgs *args;
+    char **names;
+    unsigned char *types;
+    int count;
+    int next;
+    int failed;         // errno of the first failure, or 0
+    pthread_mutex_t lock;
+} PermWork;
+
+static void *
+setPermsWorker(void *cookie)
+{
+    PermWork *work = (PermWork *)cookie;
+
+    for (;;) {
+        pthread_mutex_lock(&work->lock);
+        int i = work->next++;
+        bool done = (i >= work->count || work->failed != 0);
+        pthread_mutex_unlock(&work->lock);
+        if (done) {
+            break;
+        }
+
+        if (setPermsAt(work->rootFd, work->names[i], work->types[i],
+                work->args)) {
+            int err = errno ? errno : EIO;
+            pthread_mutex_lock(&work->lock);
+            if (work->failed == 0) {
+                work->failed = err;
+            }
+            pthread_mutex_unlock(&work->lock);
+            break;
+        }
+    }
+    return NULL;
+}
+
+/* Read the names and types of everything in dirFd (except . and ..)
+ * into the work queue.
+ */
+static int
+readPermWork(int dirFd, PermWork *work)
+{
+    char *buf = (char *)malloc(DIRENT_BUF_SIZE);
+    int cap = 0;
+    if (buf == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    for (;;) {
+        int n = syscall(__NR_getdents64, dirFd, buf, DIRENT_BUF_SIZE);
+        if (n < 0) {
+            free(buf);
             return -1;
         }
+        if (n == 0) {
+            break;
+        }
 
-        errno = 0;
-        const struct dirent *de;
-        while (errno == 0 && (de = readdir(dir)) != NULL) {
+        int off;
+        for (off = 0; off < n; ) {
+            const DirEnt64 *de = (const DirEnt64 *)(buf + off);
+            off += de->d_reclen;
             if (!strcmp(de->d_name, "..") || !strcmp(de->d_name, ".")) {
                 continue;
             }
-
-            char dn[PATH_MAX];
-            snprintf(dn, sizeof(dn), "%s/%s", path, de->d_name);
-            if (!dirSetHierarchyPermissions(dn, uid, gid, dirMode, fileMode)) {
-                errno = 0;
-            } else if (errno == 0) {
-                errno = -1;
+            if (work->count == cap) {
+                cap = cap ? cap * 2 : 64;
+                char **names = (char **)realloc(work->names,
+                        cap * sizeof(char *));
+                unsigned char *types = (unsigned char *)realloc(work->types,
+                        cap * sizeof(unsigned char));
+                if (names != NULL) work->names = names;
+                if (types != NULL) work->types = types;
+                if (names == NULL || types == NULL) {
+                    free(buf);
+                    errno = ENOMEM;
+                    return -1;
+                }
             }
+            work->names[work->count] = strdup(de->d_name);
+            if (work->names[work->count] == NULL) {
+                free(buf);
+                errno = ENOMEM;
+                return -1;
+            }
+            work->types[work->count] = de->d_type;
+            work->count++;
         }
+    }
+    free(buf);
+    return 0;
+}
 
-        if (errno != 0) {
-            int save = errno;
-            closedir(dir);
-            errno = save;
-            return -1;
-        }
+int
+dirSetHierarchyPermissionsParallel(const char *path,
+        int uid, int gid, int dirMode, int fileMode, int numThreads)
+{
+    PermArgs args = { uid, gid, dirMode, fileMode };
+    struct stat st;
 
-        if (closedir(dir)) {
-            return -1;
+    if (numThreads <= 1) {
+        return setPermsAt(AT_FDCWD, path, DT_UNKNOWN, &args);
+    }
+
+    if (lstat(path, &st)) {
+        return -1;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        return setPermsAt(AT_FDCWD, path, DT_UNKNOWN, &args);
+    }
+
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+    if (fd < 0) {
+        return -1;
+    }
+    if (fchown(fd, uid, gid) || fchmod(fd, dirMode)) {
+        int save = errno;
+        close(fd);
+        errno = save;
+        return -1;
+    }
+
+    PermWork work;
+    memset(&work, 0, sizeof(work));
+    work.rootFd = fd;
+    work.args = &args;
+    pthread_mutex_init(&work.lock, NULL);
+
+    if (readPermWork(fd, &work) != 0) {
+        work.failed = errno;
+    } else {
+        /* No point starting more threads than there are subtrees.
+         */
+        if (numThreads > work.count) {
+            numThreads = work.count;
+        }
+        pthread_t *threads = (pthread_t *)calloc(numThreads,
+                sizeof(pthread_t));
+        int started = 0;
+        if (threads != NULL) {
+            for (; started < numThreads; ++started) {
+                if (pthread_create(&threads[started], NULL,
+                        setPermsWorker, &work) != 0) {
+                    break;
+                }
+            }
+        }
+        /* If no threads could be started, do the work ourselves.
+         */
+        if (started == 0) {
+            setPermsWorker(&work);
         }
+        int i;
+        for (i = 0; i < started; ++i) {
+            pthread_join(threads[i], NULL);
+        }
+        free(threads);
+    }
+
+    int i;
+    for (i = 0; i < work.count; ++i) {
+        free(work.names[i]);
     }
+    free(work.names);
+    free(work.types);
+    pthread_mutex_destroy(&work.lock);
+    close(fd);
 
+    if (work.failed != 0) {
+        errno = work.failed;
+        return -1;
+    }
     return 0;
 }
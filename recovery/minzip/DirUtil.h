@@ -36,6 +36,24 @@
 int dirCreateHierarchy(const char *path, int mode,
         const struct utimbuf *timestamp, bool stripFileName);
 
+/* Set of directories known to exist, so that repeated
+ * dirCreateHierarchyCached() calls for files in the same tree
+ * (e.g. while extracting an archive) don't stat() or mkdir() the
+ * same parents over and over.  The cache assumes nothing else
+ * removes those directories while it is in use.
+ */
+typedef struct DirCache DirCache;
+
+DirCache *dirCacheCreate(void);
+void dirCacheFree(DirCache *cache);
+
+/* Like dirCreateHierarchy(), but skips any directory already
+ * recorded in "cache" and records every directory it checks or
+ * creates.  A NULL cache behaves exactly like dirCreateHierarchy().
+ */
+int dirCreateHierarchyCached(DirCache *cache, const char *path, int mode,
+        const struct utimbuf *timestamp, bool stripFileName);
+
 /* rm -rf <path>
  */
 int dirUnlinkHierarchy(const char *path);
@@ -44,8 +62,18 @@ int dirUnlinkHierarchy(const char *path);
  * chmod -R <mode> <path>
  *
  * Sets directories to <dirMode> and files to <fileMode>.  Skips symlinks.
+ * The tree is walked relative to open directory fds, so each entry costs
+ * one fchownat()/fchmodat() pair rather than full path lookups.
  */
 int dirSetHierarchyPermissions(const char *path,
          int uid, int gid, int dirMode, int fileMode);
 
+/* Like dirSetHierarchyPermissions(), but if <path> is a directory its
+ * immediate children are shared out among up to <numThreads> threads.
+ * On failure the first error is returned in errno; other threads finish
+ * the subtree they are in but don't start new ones.
+ */
+int dirSetHierarchyPermissionsParallel(const char *path,
+         int uid, int gid, int dirMode, int fileMode, int numThreads);
+
 #endif  // MINZIP_DIRUTIL_H_
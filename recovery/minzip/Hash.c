@@ -2,8 +2,14 @@
  * Copyright 2006 The Android Open Source Project
  *
  * Hash table.  The dominant calls are add and lookup, with removals
- * happening very infrequently.  We use probing, and don't worry much
- * about tombstone removal.
+ * happening very infrequently.
+ *
+ * We use linear probing with Robin Hood placement: an entry being inserted
+ * takes the slot of any entry that is closer to its own home slot, and the
+ * displaced entry moves on.  That keeps probe lengths short and even, and
+ * means a lookup can stop as soon as it reaches an entry that is closer to
+ * home than the item would be at that point.  Removal shifts the rest of
+ * the cluster back one slot, so there are no tombstones to clean up.
  */
 #include <stdlib.h>
 #include <assert.h>
@@ -59,10 +65,10 @@ HashTable* mzHashTableCreate(size_t initialSize, HashFreeFunc freeFunc)
         return NULL;
 
     pHashTable->tableSize = roundUpPower2(initialSize);
-    pHashTable->numEntries = pHashTable->numDeadEntries = 0;
+    pHashTable->numEntries = 0;
     pHashTable->freeFunc = freeFunc;
     pHashTable->pEntries =
-        (HashEntry*) calloc((size_t)pHashTable->tableSize, sizeof(HashTable));
+        (HashEntry*) calloc((size_t)pHashTable->tableSize, sizeof(HashEntry));
     if (pHashTable->pEntries == NULL) {
         free(pHashTable);
         return NULL;
@@ -81,10 +87,7 @@ void mzHashTableClear(HashTable* pHashTable)
 
     pEnt = pHashTable->pEntries;
     for (i = 0; i < pHashTable->tableSize; i++, pEnt++) {
-        if (pEnt->data == HASH_TOMBSTONE) {
-            // nuke entry
-            pEnt->data = NULL;
-        } else if (pEnt->data != NULL) {
+        if (pEnt->data != NULL) {
             // call free func then nuke entry
             if (pHashTable->freeFunc != NULL)
                 (*pHashTable->freeFunc)(pEnt->data);
@@ -93,7 +96,6 @@ void mzHashTableClear(HashTable* pHashTable)
     }
 
     pHashTable->numEntries = 0;
-    pHashTable->numDeadEntries = 0;
 }
 
 /*
@@ -108,21 +110,44 @@ void mzHashTableFree(HashTable* pHashTable)
     free(pHashTable);
 }
 
-#ifndef NDEBUG
 /*
- * Count up the number of tombstone entries in the hash table.
+ * Number of slots between "idx" and the home slot of an entry whose hash
+ * is "hashValue", allowing for wrap-around.
  */
-static int countTombStones(HashTable* pHashTable)
+static inline unsigned int probeDistance(unsigned int hashValue,
+    unsigned int idx, unsigned int mask)
 {
-    int i, count;
+    return (idx - (hashValue & mask)) & mask;
+}
 
-    for (count = i = 0; i < pHashTable->tableSize; i++) {
-        if (pHashTable->pEntries[i].data == HASH_TOMBSTONE)
-            count++;
+/*
+ * Store an entry, starting at slot "idx" (which must be on the entry's
+ * probe path), displacing entries that are closer to home than the one
+ * being carried.  The table must have at least one empty slot.
+ */
+static void robinHoodInsert(HashEntry* pEntries, unsigned int mask,
+    unsigned int idx, unsigned int hashValue, void* data)
+{
+    unsigned int dist = probeDistance(hashValue, idx, mask);
+
+    while (pEntries[idx].data != NULL) {
+        unsigned int slotDist =
+            probeDistance(pEntries[idx].hashValue, idx, mask);
+        if (slotDist < dist) {
+            HashEntry displaced = pEntries[idx];
+            pEntries[idx].hashValue = hashValue;
+            pEntries[idx].data = data;
+            hashValue = displaced.hashValue;
+            data = displaced.data;
+            dist = slotDist;
+        }
+        idx = (idx + 1) & mask;
+        dist++;
     }
-    return count;
+
+    pEntries[idx].hashValue = hashValue;
+    pEntries[idx].data = data;
 }
-#endif
 
 /*
  * Resize a hash table.  We do this when adding an entry increased the
@@ -137,148 +162,129 @@ static int countTombStones(HashTable* pHashTable)
 static bool resizeHash(HashTable* pHashTable, int newSize)
 {
     HashEntry* pNewEntries;
+    unsigned int newMask = newSize - 1;
     int i;
 
-    assert(countTombStones(pHashTable) == pHashTable->numDeadEntries);
-    //LOGI("before: dead=%d\n", pHashTable->numDeadEntries);
-
-    pNewEntries = (HashEntry*) calloc(newSize, sizeof(HashTable));
+    pNewEntries = (HashEntry*) calloc(newSize, sizeof(HashEntry));
     if (pNewEntries == NULL)
         return false;
 
     for (i = 0; i < pHashTable->tableSize; i++) {
-        void* data = pHashTable->pEntries[i].data;
-        if (data != NULL && data != HASH_TOMBSTONE) {
-            int hashValue = pHashTable->pEntries[i].hashValue;
-            int newIdx;
-
-            /* probe for new spot, wrapping around */
-            newIdx = hashValue & (newSize-1);
-            while (pNewEntries[newIdx].data != NULL)
-                newIdx = (newIdx + 1) & (newSize-1);
-
-            pNewEntries[newIdx].hashValue = hashValue;
-            pNewEntries[newIdx].data = data;
+        HashEntry* pEnt = &pHashTable->pEntries[i];
+        if (pEnt->data != NULL) {
+            robinHoodInsert(pNewEntries, newMask, pEnt->hashValue & newMask,
+                pEnt->hashValue, pEnt->data);
         }
     }
 
     free(pHashTable->pEntries);
     pHashTable->pEntries = pNewEntries;
     pHashTable->tableSize = newSize;
-    pHashTable->numDeadEntries = 0;
 
-    assert(countTombStones(pHashTable) == 0);
     return true;
 }
 
 /*
  * Look up an entry.
  *
- * We probe on collisions, wrapping around the table.
+ * We probe on collisions, wrapping around the table.  Because of the
+ * Robin Hood ordering, reaching an entry that is closer to its home slot
+ * than we are to ours means the item isn't in the table; that slot is
+ * also where it belongs if we're adding it.
  */
 void* mzHashTableLookup(HashTable* pHashTable, unsigned int itemHash, void* item,
     HashCompareFunc cmpFunc, bool doAdd)
 {
-    HashEntry* pEntry;
-    HashEntry* pEnd;
-    void* result = NULL;
+    HashEntry* pEntries = pHashTable->pEntries;
+    unsigned int mask = pHashTable->tableSize - 1;
+    unsigned int idx, dist;
 
     assert(pHashTable->tableSize > 0);
-    assert(item != HASH_TOMBSTONE);
     assert(item != NULL);
 
     /* jump to the first entry and probe for a match */
-    pEntry = &pHashTable->pEntries[itemHash & (pHashTable->tableSize-1)];
-    pEnd = &pHashTable->pEntries[pHashTable->tableSize];
-    while (pEntry->data != NULL) {
-        if (pEntry->data != HASH_TOMBSTONE &&
-            pEntry->hashValue == itemHash &&
+    idx = itemHash & mask;
+    dist = 0;
+    while (pEntries[idx].data != NULL) {
+        HashEntry* pEntry = &pEntries[idx];
+
+        if (probeDistance(pEntry->hashValue, idx, mask) < dist)
+            break;
+
+        if (pEntry->hashValue == itemHash &&
             (*cmpFunc)(pEntry->data, item) == 0)
         {
             /* match */
-            //LOGD("+++ match on entry %d\n", pEntry - pHashTable->pEntries);
-            break;
+            return pEntry->data;
         }
 
-        pEntry++;
-        if (pEntry == pEnd) {     /* wrap around to start */
-            if (pHashTable->tableSize == 1)
-                break;      /* edge case - single-entry table */
-            pEntry = pHashTable->pEntries;
-        }
-
-        //LOGI("+++ look probing %d...\n", pEntry - pHashTable->pEntries);
+        idx = (idx + 1) & mask;
+        dist++;
     }
 
-    if (pEntry->data == NULL) {
-        if (doAdd) {
-            pEntry->hashValue = itemHash;
-            pEntry->data = item;
-            pHashTable->numEntries++;
-
-            /*
-             * We've added an entry.  See if this brings us too close to full.
-             */
-            if ((pHashTable->numEntries+pHashTable->numDeadEntries) * LOAD_DENOM
-                > pHashTable->tableSize * LOAD_NUMER)
-            {
-                if (!resizeHash(pHashTable, pHashTable->tableSize * 2)) {
-                    /* don't really have a way to indicate failure */
-                    LOGE("Dalvik hash resize failure\n");
-                    abort();
-                }
-                /* note "pEntry" is now invalid */
-            } else {
-                //LOGW("okay %d/%d/%d\n",
-                //    pHashTable->numEntries, pHashTable->tableSize,
-                //    (pHashTable->tableSize * LOAD_NUMER) / LOAD_DENOM);
-            }
+    if (!doAdd)
+        return NULL;
+
+    robinHoodInsert(pEntries, mask, idx, itemHash, item);
+    pHashTable->numEntries++;
 
-            /* full table is bad -- search for nonexistent never halts */
-            assert(pHashTable->numEntries < pHashTable->tableSize);
-            result = item;
-        } else {
-            assert(result == NULL);
+    /*
+     * We've added an entry.  See if this brings us too close to full.
+     */
+    if (pHashTable->numEntries * LOAD_DENOM
+        > pHashTable->tableSize * LOAD_NUMER)
+    {
+        if (!resizeHash(pHashTable, pHashTable->tableSize * 2)) {
+            /* don't really have a way to indicate failure */
+            LOGE("Dalvik hash resize failure\n");
+            abort();
         }
-    } else {
-        result = pEntry->data;
     }
 
-    return result;
+    /* full table is bad -- search for nonexistent never halts */
+    assert(pHashTable->numEntries < pHashTable->tableSize);
+    return item;
 }
 
 /*
  * Remove an entry from the table.
  *
+ * The entries after it in the same cluster are shifted back one slot,
+ * which keeps the Robin Hood ordering intact without a tombstone.
+ *
  * Does NOT invoke the "free" function on the item.
  */
 bool mzHashTableRemove(HashTable* pHashTable, unsigned int itemHash, void* item)
 {
-    HashEntry* pEntry;
-    HashEntry* pEnd;
+    HashEntry* pEntries = pHashTable->pEntries;
+    unsigned int mask = pHashTable->tableSize - 1;
+    unsigned int idx, next, dist;
 
     assert(pHashTable->tableSize > 0);
 
     /* jump to the first entry and probe for a match */
-    pEntry = &pHashTable->pEntries[itemHash & (pHashTable->tableSize-1)];
-    pEnd = &pHashTable->pEntries[pHashTable->tableSize];
-    while (pEntry->data != NULL) {
-        if (pEntry->data == item) {
-            //LOGI("+++ stepping on entry %d\n", pEntry - pHashTable->pEntries);
-            pEntry->data = HASH_TOMBSTONE;
+    idx = itemHash & mask;
+    dist = 0;
+    while (pEntries[idx].data != NULL) {
+        if (probeDistance(pEntries[idx].hashValue, idx, mask) < dist)
+            break;
+
+        if (pEntries[idx].data == item) {
+            next = (idx + 1) & mask;
+            while (pEntries[next].data != NULL &&
+                probeDistance(pEntries[next].hashValue, next, mask) != 0)
+            {
+                pEntries[idx] = pEntries[next];
+                idx = next;
+                next = (next + 1) & mask;
+            }
+            pEntries[idx].data = NULL;
             pHashTable->numEntries--;
-            pHashTable->numDeadEntries++;
             return true;
         }
 
-        pEntry++;
-        if (pEntry == pEnd) {     /* wrap around to start */
-            if (pHashTable->tableSize == 1)
-                break;      /* edge case - single-entry table */
-            pEntry = pHashTable->pEntries;
-        }
-
-        //LOGI("+++ del probing %d...\n", pEntry - pHashTable->pEntries);
+        idx = (idx + 1) & mask;
+        dist++;
     }
 
     return false;
@@ -296,7 +302,7 @@ int mzHashForeach(HashTable* pHashTable, HashForeachFunc func, void* arg)
     for (i = 0; i < pHashTable->tableSize; i++) {
         HashEntry* pEnt = &pHashTable->pEntries[i];
 
-        if (pEnt->data != NULL && pEnt->data != HASH_TOMBSTONE) {
+        if (pEnt->data != NULL) {
             val = (*func)(pEnt->data, arg);
             if (val != 0)
                 return val;
@@ -315,39 +321,33 @@ int mzHashForeach(HashTable* pHashTable, HashForeachFunc func, void* arg)
 int countProbes(HashTable* pHashTable, unsigned int itemHash, const void* item,
     HashCompareFunc cmpFunc)
 {
-    HashEntry* pEntry;
-    HashEntry* pEnd;
+    HashEntry* pEntries = pHashTable->pEntries;
+    unsigned int mask = pHashTable->tableSize - 1;
+    unsigned int idx;
     int count = 0;
 
     assert(pHashTable->tableSize > 0);
-    assert(item != HASH_TOMBSTONE);
     assert(item != NULL);
 
     /* jump to the first entry and probe for a match */
-    pEntry = &pHashTable->pEntries[itemHash & (pHashTable->tableSize-1)];
-    pEnd = &pHashTable->pEntries[pHashTable->tableSize];
-    while (pEntry->data != NULL) {
-        if (pEntry->data != HASH_TOMBSTONE &&
-            pEntry->hashValue == itemHash &&
-            (*cmpFunc)(pEntry->data, item) == 0)
-        {
-            /* match */
+    idx = itemHash & mask;
+    while (pEntries[idx].data != NULL) {
+        if (probeDistance(pEntries[idx].hashValue, idx, mask)
+                < (unsigned int)count)
             break;
-        }
 
-        pEntry++;
-        if (pEntry == pEnd) {     /* wrap around to start */
-            if (pHashTable->tableSize == 1)
-                break;      /* edge case - single-entry table */
-            pEntry = pHashTable->pEntries;
+        if (pEntries[idx].hashValue == itemHash &&
+            (*cmpFunc)(pEntries[idx].data, item) == 0)
+        {
+            /* match */
+            return count;
         }
 
+        idx = (idx + 1) & mask;
         count++;
     }
-    if (pEntry->data == NULL)
-        return -1;
 
-    return count;
+    return -1;
 }
 
 /*
@@ -388,3 +388,36 @@ void mzHashTableProbeCount(HashTable* pHashTable, HashCalcFunc calcFunc,
         minProbe, maxProbe, totalProbe, numEntries, pHashTable->tableSize,
         (float) totalProbe / (float) numEntries);
 }
+
+/*
+ * Gather load and probe-length statistics.
+ *
+ * Every entry's probe length is its distance from its home slot, which
+ * we can get from the stored hash value without doing any lookups.
+ */
+void mzHashTableGetStats(const HashTable* pHashTable, HashTableStats* pStats)
+{
+    unsigned int mask = pHashTable->tableSize - 1;
+    int i, maxProbe, totalProbe;
+
+    maxProbe = totalProbe = 0;
+    for (i = 0; i < pHashTable->tableSize; i++) {
+        const HashEntry* pEnt = &pHashTable->pEntries[i];
+        int dist;
+
+        if (pEnt->data == NULL)
+            continue;
+        dist = probeDistance(pEnt->hashValue, i, mask);
+        if (dist > maxProbe)
+            maxProbe = dist;
+        totalProbe += dist;
+    }
+
+    pStats->numEntries = pHashTable->numEntries;
+    pStats->tableSize = pHashTable->tableSize;
+    pStats->loadFactor =
+        (float) pHashTable->numEntries / (float) pHashTable->tableSize;
+    pStats->maxProbe = maxProbe;
+    pStats->avgProbe = (pHashTable->numEntries == 0) ? 0.0f :
+        (float) totalProbe / (float) pHashTable->numEntries;
+}
@@ -3,7 +3,7 @@
  *
  * General purpose hash table, used for finding classes, methods, etc.
  *
- * When the number of elements reaches 3/4 of the table's capacity, the
+ * When the number of elements reaches 5/8 of the table's capacity, the
  * table will be resized.
  */
 #ifndef _MINZIP_HASH
@@ -39,10 +39,13 @@ typedef int (*HashForeachFunc)(void* data, void* arg);
 /*
  * One entry in the hash table.  "data" values are expected to be (or have
  * the same characteristics as) valid pointers.  In particular, a NULL
- * value for "data" indicates an empty slot, and HASH_TOMBSTONE indicates
- * a no-longer-used slot that must be stepped over during probing.
+ * value for "data" indicates an empty slot.
  *
- * Attempting to add a NULL or tombstone value is an error.
+ * The full hash value is kept with each entry.  Probing compares it before
+ * calling the (much more expensive) HashCompareFunc, and uses it to work
+ * out how far each entry sits from its home slot.
+ *
+ * Attempting to add a NULL value is an error.
  *
  * When an entry is released, we will call (HashFreeFunc)(entry->data).
  */
@@ -51,21 +54,33 @@ typedef struct HashEntry {
     void* data;
 } HashEntry;
 
-#define HASH_TOMBSTONE ((void*) 0xcbcacccd)     // invalid ptr value
-
 /*
- * Expandable hash table.
+ * Expandable hash table, using Robin Hood linear probing.  Removal
+ * shifts the following entries back instead of leaving tombstones, so
+ * the table never needs compacting.
  *
  * This structure should be considered opaque.
  */
 typedef struct HashTable {
     int         tableSize;          /* must be power of 2 */
     int         numEntries;         /* current #of "live" entries */
-    int         numDeadEntries;     /* current #of tombstone entries */
     HashEntry*  pEntries;           /* array on heap */
     HashFreeFunc freeFunc;
 } HashTable;
 
+/*
+ * Occupancy and probing statistics, filled in by mzHashTableGetStats().
+ * Probe lengths count the slots stepped over before reaching an entry,
+ * so an entry in its home slot has a probe length of zero.
+ */
+typedef struct HashTableStats {
+    int         numEntries;
+    int         tableSize;
+    float       loadFactor;         /* numEntries / tableSize */
+    int         maxProbe;
+    float       avgProbe;
+} HashTableStats;
+
 /*
  * Create and initialize a HashTable structure, using "initialSize" as
  * a basis for the initial capacity of the table.  (The actual initial
@@ -153,8 +168,7 @@ INLINE void mzHashIterNext(HashIter* pIter) {
     int i = pIter->idx +1;
     int lim = pIter->pHashTable->tableSize;
     for ( ; i < lim; i++) {
-        void* data = pIter->pHashTable->pEntries[i].data;
-        if (data != NULL && data != HASH_TOMBSTONE)
+        if (pIter->pHashTable->pEntries[i].data != NULL)
             break;
     }
     pIter->idx = i;
@@ -183,4 +197,11 @@ typedef unsigned int (*HashCalcFunc)(const void* item);
 void mzHashTableProbeCount(HashTable* pHashTable, HashCalcFunc calcFunc,
     HashCompareFunc cmpFunc);
 
+/*
+ * Gather load and probe-length statistics for the table.  This only walks
+ * the slot array -- no hashes are recomputed and no items are compared --
+ * so it is cheap enough to call in production code.
+ */
+void mzHashTableGetStats(const HashTable* pHashTable, HashTableStats* pStats);
+
 #endif /*_MINZIP_HASH*/
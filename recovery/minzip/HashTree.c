@@ -0,0 +1,184 @@
+/*
+ * Copyright 2026 The Android Open Source Project
+ *
+ * Per-block hashes of a signed package.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#define LOG_TAG "minzip"
+#include "HashTree.h"
+#include "Bits.h"
+#include "Log.h"
+
+/* Whole-file signature footer and EOCD sizes; see verifier.c. */
+#define FOOTER_SIZE 6
+#define EOCD_HEADER_SIZE 22
+
+/* Largest block the SHA256() length argument can take. */
+#define HASH_TREE_MAX_BLOCK_SIZE (1 << 30)
+
+/*
+ * Parse the copy in pTree->data, filling in the rest of pTree.
+ * "coveredLen" is what the whole-file footer says the signed region is.
+ */
+static bool parseHashTree(BlockHashTree* pTree, size_t coveredLen)
+{
+    const unsigned char* p = pTree->data;
+    size_t numBlocks, blockSize;
+
+    if (pTree->dataLen < HASH_TREE_HEADER_SIZE + HASH_TREE_TRAILER_SIZE ||
+        memcmp(p, HASH_TREE_MAGIC, 4) != 0) {
+        LOGW("Bad hash tree header\n");
+        return false;
+    }
+    blockSize = get4LE(p + 4);
+    if (blockSize < HASH_TREE_MIN_BLOCK_SIZE ||
+        blockSize > HASH_TREE_MAX_BLOCK_SIZE ||
+        (blockSize & (blockSize - 1)) != 0) {
+        LOGW("Bad hash tree block size %zu\n", blockSize);
+        return false;
+    }
+    if (get4LE(p + 8) != coveredLen) {
+        LOGW("Hash tree covers %u bytes, not %zu\n", get4LE(p + 8), coveredLen);
+        return false;
+    }
+    numBlocks = get4LE(p + 12);
+    if (numBlocks != (coveredLen + blockSize - 1) / blockSize ||
+        numBlocks > (pTree->dataLen - HASH_TREE_HEADER_SIZE -
+                     HASH_TREE_TRAILER_SIZE) / SHA256_DIGEST_SIZE) {
+        LOGW("Bad hash tree block count %zu\n", numBlocks);
+        return false;
+    }
+
+    pTree->blockSize = blockSize;
+    pTree->coveredLen = coveredLen;
+    pTree->numBlocks = numBlocks;
+    pTree->blockHashes = p + HASH_TREE_HEADER_SIZE;
+    pTree->signedLen = HASH_TREE_HEADER_SIZE + numBlocks * SHA256_DIGEST_SIZE;
+    pTree->signature = p + pTree->signedLen;
+    pTree->signatureLen =
+        pTree->dataLen - HASH_TREE_TRAILER_SIZE - pTree->signedLen;
+    if (pTree->signatureLen == 0) {
+        LOGW("Hash tree isn't signed\n");
+        return false;
+    }
+    return true;
+}
+
+BlockHashTree* mzLoadHashTree(const unsigned char* addr, size_t length)
+{
+    const unsigned char* footer;
+    const unsigned char* trailer;
+    size_t commentSize, signatureStart, eocdSize, treeEnd, treeLen;
+    BlockHashTree* pTree;
+
+    if (length < FOOTER_SIZE)
+        return NULL;
+    footer = addr + length - FOOTER_SIZE;
+    if (footer[2] != 0xff || footer[3] != 0xff)
+        return NULL;
+    signatureStart = get2LE(footer);
+    commentSize = get2LE(footer + 4);
+    eocdSize = commentSize + EOCD_HEADER_SIZE;
+    if (eocdSize > length || signatureStart > commentSize)
+        return NULL;
+
+    /* The tree ends where the whole-file signature block starts, and
+     * must lie entirely within the comment.
+     */
+    treeEnd = length - signatureStart;
+    if (treeEnd < length - commentSize + HASH_TREE_TRAILER_SIZE)
+        return NULL;
+    trailer = addr + treeEnd - HASH_TREE_TRAILER_SIZE;
+    if (memcmp(trailer + 4, HASH_TREE_MAGIC, 4) != 0)
+        return NULL;
+    treeLen = get4LE(trailer);
+    if (treeLen > treeEnd - (length - commentSize)) {
+        LOGW("Hash tree runs off the start of the comment\n");
+        return NULL;
+    }
+
+    pTree = (BlockHashTree*) calloc(1, sizeof(*pTree));
+    if (pTree == NULL)
+        return NULL;
+    pTree->dataLen = treeLen;
+    pTree->data = (unsigned char*) malloc(treeLen);
+    if (pTree->data == NULL)
+        goto bail;
+    memcpy(pTree->data, addr + treeEnd - treeLen, treeLen);
+
+    if (!parseHashTree(pTree, length - eocdSize + EOCD_HEADER_SIZE - 2))
+        goto bail;
+
+    LOGI("Hash tree: %u blocks of %zu bytes\n",
+        pTree->numBlocks, pTree->blockSize);
+    return pTree;
+
+bail:
+    mzFreeHashTree(pTree);
+    return NULL;
+}
+
+void mzFreeHashTree(BlockHashTree* pTree)
+{
+    if (pTree == NULL)
+        return;
+    free(pTree->data);
+    free(pTree);
+}
+
+void mzHashTreeDigest(const BlockHashTree* pTree,
+    uint8_t digest[SHA256_DIGEST_SIZE])
+{
+    SHA256(pTree->data, pTree->signedLen, digest);
+}
+
+bool mzHashTreeCheckData(const BlockHashTree* pTree, size_t offset,
+    const unsigned char* data, size_t len)
+{
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    size_t block, size;
+
+    if (offset % pTree->blockSize != 0 || offset > pTree->coveredLen ||
+            len > pTree->coveredLen - offset ||
+            ((offset + len) % pTree->blockSize != 0 &&
+             offset + len != pTree->coveredLen)) {
+        LOGE("Range %zu+%zu isn't whole blocks of the hash tree\n",
+            offset, len);
+        return false;
+    }
+
+    for (block = offset / pTree->blockSize; len > 0; block++) {
+        size = len < pTree->blockSize ? len : pTree->blockSize;
+        SHA256(data, size, digest);
+        if (memcmp(digest, pTree->blockHashes + block * SHA256_DIGEST_SIZE,
+                SHA256_DIGEST_SIZE) != 0) {
+            LOGE("Block %zu of the package doesn't match its hash\n", block);
+            return false;
+        }
+        data += size;
+        len -= size;
+    }
+    return true;
+}
+
+bool mzHashTreeCheckRange(const BlockHashTree* pTree,
+    const unsigned char* base, size_t offset, size_t len)
+{
+    size_t start, end;
+
+    if (len == 0)
+        return true;
+    if (offset > pTree->coveredLen || len > pTree->coveredLen - offset) {
+        LOGE("Range %zu+%zu isn't covered by the hash tree\n", offset, len);
+        return false;
+    }
+    start = offset - offset % pTree->blockSize;
+    end = offset + len;
+    if (end % pTree->blockSize != 0)
+        end += pTree->blockSize - end % pTree->blockSize;
+    if (end > pTree->coveredLen)
+        end = pTree->coveredLen;
+    return mzHashTreeCheckData(pTree, start, base + start, end - start);
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright 2026 The Android Open Source Project
+ *
+ * Per-block hashes of a signed package, so it can be checked a block
+ * at a time as it is read instead of all at once before it is opened.
+ */
+#ifndef _MINZIP_HASHTREE
+#define _MINZIP_HASHTREE
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "crypto/sha256.h"
+
+/*
+ * The hash tree lives in the archive comment, immediately before the
+ * whole-file signature block (so the whole-file footer's "signature
+ * start" still finds that block, and recoveries that don't know about
+ * the tree are unaffected).  All fields are little-endian:
+ *
+ *   "HTR1"                       magic
+ *   u32 blockSize                power of two, at least 4096
+ *   u32 coveredLen               bytes covered: the same region as the
+ *                                whole-file signature, ie everything
+ *                                up to the EOCD comment length field
+ *   u32 numBlocks                ceil(coveredLen / blockSize)
+ *   numBlocks x 32 bytes         SHA-256 of each block (the last one
+ *                                may be short)
+ *   signature                    PKCS#1 v1.5 RSA signature of all of
+ *                                the above, with one of the recovery
+ *                                keys and that key's digest
+ *   u32 treeLen                  length of this whole structure
+ *   "HTR1"                       magic again
+ *
+ * The two levels (signed root over the table of block hashes) are all
+ * that's needed: with blocks sized to keep the table within the 64k
+ * comment, a deeper tree would only add hashing.
+ */
+#define HASH_TREE_MAGIC "HTR1"
+#define HASH_TREE_HEADER_SIZE 16
+#define HASH_TREE_TRAILER_SIZE 8
+#define HASH_TREE_MIN_BLOCK_SIZE 4096
+
+typedef struct BlockHashTree {
+    unsigned char* data;        /* private copy of the whole structure */
+    size_t dataLen;
+    size_t signedLen;           /* header plus block hashes */
+    const unsigned char* signature;     /* points into data */
+    size_t signatureLen;
+
+    size_t blockSize;
+    size_t coveredLen;
+    unsigned int numBlocks;
+    const unsigned char* blockHashes;   /* points into data */
+} BlockHashTree;
+
+/*
+ * Find and copy out the hash tree of a package mapped at "addr".  The
+ * copy is what the signature is checked against and what blocks are
+ * compared with, so later changes to the file can't affect either.
+ *
+ * Returns NULL if the package has no (well-formed) hash tree.  The
+ * signature is not checked here; that's the verifier's job.
+ */
+BlockHashTree* mzLoadHashTree(const unsigned char* addr, size_t length);
+
+/*
+ * Free a tree returned by mzLoadHashTree().  NULL is allowed.
+ */
+void mzFreeHashTree(BlockHashTree* pTree);
+
+/*
+ * SHA-256 of the signed part of the tree, which identifies it: a
+ * process that is handed this digest can reload the tree from the
+ * package and know it's the one that was verified.
+ */
+void mzHashTreeDigest(const BlockHashTree* pTree,
+    uint8_t digest[SHA256_DIGEST_SIZE]);
+
+/*
+ * Check "len" bytes at "data", read from the package at "offset",
+ * against the tree.  "offset" must be at the start of a block, and the
+ * data must end at the end of a block or of the covered region.  Every
+ * block is hashed on every call: what's checked is the caller's copy,
+ * which is what it goes on to use, so an earlier check of the same
+ * part of the file proves nothing about it.
+ */
+bool mzHashTreeCheckData(const BlockHashTree* pTree, size_t offset,
+    const unsigned char* data, size_t len);
+
+/*
+ * Check the whole blocks holding bytes [offset, offset+len) of the
+ * package mapped at "base".  Returns false on the first block that
+ * doesn't match, or if the range extends past the covered region.
+ */
+bool mzHashTreeCheckRange(const BlockHashTree* pTree,
+    const unsigned char* base, size_t offset, size_t len);
+
+#endif /*_MINZIP_HASHTREE*/
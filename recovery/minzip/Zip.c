@@ -5,10 +5,16 @@
  */
 #include "safe_iop.h"
 #include "zlib.h"
+#include "crypto/crc32.h"
+#include "crypto/sha1.h"
+#ifdef MINZIP_USE_LIBDEFLATE
+#include "libdeflate.h"
+#endif
 
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdint.h>     // for uintptr_t
 #include <stdlib.h>
 #include <sys/stat.h>   // for S_ISLNK()
@@ -25,6 +31,30 @@
 
 #define SORT_ENTRIES 1
 
+/*
+ * Size of the buffers used to stream entry contents, which is also the
+ * most data handed to a ProcessZipEntryContentsFunction per call.  Boards
+ * with memory to spare can raise it (TARGET_MINZIP_BUFFER_SIZE) to cut
+ * the number of read() and process calls on large entries.
+ */
+#ifndef MINZIP_STREAM_BUFFER_SIZE
+#define MINZIP_STREAM_BUFFER_SIZE (32 * 1024)
+#endif
+
+/* The above and libdeflate can be overridden by benchmarks. */
+static size_t gStreamBufferSize = MINZIP_STREAM_BUFFER_SIZE;
+static bool gUseLibdeflate = true;
+
+void mzSetStreamBufferSize(size_t size)
+{
+    gStreamBufferSize = size > 0 ? size : MINZIP_STREAM_BUFFER_SIZE;
+}
+
+void mzSetUseLibdeflate(bool use)
+{
+    gUseLibdeflate = use;
+}
+
 /*
  * Offset and length constants (java.util.zip naming convention).
  */
@@ -188,6 +218,7 @@ static bool parseZipArchive(ZipArchive* pArchive, const MemMapping* pMap)
 {
     bool result = false;
     const unsigned char* ptr;
+    const unsigned char* cdEnd;
     unsigned int i, numEntries, cdOffset;
     unsigned int val;
 
@@ -236,6 +267,25 @@ static bool parseZipArchive(ZipArchive* pArchive, const MemMapping* pMap)
         goto bail;
     }
 
+    /*
+     * With a hash tree, the EOCD must be the one the tree (and the
+     * signature on it) covers, and the central directory must match
+     * the tree before we believe anything in it.  Local headers and
+     * entry data are checked when they are read.
+     */
+    if (pArchive->pHashTree != NULL) {
+        BlockHashTree* pTree = pArchive->pHashTree;
+        if (ptr + ENDHDR - 2 !=
+                (const unsigned char*)pMap->addr + pTree->coveredLen) {
+            LOGW("EOCD isn't where the hash tree says\n");
+            goto bail;
+        }
+        if (!mzHashTreeCheckRange(pTree, pMap->addr, cdOffset,
+                pTree->coveredLen - cdOffset)) {
+            goto bail;
+        }
+    }
+
     /*
      * Create data structures to hold entries.
      */
@@ -245,6 +295,15 @@ static bool parseZipArchive(ZipArchive* pArchive, const MemMapping* pMap)
     if (pArchive->pEntries == NULL || pArchive->pHash == NULL)
         goto bail;
 
+    /*
+     * Only the covered part of the file has been checked against the
+     * hash tree; the central directory mustn't extend past it.
+     */
+    cdEnd = (const unsigned char*)pMap->addr + pMap->length;
+    if (pArchive->pHashTree != NULL)
+        cdEnd = (const unsigned char*)pMap->addr +
+            pArchive->pHashTree->coveredLen;
+
     ptr = pMap->addr + cdOffset;
     for (i = 0; i < numEntries; i++) {
         ZipEntry* pEntry;
@@ -252,7 +311,7 @@ static bool parseZipArchive(ZipArchive* pArchive, const MemMapping* pMap)
         const unsigned char* localHdr;
         const char *fileName;
 
-        if (ptr + CENHDR > (const unsigned char*)pMap->addr + pMap->length) {
+        if (ptr + CENHDR > cdEnd) {
             LOGW("Ran off the end (at %d)\n", i);
             goto bail;
         }
@@ -266,7 +325,7 @@ static bool parseZipArchive(ZipArchive* pArchive, const MemMapping* pMap)
         extraLen = get2LE(ptr + CENEXT);
         commentLen = get2LE(ptr + CENCOM);
         fileName = (const char*)ptr + CENHDR;
-        if (fileName + fileNameLen > (const char*)pMap->addr + pMap->length) {
+        if (fileName + fileNameLen > (const char*)cdEnd) {
             LOGW("Filename ran off the end (at %d)\n", i);
             goto bail;
         }
@@ -368,6 +427,7 @@ static bool parseZipArchive(ZipArchive* pArchive, const MemMapping* pMap)
             LOGW("Missed a local header sig (at %d)\n", i);
             goto bail;
         }
+        pEntry->localHdrOffset = localHdrOffset;
         pEntry->offset = localHdrOffset + LOCHDR
             + get2LE(localHdr + LOCNAM) + get2LE(localHdr + LOCEXT);
         if (!safe_add(NULL, pEntry->offset, pEntry->compLen)) {
@@ -430,47 +490,66 @@ bail:
 int mzOpenZipArchive(const char* fileName, ZipArchive* pArchive)
 {
     MemMapping map;
-    int err;
+    int fd;
 
     LOGV("Opening archive '%s' %p\n", fileName, pArchive);
 
-    map.addr = NULL;
     memset(pArchive, 0, sizeof(*pArchive));
+    pArchive->fd = -1;
 
-    pArchive->fd = open(fileName, O_RDONLY, 0);
-    if (pArchive->fd < 0) {
-        err = errno ? errno : -1;
+    fd = open(fileName, O_RDONLY, 0);
+    if (fd < 0) {
+        int err = errno ? errno : -1;
         LOGV("Unable to open '%s': %s\n", fileName, strerror(err));
-        goto bail;
+        return err;
     }
 
-    if (sysMapFileInShmem(pArchive->fd, &map) != 0) {
-        err = -1;
+    if (sysMapFileInShmem(fd, &map) != 0) {
         LOGW("Map of '%s' failed\n", fileName);
-        goto bail;
+        close(fd);
+        return -1;
     }
 
-    if (map.length < ENDHDR) {
+    return mzOpenZipArchiveMapped(fd, &map, pArchive);
+}
+
+/*
+ * Scan out the contents of an archive the caller has already opened
+ * and mapped, e.g. after checking its signature over the same mapping.
+ */
+int mzOpenZipArchiveMapped(int fd, const MemMapping* pMap,
+        ZipArchive* pArchive)
+{
+    return mzOpenZipArchiveWithHashTree(fd, pMap, NULL, pArchive);
+}
+
+int mzOpenZipArchiveWithHashTree(int fd, const MemMapping* pMap,
+        BlockHashTree* pTree, ZipArchive* pArchive)
+{
+    int err;
+
+    memset(pArchive, 0, sizeof(*pArchive));
+    pArchive->fd = fd;
+    sysCopyMap(&pArchive->map, pMap);
+    pArchive->pHashTree = pTree;
+
+    if (pMap->length < ENDHDR) {
         err = -1;
-        LOGV("File '%s' too small to be zip (%zd)\n", fileName, map.length);
+        LOGV("File too small to be zip (%zd)\n", pMap->length);
         goto bail;
     }
 
-    if (!parseZipArchive(pArchive, &map)) {
+    if (!parseZipArchive(pArchive, pMap)) {
         err = -1;
-        LOGV("Parsing '%s' failed\n", fileName);
+        LOGV("Parsing archive failed\n");
         goto bail;
     }
 
     err = 0;
-    sysCopyMap(&pArchive->map, &map);
-    map.addr = NULL;
 
 bail:
     if (err != 0)
         mzCloseZipArchive(pArchive);
-    if (map.addr != NULL)
-        sysReleaseShmem(&map);
     return err;
 }
 
@@ -491,10 +570,12 @@ void mzCloseZipArchive(ZipArchive* pArchive)
     free(pArchive->pEntries);
 
     mzHashTableFree(pArchive->pHash);
+    mzFreeHashTree(pArchive->pHashTree);
 
     pArchive->fd = -1;
     pArchive->pHash = NULL;
     pArchive->pEntries = NULL;
+    pArchive->pHashTree = NULL;
 }
 
 /*
@@ -522,6 +603,119 @@ bool mzIsZipEntrySymlink(const ZipEntry* pEntry)
     return false;
 }
 
+/*
+ * How big a buffer readArchive() needs: the stream buffer size, or
+ * with a hash tree, enough whole blocks to hold at least that much.
+ */
+static size_t readBufferSize(const ZipArchive *pArchive)
+{
+    size_t size = gStreamBufferSize;
+
+    if (pArchive->pHashTree != NULL) {
+        size_t blockSize = pArchive->pHashTree->blockSize;
+        size = (size + blockSize - 1) / blockSize * blockSize;
+    }
+    return size;
+}
+
+/*
+ * Read up to "count" bytes of the archive at "pos" into "buf", which
+ * is readBufferSize() bytes long.  Sets *pData to the first of them
+ * and returns how many there are, or -1 on error.
+ *
+ * With a hash tree, the whole blocks holding them are read instead,
+ * and checked against the tree before anything is returned.  It's
+ * the bytes pread() gave us that are hashed, not the mapping, so
+ * nothing can change between the check and their use.  Entry data is
+ * checked this way as it's read, so a bad block fails the read it's in
+ * without the rest of the entry having to be hashed first.
+ */
+static ssize_t readArchive(const ZipArchive *pArchive, off_t pos,
+    size_t count, unsigned char *buf, const unsigned char **pData)
+{
+    const BlockHashTree *pTree = pArchive->pHashTree;
+    size_t bufSize = readBufferSize(pArchive);
+    size_t start, end;
+    ssize_t n;
+
+    if (pTree == NULL) {
+        if (count > bufSize)
+            count = bufSize;
+        n = pread(pArchive->fd, buf, count, pos);
+        if (n < 0 || (size_t)n != count) {
+            LOGE("Can't read %zu bytes from zip file: %ld\n", count, (long)n);
+            return -1;
+        }
+        *pData = buf;
+        return n;
+    }
+
+    if ((size_t)pos >= pTree->coveredLen) {
+        LOGE("Offset %ld isn't covered by the hash tree\n", (long)pos);
+        return -1;
+    }
+    start = pos - pos % pTree->blockSize;
+    end = pos + count;
+    if (end > start + bufSize)
+        end = start + bufSize;
+    if (end % pTree->blockSize != 0)
+        end += pTree->blockSize - end % pTree->blockSize;
+    if (end > pTree->coveredLen)
+        end = pTree->coveredLen;
+    n = pread(pArchive->fd, buf, end - start, start);
+    if (n < 0 || (size_t)n != end - start) {
+        LOGE("Can't read %zu bytes from zip file: %ld\n",
+            end - start, (long)n);
+        return -1;
+    }
+    if (!mzHashTreeCheckData(pTree, start, buf, end - start))
+        return -1;
+    *pData = buf + (pos - start);
+    if (count > end - pos)
+        count = end - pos;
+    return count;
+}
+
+/*
+ * The entry's offset was worked out from its local header before the
+ * header had been checked; read it again through the hash tree and
+ * make sure it still agrees.
+ */
+static bool checkLocalHeader(const ZipArchive *pArchive,
+    const ZipEntry *pEntry)
+{
+    unsigned char localHdr[LOCHDR];
+    const unsigned char *data;
+    unsigned char *buf;
+    size_t got = 0;
+    bool result = false;
+
+    if (pArchive->pHashTree == NULL)
+        return true;
+    buf = (unsigned char *)malloc(readBufferSize(pArchive));
+    if (buf == NULL)
+        return false;
+    while (got < LOCHDR) {
+        ssize_t n = readArchive(pArchive, pEntry->localHdrOffset + got,
+                LOCHDR - got, buf, &data);
+        if (n < 0)
+            goto bail;
+        memcpy(localHdr + got, data, n);
+        got += n;
+    }
+    if (pEntry->offset != pEntry->localHdrOffset + LOCHDR +
+            get2LE(localHdr + LOCNAM) + get2LE(localHdr + LOCEXT)) {
+        LOGW("Local header of '%.*s' changed\n",
+            (int)pEntry->fileNameLen, pEntry->fileName);
+        goto bail;
+    }
+    result = true;
+
+bail:
+    free(buf);
+    return result;
+}
+
 /* Call processFunction on the uncompressed data of a STORED entry.
  */
 static bool processStoredEntry(const ZipArchive *pArchive,
@@ -529,28 +723,38 @@ static bool processStoredEntry(const ZipArchive *pArchive,
     void *cookie)
 {
     size_t bytesLeft = pEntry->compLen;
+    size_t bufSize = readBufferSize(pArchive);
+    unsigned char *buf;
+    bool result = false;
+
+    buf = (unsigned char *)malloc(bufSize);
+    if (buf == NULL) {
+        LOGE("Can't allocate %zu bytes for stored entry\n", bufSize);
+        return false;
+    }
+
     while (bytesLeft > 0) {
-        unsigned char buf[32 * 1024];
+        const unsigned char *data;
         ssize_t n;
-        size_t count;
+        off_t pos;
         bool ret;
 
-        count = bytesLeft;
-        if (count > sizeof(buf)) {
-            count = sizeof(buf);
-        }
-        n = read(pArchive->fd, buf, count);
-        if (n < 0 || (size_t)n != count) {
-            LOGE("Can't read %zu bytes from zip file: %ld\n", count, n);
-            return false;
+        pos = pEntry->offset + (pEntry->compLen - bytesLeft);
+        n = readArchive(pArchive, pos, bytesLeft, buf, &data);
+        if (n < 0) {
+            goto bail;
         }
-        ret = processFunction(buf, n, cookie);
+        ret = processFunction(data, n, cookie);
         if (!ret) {
-            return false;
+            goto bail;
         }
-        bytesLeft -= count;
+        bytesLeft -= n;
     }
-    return true;
+    result = true;
+
+bail:
+    free(buf);
+    return result;
 }
 
 static bool processDeflatedEntry(const ZipArchive *pArchive,
@@ -558,14 +762,26 @@ static bool processDeflatedEntry(const ZipArchive *pArchive,
     void *cookie)
 {
     long result = -1;
-    unsigned char readBuf[32 * 1024];
-    unsigned char procBuf[32 * 1024];
+    unsigned char *readBuf = NULL;
+    unsigned char *procBuf = NULL;
+    const long bufSize = gStreamBufferSize;
     z_stream zstream;
     int zerr;
     long compRemaining;
 
     compRemaining = pEntry->compLen;
 
+    /*
+     * Both buffers come from the heap so that the buffer size can be
+     * raised without blowing the stack.
+     */
+    readBuf = (unsigned char *)malloc(readBufferSize(pArchive));
+    procBuf = (unsigned char *)malloc(bufSize);
+    if (readBuf == NULL || procBuf == NULL) {
+        LOGE("Can't allocate %ld-byte inflate buffers\n", bufSize);
+        goto bail;
+    }
+
     /*
      * Initialize the zlib stream.
      */
@@ -576,7 +792,7 @@ static bool processDeflatedEntry(const ZipArchive *pArchive,
     zstream.next_in = NULL;
     zstream.avail_in = 0;
     zstream.next_out = (Bytef*) procBuf;
-    zstream.avail_out = sizeof(procBuf);
+    zstream.avail_out = bufSize;
     zstream.data_type = Z_UNKNOWN;
 
     /*
@@ -600,21 +816,23 @@ static bool processDeflatedEntry(const ZipArchive *pArchive,
     do {
         /* read as much as we can */
         if (zstream.avail_in == 0) {
-            long getSize = (compRemaining > (long)sizeof(readBuf)) ?
-                        (long)sizeof(readBuf) : compRemaining;
+            long getSize = (compRemaining > bufSize) ?
+                        bufSize : compRemaining;
             LOGVV("+++ reading %ld bytes (%ld left)\n",
                 getSize, compRemaining);
 
-            int cc = read(pArchive->fd, readBuf, getSize);
-            if (cc != (int) getSize) {
-                LOGW("inflate read failed (%d vs %ld)\n", cc, getSize);
+            off_t pos = pEntry->offset + (pEntry->compLen - compRemaining);
+            const unsigned char *data;
+            ssize_t cc = readArchive(pArchive, pos, getSize, readBuf, &data);
+            if (cc <= 0) {
+                LOGW("inflate read failed (%ld vs %ld)\n", (long)cc, getSize);
                 goto z_bail;
             }
 
-            compRemaining -= getSize;
+            compRemaining -= cc;
 
-            zstream.next_in = readBuf;
-            zstream.avail_in = getSize;
+            zstream.next_in = (Bytef*) data;
+            zstream.avail_in = cc;
         }
 
         /* uncompress the data */
@@ -626,7 +844,7 @@ static bool processDeflatedEntry(const ZipArchive *pArchive,
 
         /* write when we're full or when we're done */
         if (zstream.avail_out == 0 ||
-            (zerr == Z_STREAM_END && zstream.avail_out != sizeof(procBuf)))
+            (zerr == Z_STREAM_END && zstream.avail_out != (uInt)bufSize))
         {
             long procSize = zstream.next_out - procBuf;
             LOGVV("+++ processing %d bytes\n", (int) procSize);
@@ -637,7 +855,7 @@ static bool processDeflatedEntry(const ZipArchive *pArchive,
             }
 
             zstream.next_out = procBuf;
-            zstream.avail_out = sizeof(procBuf);
+            zstream.avail_out = bufSize;
         }
     } while (zerr == Z_OK);
 
@@ -650,6 +868,8 @@ z_bail:
     inflateEnd(&zstream);        /* free up any allocated structures */
 
 bail:
+    free(readBuf);
+    free(procBuf);
     if (result != pEntry->uncompLen) {
         if (result != -1)        // error already shown?
             LOGW("Size mismatch on inflated file (%ld vs %ld)\n",
@@ -674,14 +894,15 @@ bool mzProcessZipEntryContents(const ZipArchive *pArchive,
     void *cookie)
 {
     bool ret = false;
-    off_t oldOff;
-
-    /* save current offset */
-    oldOff = lseek(pArchive->fd, 0, SEEK_CUR);
 
-    /* Seek to the beginning of the entry's compressed data. */
-    lseek(pArchive->fd, pEntry->offset, SEEK_SET);
+    if (!checkLocalHeader(pArchive, pEntry))
+        return false;
 
+    /*
+     * The entry is read with pread(), so the file offset is left alone
+     * and several entries can be processed at once from different
+     * threads.
+     */
     switch (pEntry->compression) {
     case STORED:
         ret = processStoredEntry(pArchive, pEntry, processFunction, cookie);
@@ -695,15 +916,13 @@ bool mzProcessZipEntryContents(const ZipArchive *pArchive,
         break;
     }
 
-    /* restore file offset */
-    lseek(pArchive->fd, oldOff, SEEK_SET);
     return ret;
 }
 
 static bool crcProcessFunction(const unsigned char *data, int dataLen,
         void *crc)
 {
-    *(unsigned long *)crc = crc32(*(unsigned long *)crc, data, dataLen);
+    *(unsigned long *)crc = CRC32_update(*(unsigned long *)crc, data, dataLen);
     return true;
 }
 
@@ -716,7 +935,7 @@ bool mzIsZipEntryIntact(const ZipArchive *pArchive, const ZipEntry *pEntry)
     unsigned long crc;
     bool ret;
 
-    crc = crc32(0L, Z_NULL, 0);
+    crc = 0;
     ret = mzProcessZipEntryContents(pArchive, pEntry, crcProcessFunction,
             (void *)&crc);
     if (!ret) {
@@ -731,6 +950,164 @@ bool mzIsZipEntryIntact(const ZipArchive *pArchive, const ZipEntry *pEntry)
     return true;
 }
 
+/* Work shared by the mzCheckZipArchive() threads: the entries, largest
+ * first so the long ones don't all end up at the back of the queue.
+ */
+typedef struct {
+    const ZipArchive *pArchive;
+    const ZipEntry **entries;
+    unsigned int count;
+    unsigned int next;
+    int bad;
+    void (*callback)(const ZipEntry *pEntry, bool intact, void *cookie);
+    void *cookie;
+    pthread_mutex_t lock;
+} CheckWork;
+
+static void *checkWorker(void *cookie)
+{
+    CheckWork *work = (CheckWork *)cookie;
+
+    for (;;) {
+        pthread_mutex_lock(&work->lock);
+        unsigned int i = work->next++;
+        pthread_mutex_unlock(&work->lock);
+        if (i >= work->count) {
+            break;
+        }
+
+        bool intact = mzIsZipEntryIntact(work->pArchive, work->entries[i]);
+
+        pthread_mutex_lock(&work->lock);
+        if (!intact) {
+            work->bad++;
+        }
+        if (work->callback != NULL) {
+            work->callback(work->entries[i], intact, work->cookie);
+        }
+        pthread_mutex_unlock(&work->lock);
+    }
+    return NULL;
+}
+
+static int compareCompLenDescending(const void *a, const void *b)
+{
+    long lenA = (*(const ZipEntry **)a)->compLen;
+    long lenB = (*(const ZipEntry **)b)->compLen;
+    return lenA < lenB ? 1 : lenA > lenB ? -1 : 0;
+}
+
+int mzCheckZipArchive(const ZipArchive *pArchive, int numThreads,
+    void (*callback)(const ZipEntry *pEntry, bool intact, void *cookie),
+    void *cookie)
+{
+    CheckWork work;
+    unsigned int i;
+
+    memset(&work, 0, sizeof(work));
+    work.pArchive = pArchive;
+    work.callback = callback;
+    work.cookie = cookie;
+    work.count = pArchive->numEntries;
+    work.entries = (const ZipEntry **)malloc(
+            work.count * sizeof(const ZipEntry *));
+    if (work.entries == NULL) {
+        LOGE("Can't allocate %u-entry check list\n", work.count);
+        return -1;
+    }
+    for (i = 0; i < work.count; i++) {
+        work.entries[i] = &pArchive->pEntries[i];
+    }
+    qsort(work.entries, work.count, sizeof(const ZipEntry *),
+            compareCompLenDescending);
+    pthread_mutex_init(&work.lock, NULL);
+
+    if (numThreads <= 0) {
+        numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    /* No point starting more threads than there are entries.
+     */
+    if (numThreads > (int)work.count) {
+        numThreads = work.count;
+    }
+    int started = 0;
+    pthread_t *threads = NULL;
+    if (numThreads > 1) {
+        threads = (pthread_t *)calloc(numThreads, sizeof(pthread_t));
+    }
+    if (threads != NULL) {
+        for (; started < numThreads; ++started) {
+            if (pthread_create(&threads[started], NULL, checkWorker,
+                    &work) != 0) {
+                break;
+            }
+        }
+    }
+    /* With one thread, or if none could be started, do the work
+     * ourselves.
+     */
+    if (started == 0) {
+        checkWorker(&work);
+    }
+    int t;
+    for (t = 0; t < started; ++t) {
+        pthread_join(threads[t], NULL);
+    }
+    free(threads);
+
+    pthread_mutex_destroy(&work.lock);
+    free(work.entries);
+    return work.bad;
+}
+
+typedef struct {
+    SHA1_CTX sha;
+    unsigned long crc;
+} HashProcessArgs;
+
+static bool hashProcessFunction(const unsigned char *data, int dataLen,
+        void *cookie)
+{
+    HashProcessArgs *args = (HashProcessArgs *)cookie;
+    SHA1_update(&args->sha, data, dataLen);
+    args->crc = CRC32_update(args->crc, data, dataLen);
+    return true;
+}
+
+/*
+ * Compute the SHA-1 and CRC-32 of an entry's uncompressed contents.
+ * The data is hashed as it comes out of the inflater, so the memory
+ * used doesn't depend on the size of the entry.
+ */
+bool mzHashZipEntry(const ZipArchive *pArchive, const ZipEntry *pEntry,
+    uint8_t *sha1, unsigned long *crc)
+{
+    HashProcessArgs args;
+    bool ret;
+
+    SHA1_init(&args.sha);
+    args.crc = 0;
+    ret = mzProcessZipEntryContents(pArchive, pEntry, hashProcessFunction,
+            (void *)&args);
+    if (!ret) {
+        LOGE("Can't hash entry %.*s\n", pEntry->fileNameLen, pEntry->fileName);
+        return false;
+    }
+    if (args.crc != (unsigned long)pEntry->crc32) {
+        LOGW("CRC for entry %.*s (0x%08lx) != expected (0x%08lx)\n",
+                pEntry->fileNameLen, pEntry->fileName, args.crc,
+                pEntry->crc32);
+        return false;
+    }
+    if (sha1 != NULL) {
+        memcpy(sha1, SHA1_final(&args.sha), SHA1_DIGEST_SIZE);
+    }
+    if (crc != NULL) {
+        *crc = args.crc;
+    }
+    return true;
+}
+
 typedef struct {
     char *buf;
     int bufLen;
@@ -769,10 +1146,31 @@ bool mzReadZipEntry(const ZipArchive* pArchive, const ZipEntry* pEntry,
     return true;
 }
 
+/*
+ * Check the CRC of what was extracted against the central directory.
+ */
+static bool checkExtractedCrc(const ZipEntry *pEntry, unsigned long crc)
+{
+    if (crc != (unsigned long)pEntry->crc32) {
+        LOGW("CRC for entry %.*s (0x%08lx) != expected (0x%08lx)\n",
+                pEntry->fileNameLen, pEntry->fileName, crc, pEntry->crc32);
+        return false;
+    }
+    return true;
+}
+
+typedef struct {
+    int fd;
+    unsigned long crc;
+} WriteProcessArgs;
+
 static bool writeProcessFunction(const unsigned char *data, int dataLen,
                                  void *cookie)
 {
-    int fd = (int)cookie;
+    WriteProcessArgs *args = (WriteProcessArgs *)cookie;
+    int fd = args->fd;
+
+    args->crc = CRC32_update(args->crc, data, dataLen);
 
     ssize_t soFar = 0;
     while (true) {
@@ -796,13 +1194,20 @@ static bool writeProcessFunction(const unsigned char *data, int dataLen,
 }
 
 /*
- * Uncompress "pEntry" in "pArchive" to "fd" at the current offset.
+ * Uncompress "pEntry" in "pArchive" to "fd" at the current offset,
+ * checking its CRC on the way.
  */
 bool mzExtractZipEntryToFile(const ZipArchive *pArchive,
     const ZipEntry *pEntry, int fd)
 {
+    WriteProcessArgs args;
+    args.fd = fd;
+    args.crc = 0;
     bool ret = mzProcessZipEntryContents(pArchive, pEntry, writeProcessFunction,
-                                         (void*)fd);
+                                         (void*)&args);
+    if (ret) {
+        ret = checkExtractedCrc(pEntry, args.crc);
+    }
     if (!ret) {
         LOGE("Can't extract entry to file.\n");
         return false;
@@ -813,6 +1218,7 @@ bool mzExtractZipEntryToFile(const ZipArchive *pArchive,
 typedef struct {
     unsigned char* buffer;
     long len;
+    unsigned long crc;
 } BufferExtractCookie;
 
 static bool bufferProcessFunction(const unsigned char *data, int dataLen,
@@ -820,26 +1226,81 @@ static bool bufferProcessFunction(const unsigned char *data, int dataLen,
     BufferExtractCookie *bec = (BufferExtractCookie*)cookie;
 
     memmove(bec->buffer, data, dataLen);
+    bec->crc = CRC32_update(bec->crc, bec->buffer, dataLen);
     bec->buffer += dataLen;
     bec->len -= dataLen;
 
     return true;
 }
 
+#ifdef MINZIP_USE_LIBDEFLATE
+/*
+ * Inflate a DEFLATED entry straight from the mapped archive into
+ * "buffer" in one call.  libdeflate needs the whole output buffer up
+ * front, which mzExtractZipEntryToBuffer() callers already provide,
+ * and in exchange skips the streaming bookkeeping and the extra copy
+ * through procBuf.  Only for archives without a hash tree.
+ */
+static bool inflateEntryToBuffer(const ZipArchive *pArchive,
+    const ZipEntry *pEntry, unsigned char *buffer)
+{
+    struct libdeflate_decompressor *d;
+    enum libdeflate_result lerr;
+    size_t actual = 0;
+
+    d = libdeflate_alloc_decompressor();
+    if (d == NULL) {
+        LOGE("Can't allocate libdeflate decompressor\n");
+        return false;
+    }
+    lerr = libdeflate_deflate_decompress(d,
+            (const unsigned char *)pArchive->map.addr + pEntry->offset,
+            pEntry->compLen, buffer, pEntry->uncompLen, &actual);
+    libdeflate_free_decompressor(d);
+
+    if (lerr != LIBDEFLATE_SUCCESS) {
+        LOGD("libdeflate call failed (lerr=%d)\n", (int)lerr);
+        return false;
+    }
+    if ((long)actual != pEntry->uncompLen) {
+        LOGW("Size mismatch on inflated file (%ld vs %ld)\n",
+            (long)actual, pEntry->uncompLen);
+        return false;
+    }
+    return checkExtractedCrc(pEntry, CRC32_update(0, buffer, actual));
+}
+#endif
+
 /*
  * Uncompress "pEntry" in "pArchive" to buffer, which must be large
- * enough to hold mzGetZipEntryUncomplen(pEntry) bytes.
+ * enough to hold mzGetZipEntryUncomplen(pEntry) bytes, checking its
+ * CRC on the way.
  */
 bool mzExtractZipEntryToBuffer(const ZipArchive *pArchive,
     const ZipEntry *pEntry, unsigned char *buffer)
 {
+#ifdef MINZIP_USE_LIBDEFLATE
+    /* That reads straight from the mapping, so it's no use when each
+     * block has to be checked as it's read.
+     */
+    if (pEntry->compression == DEFLATED && pArchive->pHashTree == NULL &&
+            gUseLibdeflate) {
+        if (!inflateEntryToBuffer(pArchive, pEntry, buffer)) {
+            LOGE("Can't extract entry to memory buffer.\n");
+            return false;
+        }
+        return true;
+    }
+#endif
+
     BufferExtractCookie bec;
     bec.buffer = buffer;
     bec.len = mzGetZipEntryUncompLen(pEntry);
+    bec.crc = 0;
 
     bool ret = mzProcessZipEntryContents(pArchive, pEntry,
         bufferProcessFunction, (void*)&bec);
-    if (!ret || bec.len != 0) {
+    if (!ret || bec.len != 0 || !checkExtractedCrc(pEntry, bec.crc)) {
         LOGE("Can't extract entry to memory buffer.\n");
         return false;
     }
@@ -976,6 +1437,13 @@ bool mzExtractRecursive(const ZipArchive *pArchive,
     helper.buf = NULL;
     helper.bufLen = 0;
 
+    /* Most entries share their parent directories with the entry
+     * before them; remember which ones exist to avoid re-stat()ing
+     * every component of every path.  If the cache can't be
+     * allocated we just fall back to the uncached behavior.
+     */
+    DirCache *dirCache = dirCacheCreate();
+
     /* Walk through the entries and extract anything whose path begins
      * with zpath.
 //TODO: since the entries are sorted, binary search for the first match
@@ -1044,7 +1512,7 @@ bool mzExtractRecursive(const ZipArchive *pArchive,
 #define UNZIP_FILEMODE 0644
         if (pEntry->fileName[pEntry->fileNameLen-1] == '/') {
             if (!(flags & MZ_EXTRACT_FILES_ONLY)) {
-                int ret = dirCreateHierarchy(
+                int ret = dirCreateHierarchyCached(dirCache,
                         targetFile, UNZIP_DIRMODE, timestamp, false);
                 if (ret != 0) {
                     LOGE("Can't create containing directory for \"%s\": %s\n",
@@ -1058,7 +1526,7 @@ bool mzExtractRecursive(const ZipArchive *pArchive,
             /* This is not a directory.  First, make sure that
              * the containing directory exists.
              */
-            int ret = dirCreateHierarchy(
+            int ret = dirCreateHierarchyCached(dirCache,
                     targetFile, UNZIP_DIRMODE, timestamp, true);
             if (ret != 0) {
                 LOGE("Can't create containing directory for \"%s\": %s\n",
@@ -1142,6 +1610,7 @@ bool mzExtractRecursive(const ZipArchive *pArchive,
         if (callback != NULL) callback(targetFile, cookie);
     }
 
+    dirCacheFree(dirCache);
     free(helper.buf);
     free(zpath);
 
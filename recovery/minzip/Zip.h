@@ -8,10 +8,12 @@
 
 #include "inline_magic.h"
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <utime.h>
 
 #include "Hash.h"
+#include "HashTree.h"
 #include "SysUtil.h"
 
 /*
@@ -26,6 +28,7 @@ typedef struct ZipEntry {
     unsigned int fileNameLen;
     const char*  fileName;       // not null-terminated
     long         offset;
+    long         localHdrOffset;
     long         compLen;
     long         uncompLen;
     int          compression;
@@ -44,6 +47,7 @@ typedef struct ZipArchive {
     ZipEntry*   pEntries;
     HashTable*  pHash;          // maps file name to ZipEntry
     MemMapping  map;
+    BlockHashTree* pHashTree;   // if set, data is checked against it
 } ZipArchive;
 
 /*
@@ -63,6 +67,28 @@ typedef struct {
  */
 int mzOpenZipArchive(const char* fileName, ZipArchive* pArchive);
 
+/*
+ * Open a Zip archive from a file the caller has already opened and
+ * mapped with sysMapFileInShmem().  The archive takes ownership of
+ * "fd" and "pMap" whether or not it succeeds; both are released by
+ * mzCloseZipArchive() (or before returning, on failure).
+ *
+ * Returns 0 on success, nonzero on failure.
+ */
+int mzOpenZipArchiveMapped(int fd, const MemMapping* pMap,
+        ZipArchive* pArchive);
+
+/*
+ * Like mzOpenZipArchiveMapped(), for a package whose hash tree has been
+ * verified (see HashTree.h) instead of its whole-file signature.  The
+ * central directory is checked against the tree before it is parsed,
+ * and every byte of an entry is checked, a block at a time, as it is
+ * read; anything that doesn't match fails the open or the read.  The
+ * archive takes ownership of "pTree" too.
+ */
+int mzOpenZipArchiveWithHashTree(int fd, const MemMapping* pMap,
+        BlockHashTree* pTree, ZipArchive* pArchive);
+
 /*
  * Close archive, releasing resources associated with it.
  *
@@ -163,18 +189,56 @@ bool mzReadZipEntry(const ZipArchive* pArchive, const ZipEntry* pEntry,
 bool mzIsZipEntryIntact(const ZipArchive *pArchive, const ZipEntry *pEntry);
 
 /*
- * Inflate and write an entry to a file.
+ * Check the CRC of every entry in the archive, sharing the entries out
+ * among "numThreads" threads (0 means one per online CPU).  Entries are
+ * read with pread(), so they don't interfere with each other.
+ *
+ * If callback is non-NULL it is called once for each entry, saying
+ * whether it was intact; calls are never concurrent.
+ *
+ * Returns the number of entries that aren't intact, so 0 means the
+ * whole archive is good, or -1 if the check couldn't be run.
+ */
+int mzCheckZipArchive(const ZipArchive *pArchive, int numThreads,
+    void (*callback)(const ZipEntry *pEntry, bool intact, void *cookie),
+    void *cookie);
+
+/*
+ * Compute the SHA-1 digest and CRC-32 of an entry's uncompressed contents
+ * in a single streaming pass, without extracting the entry to memory or
+ * to a file.  Either "sha1" (SHA1_DIGEST_SIZE bytes) or "crc" may be NULL
+ * if the caller isn't interested in it.
+ *
+ * Returns false if the entry can't be read or inflated, or if the CRC of
+ * the uncompressed data doesn't match the one in the central directory.
+ */
+bool mzHashZipEntry(const ZipArchive *pArchive, const ZipEntry *pEntry,
+    uint8_t *sha1, unsigned long *crc);
+
+/*
+ * Inflate and write an entry to a file.  Fails if the CRC of what was
+ * written doesn't match the central directory.
  */
 bool mzExtractZipEntryToFile(const ZipArchive *pArchive,
     const ZipEntry *pEntry, int fd);
 
 /*
  * Inflate and write an entry to a memory buffer, which must be long
- * enough to hold mzGetZipEntryUncomplen(pEntry) bytes.
+ * enough to hold mzGetZipEntryUncomplen(pEntry) bytes.  Fails if the
+ * CRC of the result doesn't match the central directory.
  */
 bool mzExtractZipEntryToBuffer(const ZipArchive *pArchive,
     const ZipEntry *pEntry, unsigned char* buffer);
 
+/*
+ * For benchmarks: stream entries through "size"-byte buffers instead
+ * of MINZIP_STREAM_BUFFER_SIZE (0 goes back to that), and say whether
+ * mzExtractZipEntryToBuffer() may inflate with libdeflate, in builds
+ * that have it.  Neither may be changed while entries are being read.
+ */
+void mzSetStreamBufferSize(size_t size);
+void mzSetUseLibdeflate(bool use);
+
 /*
  * Inflate all entries under zipDir to the directory specified by
  * targetDir, which must exist and be a writable directory.
@@ -0,0 +1,283 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Throughput of mzExtractZipEntryToBuffer() for each stream buffer
+// size, with zlib (zlib-ng, if libminzip is built with it) inflating
+// through the buffers, and with libdeflate inflating each entry in
+// one call when libminzip is built with that.  Every entry of each
+// archive named on the command line (the recovery/testdata ones, say)
+// is extracted, and so is a synthetic archive holding one large entry
+// that compresses about as well as a system image.  Each extraction's
+// CRC is checked by mzExtractZipEntryToBuffer() itself.
+//
+//   usage: minzip_bench [-m megabytes] [archive.zip...]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "zlib.h"
+
+#include "Zip.h"
+
+static const size_t kBufferSizes[] = {
+    16 * 1024, 32 * 1024, 64 * 1024, 128 * 1024, 256 * 1024, 1024 * 1024,
+};
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void put2(unsigned char* p, unsigned int v) {
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void put4(unsigned char* p, unsigned int v) {
+    put2(p, v);
+    put2(p + 2, v >> 16);
+}
+
+// Words from a small vocabulary with the odd run of random bytes:
+// a bit over 2:1 under deflate, like the code and data in a system image.
+static void fill_synthetic(unsigned char* data, size_t len) {
+    static const char* const words[] = {
+        "the", "android", "recovery", "partition", "system", "update",
+        "package", "0x7f", "return", "static", "int", "const", "char",
+        "{", "}", "(", ");", "if", "else", "for", "NULL", "size_t",
+    };
+    unsigned int x = 0x2468ace1;
+    size_t pos = 0;
+    while (pos < len) {
+        x = x * 1103515245 + 12345;
+        if ((x >> 24) < 16) {
+            size_t n = (x >> 16) % 64;
+            while (n-- > 0 && pos < len) {
+                x = x * 1103515245 + 12345;
+                data[pos++] = x >> 16;
+            }
+        } else {
+            const char* w = words[(x >> 16) % (sizeof(words) / sizeof(words[0]))];
+            while (*w && pos < len) data[pos++] = *w++;
+            if (pos < len) data[pos++] = (x & 0x100) ? ' ' : '\n';
+        }
+    }
+}
+
+// Write a zip file holding "data" as a single DEFLATED entry.
+static int write_synthetic_zip(const char* path, const unsigned char* data,
+                               size_t len) {
+    static const char name[] = "system.img";
+    const size_t name_len = sizeof(name) - 1;
+    uLong bound = compressBound(len) + 64;
+    unsigned char* comp = malloc(bound);
+    if (comp == NULL) return -1;
+
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    if (deflateInit2(&z, 6, Z_DEFLATED, -MAX_WBITS, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+        free(comp);
+        return -1;
+    }
+    z.next_in = (Bytef*) data;
+    z.avail_in = len;
+    z.next_out = comp;
+    z.avail_out = bound;
+    if (deflate(&z, Z_FINISH) != Z_STREAM_END) {
+        deflateEnd(&z);
+        free(comp);
+        return -1;
+    }
+    size_t comp_len = z.total_out;
+    deflateEnd(&z);
+    unsigned int crc = crc32(0, data, len);
+
+    unsigned char local[30], central[46], eocd[22];
+    memset(local, 0, sizeof(local));
+    put4(local, 0x04034b50);
+    put2(local + 4, 20);
+    put2(local + 8, 8);
+    put4(local + 14, crc);
+    put4(local + 18, comp_len);
+    put4(local + 22, len);
+    put2(local + 26, name_len);
+
+    memset(central, 0, sizeof(central));
+    put4(central, 0x02014b50);
+    put2(central + 4, 20);
+    put2(central + 6, 20);
+    put2(central + 10, 8);
+    put4(central + 16, crc);
+    put4(central + 20, comp_len);
+    put4(central + 24, len);
+    put2(central + 28, name_len);
+
+    size_t cd_offset = sizeof(local) + name_len + comp_len;
+    memset(eocd, 0, sizeof(eocd));
+    put4(eocd, 0x06054b50);
+    put2(eocd + 8, 1);
+    put2(eocd + 10, 1);
+    put4(eocd + 12, sizeof(central) + name_len);
+    put4(eocd + 16, cd_offset);
+
+    FILE* f = fopen(path, "wb");
+    int ok = f != NULL &&
+             fwrite(local, sizeof(local), 1, f) == 1 &&
+             fwrite(name, name_len, 1, f) == 1 &&
+             fwrite(comp, comp_len, 1, f) == 1 &&
+             fwrite(central, sizeof(central), 1, f) == 1 &&
+             fwrite(name, name_len, 1, f) == 1 &&
+             fwrite(eocd, sizeof(eocd), 1, f) == 1;
+    if (f != NULL && fclose(f) != 0) ok = 0;
+    free(comp);
+    printf("synthetic entry: %zu bytes, %zu compressed\n", len, comp_len);
+    return ok ? 0 : -1;
+}
+
+// Extract every entry until at least min_secs have gone by, three
+// times over; returns the best rate in MB/s, or a negative number if
+// an extraction failed.
+static double time_extract(const ZipArchive* zip, unsigned char* buffer,
+                           double min_secs) {
+    unsigned int n = mzZipEntryCount(zip);
+    double best = 0;
+    int run;
+    for (run = 0; run < 3; ++run) {
+        double bytes = 0;
+        double start = now(), elapsed;
+        do {
+            unsigned int i;
+            for (i = 0; i < n; ++i) {
+                const ZipEntry* entry = mzGetZipEntryAt(zip, i);
+                if (!mzExtractZipEntryToBuffer(zip, entry, buffer)) return -1;
+                bytes += mzGetZipEntryUncompLen(entry);
+            }
+            elapsed = now() - start;
+        } while (elapsed < min_secs);
+        double rate = bytes / elapsed / (1024 * 1024);
+        if (rate > best) best = rate;
+    }
+    return best;
+}
+
+static void report(const char* name, const char* backend, size_t buf_size,
+                   double rate) {
+    char size[24];
+    if (buf_size > 0) {
+        snprintf(size, sizeof(size), "%zu KB", buf_size / 1024);
+    } else {
+        snprintf(size, sizeof(size), "whole");
+    }
+    if (rate < 0) {
+        printf("%-28s %-10s %8s      FAILED\n", name, backend, size);
+    } else {
+        printf("%-28s %-10s %8s  %6.1f MB/s\n", name, backend, size, rate);
+    }
+}
+
+static int bench_archive(const char* path, const char* name,
+                         double min_secs) {
+    ZipArchive zip;
+    if (mzOpenZipArchive(path, &zip) != 0) {
+        fprintf(stderr, "can't open %s\n", path);
+        return -1;
+    }
+    long biggest = 0;
+    unsigned int i;
+    for (i = 0; i < mzZipEntryCount(&zip); ++i) {
+        long len = mzGetZipEntryUncompLen(mzGetZipEntryAt(&zip, i));
+        if (len > biggest) biggest = len;
+    }
+    unsigned char* buffer = malloc(biggest > 0 ? biggest : 1);
+    if (buffer == NULL) {
+        mzCloseZipArchive(&zip);
+        return -1;
+    }
+
+    int result = 0;
+    size_t b;
+    mzSetUseLibdeflate(false);
+    for (b = 0; b < sizeof(kBufferSizes) / sizeof(kBufferSizes[0]); ++b) {
+        mzSetStreamBufferSize(kBufferSizes[b]);
+        double rate = time_extract(&zip, buffer, min_secs);
+        if (rate < 0) result = -1;
+        report(name, "zlib", kBufferSizes[b], rate);
+    }
+    mzSetStreamBufferSize(0);
+    mzSetUseLibdeflate(true);
+#ifdef MINZIP_USE_LIBDEFLATE
+    double rate = time_extract(&zip, buffer, min_secs);
+    if (rate < 0) result = -1;
+    report(name, "libdeflate", 0, rate);
+#endif
+
+    free(buffer);
+    mzCloseZipArchive(&zip);
+    return result;
+}
+
+static int usage(void) {
+    fprintf(stderr, "usage: minzip_bench [-m megabytes] [archive.zip...]\n");
+    return 2;
+}
+
+int main(int argc, char** argv) {
+    unsigned int megabytes = 64;
+    int c;
+
+    while ((c = getopt(argc, argv, "m:")) != -1) {
+        switch (c) {
+            case 'm': megabytes = atoi(optarg); break;
+            default: return usage();
+        }
+    }
+    if (megabytes == 0) return usage();
+
+    int failed = 0;
+    for (; optind < argc; ++optind) {
+        const char* base = strrchr(argv[optind], '/');
+        base = base ? base + 1 : argv[optind];
+        if (bench_archive(argv[optind], base, 0.25) != 0) failed = 1;
+    }
+
+    size_t len = (size_t) megabytes * 1024 * 1024;
+    unsigned char* data = malloc(len);
+    if (data == NULL) return 1;
+    fill_synthetic(data, len);
+    char path[] = "/tmp/minzip_bench.XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("mkstemp");
+        return 1;
+    }
+    close(fd);
+    if (write_synthetic_zip(path, data, len) != 0) {
+        fprintf(stderr, "can't write %s\n", path);
+        failed = 1;
+    } else if (bench_archive(path, "synthetic", 1.0) != 0) {
+        failed = 1;
+    }
+    unlink(path);
+    free(data);
+
+    if (failed) printf("\nFAILED\n");
+    return failed;
+}
@@ -1,18 +1,67 @@
 LOCAL_PATH := $(call my-dir)
 include $(CLEAR_VARS)
 
-LOCAL_SRC_FILES := \
+mtdutils_src_files := \
 	mtdutils.c \
 	mounts.c
 
+LOCAL_SRC_FILES := $(mtdutils_src_files)
+
+LOCAL_C_INCLUDES += bootable/recovery
+
+# file_copy_from_partition() can gzip its output; zlib-ng in compat
+# mode stands in for zlib as it does for libminzip.
+ifeq ($(TARGET_MINZIP_USE_ZLIB_NG),true)
+LOCAL_C_INCLUDES += external/zlib-ng
+else
+LOCAL_C_INCLUDES += external/zlib
+endif
+
+# The verify policy every MtdWriteContext starts with: full (the
+# default), sampled, hash or none.
+ifeq ($(TARGET_MTD_WRITE_VERIFY),sampled)
+LOCAL_CFLAGS += -DMTD_WRITE_VERIFY_DEFAULT=MTD_VERIFY_SAMPLED
+else ifeq ($(TARGET_MTD_WRITE_VERIFY),hash)
+LOCAL_CFLAGS += -DMTD_WRITE_VERIFY_DEFAULT=MTD_VERIFY_HASH
+else ifeq ($(TARGET_MTD_WRITE_VERIFY),none)
+LOCAL_CFLAGS += -DMTD_WRITE_VERIFY_DEFAULT=MTD_VERIFY_NONE
+endif
+
+# Have mtd_erase_blocks() leave already-erased blocks alone by default.
+ifeq ($(TARGET_MTD_SKIP_ERASED),true)
+LOCAL_CFLAGS += -DMTD_SKIP_ERASED_DEFAULT=1
+endif
+
 LOCAL_MODULE := libmtdutils
 
 include $(BUILD_STATIC_LIBRARY)
 
+# For mtd_bench, which runs mtdutils against the NAND simulator
+# (mtdsim.h) on the build host.  Only this build has the simulator.
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := $(mtdutils_src_files) mtdsim.c
+
+LOCAL_CFLAGS += -DMTD_SIMULATOR
+
+LOCAL_C_INCLUDES += bootable/recovery external/zlib
+
+LOCAL_MODULE := libmtdutils
+
+include $(BUILD_HOST_STATIC_LIBRARY)
+
+include $(CLEAR_VARS)
+LOCAL_SRC_FILES := mtd_bench.c
+LOCAL_MODULE := mtd_bench
+LOCAL_MODULE_TAGS := tests
+LOCAL_STATIC_LIBRARIES := libmtdutils librecovery_crypto libz
+LOCAL_LDLIBS += -lpthread -lrt
+include $(BUILD_HOST_EXECUTABLE)
+
 include $(CLEAR_VARS)
 LOCAL_SRC_FILES := flash_image.c
 LOCAL_MODULE := flash_image
 LOCAL_MODULE_TAGS := eng
-LOCAL_STATIC_LIBRARIES := libmtdutils
-LOCAL_SHARED_LIBRARIES := libcutils libc
+LOCAL_STATIC_LIBRARIES := libmtdutils librecovery_crypto
+LOCAL_SHARED_LIBRARIES := libz libcutils libc
 include $(BUILD_EXECUTABLE)
@@ -20,13 +20,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/stat.h>
 
 #include "cutils/log.h"
 #include "mtdutils.h"
 
 #define LOG_TAG "flash_image"
 
-#define HEADER_SIZE 2048  // size of header to compare for equality
+#define HEADER_SIZE 2048  // size of header written last (MTD) or compared (eMMC)
 
 void die(const char *msg, ...) {
     int err = errno;
@@ -46,108 +47,185 @@ void die(const char *msg, ...) {
     exit(1);
 }
 
-/* Read an image file and write it to a flash partition. */
-
-int main(int argc, char **argv) {
-    const MtdPartition *ptn;
-    MtdWriteContext *write;
-    void *data;
-    unsigned sz;
+/* Read up to len bytes, stopping early only at end of file. */
+static ssize_t read_fully(int fd, char *buf, size_t len) {
+    size_t got = 0;
+    while (got < len) {
+        ssize_t n = read(fd, buf + got, len - got);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+        if (n == 0) break;
+        got += n;
+    }
+    return got;
+}
 
-    if (argc != 4) {
-        fprintf(stderr, "usage: %s type [partition|device] [image_file_path]\n", argv[0]);
-        return 2;
+/* Compares the partition, as mtd_read_partition_async() delivers it,
+ * with the image a block at a time; the image's last block is zero
+ * padded, the way mtd_write_close() pads it on flash.
+ */
+typedef struct {
+    int fd;
+    size_t block_size;
+    char *block;
+    char *pending;      // flash data not yet compared
+    size_t pending_len;
+    int differs;
+} ImageCompare;
+
+static int compare_block(ImageCompare *cmp, const char *flash) {
+    ssize_t len = read_fully(cmp->fd, cmp->block, cmp->block_size);
+    if (len < 0) die("error reading image");
+    memset(cmp->block + len, 0, cmp->block_size - len);
+    if (memcmp(cmp->block, flash, cmp->block_size) != 0) {
+        cmp->differs = 1;
+        return 1;
     }
+    return 0;
+}
 
-	if (0 == strcmp("MTD", argv[1])) {
-        if (mtd_scan_partitions() <= 0) die("error scanning partitions");
-        const MtdPartition *partition = mtd_find_partition_by_name(argv[1]);
-        if (partition == NULL) die("can't find %s partition", argv[1]);
-
-        // If the first part of the file matches the partition, skip writing
-
-        int fd = open(argv[2], O_RDONLY);
-        if (fd < 0) die("error opening %s", argv[2]);
-
-        char header[HEADER_SIZE];
-        int headerlen = read(fd, header, sizeof(header));
-        if (headerlen <= 0) die("error reading %s header", argv[2]);
-
-        MtdReadContext *in = mtd_read_partition(partition);
-        if (in == NULL) {
-            LOGW("error opening %s: %s\n", argv[1], strerror(errno));
-            // just assume it needs re-writing
-        } else {
-            char check[HEADER_SIZE];
-            int checklen = mtd_read_data(in, check, sizeof(check));
-            if (checklen <= 0) {
-                LOGW("error reading %s: %s\n", argv[1], strerror(errno));
-                // just assume it needs re-writing
-            } else if (checklen == headerlen && !memcmp(header, check, headerlen)) {
-                LOGI("header is the same, not flashing %s\n", argv[1]);
-                return 0;
-            }
-            mtd_read_close(in);
+static int compare_flash(const char *data, size_t len, void *cookie) {
+    ImageCompare *cmp = (ImageCompare *) cookie;
+    while (len > 0) {
+        if (cmp->pending_len == 0 && len >= cmp->block_size) {
+            if (compare_block(cmp, data)) return 1;
+            data += cmp->block_size;
+            len -= cmp->block_size;
+            continue;
         }
-
-        // Skip the header (we'll come back to it), write everything else
-        LOGI("flashing %s from %s\n", argv[1], argv[2]);
-
-        MtdWriteContext *out = mtd_write_partition(partition);
-        if (out == NULL) die("error writing %s", argv[1]);
-
-        char buf[HEADER_SIZE];
-        memset(buf, 0, headerlen);
-        int wrote = mtd_write_data(out, buf, headerlen);
-        if (wrote != headerlen) die("error writing %s", argv[1]);
-
-        int len;
-        while ((len = read(fd, buf, sizeof(buf))) > 0) {
-            wrote = mtd_write_data(out, buf, len);
-            if (wrote != len) die("error writing %s", argv[1]);
+        size_t copy = cmp->block_size - cmp->pending_len;
+        if (copy > len) copy = len;
+        memcpy(cmp->pending + cmp->pending_len, data, copy);
+        cmp->pending_len += copy;
+        data += copy;
+        len -= copy;
+        if (cmp->pending_len == cmp->block_size) {
+            cmp->pending_len = 0;
+            if (compare_block(cmp, cmp->pending)) return 1;
         }
-        if (len < 0) die("error reading %s", argv[2]);
+    }
+    return 0;
+}
 
-        if (mtd_write_close(out)) die("error closing %s", argv[1]);
+/* Names for the -v flag; the default is whatever libmtdutils was
+ * built with.
+ */
+static int parse_policy(const char *name, MtdVerifyPolicy *policy) {
+    if (strcmp(name, "full") == 0) *policy = MTD_VERIFY_FULL;
+    else if (strcmp(name, "sampled") == 0) *policy = MTD_VERIFY_SAMPLED;
+    else if (strcmp(name, "hash") == 0) *policy = MTD_VERIFY_HASH;
+    else if (strcmp(name, "none") == 0) *policy = MTD_VERIFY_NONE;
+    else return -1;
+    return 0;
+}
 
-        // Now come back and write the header last
+/* Write out any partial block, log what the pass did, and close. */
+static void finish(const char *name, const char *pass, MtdWriteContext *out) {
+    if (mtd_erase_blocks(out, 0) == (off_t) -1) die("error writing %s", name);
+    const MtdWriteStats *st = mtd_write_stats(out);
+    LOGI("%s: %s: %u blocks written, %u unchanged, %u bad skipped\n",
+         name, pass, st->blocks_written, st->blocks_unchanged,
+         st->bad_blocks_skipped);
+    if (mtd_write_close(out)) die("error closing %s", name);
+}
 
-        out = mtd_write_partition(partition);
-        if (out == NULL) die("error re-opening %s", argv[1]);
+/* Read an image file and write it to a flash partition.
+ *
+ * For MTD, the image is first compared with the partition, and nothing
+ * is written if they match.  Otherwise the first block goes down with
+ * its header zeroed, then the rest of the image, then the first block
+ * again with the real header, so an interrupted flash never leaves a
+ * valid header on a partial image.  Blocks that already hold the right
+ * data are left alone.  "-v policy" picks how MTD writes are read
+ * back (full, sampled, hash or none).
+ */
+
+int main(int argc, char **argv) {
+    MtdVerifyPolicy policy = MTD_VERIFY_FULL;
+    int set_policy = 0;
+    int c;
+    while ((c = getopt(argc, argv, "v:")) == 'v' &&
+           parse_policy(optarg, &policy) == 0) {
+        set_policy = 1;
+    }
+    if (c != -1 || argc - optind != 3) {
+        fprintf(stderr, "usage: %s [-v full|sampled|hash|none] type [partition|device] [image_file_path]\n", argv[0]);
+        return 2;
+    }
+    // Leave the positional arguments at argv[1..3].
+    argv += optind - 1;
 
-        wrote = mtd_write_data(out, header, headerlen);
-        if (wrote != headerlen) die("error re-writing %s", argv[1]);
+	if (0 == strcmp("MTD", argv[1])) {
+        const char *name = argv[2];
+        const char *image = argv[3];
+        if (mtd_scan_partitions() <= 0) die("error scanning partitions");
+        const MtdPartition *partition = mtd_find_partition_by_name(name);
+        if (partition == NULL) die("can't find %s partition", name);
 
-        // Need to write a complete block, so write the rest of the first block
         size_t block_size;
         if (mtd_partition_info(partition, NULL, &block_size, NULL))
-            die("error getting %s block size", argv[1]);
+            die("error getting %s block size", name);
+
+        int fd = open(image, O_RDONLY);
+        if (fd < 0) die("error opening %s", image);
+        struct stat st;
+        if (fstat(fd, &st) != 0) die("error reading %s", image);
+        size_t image_blocks = (st.st_size + block_size - 1) / block_size;
+
+        char *buf = malloc(block_size);
+        char *pending = malloc(block_size);
+        if (buf == NULL || pending == NULL) die("out of memory");
+
+        ImageCompare cmp = { fd, block_size, buf, pending, 0, 0 };
+        if (image_blocks > 0 &&
+            mtd_read_partition_async(partition, 0, image_blocks * block_size,
+                                     8, compare_flash, &cmp) < 0) {
+            LOGW("error reading %s: %s\n", name, strerror(errno));
+            cmp.differs = 1;    // just assume it needs re-writing
+        }
+        if (!cmp.differs) {
+            LOGI("image is the same, not flashing %s\n", name);
+            return 0;
+        }
 
-        if (lseek(fd, headerlen, SEEK_SET) != headerlen)
-            die("error rewinding %s", argv[2]);
+        // Write everything, with the header zeroed (we'll come back
+        // to it).
+        LOGI("flashing %s from %s\n", name, image);
+        if (lseek(fd, 0, SEEK_SET) != 0) die("error rewinding %s", image);
 
-        int left = block_size - headerlen;
-        while (left < 0) left += block_size;
-        while (left > 0) {
-            len = read(fd, buf, left > (int)sizeof(buf) ? (int)sizeof(buf) : left);
-            if (len == 0) break;
-            if (len < 0) die("error reading %s", argv[2]);
+        MtdWriteContext *out = mtd_write_partition(partition);
+        if (out == NULL) die("error writing %s", name);
+        mtd_write_set_skip_identical(out, 1);
+        if (set_policy) mtd_write_set_verify(out, policy, 0);
+
+        ssize_t len = read_fully(fd, buf, block_size);
+        if (len < 0) die("error reading %s", image);
+        size_t headerlen = len < HEADER_SIZE ? len : HEADER_SIZE;
+        memset(buf, 0, headerlen);
+        do {
             if (mtd_write_data(out, buf, len) != len)
-                die("error writing %s", argv[1]);
-            left -= len;
-        }
+                die("error writing %s", name);
+        } while ((len = read_fully(fd, buf, block_size)) > 0);
+        if (len < 0) die("error reading %s", image);
 
-        // If there is more to write, input data was less than block_size, so pad
-        // with nulls.
-        memset(buf, 0, sizeof(buf));
-        while (left > 0) {
-            int pad_len = left > (int)sizeof(buf) ? (int)sizeof(buf) : left;
-            if (mtd_write_data(out, buf, pad_len) != pad_len)
-                die("error writing %s", argv[1]);
-            left -= pad_len;
-        }
+        finish(name, "image", out);
 
-        if (mtd_write_close(out)) die("error closing %s", argv[1]);
+        // Now come back and write the header last, zero padded to a
+        // complete block.
+        if (lseek(fd, 0, SEEK_SET) != 0) die("error rewinding %s", image);
+        len = read_fully(fd, buf, block_size);
+        if (len < 0) die("error reading %s", image);
+
+        out = mtd_write_partition(partition);
+        if (out == NULL) die("error re-opening %s", name);
+        if (set_policy) mtd_write_set_verify(out, policy, 0);
+        if (mtd_write_data(out, buf, len) != len)
+            die("error re-writing %s", name);
+        finish(name, "header", out);
+
+        free(pending);
+        free(buf);
+        close(fd);
         return 0;
 	} else if (0 == strcmp("EMMC", argv[1]) || 0 == strcmp("INAND",argv[1])) {
 
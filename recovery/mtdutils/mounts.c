@@ -19,6 +19,8 @@
 #include <string.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <poll.h>
+#include <unistd.h>
 #include <sys/mount.h>
 
 #include "mounts.h"
@@ -34,12 +36,32 @@ typedef struct {
     MountedVolume *volumes;
     int volumes_allocd;
     int volume_count;
+
+    /* Open-addressed tables of indices into volumes (-1 for empty),
+     * hash_size entries each, for lookups by mount point and device.
+     */
+    int *by_mount_point;
+    int *by_device;
+    int hash_size;
+
+    /* Kept open so poll() can tell us when the table has changed. */
+    int fd;
+    int valid;
+    char *buf;
+    size_t buf_allocd;
 } MountsState;
 
 static MountsState g_mounts_state = {
     NULL,   // volumes
     0,      // volumes_allocd
-    0       // volume_count
+    0,      // volume_count
+    NULL,   // by_mount_point
+    NULL,   // by_device
+    0,      // hash_size
+    -1,     // fd
+    0,      // valid
+    NULL,   // buf
+    0       // buf_allocd
 };
 
 static inline void
@@ -54,48 +76,154 @@ free_volume_internals(const MountedVolume *volume, int zero)
     }
 }
 
+/* The kernel flags /proc/self/mounts with POLLERR | POLLPRI after any
+ * mount or unmount in our namespace; /proc/mounts is the fallback for
+ * kernels without it, and is re-read every time.
+ */
+#define PROC_SELF_MOUNTS_FILENAME   "/proc/self/mounts"
 #define PROC_MOUNTS_FILENAME   "/proc/mounts"
 
-int
-scan_mounted_volumes()
+static unsigned int
+hash_string(const char *str)
 {
-    char buf[2048];
-    const char *bufp;
-    int fd;
-    ssize_t nbytes;
+    unsigned int h = 2166136261u;   // FNV-1a
+    while (*str != '\0') {
+        h = (h ^ (unsigned char) *str++) * 16777619u;
+    }
+    return h;
+}
 
-    if (g_mounts_state.volumes == NULL) {
-        const int numv = 32;
-        MountedVolume *volumes = malloc(numv * sizeof(*volumes));
-        if (volumes == NULL) {
-            errno = ENOMEM;
+/* Index the volumes just scanned.  Where several entries share a
+ * mount point or device, lookups find the first, as a linear search
+ * of the table would.
+ */
+static int
+build_hash_tables(MountsState *state)
+{
+    int size = 16;
+    int i;
+    while (size < state->volume_count * 2) size *= 2;
+    if (size != state->hash_size) {
+        int *mp = realloc(state->by_mount_point, size * sizeof(int));
+        if (mp != NULL) state->by_mount_point = mp;
+        int *dev = realloc(state->by_device, size * sizeof(int));
+        if (dev != NULL) state->by_device = dev;
+        if (mp == NULL || dev == NULL) {
+            state->hash_size = 0;
             return -1;
         }
-        g_mounts_state.volumes = volumes;
-        g_mounts_state.volumes_allocd = numv;
-        memset(volumes, 0, numv * sizeof(*volumes));
-    } else {
-        /* Free the old volume strings.
-         */
-        int i;
-        for (i = 0; i < g_mounts_state.volume_count; i++) {
-            free_volume_internals(&g_mounts_state.volumes[i], 1);
+        state->hash_size = size;
+    }
+    memset(state->by_mount_point, 0xff, size * sizeof(int));
+    memset(state->by_device, 0xff, size * sizeof(int));
+
+    for (i = 0; i < state->volume_count; i++) {
+        const MountedVolume *v = &state->volumes[i];
+        unsigned int h = hash_string(v->mount_point) & (size - 1);
+        while (state->by_mount_point[h] >= 0 &&
+               strcmp(state->volumes[state->by_mount_point[h]].mount_point,
+                      v->mount_point) != 0) {
+            h = (h + 1) & (size - 1);
+        }
+        if (state->by_mount_point[h] < 0) state->by_mount_point[h] = i;
+
+        h = hash_string(v->device) & (size - 1);
+        while (state->by_device[h] >= 0 &&
+               strcmp(state->volumes[state->by_device[h]].device,
+                      v->device) != 0) {
+            h = (h + 1) & (size - 1);
         }
+        if (state->by_device[h] < 0) state->by_device[h] = i;
     }
-    g_mounts_state.volume_count = 0;
+    return 0;
+}
 
-    /* Open and read the file contents.
-     */
-    fd = open(PROC_MOUNTS_FILENAME, O_RDONLY);
+/* Whether the table may have changed since it was last read.
+ */
+static int
+mounts_changed(MountsState *state)
+{
+    if (!state->valid || state->fd < 0) return 1;
+
+    struct pollfd pfd;
+    pfd.fd = state->fd;
+    pfd.events = POLLPRI;
+    pfd.revents = 0;
+    if (poll(&pfd, 1, 0) < 0) return 1;
+    return (pfd.revents & (POLLERR | POLLPRI)) != 0;
+}
+
+/* Read the whole of the mounts file, however big, into state->buf.
+ */
+static ssize_t
+read_mounts_file(MountsState *state)
+{
+    int fd = state->fd;
     if (fd < 0) {
-        goto bail;
+        fd = open(PROC_MOUNTS_FILENAME, O_RDONLY);
+        if (fd < 0) return -1;
+    } else if (lseek(fd, 0, SEEK_SET) != 0) {
+        return -1;
     }
-    nbytes = read(fd, buf, sizeof(buf) - 1);
-    close(fd);
+
+    size_t len = 0;
+    for (;;) {
+        if (state->buf_allocd - len < 1024) {
+            size_t allocd = state->buf_allocd ? state->buf_allocd * 2 : 4096;
+            char *buf = realloc(state->buf, allocd);
+            if (buf == NULL) {
+                len = -1;
+                errno = ENOMEM;
+                break;
+            }
+            state->buf = buf;
+            state->buf_allocd = allocd;
+        }
+        ssize_t n = read(fd, state->buf + len, state->buf_allocd - len - 1);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            len = -1;
+            break;
+        }
+        if (n == 0) break;
+        len += n;
+    }
+    if (fd != state->fd) close(fd);
+    if (len != (size_t) -1) state->buf[len] = '\0';
+    return len;
+}
+
+int
+scan_mounted_volumes()
+{
+    MountsState *state = &g_mounts_state;
+    char *line, *next;
+    ssize_t nbytes;
+    int i;
+
+    if (state->fd < 0 && !state->valid) {
+        /* Kept open for good, so don't leak it into children. */
+        state->fd = open(PROC_SELF_MOUNTS_FILENAME, O_RDONLY | O_CLOEXEC);
+    }
+    if (!mounts_changed(state)) {
+        return 0;
+    }
+
+    /* Free the old volume strings.
+     */
+    for (i = 0; i < state->volume_count; i++) {
+        free_volume_internals(&state->volumes[i], 1);
+    }
+    state->volume_count = 0;
+    state->valid = 0;
+
+    /* Read the file contents; any change after this point will be
+     * seen by the next poll().
+     */
+    nbytes = read_mounts_file(state);
     if (nbytes < 0) {
         goto bail;
     }
-    buf[nbytes] = '\0';
 
     /* Parse the contents of the file, which looks like:
      *
@@ -111,91 +239,99 @@ scan_mounted_volumes()
      * The zeroes at the end are dummy placeholder fields to make the
      * output match Linux's /etc/mtab, but don't represent anything here.
      */
-    bufp = buf;
-    while (nbytes > 0) {
-        char device[64];
-        char mount_point[64];
-        char filesystem[64];
-        char flags[128];
+    for (line = state->buf; line != NULL && *line != '\0'; line = next) {
+        char *fields[4];
+        char *saveptr;
         int matches;
 
-        /* %as is a gnu extension that malloc()s a string for each field.
-         */
-        matches = sscanf(bufp, "%63s %63s %63s %127s",
-                device, mount_point, filesystem, flags);
-
-        if (matches == 4) {
-            device[sizeof(device)-1] = '\0';
-            mount_point[sizeof(mount_point)-1] = '\0';
-            filesystem[sizeof(filesystem)-1] = '\0';
-            flags[sizeof(flags)-1] = '\0';
-
-            MountedVolume *v =
-                    &g_mounts_state.volumes[g_mounts_state.volume_count++];
-            v->device = strdup(device);
-            v->mount_point = strdup(mount_point);
-            v->filesystem = strdup(filesystem);
-            v->flags = strdup(flags);
-        } else {
-printf("matches was %d on <<%.40s>>\n", matches, bufp);
+        next = strchr(line, '\n');
+        if (next != NULL) *next++ = '\0';
+
+        for (matches = 0; matches < 4; matches++) {
+            fields[matches] = strtok_r(matches == 0 ? line : NULL, " \t",
+                                       &saveptr);
+            if (fields[matches] == NULL) break;
+        }
+        if (matches != 4) {
+            printf("matches was %d on <<%.40s>>\n", matches, line);
+            continue;
         }
 
-        /* Eat the line.
-         */
-        while (nbytes > 0 && *bufp != '\n') {
-            bufp++;
-            nbytes--;
+        if (state->volume_count == state->volumes_allocd) {
+            int numv = state->volumes_allocd ? state->volumes_allocd * 2 : 32;
+            MountedVolume *volumes =
+                    realloc(state->volumes, numv * sizeof(*volumes));
+            if (volumes == NULL) {
+                errno = ENOMEM;
+                goto bail;
+            }
+            memset(volumes + state->volumes_allocd, 0,
+                   (numv - state->volumes_allocd) * sizeof(*volumes));
+            state->volumes = volumes;
+            state->volumes_allocd = numv;
         }
-        if (nbytes > 0) {
-            bufp++;
-            nbytes--;
+
+        MountedVolume *v = &state->volumes[state->volume_count];
+        v->device = strdup(fields[0]);
+        v->mount_point = strdup(fields[1]);
+        v->filesystem = strdup(fields[2]);
+        v->flags = strdup(fields[3]);
+        if (v->device == NULL || v->mount_point == NULL ||
+            v->filesystem == NULL || v->flags == NULL) {
+            free_volume_internals(v, 1);
+            errno = ENOMEM;
+            goto bail;
         }
+        state->volume_count++;
     }
 
+    if (build_hash_tables(state) != 0) {
+        errno = ENOMEM;
+        goto bail;
+    }
+    state->valid = 1;
     return 0;
 
 bail:
-//TODO: free the strings we've allocated.
-    g_mounts_state.volume_count = 0;
+    for (i = 0; i < state->volume_count; i++) {
+        free_volume_internals(&state->volumes[i], 1);
+    }
+    state->volume_count = 0;
     return -1;
 }
 
-const MountedVolume *
-find_mounted_volume_by_device(const char *device)
+static const MountedVolume *
+find_mounted_volume(const int *table, const char *key, int by_device)
 {
-    if (g_mounts_state.volumes != NULL) {
-        int i;
-        for (i = 0; i < g_mounts_state.volume_count; i++) {
-            MountedVolume *v = &g_mounts_state.volumes[i];
-            /* May be null if it was unmounted and we haven't rescanned.
-             */
-            if (v->device != NULL) {
-                if (strcmp(v->device, device) == 0) {
-                    return v;
-                }
-            }
+    const MountsState *state = &g_mounts_state;
+    if (!state->valid || state->hash_size == 0) {
+        return NULL;
+    }
+
+    unsigned int h = hash_string(key) & (state->hash_size - 1);
+    while (table[h] >= 0) {
+        const MountedVolume *v = &state->volumes[table[h]];
+        const char *name = by_device ? v->device : v->mount_point;
+        /* May be null if it was unmounted and we haven't rescanned.
+         */
+        if (name != NULL && strcmp(name, key) == 0) {
+            return v;
         }
+        h = (h + 1) & (state->hash_size - 1);
     }
     return NULL;
 }
 
+const MountedVolume *
+find_mounted_volume_by_device(const char *device)
+{
+    return find_mounted_volume(g_mounts_state.by_device, device, 1);
+}
+
 const MountedVolume *
 find_mounted_volume_by_mount_point(const char *mount_point)
 {
-    if (g_mounts_state.volumes != NULL) {
-        int i;
-        for (i = 0; i < g_mounts_state.volume_count; i++) {
-            MountedVolume *v = &g_mounts_state.volumes[i];
-            /* May be null if it was unmounted and we haven't rescanned.
-             */
-            if (v->mount_point != NULL) {
-                if (strcmp(v->mount_point, mount_point) == 0) {
-                    return v;
-                }
-            }
-        }
-    }
-    return NULL;
+    return find_mounted_volume(g_mounts_state.by_mount_point, mount_point, 0);
 }
 
 const char *
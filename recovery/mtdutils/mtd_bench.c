@@ -0,0 +1,249 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Throughput of the mtdutils write, read and erase paths on the NAND
+// simulator, with latencies typical of SLC NAND by default (2 ms
+// block erase, 200 us page program, 25 us page read; -e, -p and -r
+// change them, and 0 measures mtdutils alone).  Everything written is
+// read back both ways and compared.
+//
+//   usage: mtd_bench [-s megabytes] [-k erase_kb] [-e us] [-p us] [-r us]
+//                    [-b bad_blocks] [-w worn_blocks] [-f flips_per_million]
+//                    [-v full|sampled|hash|none] [-x] [-d dir]
+//
+// -x has mtd_erase_blocks() skip blocks that are already erased.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "mtdutils.h"
+#include "mtdsim.h"
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char* name, size_t bytes, double elapsed) {
+    MtdSimCounters c;
+    mtd_sim_get_counters(0, &c);
+    printf("%-24s %8.1f MB/s  %7.0f ms  %6u erases %7u programs "
+           "%7u reads %6u ioctls\n",
+           name, bytes / (1024.0 * 1024.0) / elapsed, elapsed * 1000,
+           c.erases, c.pages_programmed, c.pages_read, c.ioctls);
+    mtd_sim_reset_counters(0);
+}
+
+typedef struct {
+    const char* expected;
+    size_t pos;
+    int mismatch;
+} AsyncCheck;
+
+static int check_async(const char* data, size_t len, void* cookie) {
+    AsyncCheck* check = (AsyncCheck*) cookie;
+    if (memcmp(data, check->expected + check->pos, len) != 0) {
+        check->mismatch = 1;
+    }
+    check->pos += len;
+    return 0;
+}
+
+static int parse_policy(const char* name, MtdVerifyPolicy* policy) {
+    if (strcmp(name, "full") == 0) *policy = MTD_VERIFY_FULL;
+    else if (strcmp(name, "sampled") == 0) *policy = MTD_VERIFY_SAMPLED;
+    else if (strcmp(name, "hash") == 0) *policy = MTD_VERIFY_HASH;
+    else if (strcmp(name, "none") == 0) *policy = MTD_VERIFY_NONE;
+    else return -1;
+    return 0;
+}
+
+static int usage(void) {
+    fprintf(stderr, "usage: mtd_bench [-s megabytes] [-k erase_kb] "
+            "[-e us] [-p us] [-r us]\n"
+            "                 [-b bad_blocks] [-w worn_blocks] "
+            "[-f flips_per_million]\n"
+            "                 [-v full|sampled|hash|none] [-x] [-d dir]\n");
+    return 2;
+}
+
+int main(int argc, char** argv) {
+    unsigned int megabytes = 16, erase_kb = 128;
+    unsigned int erase_us = 2000, program_us = 200, read_us = 25;
+    unsigned int bad = 0, worn = 0, flips = 0;
+    int skip_erased = 0;
+    MtdVerifyPolicy policy = MTD_VERIFY_FULL;
+    const char* dir = NULL;
+    char tmpdir[] = "/tmp/mtd_bench.XXXXXX";
+    int c;
+
+    while ((c = getopt(argc, argv, "s:k:e:p:r:b:w:f:v:xd:")) != -1) {
+        switch (c) {
+            case 's': megabytes = atoi(optarg); break;
+            case 'k': erase_kb = atoi(optarg); break;
+            case 'e': erase_us = atoi(optarg); break;
+            case 'p': program_us = atoi(optarg); break;
+            case 'r': read_us = atoi(optarg); break;
+            case 'b': bad = atoi(optarg); break;
+            case 'w': worn = atoi(optarg); break;
+            case 'f': flips = atoi(optarg); break;
+            case 'v':
+                if (parse_policy(optarg, &policy) != 0) return usage();
+                break;
+            case 'x': skip_erased = 1; break;
+            case 'd': dir = optarg; break;
+            default: return usage();
+        }
+    }
+    if (megabytes == 0 || erase_kb == 0) return usage();
+
+    const size_t erase_size = erase_kb * 1024;
+    const unsigned int num_blocks = megabytes * 1024 / erase_kb;
+    if (bad + worn + 1 >= num_blocks) return usage();
+    if (dir == NULL) {
+        dir = mkdtemp(tmpdir);
+        if (dir == NULL) {
+            perror("mkdtemp");
+            return 1;
+        }
+    }
+
+    char path[256];
+    snprintf(path, sizeof(path), "%s/mtd", dir);
+    FILE* f = fopen(path, "w");
+    if (f == NULL) {
+        perror(path);
+        return 1;
+    }
+    fprintf(f, "dev:    size   erasesize  name\n");
+    fprintf(f, "mtd0: %08x %08zx \"bench\"\n",
+            (unsigned int) (num_blocks * erase_size), erase_size);
+    fclose(f);
+
+    if (mtd_sim_init(dir) != 0) return 1;
+    mtd_sim_set_latency(erase_us, program_us, read_us);
+    mtd_sim_set_bitflips(flips, 12345);
+    // Spread the bad and worn blocks through the partition.
+    unsigned int i;
+    for (i = 0; i < bad + worn; ++i) {
+        unsigned int block = (i + 1) * num_blocks / (bad + worn + 1);
+        if (i < bad) mtd_sim_mark_bad(0, block);
+        else mtd_sim_mark_worn(0, block);
+    }
+
+    if (mtd_scan_partitions() <= 0) return 1;
+    const MtdPartition* partition = mtd_find_partition_by_name("bench");
+    if (partition == NULL) return 1;
+
+    // The writer skips bad blocks, and the reader skips worn ones too,
+    // so write as much as fits in what's left.
+    const size_t len = (num_blocks - bad - worn - 1) * erase_size;
+    char* data = malloc(len);
+    char* back = malloc(len);
+    if (data == NULL || back == NULL) return 1;
+    unsigned int x = 0x13579bdf;
+    for (i = 0; i < len / 4; ++i) {
+        x = x * 1103515245 + 12345;
+        memcpy(data + i * 4, &x, 4);
+    }
+
+    printf("%u MB, %zu KB blocks (%u bad, %u worn), erase %u us, "
+           "program %u us, read %u us per page\n\n",
+           megabytes, erase_size / 1024, bad, worn,
+           erase_us, program_us, read_us);
+    int failed = 0;
+
+    // mtd_write_data, in 64 KB pieces as flash_image does.
+    MtdWriteContext* out = mtd_write_partition(partition);
+    if (out == NULL) return 1;
+    mtd_write_set_verify(out, policy, 0);
+    mtd_sim_reset_counters(0);
+    double start = now();
+    size_t pos;
+    for (pos = 0; pos < len; pos += 65536) {
+        size_t n = len - pos < 65536 ? len - pos : 65536;
+        if (mtd_write_data(out, data + pos, n) != (ssize_t) n) {
+            fprintf(stderr, "mtd_write_data failed at %zu\n", pos);
+            return 1;
+        }
+    }
+    if (mtd_write_close(out) != 0) {
+        fprintf(stderr, "mtd_write_close failed\n");
+        failed = 1;
+    }
+    report("mtd_write_data", len, now() - start);
+
+    // mtd_read_data, in the same pieces.
+    MtdReadContext* in = mtd_read_partition(partition);
+    if (in == NULL) return 1;
+    start = now();
+    for (pos = 0; pos < len; pos += 65536) {
+        size_t n = len - pos < 65536 ? len - pos : 65536;
+        if (mtd_read_data(in, back + pos, n) != (ssize_t) n) {
+            fprintf(stderr, "mtd_read_data failed at %zu\n", pos);
+            return 1;
+        }
+    }
+    report("mtd_read_data", len, now() - start);
+    mtd_read_close(in);
+    if (memcmp(data, back, len) != 0) {
+        fprintf(stderr, "mtd_read_data returned the wrong data\n");
+        failed = 1;
+    }
+
+    AsyncCheck check = { data, 0, 0 };
+    start = now();
+    ssize_t got = mtd_read_partition_async(partition, 0, len, 8,
+                                           check_async, &check);
+    report("mtd_read_partition_async", len, now() - start);
+    if (got != (ssize_t) len || check.mismatch) {
+        fprintf(stderr, "mtd_read_partition_async returned the wrong data\n");
+        failed = 1;
+    }
+
+    // mtd_erase_blocks over the whole partition, then again now that
+    // it is blank.
+    static const char* erase_names[] = {
+        "mtd_erase_blocks", "mtd_erase_blocks again"
+    };
+    for (i = 0; i < 2; ++i) {
+        out = mtd_write_partition(partition);
+        if (out == NULL) return 1;
+        mtd_write_set_skip_erased(out, skip_erased);
+        start = now();
+        if (mtd_erase_blocks(out, -1) == (off_t) -1) {
+            fprintf(stderr, "mtd_erase_blocks failed\n");
+            failed = 1;
+        }
+        report(erase_names[i], num_blocks * erase_size, now() - start);
+        mtd_write_close(out);
+    }
+
+    free(data);
+    free(back);
+    if (dir == tmpdir) {
+        snprintf(path, sizeof(path), "%s/mtd", dir);
+        unlink(path);
+        snprintf(path, sizeof(path), "%s/mtd0", dir);
+        unlink(path);
+        rmdir(dir);
+    }
+    return failed;
+}
@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MTDUTILS_MTDDEV_H_
+#define MTDUTILS_MTDDEV_H_
+
+#include <sys/types.h>
+
+/* Everything mtdutils does to an MTD device goes through one of
+ * these, so the simulator (mtdsim.c) can stand in for the kernel.
+ * Only libmtdutils uses this header.
+ *
+ * The descriptors returned by open() are real, so lseek() works on
+ * them either way.
+ */
+typedef struct {
+    const char *table;          /* partition table, /proc/mtd format */
+    int (*open)(int index, int flags);
+    int (*close)(int fd);
+    int (*ioctl)(int fd, unsigned long request, void *arg);
+    ssize_t (*read)(int fd, void *buf, size_t count);
+    ssize_t (*write)(int fd, const void *buf, size_t count);
+    ssize_t (*pread)(int fd, void *buf, size_t count, off_t pos);
+} MtdDeviceOps;
+
+void mtd_set_device_ops(const MtdDeviceOps *ops);
+
+#endif  // MTDUTILS_MTDDEV_H_
@@ -0,0 +1,560 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <mtd/mtd-user.h>
+
+#include "mtddev.h"
+#include "mtdsim.h"
+
+/* Descriptors open on the simulator at once. */
+#define MTD_SIM_MAX_OPEN 64
+
+typedef struct {
+    int present;
+    unsigned int size;
+    unsigned int erase_size;
+    unsigned int write_size;
+    unsigned int num_blocks;
+    unsigned char *bad;         // one bit per block
+    unsigned char *worn;        // ...and for blocks that fail ECC
+    unsigned int *erase_counts;
+    struct mtd_ecc_stats ecc;
+    MtdSimCounters counters;
+} MtdSimPartition;
+
+typedef struct {
+    int fd;
+    int index;
+} MtdSimFile;
+
+static struct {
+    char dir[256];
+    char table[280];
+    MtdSimPartition parts[MTD_SIM_MAX_PARTITIONS];
+    MtdSimFile files[MTD_SIM_MAX_OPEN];
+    unsigned int erase_us, program_us, read_us;
+    unsigned int bitflip_ppm;
+    unsigned int seed;
+} g_sim;
+
+// Guards everything in g_sim except the latencies, which are set
+// before use.  Data is read and written outside it.
+static pthread_mutex_t g_sim_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int test_bit(const unsigned char *bits, unsigned int i)
+{
+    return (bits[i / 8] & (1 << (i % 8))) != 0;
+}
+
+static void set_bit(unsigned char *bits, unsigned int i)
+{
+    bits[i / 8] |= 1 << (i % 8);
+}
+
+static MtdSimPartition *part_for_fd(int fd)
+{
+    int i;
+    MtdSimPartition *part = NULL;
+    pthread_mutex_lock(&g_sim_lock);
+    for (i = 0; i < MTD_SIM_MAX_OPEN; ++i) {
+        if (g_sim.files[i].fd == fd) {
+            part = &g_sim.parts[g_sim.files[i].index];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g_sim_lock);
+    if (part == NULL) errno = EBADF;
+    return part;
+}
+
+static int part_index(const MtdSimPartition *part)
+{
+    return part - g_sim.parts;
+}
+
+static void sim_delay(unsigned int per_unit, unsigned int units)
+{
+    if (per_unit > 0 && units > 0) usleep(per_unit * units);
+}
+
+static int sim_open(int index, int flags)
+{
+    char path[300];
+    int i, fd;
+
+    if (index < 0 || index >= MTD_SIM_MAX_PARTITIONS ||
+        !g_sim.parts[index].present) {
+        errno = ENOENT;
+        return -1;
+    }
+    snprintf(path, sizeof(path), "%s/mtd%d", g_sim.dir, index);
+    fd = open(path, flags & (O_ACCMODE | O_CLOEXEC));
+    if (fd < 0) return -1;
+
+    pthread_mutex_lock(&g_sim_lock);
+    for (i = 0; i < MTD_SIM_MAX_OPEN; ++i) {
+        if (g_sim.files[i].fd < 0) {
+            g_sim.files[i].fd = fd;
+            g_sim.files[i].index = index;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g_sim_lock);
+    if (i == MTD_SIM_MAX_OPEN) {
+        close(fd);
+        errno = EMFILE;
+        return -1;
+    }
+    return fd;
+}
+
+static int sim_close(int fd)
+{
+    int i;
+    pthread_mutex_lock(&g_sim_lock);
+    for (i = 0; i < MTD_SIM_MAX_OPEN; ++i) {
+        if (g_sim.files[i].fd == fd) g_sim.files[i].fd = -1;
+    }
+    pthread_mutex_unlock(&g_sim_lock);
+    return close(fd);
+}
+
+/* The image holds inverted bytes, so a hole reads back as erased.
+ */
+static void invert(char *data, size_t len)
+{
+    size_t i;
+    for (i = 0; i < len; ++i) data[i] = ~data[i];
+}
+
+static ssize_t sim_pread(int fd, void *buf, size_t count, off_t pos)
+{
+    MtdSimPartition *part = part_for_fd(fd);
+    if (part == NULL) return -1;
+    if (pos < 0 || pos >= (off_t) part->size) return 0;
+    size_t left = part->size - (size_t) pos;
+    if (count > left) count = left;
+
+    ssize_t got = pread(fd, buf, count, pos);
+    if (got <= 0) return got;
+    invert(buf, got);
+
+    // Every page read may report a corrected bit flip; pages of worn
+    // blocks come back with a bit flipped and count as failures.
+    unsigned int first = pos / part->write_size;
+    unsigned int last = (pos + got - 1) / part->write_size;
+    unsigned int page, pages = last - first + 1;
+    pthread_mutex_lock(&g_sim_lock);
+    for (page = first; page <= last; ++page) {
+        unsigned int block = page * part->write_size / part->erase_size;
+        if (test_bit(part->worn, block)) {
+            off_t flip = (off_t) page * part->write_size;
+            if (flip < pos) flip = pos;
+            ((char *) buf)[flip - pos] ^= 0x10;
+            part->ecc.failed++;
+        } else if (g_sim.bitflip_ppm > 0 &&
+                   (unsigned int) rand_r(&g_sim.seed) % 1000000 <
+                   g_sim.bitflip_ppm) {
+            part->ecc.corrected++;
+        }
+    }
+    part->counters.pages_read += pages;
+    pthread_mutex_unlock(&g_sim_lock);
+
+    sim_delay(g_sim.read_us, pages);
+    return got;
+}
+
+static ssize_t sim_read(int fd, void *buf, size_t count)
+{
+    off_t pos = lseek(fd, 0, SEEK_CUR);
+    if (pos == (off_t) -1) return -1;
+    ssize_t got = sim_pread(fd, buf, count, pos);
+    if (got > 0) lseek(fd, pos + got, SEEK_SET);
+    return got;
+}
+
+/* Programming can only turn 1s into 0s, so in the inverted image it
+ * ORs in the complement of the data.
+ */
+static ssize_t sim_pwrite(int fd, const void *buf, size_t count, off_t pos)
+{
+    MtdSimPartition *part = part_for_fd(fd);
+    if (part == NULL) return -1;
+    if (pos < 0 || pos % part->write_size != 0 ||
+        count % part->write_size != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (pos + count > part->size) {
+        errno = ENOSPC;
+        return -1;
+    }
+
+    char *page = malloc(part->write_size);
+    if (page == NULL) return -1;
+    size_t done;
+    for (done = 0; done < count; done += part->write_size) {
+        unsigned int block = (pos + done) / part->erase_size;
+        pthread_mutex_lock(&g_sim_lock);
+        int bad = test_bit(part->bad, block);
+        pthread_mutex_unlock(&g_sim_lock);
+        if (bad) {
+            errno = EIO;
+            break;
+        }
+        if (pread(fd, page, part->write_size, pos + done) !=
+            (ssize_t) part->write_size) {
+            break;
+        }
+        const char *data = (const char *) buf + done;
+        unsigned int i;
+        for (i = 0; i < part->write_size; ++i) page[i] |= ~data[i];
+        if (pwrite(fd, page, part->write_size, pos + done) !=
+            (ssize_t) part->write_size) {
+            break;
+        }
+    }
+    free(page);
+
+    unsigned int pages = done / part->write_size;
+    pthread_mutex_lock(&g_sim_lock);
+    part->counters.pages_programmed += pages;
+    pthread_mutex_unlock(&g_sim_lock);
+    sim_delay(g_sim.program_us, pages);
+    return done > 0 ? (ssize_t) done : -1;
+}
+
+static ssize_t sim_write(int fd, const void *buf, size_t count)
+{
+    off_t pos = lseek(fd, 0, SEEK_CUR);
+    if (pos == (off_t) -1) return -1;
+    ssize_t wrote = sim_pwrite(fd, buf, count, pos);
+    if (wrote > 0) lseek(fd, pos + wrote, SEEK_SET);
+    return wrote;
+}
+
+static int erase_block(int fd, MtdSimPartition *part, unsigned int block)
+{
+    off_t pos = (off_t) block * part->erase_size;
+#ifdef FALLOC_FL_PUNCH_HOLE
+    if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                  pos, part->erase_size) == 0) {
+        return 0;
+    }
+#endif
+    char *zero = calloc(1, part->erase_size);
+    if (zero == NULL) return -1;
+    int ret = pwrite(fd, zero, part->erase_size, pos) ==
+              (ssize_t) part->erase_size ? 0 : -1;
+    free(zero);
+    return ret;
+}
+
+static int sim_erase(int fd, MtdSimPartition *part,
+                     const struct erase_info_user *ei)
+{
+    if (ei->start % part->erase_size != 0 ||
+        ei->length % part->erase_size != 0 ||
+        ei->start + ei->length > part->size) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    unsigned int block = ei->start / part->erase_size;
+    unsigned int end = block + ei->length / part->erase_size;
+    unsigned int erased = 0;
+    int ret = 0;
+    for (; block < end; ++block) {
+        pthread_mutex_lock(&g_sim_lock);
+        int bad = test_bit(part->bad, block);
+        pthread_mutex_unlock(&g_sim_lock);
+        if (bad || erase_block(fd, part, block) != 0) {
+            errno = EIO;
+            ret = -1;
+            break;
+        }
+        pthread_mutex_lock(&g_sim_lock);
+        part->erase_counts[block]++;
+        part->counters.erases++;
+        pthread_mutex_unlock(&g_sim_lock);
+        erased++;
+    }
+    sim_delay(g_sim.erase_us, erased);
+    return ret;
+}
+
+static int sim_ioctl(int fd, unsigned long request, void *arg)
+{
+    MtdSimPartition *part = part_for_fd(fd);
+    if (part == NULL) return -1;
+
+    pthread_mutex_lock(&g_sim_lock);
+    part->counters.ioctls++;
+    pthread_mutex_unlock(&g_sim_lock);
+
+    switch (request) {
+        case MEMGETINFO: {
+            struct mtd_info_user *info = (struct mtd_info_user *) arg;
+            memset(info, 0, sizeof(*info));
+            info->type = MTD_NANDFLASH;
+            info->flags = MTD_CAP_NANDFLASH;
+            info->size = part->size;
+            info->erasesize = part->erase_size;
+            info->writesize = part->write_size;
+            info->oobsize = part->write_size / 32;
+            return 0;
+        }
+
+        case MEMERASE:
+            return sim_erase(fd, part, (struct erase_info_user *) arg);
+
+        case MEMGETBADBLOCK: {
+            loff_t pos = *(loff_t *) arg;
+            if (pos < 0 || pos >= (loff_t) part->size) {
+                errno = EINVAL;
+                return -1;
+            }
+            pthread_mutex_lock(&g_sim_lock);
+            int bad = test_bit(part->bad, pos / part->erase_size);
+            pthread_mutex_unlock(&g_sim_lock);
+            return bad;
+        }
+
+        case MEMSETBADBLOCK: {
+            loff_t pos = *(loff_t *) arg;
+            if (pos < 0 || pos >= (loff_t) part->size) {
+                errno = EINVAL;
+                return -1;
+            }
+            return mtd_sim_mark_bad(part_index(part), pos / part->erase_size);
+        }
+
+        case ECCGETSTATS:
+            pthread_mutex_lock(&g_sim_lock);
+            memcpy(arg, &part->ecc, sizeof(part->ecc));
+            pthread_mutex_unlock(&g_sim_lock);
+            return 0;
+
+        default:
+            errno = ENOTTY;
+            return -1;
+    }
+}
+
+static const MtdDeviceOps sim_ops = {
+    g_sim.table,
+    sim_open,
+    sim_close,
+    sim_ioctl,
+    sim_read,
+    sim_write,
+    sim_pread,
+};
+
+static void free_partition(MtdSimPartition *part)
+{
+    free(part->bad);
+    free(part->worn);
+    free(part->erase_counts);
+    memset(part, 0, sizeof(*part));
+}
+
+/* Create the image for one partition if it isn't there, and read its
+ * bad block list.
+ */
+static int load_partition(int index, unsigned int size,
+                          unsigned int erase_size)
+{
+    MtdSimPartition *part = &g_sim.parts[index];
+    char path[300];
+
+    if (erase_size == 0 || size % erase_size != 0) {
+        fprintf(stderr, "mtd: simulated mtd%d: size 0x%x isn't a multiple "
+                "of the erase size 0x%x\n", index, size, erase_size);
+        return -1;
+    }
+    free_partition(part);
+    part->size = size;
+    part->erase_size = erase_size;
+    part->write_size = erase_size < MTD_SIM_DEFAULT_WRITE_SIZE ?
+                       erase_size : MTD_SIM_DEFAULT_WRITE_SIZE;
+    part->num_blocks = size / erase_size;
+    part->bad = calloc((part->num_blocks + 7) / 8, 1);
+    part->worn = calloc((part->num_blocks + 7) / 8, 1);
+    part->erase_counts = calloc(part->num_blocks, sizeof(unsigned int));
+    if (part->bad == NULL || part->worn == NULL ||
+        part->erase_counts == NULL) {
+        free_partition(part);
+        return -1;
+    }
+
+    snprintf(path, sizeof(path), "%s/mtd%d", g_sim.dir, index);
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "mtd: can't create %s (%s)\n", path, strerror(errno));
+        free_partition(part);
+        return -1;
+    }
+    off_t len = lseek(fd, 0, SEEK_END);
+    if (len < (off_t) size && ftruncate(fd, size) != 0) {
+        fprintf(stderr, "mtd: can't size %s (%s)\n", path, strerror(errno));
+        close(fd);
+        free_partition(part);
+        return -1;
+    }
+    close(fd);
+
+    snprintf(path, sizeof(path), "%s/mtd%d.bad", g_sim.dir, index);
+    FILE *f = fopen(path, "r");
+    if (f != NULL) {
+        unsigned int block;
+        while (fscanf(f, "%u", &block) == 1) {
+            if (block < part->num_blocks) set_bit(part->bad, block);
+        }
+        fclose(f);
+    }
+    part->present = 1;
+    return 0;
+}
+
+int mtd_sim_init(const char *dir)
+{
+    char buf[2048];
+    const char *bufp;
+    int i;
+
+    pthread_mutex_lock(&g_sim_lock);
+    for (i = 0; i < MTD_SIM_MAX_OPEN; ++i) g_sim.files[i].fd = -1;
+    pthread_mutex_unlock(&g_sim_lock);
+    for (i = 0; i < MTD_SIM_MAX_PARTITIONS; ++i) {
+        free_partition(&g_sim.parts[i]);
+    }
+    if (g_sim.seed == 0) g_sim.seed = 1;
+
+    snprintf(g_sim.dir, sizeof(g_sim.dir), "%s", dir);
+    snprintf(g_sim.table, sizeof(g_sim.table), "%s/mtd", dir);
+    FILE *f = fopen(g_sim.table, "r");
+    if (f == NULL) {
+        fprintf(stderr, "mtd: can't open %s (%s)\n",
+                g_sim.table, strerror(errno));
+        return -1;
+    }
+    size_t nbytes = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[nbytes] = '\0';
+
+    // Same format, and parsing, as /proc/mtd.
+    int count = 0;
+    for (bufp = buf; bufp != NULL && *bufp != '\0'; ) {
+        int mtdnum = -1;
+        unsigned int mtdsize, mtderasesize;
+        if (sscanf(bufp, "mtd%d: %x %x", &mtdnum, &mtdsize,
+                   &mtderasesize) == 3 &&
+            mtdnum >= 0 && mtdnum < MTD_SIM_MAX_PARTITIONS) {
+            if (load_partition(mtdnum, mtdsize, mtderasesize) != 0) return -1;
+            ++count;
+        }
+        bufp = strchr(bufp, '\n');
+        if (bufp != NULL) ++bufp;
+    }
+
+    mtd_set_device_ops(&sim_ops);
+    fprintf(stderr, "mtd: simulating %d partition(s) in %s\n", count, dir);
+    return 0;
+}
+
+void mtd_sim_set_latency(unsigned int erase_us, unsigned int program_us,
+        unsigned int read_us)
+{
+    g_sim.erase_us = erase_us;
+    g_sim.program_us = program_us;
+    g_sim.read_us = read_us;
+}
+
+void mtd_sim_set_bitflips(unsigned int per_million, unsigned int seed)
+{
+    pthread_mutex_lock(&g_sim_lock);
+    g_sim.bitflip_ppm = per_million;
+    g_sim.seed = seed != 0 ? seed : 1;
+    pthread_mutex_unlock(&g_sim_lock);
+}
+
+static MtdSimPartition *find_block(int index, unsigned int block)
+{
+    if (index < 0 || index >= MTD_SIM_MAX_PARTITIONS ||
+        !g_sim.parts[index].present ||
+        block >= g_sim.parts[index].num_blocks) {
+        errno = EINVAL;
+        return NULL;
+    }
+    return &g_sim.parts[index];
+}
+
+int mtd_sim_mark_bad(int index, unsigned int block)
+{
+    MtdSimPartition *part = find_block(index, block);
+    if (part == NULL) return -1;
+    pthread_mutex_lock(&g_sim_lock);
+    set_bit(part->bad, block);
+    pthread_mutex_unlock(&g_sim_lock);
+    return 0;
+}
+
+int mtd_sim_mark_worn(int index, unsigned int block)
+{
+    MtdSimPartition *part = find_block(index, block);
+    if (part == NULL) return -1;
+    pthread_mutex_lock(&g_sim_lock);
+    set_bit(part->worn, block);
+    pthread_mutex_unlock(&g_sim_lock);
+    return 0;
+}
+
+void mtd_sim_get_counters(int index, MtdSimCounters *counters)
+{
+    memset(counters, 0, sizeof(*counters));
+    if (find_block(index, 0) == NULL) return;
+    pthread_mutex_lock(&g_sim_lock);
+    *counters = g_sim.parts[index].counters;
+    pthread_mutex_unlock(&g_sim_lock);
+}
+
+void mtd_sim_reset_counters(int index)
+{
+    if (find_block(index, 0) == NULL) return;
+    pthread_mutex_lock(&g_sim_lock);
+    memset(&g_sim.parts[index].counters, 0, sizeof(MtdSimCounters));
+    pthread_mutex_unlock(&g_sim_lock);
+}
+
+unsigned int mtd_sim_erase_count(int index, unsigned int block)
+{
+    MtdSimPartition *part = find_block(index, block);
+    if (part == NULL) return 0;
+    pthread_mutex_lock(&g_sim_lock);
+    unsigned int count = part->erase_counts[block];
+    pthread_mutex_unlock(&g_sim_lock);
+    return count;
+}
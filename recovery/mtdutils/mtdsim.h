@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MTDUTILS_MTDSIM_H_
+#define MTDUTILS_MTDSIM_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/* A NAND flash simulator that mtdutils can use instead of /dev/mtd,
+ * so the flash read and write paths can be run and timed on a build
+ * host.
+ *
+ * The simulator lives in a directory holding:
+ *
+ *   mtd          the partition table, in /proc/mtd format
+ *   mtdN         partition N's contents, created as needed.  The file
+ *                holds the inverse of each byte, so erased (0xff)
+ *                flash is a hole and large images stay sparse.
+ *   mtdN.bad     optional: numbers of blocks that are bad, one per line
+ *
+ * Erasing fills a block with 0xff; programming can only clear bits,
+ * as on real NAND, and must be whole pages.  Bad blocks refuse both.
+ * Reads can report correctable bit flips, and blocks marked worn
+ * fail ECC with a flipped bit, through ECCGETSTATS.
+ *
+ * Setting MTD_SIMULATOR to the directory makes mtd_scan_partitions()
+ * switch to the simulator, so unmodified tools like flash_image can
+ * use it too.  The simulator is only built into the host libmtdutils
+ * (with -DMTD_SIMULATOR); device builds ignore MTD_SIMULATOR.
+ */
+
+#define MTD_SIM_MAX_PARTITIONS 32
+#define MTD_SIM_DEFAULT_WRITE_SIZE 2048
+
+/* Switch mtdutils over to the simulator in "dir".  Returns 0 on
+ * success.  Call before mtd_scan_partitions().
+ */
+int mtd_sim_init(const char *dir);
+
+/* Time each operation takes, in microseconds; all 0 by default.  The
+ * simulator sleeps for this long on each erase, and for each page
+ * programmed or read.
+ */
+void mtd_sim_set_latency(unsigned int erase_us, unsigned int program_us,
+        unsigned int read_us);
+
+/* Report a correctable bit flip on this many reads per million pages.
+ */
+void mtd_sim_set_bitflips(unsigned int per_million, unsigned int seed);
+
+/* Mark a block of partition "index" bad, or worn (every read of it
+ * fails ECC).
+ */
+int mtd_sim_mark_bad(int index, unsigned int block);
+int mtd_sim_mark_worn(int index, unsigned int block);
+
+typedef struct {
+    unsigned int erases;        /* blocks erased */
+    unsigned int pages_programmed;
+    unsigned int pages_read;
+    unsigned int ioctls;
+} MtdSimCounters;
+
+/* Counters for partition "index" since mtd_sim_init() or the last
+ * reset.
+ */
+void mtd_sim_get_counters(int index, MtdSimCounters *counters);
+void mtd_sim_reset_counters(int index);
+
+/* How many times "block" of partition "index" has been erased. */
+unsigned int mtd_sim_erase_count(int index, unsigned int block);
+
+#endif  // MTDUTILS_MTDSIM_H_
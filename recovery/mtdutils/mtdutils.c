@@ -20,19 +20,34 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <limits.h>
+#include <pthread.h>
 #include <sys/mount.h>  // for _IOW, _IOR, mount()
 #include <sys/stat.h>
+#include <time.h>
 #include <mtd/mtd-user.h>
 #undef NDEBUG
 #include <assert.h>
 
+#include "zlib.h"
+
 #include "mtdutils.h"
+#include "mtddev.h"
+#ifdef MTD_SIMULATOR
+#include "mtdsim.h"
+#endif
+#include "crypto/crc32.h"
 
 struct MtdPartition {
     int device_index;
     unsigned int size;
     unsigned int erase_size;
     char *name;
+
+    // One bit per block, shared by every context on the partition;
+    // see block_is_bad().
+    unsigned char *bad_blocks;
+    int bad_blocks_valid;
 };
 
 struct MtdReadContext {
@@ -42,6 +57,16 @@ struct MtdReadContext {
     int fd;
 };
 
+/* Blocks written under MTD_VERIFY_HASH wait here for the verify
+ * thread to read them back.
+ */
+#define MTD_HASH_QUEUE_SIZE 64
+
+typedef struct {
+    off_t pos;
+    uint32_t crc;
+} MtdHashCheck;
+
 struct MtdWriteContext {
     const MtdPartition *partition;
     char *buffer;
@@ -51,6 +76,28 @@ struct MtdWriteContext {
     off_t* bad_block_offsets;
     int bad_block_alloc;
     int bad_block_count;
+
+    MtdVerifyPolicy verify_policy;
+    int verify_interval;        // for MTD_VERIFY_SAMPLED
+    char *verify;               // read-back buffer, one erase block
+    MtdWriteStats stats;
+
+    int skip_erased;
+    int skip_identical;
+    size_t page_size;           // from MEMGETINFO, once skip_erased is used
+    size_t oob_size;            // 0 if the spare area can't be read
+    unsigned char *oob;
+
+    // MTD_VERIFY_HASH: written blocks queued for the verify thread,
+    // which has its own read-back buffer.
+    pthread_t hash_thread;
+    int hash_thread_running;
+    char *hash_verify;
+    MtdHashCheck hash_queue[MTD_HASH_QUEUE_SIZE];
+    int hash_head, hash_count;
+    int hash_stop;
+    pthread_mutex_t hash_lock;
+    pthread_cond_t hash_cond;
 };
 
 typedef struct {
@@ -67,6 +114,54 @@ static MtdState g_mtd_state = {
 
 #define MTD_PROC_FILENAME   "/proc/mtd"
 
+static int default_open(int index, int flags)
+{
+    char mtddevname[32];
+    sprintf(mtddevname, "/dev/mtd/mtd%d", index);
+    return open(mtddevname, flags);
+}
+
+static int default_ioctl(int fd, unsigned long request, void *arg)
+{
+    return ioctl(fd, request, arg);
+}
+
+static const MtdDeviceOps g_default_ops = {
+    MTD_PROC_FILENAME,
+    default_open,
+    close,
+    default_ioctl,
+    read,
+    write,
+    pread,
+};
+
+static const MtdDeviceOps *g_dev = &g_default_ops;
+
+void mtd_set_device_ops(const MtdDeviceOps *ops)
+{
+    g_dev = ops != NULL ? ops : &g_default_ops;
+}
+
+/* MTD_SIMULATOR=<dir> runs everything against the simulator in dir
+ * (see mtdsim.h) instead of the kernel's MTD devices.  Only the host
+ * build of libmtdutils has the simulator; on the device the MTD
+ * devices can't be redirected.
+ */
+static void check_simulator(void)
+{
+#ifdef MTD_SIMULATOR
+    static int checked = 0;
+    if (checked) return;
+    checked = 1;
+
+    const char *dir = getenv("MTD_SIMULATOR");
+    if (dir != NULL && g_dev == &g_default_ops && mtd_sim_init(dir) != 0) {
+        fprintf(stderr, "mtd: can't start simulator in %s\n", dir);
+    }
+#endif
+}
+
 int
 mtd_scan_partitions()
 {
@@ -76,6 +171,8 @@ mtd_scan_partitions()
     int i;
     ssize_t nbytes;
 
+    check_simulator();
+
     if (g_mtd_state.partitions == NULL) {
         const int nump = 32;
         MtdPartition *partitions = malloc(nump * sizeof(*partitions));
@@ -99,12 +196,15 @@ mtd_scan_partitions()
             free(p->name);
             p->name = NULL;
         }
+        free(p->bad_blocks);
+        p->bad_blocks = NULL;
+        p->bad_blocks_valid = 0;
         p->device_index = -1;
     }
 
     /* Open and read the file contents.
      */
-    fd = open(MTD_PROC_FILENAME, O_RDONLY);
+    fd = open(g_dev->table, O_RDONLY);
     if (fd < 0) {
         goto bail;
     }
@@ -255,14 +355,12 @@ int
 mtd_partition_info(const MtdPartition *partition,
         size_t *total_size, size_t *erase_size, size_t *write_size)
 {
-    char mtddevname[32];
-    sprintf(mtddevname, "/dev/mtd/mtd%d", partition->device_index);
-    int fd = open(mtddevname, O_RDONLY);
+    int fd = g_dev->open(partition->device_index, O_RDONLY);
     if (fd < 0) return -1;
 
     struct mtd_info_user mtd_info;
-    int ret = ioctl(fd, MEMGETINFO, &mtd_info);
-    close(fd);
+    int ret = g_dev->ioctl(fd, MEMGETINFO, &mtd_info);
+    g_dev->close(fd);
     if (ret < 0) return -1;
 
     if (total_size != NULL) *total_size = mtd_info.size;
@@ -271,6 +369,63 @@ mtd_partition_info(const MtdPartition *partition,
     return 0;
 }
 
+/* Bad blocks are looked up in a table built by one scan of the
+ * partition, the first time any context needs it, rather than with a
+ * MEMGETBADBLOCK call per block per context.
+ */
+static pthread_mutex_t g_bad_block_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Call with g_bad_block_lock held.
+static void scan_bad_blocks(MtdPartition *partition, int fd)
+{
+    const unsigned int num_blocks = partition->size / partition->erase_size;
+    if (partition->bad_blocks == NULL) {
+        partition->bad_blocks = malloc((num_blocks + 7) / 8);
+        if (partition->bad_blocks == NULL) return;
+    }
+    memset(partition->bad_blocks, 0, (num_blocks + 7) / 8);
+
+    unsigned int i;
+    for (i = 0; i < num_blocks; ++i) {
+        loff_t pos = (loff_t) i * partition->erase_size;
+        int ret = g_dev->ioctl(fd, MEMGETBADBLOCK, &pos);
+        if (ret == -1 && errno == EOPNOTSUPP) break;  // no bad blocks
+        if (ret != 0) {
+            fprintf(stderr, "mtd: bad block at 0x%08llx (ret %d errno %d)\n",
+                    (long long) pos, ret, errno);
+            partition->bad_blocks[i / 8] |= 1 << (i % 8);
+        }
+    }
+    partition->bad_blocks_valid = 1;
+}
+
+static int block_is_bad(const MtdPartition *partition, int fd, off_t pos)
+{
+    MtdPartition *p = (MtdPartition *) partition;
+    unsigned int block = pos / partition->erase_size;
+    int bad;
+
+    pthread_mutex_lock(&g_bad_block_lock);
+    if (!p->bad_blocks_valid) scan_bad_blocks(p, fd);
+    if (p->bad_blocks_valid) {
+        bad = (p->bad_blocks[block / 8] & (1 << (block % 8))) != 0;
+    } else {
+        // Out of memory for the table; ask the driver.
+        loff_t bpos = pos;
+        int ret = g_dev->ioctl(fd, MEMGETBADBLOCK, &bpos);
+        bad = ret != 0 && !(ret == -1 && errno == EOPNOTSUPP);
+    }
+    pthread_mutex_unlock(&g_bad_block_lock);
+    return bad;
+}
+
+void mtd_invalidate_bad_blocks(const MtdPartition *partition)
+{
+    pthread_mutex_lock(&g_bad_block_lock);
+    ((MtdPartition *) partition)->bad_blocks_valid = 0;
+    pthread_mutex_unlock(&g_bad_block_lock);
+}
+
 MtdReadContext *mtd_read_partition(const MtdPartition *partition)
 {
     MtdReadContext *ctx = (MtdReadContext*) malloc(sizeof(MtdReadContext));
@@ -282,9 +437,7 @@ MtdReadContext *mtd_read_partition(const MtdPartition *partition)
         return NULL;
     }
 
-    char mtddevname[32];
-    sprintf(mtddevname, "/dev/mtd/mtd%d", partition->device_index);
-    ctx->fd = open(mtddevname, O_RDONLY);
+    ctx->fd = g_dev->open(partition->device_index, O_RDONLY);
     if (ctx->fd < 0) {
         free(ctx->buffer);
         free(ctx);
@@ -305,7 +458,7 @@ void mtd_read_skip_to(const MtdReadContext* ctx, size_t offset) {
 static int read_block(const MtdPartition *partition, int fd, char *data)
 {
     struct mtd_ecc_stats before, after;
-    if (ioctl(fd, ECCGETSTATS, &before)) {
+    if (g_dev->ioctl(fd, ECCGETSTATS, &before)) {
         fprintf(stderr, "mtd: ECCGETSTATS error (%s)\n", strerror(errno));
         return -1;
     }
@@ -313,21 +466,18 @@ static int read_block(const MtdPartition *partition, int fd, char *data)
     loff_t pos = lseek64(fd, 0, SEEK_CUR);
 
     ssize_t size = partition->erase_size;
-    int mgbb;
 
     while (pos + size <= (int) partition->size) {
-		if ((mgbb = ioctl(fd, MEMGETBADBLOCK, &pos))) {
-            fprintf(stderr, "mtd: MEMGETBADBLOCK returned %d at 0x%08llx (errno=%d)\n",
-                    mgbb, pos, errno);
-			ioctl(fd, ECCGETSTATS, &after);
-			before = after;
-			pos += partition->erase_size;
-			continue;
-        }
-        if (lseek64(fd, pos, SEEK_SET) != pos || read(fd, data, size) != size) {
+        if (block_is_bad(partition, fd, pos)) {
+            fprintf(stderr, "mtd: skipping bad block at 0x%08llx\n", pos);
+            pos += partition->erase_size;
+            continue;
+        }
+        if (lseek64(fd, pos, SEEK_SET) != pos ||
+            g_dev->read(fd, data, size) != size) {
             fprintf(stderr, "mtd: read error at 0x%08llx (%s)\n",
                     pos, strerror(errno));
-        } else if (ioctl(fd, ECCGETSTATS, &after)) {
+        } else if (g_dev->ioctl(fd, ECCGETSTATS, &after)) {
             fprintf(stderr, "mtd: ECCGETSTATS error (%s)\n", strerror(errno));
             return -1;
         } else if (after.failed != before.failed) {
@@ -383,30 +533,287 @@ ssize_t mtd_read_data(MtdReadContext *ctx, char *data, size_t len)
 
 void mtd_read_close(MtdReadContext *ctx)
 {
-    close(ctx->fd);
+    g_dev->close(ctx->fd);
     free(ctx->buffer);
     free(ctx);
 }
 
+/* The asynchronous reader reads up to this many contiguous good
+ * blocks with one read() and one pair of ECCGETSTATS calls.
+ */
+#define MTD_READ_BATCH_BLOCKS 4
+
+typedef struct {
+    char *data;
+    size_t len;         // bytes of good data in this slot
+    int full;
+} MtdReadSlot;
+
+typedef struct {
+    const MtdPartition *partition;
+    int fd;
+    unsigned int num_blocks;
+    unsigned int next_block;    // next block the reader thread looks at
+    size_t remaining;           // bytes the reader thread still has to read
+
+    MtdReadSlot *slots;
+    int num_slots;
+    int batch;                  // blocks per slot
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int done;                   // reader thread has finished
+    int error;                  // ...and this is its errno, if it failed
+    int abort;                  // consumer wants it to stop
+} MtdAsyncRead;
+
+/* Read "count" contiguous blocks starting at "first" into data,
+ * dropping any that fail ECC the way read_block() does.  Returns the
+ * number of good blocks now at the start of data, or -1.
+ */
+static int read_block_run(MtdAsyncRead *ar, unsigned int first, int count,
+                          char *data)
+{
+    const size_t erase_size = ar->partition->erase_size;
+    size_t size = count * erase_size;
+    off_t pos = (off_t) first * erase_size;
+    struct mtd_ecc_stats before, after;
+
+    if (g_dev->ioctl(ar->fd, ECCGETSTATS, &before)) {
+        fprintf(stderr, "mtd: ECCGETSTATS error (%s)\n", strerror(errno));
+        return -1;
+    }
+    ssize_t got = g_dev->pread(ar->fd, data, size, pos);
+    if (g_dev->ioctl(ar->fd, ECCGETSTATS, &after)) {
+        fprintf(stderr, "mtd: ECCGETSTATS error (%s)\n", strerror(errno));
+        return -1;
+    }
+    if (got == (ssize_t) size && after.failed == before.failed) {
+        return count;
+    }
+
+    if (count == 1) {
+        if (got != (ssize_t) size) {
+            fprintf(stderr, "mtd: read error at 0x%08llx (%s)\n",
+                    (long long) pos, strerror(errno));
+        } else {
+            fprintf(stderr, "mtd: ECC errors (%d soft, %d hard) at 0x%08llx\n",
+                    after.corrected - before.corrected,
+                    after.failed - before.failed, (long long) pos);
+        }
+        return 0;
+    }
+
+    // Something in the run failed; find out which blocks.
+    int i, good = 0;
+    for (i = 0; i < count; ++i) {
+        int r = read_block_run(ar, first + i, 1, data + good * erase_size);
+        if (r < 0) return -1;
+        good += r;
+    }
+    return good;
+}
+
+static void *async_read_thread(void *cookie)
+{
+    MtdAsyncRead *ar = (MtdAsyncRead *) cookie;
+    const size_t erase_size = ar->partition->erase_size;
+    int slot = 0;
+    int error = 0;
+
+    while (ar->remaining > 0) {
+        pthread_mutex_lock(&ar->lock);
+        while (ar->slots[slot].full && !ar->abort) {
+            pthread_cond_wait(&ar->cond, &ar->lock);
+        }
+        int abort = ar->abort;
+        pthread_mutex_unlock(&ar->lock);
+        if (abort) break;
+
+        // Gather a run of contiguous good blocks.
+        while (ar->next_block < ar->num_blocks &&
+               block_is_bad(ar->partition, ar->fd,
+                            (off_t) ar->next_block * erase_size)) {
+            ++ar->next_block;
+        }
+        if (ar->next_block >= ar->num_blocks) {
+            error = ENOSPC;
+            break;
+        }
+        unsigned int first = ar->next_block;
+        int count = 0;
+        while (count < ar->batch && first + count < ar->num_blocks &&
+               !block_is_bad(ar->partition, ar->fd,
+                             (off_t) (first + count) * erase_size) &&
+               (size_t) count * erase_size < ar->remaining) {
+            ++count;
+        }
+        ar->next_block = first + count;
+
+        int good = read_block_run(ar, first, count, ar->slots[slot].data);
+        if (good < 0) {
+            error = errno ? errno : EIO;
+            break;
+        }
+        size_t len = good * erase_size;
+        if (len > ar->remaining) len = ar->remaining;
+        ar->remaining -= len;
+        if (len == 0) continue;
+
+        pthread_mutex_lock(&ar->lock);
+        ar->slots[slot].len = len;
+        ar->slots[slot].full = 1;
+        pthread_cond_broadcast(&ar->cond);
+        pthread_mutex_unlock(&ar->lock);
+        slot = (slot + 1) % ar->num_slots;
+    }
+
+    pthread_mutex_lock(&ar->lock);
+    ar->done = 1;
+    ar->error = error;
+    pthread_cond_broadcast(&ar->cond);
+    pthread_mutex_unlock(&ar->lock);
+    return NULL;
+}
+
+ssize_t mtd_read_partition_async(const MtdPartition *partition,
+        size_t offset, size_t len, int depth,
+        MtdReadCallback callback, void *cookie)
+{
+    const size_t erase_size = partition->erase_size;
+    MtdAsyncRead ar;
+    ssize_t delivered = -1;
+    int i;
+
+    memset(&ar, 0, sizeof(ar));
+    ar.partition = partition;
+    ar.num_blocks = partition->size / erase_size;
+    ar.next_block = offset / erase_size;
+    ar.remaining = len + offset % erase_size;
+    if (depth < 2) depth = 2;
+    ar.batch = depth / 2 < MTD_READ_BATCH_BLOCKS ? depth / 2
+                                                 : MTD_READ_BATCH_BLOCKS;
+    ar.num_slots = depth / ar.batch;
+
+    ar.fd = g_dev->open(partition->device_index, O_RDONLY);
+    if (ar.fd < 0) return -1;
+
+    ar.slots = calloc(ar.num_slots, sizeof(MtdReadSlot));
+    if (ar.slots == NULL) goto exit;
+    for (i = 0; i < ar.num_slots; ++i) {
+        ar.slots[i].data = malloc(ar.batch * erase_size);
+        if (ar.slots[i].data == NULL) goto exit;
+    }
+
+    pthread_mutex_init(&ar.lock, NULL);
+    pthread_cond_init(&ar.cond, NULL);
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, async_read_thread, &ar) != 0) {
+        pthread_cond_destroy(&ar.cond);
+        pthread_mutex_destroy(&ar.lock);
+        goto exit;
+    }
+
+    // Hand the slots to the callback in order as they fill.  The first
+    // one starts at "offset" within its block.
+    size_t skip = offset % erase_size;
+    int slot = 0;
+    int error = 0;
+    delivered = 0;
+    for (;;) {
+        pthread_mutex_lock(&ar.lock);
+        while (!ar.slots[slot].full && !ar.done) {
+            pthread_cond_wait(&ar.cond, &ar.lock);
+        }
+        int full = ar.slots[slot].full;
+        if (!full) error = ar.error;
+        pthread_mutex_unlock(&ar.lock);
+        if (!full) break;
+
+        MtdReadSlot *s = &ar.slots[slot];
+        int stop = 0;
+        if (s->len > skip) {
+            stop = callback(s->data + skip, s->len - skip, cookie);
+            delivered += s->len - skip;
+        }
+        skip = 0;
+
+        pthread_mutex_lock(&ar.lock);
+        s->full = 0;
+        if (stop) ar.abort = 1;
+        pthread_cond_broadcast(&ar.cond);
+        pthread_mutex_unlock(&ar.lock);
+        if (stop) break;
+        slot = (slot + 1) % ar.num_slots;
+    }
+
+    pthread_join(thread, NULL);
+    pthread_cond_destroy(&ar.cond);
+    pthread_mutex_destroy(&ar.lock);
+    if (error != 0) {
+        errno = error;
+        delivered = -1;
+    }
+
+exit:
+    if (ar.slots != NULL) {
+        for (i = 0; i < ar.num_slots; ++i) free(ar.slots[i].data);
+    }
+    free(ar.slots);
+    g_dev->close(ar.fd);
+    return delivered;
+}
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* The policy a new context starts with.  It is fixed at build time
+ * (TARGET_MTD_WRITE_VERIFY in Android.mk); only a caller that asks for
+ * another one with mtd_write_set_verify() gets anything else.
+ */
+#ifndef MTD_WRITE_VERIFY_DEFAULT
+#define MTD_WRITE_VERIFY_DEFAULT MTD_VERIFY_FULL
+#endif
+
+/* Likewise whether mtd_erase_blocks() skips blocks that are already
+ * erased (TARGET_MTD_SKIP_ERASED); see mtd_write_set_skip_erased().
+ */
+#ifndef MTD_SKIP_ERASED_DEFAULT
+#define MTD_SKIP_ERASED_DEFAULT 0
+#endif
+
 MtdWriteContext *mtd_write_partition(const MtdPartition *partition)
 {
-    MtdWriteContext *ctx = (MtdWriteContext*) malloc(sizeof(MtdWriteContext));
+    MtdWriteContext *ctx = (MtdWriteContext*) calloc(1, sizeof(MtdWriteContext));
     if (ctx == NULL) return NULL;
 
     ctx->bad_block_offsets = NULL;
     ctx->bad_block_alloc = 0;
     ctx->bad_block_count = 0;
 
+    // The read-back buffer is allocated once here rather than for
+    // every block written.
     ctx->buffer = malloc(partition->erase_size);
-    if (ctx->buffer == NULL) {
+    ctx->verify = malloc(partition->erase_size);
+    ctx->stats.num_blocks = partition->size / partition->erase_size;
+    ctx->stats.blocks = calloc(ctx->stats.num_blocks, sizeof(MtdBlockTiming));
+    if (ctx->buffer == NULL || ctx->verify == NULL ||
+        ctx->stats.blocks == NULL) {
+        free(ctx->stats.blocks);
+        free(ctx->verify);
+        free(ctx->buffer);
         free(ctx);
         return NULL;
     }
 
-    char mtddevname[32];
-    sprintf(mtddevname, "/dev/mtd/mtd%d", partition->device_index);
-    ctx->fd = open(mtddevname, O_RDWR);
+    ctx->fd = g_dev->open(partition->device_index, O_RDWR);
     if (ctx->fd < 0) {
+        free(ctx->stats.blocks);
+        free(ctx->verify);
         free(ctx->buffer);
         free(ctx);
         return NULL;
@@ -414,9 +821,122 @@ MtdWriteContext *mtd_write_partition(const MtdPartition *partition)
 
     ctx->partition = partition;
     ctx->stored = 0;
+    pthread_mutex_init(&ctx->hash_lock, NULL);
+    pthread_cond_init(&ctx->hash_cond, NULL);
+    ctx->verify_policy = MTD_WRITE_VERIFY_DEFAULT;
+    ctx->verify_interval = MTD_DEFAULT_VERIFY_INTERVAL;
+    ctx->skip_erased = MTD_SKIP_ERASED_DEFAULT;
     return ctx;
 }
 
+/* Reads back the blocks queued by queue_hash_check() and compares
+ * their CRCs with what was written.  A mismatch can't be retried by
+ * then, so it is only counted, and makes mtd_write_close() fail.
+ */
+static void *hash_verify_thread(void *cookie)
+{
+    MtdWriteContext *ctx = (MtdWriteContext *) cookie;
+    const size_t size = ctx->partition->erase_size;
+
+    pthread_mutex_lock(&ctx->hash_lock);
+    for (;;) {
+        while (ctx->hash_count == 0 && !ctx->hash_stop) {
+            pthread_cond_wait(&ctx->hash_cond, &ctx->hash_lock);
+        }
+        if (ctx->hash_count == 0) break;
+        MtdHashCheck check = ctx->hash_queue[ctx->hash_head];
+        pthread_mutex_unlock(&ctx->hash_lock);
+
+        uint64_t start = now_us();
+        int ok = g_dev->pread(ctx->fd, ctx->hash_verify, size, check.pos) ==
+                 (ssize_t) size &&
+                 CRC32_update(0, ctx->hash_verify, size) == check.crc;
+        uint32_t elapsed = now_us() - start;
+        if (!ok) {
+            fprintf(stderr, "mtd: verification error at 0x%08lx "
+                    "(found after writing)\n", check.pos);
+        }
+
+        pthread_mutex_lock(&ctx->hash_lock);
+        ctx->stats.blocks_verified++;
+        ctx->stats.verify_us += elapsed;
+        ctx->stats.blocks[check.pos / size].verify_us += elapsed;
+        if (!ok) ctx->stats.verify_failures++;
+        ctx->hash_head = (ctx->hash_head + 1) % MTD_HASH_QUEUE_SIZE;
+        ctx->hash_count--;
+        pthread_cond_broadcast(&ctx->hash_cond);
+    }
+    pthread_mutex_unlock(&ctx->hash_lock);
+    return NULL;
+}
+
+static int queue_hash_check(MtdWriteContext *ctx, off_t pos, const char *data)
+{
+    const size_t size = ctx->partition->erase_size;
+    MtdHashCheck check;
+    check.pos = pos;
+    check.crc = CRC32_update(0, data, size);
+
+    if (!ctx->hash_thread_running) {
+        ctx->hash_verify = malloc(size);
+        if (ctx->hash_verify == NULL ||
+            pthread_create(&ctx->hash_thread, NULL, hash_verify_thread,
+                           ctx) != 0) {
+            free(ctx->hash_verify);
+            ctx->hash_verify = NULL;
+            return -1;
+        }
+        ctx->hash_thread_running = 1;
+    }
+
+    pthread_mutex_lock(&ctx->hash_lock);
+    while (ctx->hash_count == MTD_HASH_QUEUE_SIZE) {
+        pthread_cond_wait(&ctx->hash_cond, &ctx->hash_lock);
+    }
+    ctx->hash_queue[(ctx->hash_head + ctx->hash_count) %
+                    MTD_HASH_QUEUE_SIZE] = check;
+    ctx->hash_count++;
+    pthread_cond_broadcast(&ctx->hash_cond);
+    pthread_mutex_unlock(&ctx->hash_lock);
+    return 0;
+}
+
+/* Wait for the verify thread to finish everything queued so far.
+ */
+static void drain_hash_checks(MtdWriteContext *ctx)
+{
+    if (!ctx->hash_thread_running) return;
+    pthread_mutex_lock(&ctx->hash_lock);
+    while (ctx->hash_count > 0) {
+        pthread_cond_wait(&ctx->hash_cond, &ctx->hash_lock);
+    }
+    pthread_mutex_unlock(&ctx->hash_lock);
+}
+
+void mtd_write_set_verify(MtdWriteContext *ctx, MtdVerifyPolicy policy,
+        int interval)
+{
+    ctx->verify_policy = policy;
+    ctx->verify_interval = interval > 0 ? interval
+                                        : MTD_DEFAULT_VERIFY_INTERVAL;
+}
+
+void mtd_write_set_skip_erased(MtdWriteContext *ctx, int skip)
+{
+    ctx->skip_erased = skip;
+}
+
+void mtd_write_set_skip_identical(MtdWriteContext *ctx, int skip)
+{
+    ctx->skip_identical = skip;
+}
+
+const MtdWriteStats *mtd_write_stats(MtdWriteContext *ctx)
+{
+    drain_hash_checks(ctx);
+    return &ctx->stats;
+}
+
 static void add_bad_block_offset(MtdWriteContext *ctx, off_t pos) {
     if (ctx->bad_block_count + 1 > ctx->bad_block_alloc) {
         ctx->bad_block_alloc = (ctx->bad_block_alloc*2) + 1;
@@ -426,78 +946,136 @@ static void add_bad_block_offset(MtdWriteContext *ctx, off_t pos) {
     ctx->bad_block_offsets[ctx->bad_block_count++] = pos;
 }
 
+/* Whether the block about to be written should be read back and
+ * compared before write_block() moves on.  Blocks that needed a retry
+ * are always checked.
+ */
+static int verify_now(MtdWriteContext *ctx, int retry)
+{
+    switch (ctx->verify_policy) {
+        case MTD_VERIFY_FULL:
+            return 1;
+        case MTD_VERIFY_SAMPLED:
+            return retry > 0 ||
+                   ctx->stats.blocks_written % ctx->verify_interval == 0;
+        default:
+            return retry > 0;
+    }
+}
+
+/* Whether the block at pos already holds "data" and read cleanly; one
+ * that needed ECC correction is rewritten to refresh it.
+ */
+static int block_unchanged(MtdWriteContext *ctx, off_t pos, const char *data)
+{
+    const ssize_t size = ctx->partition->erase_size;
+    struct mtd_ecc_stats before, after;
+
+    if (g_dev->ioctl(ctx->fd, ECCGETSTATS, &before) != 0) return 0;
+    int same = g_dev->pread(ctx->fd, ctx->verify, size, pos) == size &&
+               memcmp(data, ctx->verify, size) == 0;
+    if (g_dev->ioctl(ctx->fd, ECCGETSTATS, &after) != 0) return 0;
+    return same && after.corrected == before.corrected &&
+           after.failed == before.failed;
+}
+
 static int write_block(MtdWriteContext *ctx, const char *data)
 {
     const MtdPartition *partition = ctx->partition;
     int fd = ctx->fd;
-    char *verify = NULL;
 
     off_t pos = lseek(fd, 0, SEEK_CUR);
     if (pos == (off_t) -1) return 1;
 
     ssize_t size = partition->erase_size;
     while (pos + size <= (int) partition->size) {
-        loff_t bpos = pos;
-        int ret = ioctl(fd, MEMGETBADBLOCK, &bpos);
-        if (ret != 0 && !(ret == -1 && errno == EOPNOTSUPP)) {
+        if (block_is_bad(partition, fd, pos)) {
             add_bad_block_offset(ctx, pos);
-            fprintf(stderr,
-                    "mtd: not writing bad block at 0x%08lx (ret %d errno %d)\n",
-                    pos, ret, errno);
+            ctx->stats.bad_blocks_skipped++;
+            fprintf(stderr, "mtd: not writing bad block at 0x%08lx\n", pos);
             pos += partition->erase_size;
             continue;  // Don't try to erase known factory-bad blocks.
         }
 
+        if (ctx->skip_identical && block_unchanged(ctx, pos, data)) {
+            if (lseek(fd, pos + size, SEEK_SET) != pos + size) return -1;
+            ctx->stats.blocks_unchanged++;
+            return 0;
+        }
+
+        MtdBlockTiming *timing = &ctx->stats.blocks[pos / size];
         struct erase_info_user erase_info;
         erase_info.start = pos;
         erase_info.length = size;
         int retry;
         for (retry = 0; retry < 2; ++retry) {
-            if (ioctl(fd, MEMERASE, &erase_info) < 0) {
+            uint64_t t0 = now_us();
+            if (g_dev->ioctl(fd, MEMERASE, &erase_info) < 0) {
                 fprintf(stderr, "mtd: erase failure at 0x%08lx (%s)\n",
                         pos, strerror(errno));
+                // The driver may have marked it bad.
+                mtd_invalidate_bad_blocks(partition);
                 continue;
             }
+            uint64_t t1 = now_us();
+            ctx->stats.blocks_erased++;
             if (lseek(fd, pos, SEEK_SET) != pos ||
-                write(fd, data, size) != size) {
+                g_dev->write(fd, data, size) != size) {
                 fprintf(stderr, "mtd: write error at 0x%08lx (%s)\n",
                         pos, strerror(errno));
             }
-
-            verify = malloc(size);
-            if (verify == NULL) {
-                fprintf(stderr, "mtd: failed to malloc size=%u (%s)\n", size, strerror(errno));
-                return -1;
-            }
-            if (lseek(fd, pos, SEEK_SET) != pos ||
-                read(fd, verify, size) != size) {
-                fprintf(stderr, "mtd: re-read error at 0x%08lx (%s)\n",
-                        pos, strerror(errno));
-                if (verify)
-                    free(verify);
-                continue;
-            }
-            if (memcmp(data, verify, size) != 0) {
-                fprintf(stderr, "mtd: verification error at 0x%08lx (%s)\n",
-                        pos, strerror(errno));
-                if (verify)
-                    free(verify);
-                continue;
+            uint64_t t2 = now_us();
+            timing->erase_us += t1 - t0;
+            timing->program_us += t2 - t1;
+            ctx->stats.erase_us += t1 - t0;
+            ctx->stats.program_us += t2 - t1;
+            if (retry > 0) ctx->stats.retries++;
+
+            // pread() leaves the file position after the block, where
+            // the write left it.
+            if (verify_now(ctx, retry)) {
+                int ok = g_dev->pread(fd, ctx->verify, size, pos) == size;
+                if (!ok) {
+                    fprintf(stderr, "mtd: re-read error at 0x%08lx (%s)\n",
+                            pos, strerror(errno));
+                } else if (memcmp(data, ctx->verify, size) != 0) {
+                    fprintf(stderr, "mtd: verification error at 0x%08lx\n",
+                            pos);
+                    ok = 0;
+                }
+                uint32_t elapsed = now_us() - t2;
+                timing->verify_us += elapsed;
+                pthread_mutex_lock(&ctx->hash_lock);
+                ctx->stats.verify_us += elapsed;
+                ctx->stats.blocks_verified++;
+                if (!ok) ctx->stats.verify_failures++;
+                pthread_mutex_unlock(&ctx->hash_lock);
+                if (!ok) continue;
+            } else if (ctx->verify_policy == MTD_VERIFY_HASH &&
+                       queue_hash_check(ctx, pos, data) != 0) {
+                fprintf(stderr, "mtd: can't start verify thread; "
+                        "verifying in line\n");
+                ctx->verify_policy = MTD_VERIFY_FULL;
+                if (g_dev->pread(fd, ctx->verify, size, pos) != size ||
+                    memcmp(data, ctx->verify, size) != 0) {
+                    fprintf(stderr, "mtd: verification error at 0x%08lx\n",
+                            pos);
+                    continue;
+                }
             }
 
             if (retry > 0) {
                 fprintf(stderr, "mtd: wrote block after %d retries\n", retry);
             }
             fprintf(stderr, "mtd: successfully wrote block at %llx\n", pos);
-            if (verify)
-                free(verify);
+            ctx->stats.blocks_written++;
             return 0;  // Success!
         }
 
         // Try to erase it once more as we give up on this block
         add_bad_block_offset(ctx, pos);
         fprintf(stderr, "mtd: skipping write block at 0x%08lx\n", pos);
-        ioctl(fd, MEMERASE, &erase_info);
+        g_dev->ioctl(fd, MEMERASE, &erase_info);
         pos += partition->erase_size;
     }
 
@@ -535,6 +1113,70 @@ ssize_t mtd_write_data(MtdWriteContext *ctx, const char *data, size_t len)
     return wrote;
 }
 
+static int all_ff(const char *data, size_t len)
+{
+    // The buffers come from malloc() and len is a page multiple, so
+    // this can go a word at a time.
+    const uint32_t *words = (const uint32_t *) data;
+    size_t i;
+    for (i = 0; i < len / 4; ++i) {
+        if (words[i] != 0xffffffff) return 0;
+    }
+    return 1;
+}
+
+/* Whether the block at pos reads back erased.  The first page is read
+ * on its own, since that is usually enough to reject a block holding
+ * data, then the rest in one go.  A page programmed with all-0xff data
+ * still has ECC bytes in its spare area, so that is checked too where
+ * the driver supports MEMREADOOB.
+ */
+static int block_is_erased(MtdWriteContext *ctx, off_t pos)
+{
+    const size_t size = ctx->partition->erase_size;
+    size_t off, i;
+
+    if (ctx->page_size == 0) {
+        struct mtd_info_user info;
+        ctx->page_size = size < 2048 ? size : 2048;
+        if (g_dev->ioctl(ctx->fd, MEMGETINFO, &info) == 0 &&
+            info.writesize > 0 && size % info.writesize == 0) {
+            ctx->page_size = info.writesize;
+            ctx->oob_size = info.oobsize;
+            ctx->oob = malloc(info.oobsize);
+            if (ctx->oob == NULL) ctx->oob_size = 0;
+        }
+    }
+
+    if (g_dev->pread(ctx->fd, ctx->verify, ctx->page_size, pos) !=
+            (ssize_t) ctx->page_size ||
+        !all_ff(ctx->verify, ctx->page_size)) {
+        return 0;
+    }
+    size_t rest = size - ctx->page_size;
+    if (rest > 0 &&
+        (g_dev->pread(ctx->fd, ctx->verify, rest, pos + ctx->page_size) !=
+             (ssize_t) rest ||
+         !all_ff(ctx->verify, rest))) {
+        return 0;
+    }
+
+    for (off = 0; off < size && ctx->oob_size > 0; off += ctx->page_size) {
+        struct mtd_oob_buf oob;
+        oob.start = pos + off;
+        oob.length = ctx->oob_size;
+        oob.ptr = ctx->oob;
+        if (g_dev->ioctl(ctx->fd, MEMREADOOB, &oob) != 0) {
+            ctx->oob_size = 0;  // not supported; check data only
+            break;
+        }
+        for (i = 0; i < ctx->oob_size; ++i) {
+            if (ctx->oob[i] != 0xff) return 0;
+        }
+    }
+    return 1;
+}
+
 off_t mtd_erase_blocks(MtdWriteContext *ctx, int blocks)
 {
     // Zero-pad and write any pending data to get us to a block boundary
@@ -557,19 +1199,27 @@ off_t mtd_erase_blocks(MtdWriteContext *ctx, int blocks)
 
     // Erase the specified number of blocks
     while (blocks-- > 0) {
-        loff_t bpos = pos;
-        if (ioctl(ctx->fd, MEMGETBADBLOCK, &bpos) > 0) {
+        if (block_is_bad(ctx->partition, ctx->fd, pos)) {
             fprintf(stderr, "mtd: not erasing bad block at 0x%08lx\n", pos);
             pos += ctx->partition->erase_size;
             continue;  // Don't try to erase known factory-bad blocks.
         }
 
+        uint64_t start = now_us();
         struct erase_info_user erase_info;
         erase_info.start = pos;
         erase_info.length = ctx->partition->erase_size;
-        if (ioctl(ctx->fd, MEMERASE, &erase_info) < 0) {
+        if (ctx->skip_erased && block_is_erased(ctx, pos)) {
+            ctx->stats.erase_skipped++;
+        } else if (g_dev->ioctl(ctx->fd, MEMERASE, &erase_info) < 0) {
             fprintf(stderr, "mtd: erase failure at 0x%08lx\n", pos);
+            mtd_invalidate_bad_blocks(ctx->partition);
+        } else {
+            ctx->stats.blocks_erased++;
         }
+        uint32_t elapsed = now_us() - start;
+        ctx->stats.erase_us += elapsed;
+        ctx->stats.blocks[pos / ctx->partition->erase_size].erase_us += elapsed;
         pos += ctx->partition->erase_size;
     }
 
@@ -581,8 +1231,39 @@ int mtd_write_close(MtdWriteContext *ctx)
     int r = 0;
     // Make sure any pending data gets written
     if (mtd_erase_blocks(ctx, 0) == (off_t) -1) r = -1;
-    if (close(ctx->fd)) r = -1;
+
+    // ...and checked.
+    if (ctx->hash_thread_running) {
+        pthread_mutex_lock(&ctx->hash_lock);
+        ctx->hash_stop = 1;
+        pthread_cond_broadcast(&ctx->hash_cond);
+        pthread_mutex_unlock(&ctx->hash_lock);
+        pthread_join(ctx->hash_thread, NULL);
+    }
+    const MtdWriteStats *st = &ctx->stats;
+    if (st->verify_failures > 0 && ctx->verify_policy == MTD_VERIFY_HASH) {
+        fprintf(stderr, "mtd: %u block(s) failed verification\n",
+                st->verify_failures);
+        r = -1;
+    }
+    fprintf(stderr, "mtd: wrote %u blocks (%u unchanged, %u verified, "
+            "%u retries), erased %u (%u already erased): "
+            "erase %llu ms, program %llu ms, verify %llu ms\n",
+            st->blocks_written, st->blocks_unchanged, st->blocks_verified,
+            st->retries,
+            st->blocks_erased, st->erase_skipped,
+            (unsigned long long) st->erase_us / 1000,
+            (unsigned long long) st->program_us / 1000,
+            (unsigned long long) st->verify_us / 1000);
+
+    if (g_dev->close(ctx->fd)) r = -1;
+    pthread_cond_destroy(&ctx->hash_cond);
+    pthread_mutex_destroy(&ctx->hash_lock);
     free(ctx->bad_block_offsets);
+    free(ctx->stats.blocks);
+    free(ctx->hash_verify);
+    free(ctx->oob);
+    free(ctx->verify);
     free(ctx->buffer);
     free(ctx);
     return r;
@@ -603,169 +1284,477 @@ off_t mtd_find_write_start(MtdWriteContext *ctx, off_t pos) {
     return pos;
 }
 
+/* file_copy_from_partition() runs as a pipeline: the caller's thread
+ * reads (through mtd_read_partition_async() for MTD, which reads ahead
+ * on its own thread), a pool of threads compresses each 1 MB chunk to
+ * a separate gzip member, and a writer thread writes them in order.
+ * Concatenated gzip members are a valid gzip file.  Raw copies skip
+ * the compressors and leave holes where the data is all zeros.
+ */
 #define FILE_COPY_BUFFER_SIZE	0x100000
+#define FILE_COPY_SPARSE_BLOCK	4096
+
+typedef enum {
+    COPY_FREE,          // reader may fill it
+    COPY_FILLED,        // waiting for a compressor
+    COPY_BUSY,          // being compressed
+    COPY_DONE,          // waiting for the writer
+} CopySlotState;
+
+typedef struct {
+    char *data;
+    size_t len;
+    unsigned char *out;         // gzip member, for compressed copies
+    size_t out_len;
+    CopySlotState state;
+} CopySlot;
+
+typedef struct {
+    const PartitionCopyOptions *options;
+    int fd;
+    CopySlot *slots;
+    int num_slots;
+    size_t out_alloc;           // size of each slot's "out"
+
+    unsigned int next_fill;     // chunk the reader is filling
+    unsigned int next_compress;
+    unsigned int next_write;
+    int reader_done;
+    int error;                  // errno of the first failure
+    off64_t written;            // bytes of output, holes included
+
+    // Whole chunks of 0x00 or 0xff (zeroed or erased flash) compress
+    // to the same member every time, so it is kept.
+    unsigned char *constant_member[2];
+    size_t constant_len[2];
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} PartitionCopy;
+
+static int is_constant(const char *data, size_t len, unsigned char c)
+{
+    if (len == 0 || (unsigned char) data[0] != c) return 0;
+    return memcmp(data, data + 1, len - 1) == 0;
+}
+
+static void copy_fail(PartitionCopy *pc, int error)
+{
+    pthread_mutex_lock(&pc->lock);
+    if (pc->error == 0) pc->error = error ? error : EIO;
+    pthread_cond_broadcast(&pc->cond);
+    pthread_mutex_unlock(&pc->lock);
+}
+
+static int gzip_chunk(z_stream *z, CopySlot *slot, size_t out_alloc)
+{
+    if (deflateReset(z) != Z_OK) return -1;
+    z->next_in = (Bytef *) slot->data;
+    z->avail_in = slot->len;
+    z->next_out = slot->out;
+    z->avail_out = out_alloc;
+    if (deflate(z, Z_FINISH) != Z_STREAM_END) return -1;
+    slot->out_len = out_alloc - z->avail_out;
+    return 0;
+}
+
+static void *copy_compress_thread(void *cookie)
+{
+    PartitionCopy *pc = (PartitionCopy *) cookie;
+    z_stream z;
+
+    memset(&z, 0, sizeof(z));
+    // windowBits 15 + 16 writes a gzip header and trailer.
+    if (deflateInit2(&z, pc->options->gzip_level, Z_DEFLATED, 15 + 16, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+        copy_fail(pc, ENOMEM);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&pc->lock);
+    for (;;) {
+        CopySlot *slot = &pc->slots[pc->next_compress % pc->num_slots];
+        while (pc->error == 0 && slot->state != COPY_FILLED &&
+               !(pc->reader_done && pc->next_compress == pc->next_fill)) {
+            pthread_cond_wait(&pc->cond, &pc->lock);
+            slot = &pc->slots[pc->next_compress % pc->num_slots];
+        }
+        if (pc->error != 0 || slot->state != COPY_FILLED) break;
+        slot->state = COPY_BUSY;
+        pc->next_compress++;
+
+        int constant = -1;
+        if (slot->len == FILE_COPY_BUFFER_SIZE) {
+            if (is_constant(slot->data, slot->len, 0x00)) constant = 0;
+            else if (is_constant(slot->data, slot->len, 0xff)) constant = 1;
+        }
+        if (constant >= 0 && pc->constant_member[constant] != NULL) {
+            slot->out_len = pc->constant_len[constant];
+            memcpy(slot->out, pc->constant_member[constant], slot->out_len);
+        } else {
+            pthread_mutex_unlock(&pc->lock);
+            int ret = gzip_chunk(&z, slot, pc->out_alloc);
+            pthread_mutex_lock(&pc->lock);
+            if (ret != 0) {
+                if (pc->error == 0) pc->error = EIO;
+                pthread_cond_broadcast(&pc->cond);
+                break;
+            }
+            if (constant >= 0 && pc->constant_member[constant] == NULL) {
+                pc->constant_member[constant] = malloc(slot->out_len);
+                if (pc->constant_member[constant] != NULL) {
+                    memcpy(pc->constant_member[constant], slot->out,
+                           slot->out_len);
+                    pc->constant_len[constant] = slot->out_len;
+                }
+            }
+        }
+        slot->state = COPY_DONE;
+        pthread_cond_broadcast(&pc->cond);
+    }
+    pthread_mutex_unlock(&pc->lock);
+    deflateEnd(&z);
+    return NULL;
+}
+
+static int write_fully(int fd, const void *data, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        data = (const char *) data + n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* Write a chunk of a raw copy, seeking over runs of zeros instead. */
+static int write_sparse(PartitionCopy *pc, const char *data, size_t len)
+{
+    size_t pos = 0;
+    while (pos < len) {
+        size_t n = len - pos < FILE_COPY_SPARSE_BLOCK ? len - pos
+                                                      : FILE_COPY_SPARSE_BLOCK;
+        size_t run = 0;
+        int zero = is_constant(data + pos, n, 0x00);
+        do {
+            run += n;
+            n = len - pos - run < FILE_COPY_SPARSE_BLOCK ?
+                len - pos - run : FILE_COPY_SPARSE_BLOCK;
+        } while (n > 0 && is_constant(data + pos + run, n, 0x00) == zero);
+
+        if (zero) {
+            if (lseek64(pc->fd, run, SEEK_CUR) == (off64_t) -1) return -1;
+        } else if (write_fully(pc->fd, data + pos, run) != 0) {
+            return -1;
+        }
+        pos += run;
+    }
+    return 0;
+}
+
+static void *copy_write_thread(void *cookie)
+{
+    PartitionCopy *pc = (PartitionCopy *) cookie;
+    const int gzip = pc->options->gzip_level > 0;
+
+    pthread_mutex_lock(&pc->lock);
+    for (;;) {
+        CopySlot *slot = &pc->slots[pc->next_write % pc->num_slots];
+        while (pc->error == 0 && slot->state != COPY_DONE &&
+               !(pc->reader_done && pc->next_write == pc->next_fill)) {
+            pthread_cond_wait(&pc->cond, &pc->lock);
+        }
+        if (pc->error != 0 || slot->state != COPY_DONE) break;
+        pthread_mutex_unlock(&pc->lock);
+
+        int ret;
+        size_t len;
+        if (gzip) {
+            len = slot->out_len;
+            ret = write_fully(pc->fd, slot->out, len);
+        } else if (pc->options->sparse) {
+            len = slot->len;
+            ret = write_sparse(pc, slot->data, len);
+        } else {
+            len = slot->len;
+            ret = write_fully(pc->fd, slot->data, len);
+        }
+        int error = errno;
+
+        pthread_mutex_lock(&pc->lock);
+        if (ret != 0) {
+            if (pc->error == 0) pc->error = error ? error : EIO;
+            pthread_cond_broadcast(&pc->cond);
+            break;
+        }
+        pc->written += len;
+        slot->len = 0;
+        slot->state = COPY_FREE;
+        pc->next_write++;
+        pthread_cond_broadcast(&pc->cond);
+    }
+    pthread_mutex_unlock(&pc->lock);
+    return NULL;
+}
+
+/* Hand a full (or the last) chunk on to the compressors or writer. */
+static int copy_queue(PartitionCopy *pc)
+{
+    CopySlot *slot = &pc->slots[pc->next_fill % pc->num_slots];
+    pthread_mutex_lock(&pc->lock);
+    slot->state = pc->options->gzip_level > 0 ? COPY_FILLED : COPY_DONE;
+    pc->next_fill++;
+    pthread_cond_broadcast(&pc->cond);
+    pthread_mutex_unlock(&pc->lock);
+    return 0;
+}
 
-int file_copy_from_partition(const char *dest_path, const char *partition_type, const char *partition, ssize_t offset, ssize_t file_size)
-{
-	int result = -1;
-	FILE* f_dest = NULL;
-
-
-	if(!strcmp(partition_type, "MTD"))
-	{
-		MtdReadContext* ctx = NULL;
-
-		mtd_scan_partitions();
-
-
-	    const MtdPartition* mtd = mtd_find_partition_by_name(partition);
-	    if (mtd == NULL) {
-	        fprintf(stderr, "mtd partition \"%s\" not found!\n", partition);
-	        return -1;
-	    }
-
-	    ctx = mtd_read_partition(mtd);
-	    if (ctx == NULL) {
-	        fprintf(stderr, "failed to initialize read of mtd partition \"%s\"\n",
-	               partition);
-	        return -1;
-	    }
-
-		f_dest = fopen(dest_path, "wb+");
-	    if (f_dest == NULL) {
-	        fprintf(stderr, "%s: can't open %s: %s\n", dest_path, strerror(errno));
-	        result = errno;
-	        goto done_MTD;
-	    }
-
-		lseek64(ctx->fd, offset, SEEK_SET);
-
-	    void *buffer = malloc(ctx->partition->erase_size);
-		ssize_t read = 0;
-	    while (read < file_size)
-		{
-			if (ctx->consumed < ctx->partition->erase_size) {
-	            size_t avail = ctx->partition->erase_size - ctx->consumed;
-	            size_t copy = file_size - read < avail ? file_size - read : avail;
-
-				if(copy != fwrite(ctx->buffer + ctx->consumed, 1, copy, f_dest))
-				{
-					fprintf(stderr, "%s: can't write %s: %s\n", dest_path, strerror(errno));
-				}
-	            ctx->consumed += copy;
-	            read += copy;
-	        }
-
-	        // Read complete blocks directly into the user's buffer
-	        while (ctx->consumed == ctx->partition->erase_size &&
-	               file_size - read >= ctx->partition->erase_size)
-			{
-				if (read_block(ctx->partition, ctx->fd, buffer)) return -1;
-				if(ctx->partition->erase_size != fwrite(buffer, 1, ctx->partition->erase_size, f_dest))
-				{
-					fprintf(stderr, "%s: can't write %s: %s\n", dest_path, strerror(errno));
-				}
-	            read += ctx->partition->erase_size;
-	        }
-
-	        if (read >= file_size)
-			{
-	            result = read;
-				goto done_MTD;
-	        }
-
-	        // Read the next block into the buffer
-	        if (ctx->consumed == ctx->partition->erase_size && read < (int) file_size)
-			{
-				if (read_block(ctx->partition, ctx->fd, ctx->buffer)) return -1;
-	            ctx->consumed = 0;
-	        }
-	    }
-
-	done_MTD:
-		mtd_read_close(ctx);
-		if(buffer)
-		{
-			free(buffer);
-			buffer = NULL;
-		}
-		if(f_dest)
-		{
-			fclose(f_dest);
-			f_dest = NULL;
-		}
-	}
-	else if(!strcmp(partition_type, "eMMC"))
-	{
-		FILE* f_src = NULL;
-		void *buffer = NULL;
-		f_src = fopen(partition, "rb");
-	    if (f_src == NULL) {
-	        fprintf(stderr, "%s: can't open eMMC parition %s: %s\n", dest_path, strerror(errno));
-	        result = errno;
-	        goto done_eMMC;
-	    }
-		
-		f_dest = fopen(dest_path, "wb+");
-	    if (f_dest == NULL) {
-	        fprintf(stderr, "%s: can't open %s: %s\n", dest_path, strerror(errno));
-	        result = errno;
-	        goto done_eMMC;
-	    }
-	    
-		buffer = malloc(FILE_COPY_BUFFER_SIZE);
-		ssize_t read = 0;
-		ssize_t copy = 0;
-	    while (read < file_size)
-		{
-			if((read+FILE_COPY_BUFFER_SIZE) < file_size)
-			{
-				copy = FILE_COPY_BUFFER_SIZE;
-			}
-			else
-			{
-				copy = file_size - read;
-			}
-			if(copy != fread(buffer, 1, copy, f_src))
-			{
-				fprintf(stderr, "%s: can't read %s: %s\n", partition, strerror(errno));
-				result = errno;
-				goto done_eMMC;
-			}
-			if(copy != fwrite(buffer, 1, copy, f_dest))
-			{
-				fprintf(stderr, "%s: can't read %s: %s\n", dest_path, strerror(errno));
-				result = errno;
-				goto done_eMMC;
-			}
-			read += copy;
-			if (read >= file_size)
-			{
-				result = read;
-				goto done_eMMC;
-	        }
-		}
-
-		done_eMMC:
-			
-		if(buffer)
-		{
-			free(buffer);
-			buffer = NULL;
-		}
-		if(f_src)
-		{
-			fclose(f_src);
-			f_src = NULL;
-		}
-
-		if(f_dest)
-		{
-			fclose(f_dest);
-			f_dest = NULL;
-		}
-	}
-	printf("file_copy_from_partition finish! result=%d\n", result);
-	return result;
+/* Add data from the partition to the chunk being filled, waiting for
+ * a free slot when the pipeline is full.  Returns nonzero once the
+ * copy has failed.
+ */
+static int copy_put(const char *data, size_t len, void *cookie)
+{
+    PartitionCopy *pc = (PartitionCopy *) cookie;
+    while (len > 0) {
+        CopySlot *slot = &pc->slots[pc->next_fill % pc->num_slots];
+        pthread_mutex_lock(&pc->lock);
+        while (pc->error == 0 && slot->state != COPY_FREE) {
+            pthread_cond_wait(&pc->cond, &pc->lock);
+        }
+        int error = pc->error;
+        pthread_mutex_unlock(&pc->lock);
+        if (error != 0) return 1;
+
+        size_t copy = FILE_COPY_BUFFER_SIZE - slot->len;
+        if (copy > len) copy = len;
+        memcpy(slot->data + slot->len, data, copy);
+        slot->len += copy;
+        data += copy;
+        len -= copy;
+        if (slot->len == FILE_COPY_BUFFER_SIZE) copy_queue(pc);
+    }
+    return 0;
+}
+
+static int copy_from_mtd(PartitionCopy *pc, const char *partition,
+                         int64_t offset, int64_t file_size)
+{
+    if (offset > SSIZE_MAX || file_size > SSIZE_MAX - offset) {
+        fprintf(stderr, "mtd partition \"%s\": %lld bytes at %lld is too "
+                "much to read\n", partition, (long long) file_size,
+                (long long) offset);
+        errno = EFBIG;
+        return -1;
+    }
+    mtd_scan_partitions();
+    const MtdPartition *mtd = mtd_find_partition_by_name(partition);
+    if (mtd == NULL) {
+        fprintf(stderr, "mtd partition \"%s\" not found!\n", partition);
+        errno = ENOENT;
+        return -1;
+    }
+    ssize_t got = mtd_read_partition_async(mtd, offset, file_size, 8,
+                                           copy_put, pc);
+    if (got != (ssize_t) file_size) {
+        if (got >= 0) errno = pc->error ? pc->error : EIO;
+        fprintf(stderr, "can't read mtd partition \"%s\": %s\n",
+                partition, strerror(errno));
+        return -1;
+    }
+    return 0;
 }
 
+static int copy_from_device(PartitionCopy *pc, const char *path,
+                            int64_t offset, int64_t file_size)
+{
+    int fd = open(path, O_RDONLY | O_LARGEFILE);
+    if (fd < 0) {
+        fprintf(stderr, "can't open eMMC partition %s: %s\n",
+                path, strerror(errno));
+        return -1;
+    }
+    char *buffer = malloc(FILE_COPY_BUFFER_SIZE);
+    if (buffer == NULL) {
+        close(fd);
+        return -1;
+    }
+
+    int result = 0;
+    int64_t done = 0;
+    while (done < file_size) {
+        size_t want = file_size - done < FILE_COPY_BUFFER_SIZE ?
+                      (size_t) (file_size - done) : FILE_COPY_BUFFER_SIZE;
+        ssize_t n = pread64(fd, buffer, want, (off64_t) (offset + done));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            if (n == 0) errno = EIO;
+            fprintf(stderr, "can't read %s: %s\n", path, strerror(errno));
+            result = -1;
+            break;
+        }
+        if (copy_put(buffer, n, pc)) {
+            result = -1;
+            break;
+        }
+        done += n;
+    }
+    free(buffer);
+    close(fd);
+    return result;
+}
+
+int64_t file_copy_from_partition_ex(const char *dest_path,
+        const char *partition_type, const char *partition,
+        int64_t offset, int64_t file_size,
+        const PartitionCopyOptions *options)
+{
+    PartitionCopy pc;
+    pthread_t writer;
+    pthread_t *compressors = NULL;
+    int num_compressors = 0;
+    int64_t result = -1;
+    int i;
+
+    if (strcmp(partition_type, "MTD") != 0 &&
+        strcmp(partition_type, "eMMC") != 0) {
+        fprintf(stderr, "unknown partition type %s\n", partition_type);
+        errno = EINVAL;
+        return -1;
+    }
+    if (offset < 0 || file_size < 0 || file_size > INT64_MAX - offset) {
+        fprintf(stderr, "bad range %lld+%lld of %s\n",
+                (long long) offset, (long long) file_size, partition);
+        errno = EINVAL;
+        return -1;
+    }
+
+    memset(&pc, 0, sizeof(pc));
+    pc.options = options;
+    pc.fd = -1;
+    pthread_mutex_init(&pc.lock, NULL);
+    pthread_cond_init(&pc.cond, NULL);
+    if (options->gzip_level > 0) {
+        num_compressors = options->threads;
+        if (num_compressors <= 0) num_compressors = sysconf(_SC_NPROCESSORS_ONLN);
+        if (num_compressors <= 0) num_compressors = 1;
+        z_stream z;
+        memset(&z, 0, sizeof(z));
+        if (deflateInit2(&z, options->gzip_level, Z_DEFLATED, 15 + 16, 8,
+                         Z_DEFAULT_STRATEGY) != Z_OK) {
+            errno = EINVAL;
+            goto exit;
+        }
+        pc.out_alloc = deflateBound(&z, FILE_COPY_BUFFER_SIZE) + 32;
+        deflateEnd(&z);
+    }
+    pc.num_slots = num_compressors * 2 + 2;
+    pc.slots = calloc(pc.num_slots, sizeof(CopySlot));
+    if (pc.slots == NULL) goto exit;
+    for (i = 0; i < pc.num_slots; ++i) {
+        pc.slots[i].data = malloc(FILE_COPY_BUFFER_SIZE);
+        if (pc.slots[i].data == NULL) goto exit;
+        if (pc.out_alloc > 0) {
+            pc.slots[i].out = malloc(pc.out_alloc);
+            if (pc.slots[i].out == NULL) goto exit;
+        }
+    }
+
+    pc.fd = open(dest_path, O_WRONLY | O_CREAT | O_TRUNC | O_LARGEFILE, 0644);
+    if (pc.fd < 0) {
+        fprintf(stderr, "can't open %s: %s\n", dest_path, strerror(errno));
+        goto exit;
+    }
+
+    compressors = calloc(num_compressors + 1, sizeof(pthread_t));
+    if (compressors == NULL) goto exit;
+    for (i = 0; i < num_compressors; ++i) {
+        if (pthread_create(&compressors[i], NULL, copy_compress_thread,
+                           &pc) != 0) {
+            break;
+        }
+    }
+    num_compressors = i;
+    int have_writer =
+        pthread_create(&writer, NULL, copy_write_thread, &pc) == 0;
+    if (!have_writer || (options->gzip_level > 0 && num_compressors == 0)) {
+        copy_fail(&pc, EAGAIN);
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int read_result;
+    if (strcmp(partition_type, "MTD") == 0) {
+        read_result = copy_from_mtd(&pc, partition, offset, file_size);
+    } else {
+        read_result = copy_from_device(&pc, partition, offset, file_size);
+    }
+    int read_errno = errno;
+
+    // Queue the last, partial chunk and let the threads drain.
+    if (read_result == 0 && pc.slots[pc.next_fill % pc.num_slots].len > 0) {
+        copy_queue(&pc);
+    }
+    pthread_mutex_lock(&pc.lock);
+    pc.reader_done = 1;
+    if (read_result != 0 && pc.error == 0) {
+        pc.error = read_errno ? read_errno : EIO;
+    }
+    pthread_cond_broadcast(&pc.cond);
+    pthread_mutex_unlock(&pc.lock);
+    for (i = 0; i < num_compressors; ++i) pthread_join(compressors[i], NULL);
+    if (have_writer) pthread_join(writer, NULL);
+
+    // A raw copy that ends in a hole needs its length set.
+    if (pc.error == 0 && ftruncate64(pc.fd, pc.written) != 0) pc.error = errno;
+    if (close(pc.fd) != 0 && pc.error == 0) pc.error = errno;
+    pc.fd = -1;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (pc.error == 0) {
+        double secs = (end.tv_sec - start.tv_sec) +
+                      (end.tv_nsec - start.tv_nsec) / 1e9;
+        printf("copied %lld bytes from %s to %s (%lld bytes%s) "
+               "in %.2f s\n", (long long) file_size, partition, dest_path,
+               (long long) pc.written,
+               options->gzip_level > 0 ? ", gzip" : "", secs);
+        result = file_size;
+    } else {
+        fprintf(stderr, "copying %s to %s failed: %s\n",
+                partition, dest_path, strerror(pc.error));
+        errno = pc.error;
+    }
+
+exit:
+    if (pc.fd >= 0) close(pc.fd);
+    if (pc.slots != NULL) {
+        for (i = 0; i < pc.num_slots; ++i) {
+            free(pc.slots[i].data);
+            free(pc.slots[i].out);
+        }
+    }
+    free(pc.slots);
+    free(compressors);
+    free(pc.constant_member[0]);
+    free(pc.constant_member[1]);
+    pthread_cond_destroy(&pc.cond);
+    pthread_mutex_destroy(&pc.lock);
+    return result;
+}
+
+int64_t file_copy_from_partition(const char *dest_path,
+        const char *partition_type, const char *partition,
+        int64_t offset, int64_t file_size)
+{
+    PartitionCopyOptions options;
+    options.gzip_level = 0;
+    options.threads = 0;
+    options.sparse = 1;
+    int64_t result = file_copy_from_partition_ex(dest_path, partition_type,
+            partition, offset, file_size, &options);
+    printf("file_copy_from_partition finish! result=%lld\n",
+           (long long) result);
+    return result;
+}
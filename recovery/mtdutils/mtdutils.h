@@ -17,6 +17,7 @@
 #ifndef MTDUTILS_H_
 #define MTDUTILS_H_
 
+#include <stdint.h>
 #include <sys/types.h>  // for size_t, etc.
 
 typedef struct MtdPartition MtdPartition;
@@ -43,15 +44,125 @@ int mtd_partition_info(const MtdPartition *partition,
 typedef struct MtdReadContext MtdReadContext;
 typedef struct MtdWriteContext MtdWriteContext;
 
+/* Readers and writers share each partition's bad block table, which
+ * is built by one scan when first needed.  Call this after marking a
+ * block bad behind mtdutils' back so the next lookup rescans.
+ */
+void mtd_invalidate_bad_blocks(const MtdPartition *);
+
 MtdReadContext *mtd_read_partition(const MtdPartition *);
 ssize_t mtd_read_data(MtdReadContext *, char *data, size_t data_len);
 void mtd_read_close(MtdReadContext *);
 void mtd_read_skip_to(const MtdReadContext *, size_t offset);
 
+/* Read len bytes of a partition starting at offset, skipping bad
+ * blocks like mtd_read_data(), on a background thread that keeps up
+ * to "depth" erase blocks in flight.  The bad-block marks are looked
+ * up once at the start, and runs of good blocks are read and
+ * ECC-checked together.  Each chunk is passed to callback, in order,
+ * on the calling thread; a nonzero return stops the read early.
+ * Returns the number of bytes passed to callback, or -1 on error.
+ */
+typedef int (*MtdReadCallback)(const char *data, size_t len, void *cookie);
+ssize_t mtd_read_partition_async(const MtdPartition *partition,
+        size_t offset, size_t len, int depth,
+        MtdReadCallback callback, void *cookie);
+
 MtdWriteContext *mtd_write_partition(const MtdPartition *);
+
+/* How written blocks are read back and checked.  Whatever the policy,
+ * a block that needed a retry is always checked before moving on.
+ */
+typedef enum {
+    MTD_VERIFY_FULL,        /* read back and compare every block (default) */
+    MTD_VERIFY_SAMPLED,     /* ...only every "interval"th block */
+    MTD_VERIFY_HASH,        /* read back and compare CRCs on a background
+                             * thread; a mismatch fails mtd_write_close()
+                             * instead of being retried */
+    MTD_VERIFY_NONE,
+} MtdVerifyPolicy;
+
+#define MTD_DEFAULT_VERIFY_INTERVAL 16
+
+/* The default is chosen when libmtdutils is built, and is
+ * MTD_VERIFY_FULL unless the board sets TARGET_MTD_WRITE_VERIFY.
+ */
+void mtd_write_set_verify(MtdWriteContext *, MtdVerifyPolicy policy,
+        int interval);
+
+/* Have mtd_erase_blocks() read each block first and leave it alone
+ * if it is already erased (all 0xff, spare area included when the
+ * driver can read it).  A block holding data is usually rejected
+ * after reading its first page; a blank one costs a read of the
+ * whole block instead of an erase, and a cycle of wear.
+ * Off by default, unless libmtdutils is built with
+ * TARGET_MTD_SKIP_ERASED := true.
+ */
+void mtd_write_set_skip_erased(MtdWriteContext *, int skip);
+
+/* Have each block mtd_write_data() would write read back first, and
+ * left as it is (not erased or programmed) if it already holds the
+ * same data and read without ECC corrections.  The write position
+ * still moves past it.  Off by default.
+ */
+void mtd_write_set_skip_identical(MtdWriteContext *, int skip);
+
+/* Time spent on each block, indexed by its position in the partition.
+ */
+typedef struct {
+    uint32_t erase_us;
+    uint32_t program_us;
+    uint32_t verify_us;
+} MtdBlockTiming;
+
+typedef struct {
+    unsigned int blocks_written;
+    unsigned int blocks_unchanged;  /* skipped as identical */
+    unsigned int blocks_verified;
+    unsigned int verify_failures;
+    unsigned int retries;
+    unsigned int bad_blocks_skipped;
+    unsigned int blocks_erased;
+    unsigned int erase_skipped;     /* already erased; see above */
+    uint64_t erase_us;
+    uint64_t program_us;
+    uint64_t verify_us;
+
+    MtdBlockTiming *blocks;
+    unsigned int num_blocks;
+} MtdWriteStats;
+
+/* Waits for any background verification, then returns the context's
+ * counters; valid until mtd_write_close().
+ */
+const MtdWriteStats *mtd_write_stats(MtdWriteContext *);
 ssize_t mtd_write_data(MtdWriteContext *, const char *data, size_t data_len);
 off_t mtd_erase_blocks(MtdWriteContext *, int blocks);  /* 0 ok, -1 for all */
 off_t mtd_find_write_start(MtdWriteContext *ctx, off_t pos);
 int mtd_write_close(MtdWriteContext *);
 
+typedef struct {
+    int gzip_level;     /* 1-9 to write a gzip file, 0 for a raw copy */
+    int threads;        /* compressor threads; 0 for one per CPU */
+    int sparse;         /* raw copies: leave holes for all-zero blocks */
+} PartitionCopyOptions;
+
+/* Copy file_size bytes starting at offset in a partition to a file,
+ * for backups and crash dumps.  partition_type is "MTD", with the
+ * partition's name, or "eMMC", with the path of its block device.
+ * Reading, compressing and writing overlap.  Offsets and sizes are
+ * 64-bit, since eMMC partitions can be bigger than ssize_t on 32-bit
+ * targets (MTD reads are still limited to what fits in ssize_t).
+ * Returns the number of bytes copied, or -1 with errno set.
+ */
+int64_t file_copy_from_partition_ex(const char *dest_path,
+        const char *partition_type, const char *partition,
+        int64_t offset, int64_t file_size,
+        const PartitionCopyOptions *options);
+
+/* The same, as a sparse raw copy. */
+int64_t file_copy_from_partition(const char *dest_path,
+        const char *partition_type, const char *partition,
+        int64_t offset, int64_t file_size);
+
 #endif  // MTDUTILS_H_
@@ -36,6 +36,7 @@
 #include "install.h"
 #include "minui/minui.h"
 #include "minzip/DirUtil.h"
+#include "mtdutils/mtdutils.h"
 #include "roots.h"
 #include "recovery_ui.h"
 #include "efuse.h"
@@ -600,10 +601,11 @@ static int compare_string(const void* a, const void* b) {
 
 static int
 update_directory(const char* path, const char* unmount_when_done,
-                 int* wipe_cache) {
+                 int* wipe_cache, int check_only) {
     ensure_path_mounted(unmount_when_done);
 
-    const char* MENU_HEADERS[] = { "Choose a package to install:",
+    const char* MENU_HEADERS[] = { check_only ? "Choose a package to check:"
+                                              : "Choose a package to install:",
                                    path,
                                    "",
                                    NULL };
@@ -706,7 +708,8 @@ update_directory(const char* path, const char* unmount_when_done,
                 strlcat(new_path, "/", PATH_MAX);
             strlcat(new_path, item, PATH_MAX);
             new_path[strlen(new_path)-1] = '\0';  // truncate the trailing '/'
-            result = update_directory(new_path, unmount_when_done_new, wipe_cache);
+            result = update_directory(new_path, unmount_when_done_new,
+                                      wipe_cache, check_only);
             if (result >= 0) break;
         } else {
             // selected a zip file:  attempt to install it, and return
@@ -717,6 +720,13 @@ update_directory(const char* path, const char* unmount_when_done,
                 strlcat(new_path, "/", PATH_MAX);
             strlcat(new_path, item, PATH_MAX);
 
+            if (check_only) {
+                // Nothing is installed, so check the package where it is.
+                ui_print("\n-- Check %s ...\n", new_path);
+                result = check_package(new_path);
+                break;
+            }
+
             ui_print("\n-- Install %s ...\n", path);
             set_sdcard_update_bootloader_message();
             char* copy = copy_sideloaded_package(new_path);
@@ -867,9 +877,9 @@ prompt_and_wait() {
 
             case ITEM_APPLY_SDCARD:
 #ifdef RECOVERY_HAS_SDCARD_ONLY
-                status = update_directory(SDCARD_ROOT, SDCARD_ROOT, &wipe_cache);
+                status = update_directory(SDCARD_ROOT, SDCARD_ROOT, &wipe_cache, 0);
 #else
-                status = update_directory("/", "/", &wipe_cache);
+                status = update_directory("/", "/", &wipe_cache, 0);
 #endif /* RECOVERY_HAS_SDCARD_ONLY */
                 if (status == INSTALL_SUCCESS && wipe_cache) {
                     ui_print("\n-- Wiping cache (at package request)...\n");
@@ -896,7 +906,7 @@ prompt_and_wait() {
                 break;
             case ITEM_APPLY_CACHE:
                 // Don't unmount cache at the end of this.
-                status = update_directory(CACHE_ROOT, NULL, &wipe_cache);
+                status = update_directory(CACHE_ROOT, NULL, &wipe_cache, 0);
                 if (status == INSTALL_SUCCESS && wipe_cache) {
                     ui_print("\n-- Wiping cache (at package request)...\n");
                     if (erase_volume("/cache")) {
@@ -917,6 +927,23 @@ prompt_and_wait() {
                 }
                 break;
 
+            case ITEM_CHECK_PACKAGE:
+#ifdef RECOVERY_HAS_SDCARD_ONLY
+                status = update_directory(SDCARD_ROOT, SDCARD_ROOT, &wipe_cache, 1);
+#else
+                status = update_directory("/", "/", &wipe_cache, 1);
+#endif /* RECOVERY_HAS_SDCARD_ONLY */
+                if (status >= 0) {
+                    if (status != INSTALL_SUCCESS) {
+                        ui_set_background(BACKGROUND_ICON_ERROR);
+                        ui_print("Package check failed.\n");
+                    } else {
+                        ui_set_background(BACKGROUND_ICON_NONE);
+                        ui_print("\nPackage check complete.\n");
+                    }
+                }
+                break;
+
 #ifdef RECOVERY_HAS_EFUSE
 
             case ITEM_WRITE_EFUSE:
@@ -933,6 +960,67 @@ print_property(const char *key, const char *name, void *cookie) {
     printf("%s=%s\n", key, name);
 }
 
+// Parse a decimal offset or size, which must be non-negative and fit
+// in 64 bits.
+static int
+parse_copy_size(const char *str, int64_t *value) {
+    char *end;
+    errno = 0;
+    long long v = strtoll(str, &end, 10);
+    if (errno != 0 || end == str || *end != '\0' || v < 0) return -1;
+    *value = v;
+    return 0;
+}
+
+// --file_copy_from_partition=path:type:partition:offset:size[:options],
+// where the options are a comma separated list of "gzip" or "gzipN"
+// (compression level N) and "nosparse".
+static void
+copy_from_partition_arg(char *arg, const char *option) {
+    char *file_path, *partition_type, *partition, *offset_str, *size_str;
+    char *flags, *flag;
+    PartitionCopyOptions options;
+
+    if ((file_path = strtok(arg, ":")) == NULL ||
+        (partition_type = strtok(NULL, ":")) == NULL ||
+        (partition = strtok(NULL, ":")) == NULL ||
+        (offset_str = strtok(NULL, ":")) == NULL ||
+        (size_str = strtok(NULL, ":")) == NULL) {
+        printf("%s_args Invalid!\n", option);
+        return;
+    }
+    flags = strtok(NULL, ":");
+
+    options.gzip_level = 0;
+    options.threads = 0;
+    options.sparse = 1;
+    for (flag = flags ? strtok(flags, ",") : NULL; flag != NULL;
+         flag = strtok(NULL, ",")) {
+        if (strncmp(flag, "gzip", 4) == 0) {
+            options.gzip_level = flag[4] ? atoi(flag + 4) : 6;
+            if (options.gzip_level < 1 || options.gzip_level > 9) {
+                options.gzip_level = 6;
+            }
+        } else if (strcmp(flag, "nosparse") == 0) {
+            options.sparse = 0;
+        } else {
+            printf("%s: ignoring unknown option \"%s\"\n", option, flag);
+        }
+    }
+
+    int64_t offset, size;
+    if (parse_copy_size(offset_str, &offset) != 0 ||
+        parse_copy_size(size_str, &size) != 0) {
+        printf("%s: bad offset \"%s\" or size \"%s\"\n",
+               option, offset_str, size_str);
+        return;
+    }
+
+    int64_t result = file_copy_from_partition_ex(file_path, partition_type,
+            partition, offset, size, &options);
+    printf("%s finish! result=%lld\n", option, (long long) result);
+}
+
 //add ainuo
 char *dump_full_path(const char* path, const char* name)
 {
@@ -1215,49 +1303,12 @@ main(int argc, char **argv) {
 #endif
 #endif /* 0 */
 
-	char *file_path = NULL;
-	char *partition_type = NULL;
-	char *partition = NULL;
-	char *offset_str = NULL;
-	char *size_str = NULL;
-	ssize_t part_offset;
-	ssize_t file_size;
-
 	if(file_copy_from_partition_args)
-	{
-		if(((file_path = strtok(file_copy_from_partition_args, ":")) == NULL) ||
-			((partition_type = strtok(NULL, ":")) == NULL)	||
-			((partition = strtok(NULL, ":")) == NULL)	||
-			((offset_str = strtok(NULL, ":")) == NULL)	||
-			((size_str = strtok(NULL, ":")) == NULL))
-		{
-			printf("file_copy_from_partition_args Invalid!\n");
-		}
-		else
-		{
-			part_offset = atoi(offset_str);
-			file_size = atoi(size_str);
-			file_copy_from_partition(file_path, partition_type, partition, part_offset, file_size);
-		}	
-	}
-
+		copy_from_partition_arg((char *)file_copy_from_partition_args,
+		                        "file_copy_from_partition");
 	if(file1_copy_from_partition_args)
-	{
-		if(((file_path = strtok(file1_copy_from_partition_args, ":")) == NULL) ||
-			((partition_type = strtok(NULL, ":")) == NULL)	||
-			((partition = strtok(NULL, ":")) == NULL)	||
-			((offset_str = strtok(NULL, ":")) == NULL)	||
-			((size_str = strtok(NULL, ":")) == NULL))
-		{
-			printf("file1_copy_from_partition_args Invalid!\n");
-		}
-		else
-		{
-			part_offset = atoi(offset_str);
-			file_size = atoi(size_str);
-			file_copy_from_partition(file_path, partition_type, partition, part_offset, file_size);
-		}	
-	}
+		copy_from_partition_arg((char *)file1_copy_from_partition_args,
+		                        "file1_copy_from_partition");
 
     if (update_package) {
         // For backwards compatibility on the cache partition only, if
@@ -87,8 +87,9 @@ enum{
 	ITEM_WRITE_EFUSE,
 #endif
 #ifdef RECOVERY_HAS_FACTORY_TEST
-	ITEM_FACTORY_TEST
+	ITEM_FACTORY_TEST,
 #endif
+	ITEM_CHECK_PACKAGE
 };
 
 #define ITEM_APPLY_SDCARD    ITEM_APPLY_EXT  // historical synonym for ITEM_APPLY_EXT
@@ -15,7 +15,13 @@
  */
 
 #include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
 #include <sys/mount.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
@@ -37,6 +43,7 @@ static int num_volumes = 0;
 static Volume* device_volumes = NULL;
 
 static int format_ubifs_volume(const char* location);
+static int truncate_ubifs_volume(const char* location);
 
 static int parse_options(char* options, Volume* volume) {
     char* option;
@@ -150,92 +157,195 @@ Volume* volume_for_path(const char* path) {
     return NULL;
 }
 
-int smart_device_mounted(Volume *vol) {
-    int i, len;
-    char * tmp;
-    char device_name[256];
-    char *mounted_device;
-
-    mkdir(vol->mount_point, 0755); 
-
-    if (vol->device != NULL) {
-        tmp = strchr(vol->device, '#');
-        len = tmp - vol->device;
-        if (tmp && len < 255) {
-            strncpy(device_name, vol->device, len);
-
-            for (i = 1; i <= NUM_OF_PARTITION_TO_ENUM; i++) {
-                device_name[len] = 48 + i;
-                device_name[len + 1] = '\0';
-                LOGW("try mount %s ...\n", device_name);
-
-                if (!mount(device_name, vol->mount_point, vol->fs_type,
-                           MS_NOATIME | MS_NODEV | MS_NODIRATIME, "utf8")) {
-                    mounted_device = device_name;
-                    goto mounted;
-                }
-            }
+// Removable media (sdcard, udisk) may show up as any of partitions
+// 1..NUM_OF_PARTITION_TO_ENUM of a "device#" entry, or as the whole
+// device.  Rather than trying mount() on each in turn, every candidate
+// has its superblock read by its own thread, and only one that holds
+// a usable filesystem is mounted.  A slow or absent card then costs
+// one read, not one mount attempt per candidate.
+
+#define MAX_PROBE_CANDIDATES (2 * (NUM_OF_PARTITION_TO_ENUM + 1))
+#define PROBE_READ_SIZE 4096
+
+struct ProbeSet;
+
+typedef struct {
+    struct ProbeSet* set;
+    char device[256];
+    int done;
+    int readable;         // superblock could be read
+    const char* fs_type;  // what it holds, or NULL if unrecognized
+} ProbeCandidate;
+
+typedef struct ProbeSet {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int refs;             // the caller plus each probe still running
+    int count;
+    ProbeCandidate candidates[MAX_PROBE_CANDIDATES];
+} ProbeSet;
+
+static const char* probe_superblock(const char* device, int* readable) {
+    unsigned char buf[PROBE_READ_SIZE];
+    *readable = 0;
+    int fd = open(device, O_RDONLY);
+    if (fd < 0) return NULL;
+    ssize_t n = pread(fd, buf, sizeof(buf), 0);
+    close(fd);
+    if (n != sizeof(buf)) return NULL;
+    *readable = 1;
+
+    // ext2/3/4: s_magic in the superblock at 1024.
+    if (buf[1024 + 0x38] == 0x53 && buf[1024 + 0x39] == 0xef) {
+        return "ext4";
+    }
+    if (memcmp(buf + 3, "EXFAT   ", 8) == 0) {
+        return "exfat";
+    }
+    // FAT12/16 and FAT32 boot sectors; a partition table has the same
+    // signature but not the type string.
+    if (buf[510] == 0x55 && buf[511] == 0xaa &&
+        (memcmp(buf + 0x36, "FAT", 3) == 0 ||
+         memcmp(buf + 0x52, "FAT32", 5) == 0)) {
+        return "vfat";
+    }
+    return NULL;
+}
 
-            device_name[len] = '\0';
-            LOGW("try mount %s ...\n", device_name);
+static void release_probe_set(ProbeSet* set) {
+    pthread_mutex_lock(&set->lock);
+    int refs = --set->refs;
+    pthread_mutex_unlock(&set->lock);
+    if (refs == 0) {
+        pthread_mutex_destroy(&set->lock);
+        pthread_cond_destroy(&set->cond);
+        free(set);
+    }
+}
 
-            if (!mount(device_name, vol->mount_point, vol->fs_type,
-                       MS_NOATIME | MS_NODEV | MS_NODIRATIME, "utf8")) {
-                mounted_device = device_name;
-                goto mounted;
-            }
-        } else {
-            LOGW("try mount %s ...\n", vol->device);
-            if (!mount(vol->device, vol->mount_point, vol->fs_type,
-                       MS_NOATIME | MS_NODEV | MS_NODIRATIME, "utf8")) {
-                mounted_device = device_name;
-                goto mounted;
-            }
+static void* probe_thread(void* cookie) {
+    ProbeCandidate* c = (ProbeCandidate*) cookie;
+    int readable;
+    const char* fs_type = probe_superblock(c->device, &readable);
+
+    pthread_mutex_lock(&c->set->lock);
+    c->readable = readable;
+    c->fs_type = fs_type;
+    c->done = 1;
+    pthread_cond_broadcast(&c->set->cond);
+    pthread_mutex_unlock(&c->set->lock);
+    release_probe_set(c->set);
+    return NULL;
+}
+
+static void add_probe_candidate(ProbeSet* set, const char* device, int len,
+                                int partition) {
+    ProbeCandidate* c = &set->candidates[set->count++];
+    c->set = set;
+    memcpy(c->device, device, len);
+    if (partition > 0) {
+        c->device[len++] = '0' + partition;
+    }
+    c->device[len] = '\0';
+}
+
+static void add_probe_candidates(ProbeSet* set, const char* device) {
+    if (device == NULL) return;
+    const char* hash = strchr(device, '#');
+    int len = hash ? hash - device : (int) strlen(device);
+    if (len >= 255) return;
+
+    int i;
+    if (hash) {
+        for (i = 1; i <= NUM_OF_PARTITION_TO_ENUM; ++i) {
+            add_probe_candidate(set, device, len, i);
         }
     }
+    add_probe_candidate(set, device, len, 0);
+}
 
-    if (vol->device2 != NULL) {
-        tmp = strchr(vol->device2, '#');
-        len = tmp - vol->device2;
-        if (tmp && len < 255) {
-            strncpy(device_name, vol->device2, len);
+// Whether a filesystem found on the media can stand in for the one in
+// recovery.fstab.  Cards over 32GB come formatted exFAT.
+static int probe_fs_matches(const char* wanted, const char* found) {
+    return strcmp(wanted, found) == 0 ||
+           (strcmp(wanted, "vfat") == 0 && strcmp(found, "exfat") == 0);
+}
 
-            for (i = 1; i <= NUM_OF_PARTITION_TO_ENUM; i++) {
-                device_name[len] = 48 + i;
-                device_name[len + 1] = '\0';
-                LOGW("try mount %s ...\n", device_name);
+static int mount_removable(const char* device, const char* mount_point,
+                           const char* fs_type) {
+    LOGW("try mount %s (%s) ...\n", device, fs_type);
+    return mount(device, mount_point, fs_type,
+                 MS_NOATIME | MS_NODEV | MS_NODIRATIME,
+                 strcmp(fs_type, "ext4") == 0 ? NULL : "utf8");
+}
 
-                if (!mount(device_name, vol->mount_point, vol->fs_type,
-                           MS_NOATIME | MS_NODEV | MS_NODIRATIME, "utf8")) {
-                    mounted_device = device_name;
-                    goto mounted;
-                }
-            }
+int smart_device_mounted(Volume *vol) {
+    int i;
 
-            device_name[len] = '\0';
-            LOGW("try mount %s ...\n", device_name);
+    mkdir(vol->mount_point, 0755);
+    errno = ENODEV;
+
+    ProbeSet* set = calloc(1, sizeof(ProbeSet));
+    if (set == NULL) return -1;
+    pthread_mutex_init(&set->lock, NULL);
+    pthread_cond_init(&set->cond, NULL);
+    add_probe_candidates(set, vol->device);
+    add_probe_candidates(set, vol->device2);
+    set->refs = 1 + set->count;
+
+    for (i = 0; i < set->count; ++i) {
+        pthread_attr_t attr;
+        pthread_t thread;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        if (pthread_create(&thread, &attr, probe_thread,
+                           &set->candidates[i]) != 0) {
+            probe_thread(&set->candidates[i]);
+        }
+        pthread_attr_destroy(&attr);
+    }
 
-            if (!mount(device_name, vol->mount_point, vol->fs_type,
-                       MS_NOATIME | MS_NODEV | MS_NODIRATIME, "utf8")) {
-                mounted_device = device_name;
-                goto mounted;
-            }
-        } else {
-            LOGW("try mount %s ...\n", vol->device2);
-            if (!mount(vol->device2, vol->mount_point, vol->fs_type,
-                       MS_NOATIME | MS_NODEV | MS_NODIRATIME, "utf8")) {
-                mounted_device = device_name;
-                goto mounted;
-            }
+    // Take the candidates in the order they used to be tried, waiting
+    // for each only until its own probe finishes.  Probes of later
+    // candidates that are still stuck on slow media are left to finish
+    // on their own.
+    char device[256];
+    const char* fs_type;
+    pthread_mutex_lock(&set->lock);
+    for (i = 0; i < set->count; ++i) {
+        ProbeCandidate* c = &set->candidates[i];
+        while (!c->done) pthread_cond_wait(&set->cond, &set->lock);
+        if (c->fs_type == NULL || !probe_fs_matches(vol->fs_type, c->fs_type)) {
+            continue;
         }
+        strcpy(device, c->device);
+        fs_type = c->fs_type;
+        pthread_mutex_unlock(&set->lock);
+        if (mount_removable(device, vol->mount_point, fs_type) == 0) {
+            release_probe_set(set);
+            return 0;
+        }
+        pthread_mutex_lock(&set->lock);
+    }
+
+    // Nothing we recognize: fall back to mounting, as before, whatever
+    // could be read at all, in case the superblock checks missed it.
+    for (i = 0; i < set->count; ++i) {
+        ProbeCandidate* c = &set->candidates[i];
+        if (!c->readable || c->fs_type != NULL) continue;
+        strcpy(device, c->device);
+        pthread_mutex_unlock(&set->lock);
+        if (mount_removable(device, vol->mount_point, vol->fs_type) == 0) {
+            release_probe_set(set);
+            return 0;
+        }
+        pthread_mutex_lock(&set->lock);
     }
+    pthread_mutex_unlock(&set->lock);
+    release_probe_set(set);
 
     LOGE("failed to mount %s (%s)\n", vol->mount_point, strerror(errno));
     return -1;
-
-mounted:
-    //ui_print("Device %s mounted\n", mounted_device);
-    return 0;
 }
 
 int ensure_path_mounted(const char* path) {
@@ -472,7 +582,70 @@ int ensure_path_unmounted(const char* path) {
     }
 }
 
+static long long now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+// Tell the device that every block of the volume is unused, so the
+// filesystem written over it starts from a clean slate and the old
+// data is gone without having to be overwritten.  A negative length
+// leaves that much at the end alone, as make_ext4fs does (e.g. for a
+// crypto footer).  Failure is not fatal: not every device (or kernel)
+// supports discard, and formatting works without it.
+static int discard_block_device(const char* device, long long length) {
+    int fd = open(device, O_RDWR);
+    if (fd < 0) {
+        LOGW("discard: can't open %s (%s)\n", device, strerror(errno));
+        return -1;
+    }
+
+    uint64_t size;
+    if (ioctl(fd, BLKGETSIZE64, &size) != 0) {
+        LOGW("discard: can't get size of %s (%s)\n", device, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    if (length > 0 && (uint64_t) length < size) {
+        size = length;
+    } else if (length < 0) {
+        if ((uint64_t) -length >= size) {
+            close(fd);
+            return -1;
+        }
+        size += length;
+    }
+
+    long long start = now_ms();
+    uint64_t range[2] = { 0, size };
+    int ret = -1;
+    const char* how = "discard";
+#ifdef RECOVERY_SECURE_DISCARD
+    ret = ioctl(fd, BLKSECDISCARD, &range);
+    how = "secure discard";
+#endif
+    if (ret != 0) {
+        range[0] = 0;
+        range[1] = size;
+        ret = ioctl(fd, BLKDISCARD, &range);
+        how = "discard";
+    }
+    if (ret != 0) {
+        LOGW("discard: %s doesn't support discard (%s)\n",
+             device, strerror(errno));
+    } else {
+        LOGI("%s of %s (%llu bytes) took %lld ms\n", how, device,
+             (unsigned long long) size, now_ms() - start);
+    }
+    close(fd);
+    return ret;
+}
+
+static int format_volume_internal(Volume* v);
+
 int format_volume(const char* volume) {
+    long long start = now_ms();
     Volume* v = volume_for_path(volume);
     if (v == NULL) {
         LOGE("unknown volume \"%s\"\n", volume);
@@ -493,6 +666,18 @@ int format_volume(const char* volume) {
         return -1;
     }
 
+    int result = format_volume_internal(v);
+    LOGI("format_volume: %s (%s) %s in %lld ms\n", v->mount_point,
+         v->fs_type, result == 0 ? "formatted" : "failed", now_ms() - start);
+    return result;
+}
+
+static int format_volume_internal(Volume* v) {
+    if (strcmp(v->fs_type, "ubifs") == 0 &&
+        truncate_ubifs_volume(v->device) == 0) {
+        return 0;
+    }
+
     if (strcmp(v->fs_type, "yaffs2") == 0 || strcmp(v->fs_type, "mtd") == 0 ||
         strcmp(v->fs_type, "ubifs") == 0) {
         mtd_scan_partitions();
@@ -521,6 +706,7 @@ int format_volume(const char* volume) {
     }
 
     if (strcmp(v->fs_type, "ext4") == 0) {
+        discard_block_device(v->device, v->length);
         int result = make_ext4fs(v->device, v->length);
         if (result != 0) {
             LOGE("format_volume: make_extf4fs failed on %s\n", v->device);
@@ -572,6 +758,7 @@ int format_volume(const char* volume) {
                     argv[4] = (char *)v->device2;
             }
         }
+        discard_block_device(argv[4], 0);
 
         result = 0;
         pid = fork();
@@ -604,6 +791,81 @@ int format_volume(const char* volume) {
     return -1;
 }
 
+// If the MTD partition already holds a UBI volume named "location",
+// empty it with a zero-length volume update, and UBIFS formats the
+// empty volume when it is first mounted.  The kernel unmaps all the
+// volume's LEBs for that update and then flushes the pending erases
+// before the ioctl returns, which is what makes it safe to detach
+// straight afterwards: unmapping LEBs ourselves would only schedule
+// the erases, and the old data could come back if they hadn't run by
+// the detach or a reboot.  Much faster than erasing the whole
+// partition, and it keeps UBI's erase counters.  Returns -1 if there's
+// no such volume, and the caller does it the slow way.
+static int truncate_ubifs_volume(const char* location) {
+    struct ubi_info ubi_info;
+    struct ubi_vol_info vol_info;
+    struct ubi_attach_request req;
+    char vol_node[32];
+    int dev_num, attached = 0;
+    int result = -1;
+
+    mtd_scan_partitions();
+    int mtdn = mtd_get_index_by_name(location);
+    if (mtdn < 0) {
+        return -1;
+    }
+
+    libubi_t libubi = libubi_open();
+    if (!libubi) {
+        return -1;
+    }
+    if (ubi_get_info(libubi, &ubi_info) != 0 || ubi_info.ctrl_major == -1) {
+        goto out_ubi_close;
+    }
+
+    if (mtd_num2ubi_dev(libubi, mtdn, &dev_num) != 0) {
+        req.dev_num = UBI_DEV_NUM_AUTO;
+        req.mtd_num = mtdn;
+        req.vid_hdr_offset = 0;
+        req.mtd_dev_node = NULL;
+        if (ubi_attach(libubi, DEFAULT_CTRL_DEV, &req) != 0) {
+            LOGW("mtd%d doesn't hold UBI; erasing it\n", mtdn);
+            goto out_ubi_close;
+        }
+        dev_num = req.dev_num;
+        attached = 1;
+    }
+
+    if (ubi_get_vol_info1_nm(libubi, dev_num, location, &vol_info) != 0) {
+        LOGW("no UBI volume \"%s\" on mtd%d; erasing it\n", location, mtdn);
+        goto out_ubi_detach;
+    }
+
+    snprintf(vol_node, sizeof(vol_node), "/dev/ubi%d_%d",
+             vol_info.dev_num, vol_info.vol_id);
+    int fd = open(vol_node, O_RDWR);
+    if (fd < 0) {
+        LOGW("can't open %s (%s)\n", vol_node, strerror(errno));
+        goto out_ubi_detach;
+    }
+    if (ubi_update_start(libubi, fd, 0) != 0) {
+        LOGW("can't truncate %s (%s)\n", vol_node, strerror(errno));
+    } else {
+        LOGI("truncated UBI volume \"%s\" (%s)\n", location, vol_node);
+        result = 0;
+    }
+    close(fd);
+
+out_ubi_detach:
+    if (attached) {
+        ubi_detach_mtd(libubi, DEFAULT_CTRL_DEV, mtdn);
+    }
+
+out_ubi_close:
+    libubi_close(libubi);
+    return result;
+}
+
 static int format_ubifs_volume(const char* location) {
     int err;
     struct ubi_info ubi_info;
@@ -0,0 +1,149 @@
+#!/usr/bin/env python
+#
+# Copyright (C) 2026 The Android Open Source Project
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Add a signed block hash tree to an OTA package that already has a
+whole-file signature, so recovery can check the package a block at a
+time as it installs it instead of hashing all of it first.  See
+minzip/HashTree.h for the layout.
+
+usage: add-hash-tree.py [-b block_size] [-d sha1|sha256] key input.zip output.zip
+
+  key       private key to sign the tree with (PEM, or DER PKCS#8 if
+            it ends in .pk8); one whose public half is in recovery's
+            /res/keys
+  -d        digest the tree signature is made with; must match the key's
+            entry in /res/keys (sha1 for v1/v2 keys, sha256 for v3/v4)
+  -b        block size; by default the smallest power of two, at least
+            64k, that keeps the tree within the zip comment
+
+Only add a tree to packages whose update-binary was built from a
+recovery tree that checks the package against it (it reads
+UPDATE_PACKAGE_HASH_TREE); recovery doesn't hash the rest of the
+package before running the update-binary.
+
+The whole-file signature doesn't cover the comment, so adding the
+tree leaves it valid, and recoveries that don't know about trees
+still verify the package the old way.
+"""
+
+import getopt
+import hashlib
+import struct
+import subprocess
+import sys
+
+MAGIC = b"HTR1"
+EOCD_MAGIC = b"PK\x05\x06"
+EOCD_HEADER_SIZE = 22
+FOOTER_SIZE = 6
+MIN_BLOCK_SIZE = 64 * 1024
+MAX_COMMENT_SIZE = 0xffff
+
+
+def usage():
+  sys.stderr.write(__doc__[__doc__.index("usage:"):] + "\n")
+  sys.exit(2)
+
+
+def sign(key, digest, data):
+  cmd = ["openssl", "dgst", "-" + digest, "-sign", key]
+  if key.endswith(".pk8"):
+    cmd += ["-keyform", "DER"]
+  p = subprocess.Popen(cmd, stdin=subprocess.PIPE, stdout=subprocess.PIPE)
+  sig, _ = p.communicate(data)
+  if p.returncode != 0:
+    raise RuntimeError("openssl failed to sign the hash tree")
+  return sig
+
+
+def build_tree(signed, block_size):
+  n = (len(signed) + block_size - 1) // block_size
+  out = [MAGIC, struct.pack("<III", block_size, len(signed), n)]
+  for i in range(n):
+    out.append(hashlib.sha256(signed[i*block_size:(i+1)*block_size]).digest())
+  return b"".join(out)
+
+
+def main(argv):
+  try:
+    opts, args = getopt.getopt(argv, "b:d:")
+  except getopt.GetoptError:
+    usage()
+  if len(args) != 3:
+    usage()
+  block_size = None
+  digest = "sha1"
+  for o, a in opts:
+    if o == "-b":
+      block_size = int(a, 0)
+    elif o == "-d":
+      digest = a
+  if digest not in ("sha1", "sha256"):
+    usage()
+  if block_size is not None and \
+      (block_size < 4096 or block_size & (block_size - 1)):
+    sys.exit("block size must be a power of two, at least 4096")
+  key, input_name, output_name = args
+
+  data = open(input_name, "rb").read()
+  footer = data[-FOOTER_SIZE:]
+  if len(data) < FOOTER_SIZE or footer[2:4] != b"\xff\xff":
+    sys.exit("%s has no whole-file signature" % input_name)
+  signature_start, _, _, comment_size = struct.unpack("<HBBH", footer)
+  eocd = len(data) - comment_size - EOCD_HEADER_SIZE
+  if eocd < 0 or data[eocd:eocd+4] != EOCD_MAGIC:
+    sys.exit("%s: signature footer doesn't match the EOCD" % input_name)
+  if data[eocd+EOCD_HEADER_SIZE-2:eocd+EOCD_HEADER_SIZE] != \
+      struct.pack("<H", comment_size):
+    sys.exit("%s: EOCD comment length doesn't match the footer" % input_name)
+  comment = data[eocd+EOCD_HEADER_SIZE:]
+  # The tree goes immediately before the signature block, after
+  # anything else in the comment.
+  prefix = comment[:comment_size-signature_start]
+  if prefix[-4:] == MAGIC:
+    sys.exit("%s already has a hash tree" % input_name)
+
+  # Everything up to the EOCD comment length field is covered, the
+  # same as the whole-file signature.
+  signed = data[:eocd+EOCD_HEADER_SIZE-2]
+
+  # The tree must fit in the comment alongside the signature, and (as
+  # recovery rejects it) mustn't contain the EOCD magic; a different
+  # block size gives different hashes.
+  block_size = block_size or MIN_BLOCK_SIZE
+  while True:
+    tree = build_tree(signed, block_size)
+    tree += sign(key, digest, tree)
+    tree += struct.pack("<I", len(tree) + 8) + MAGIC
+    new_comment = prefix + tree + comment[len(prefix):]
+    if len(new_comment) <= MAX_COMMENT_SIZE and EOCD_MAGIC not in new_comment:
+      break
+    if block_size >= 1 << 30:
+      sys.exit("can't fit a hash tree in the comment")
+    block_size *= 2
+
+  # The footer keeps its signature start (still counted from the end)
+  # and gets the new comment size, which must also go in the EOCD.
+  new_comment = new_comment[:-2] + struct.pack("<H", len(new_comment))
+  out = signed + struct.pack("<H", len(new_comment)) + new_comment
+  open(output_name, "wb").write(out)
+  print("%s: %d blocks of %d bytes, tree %d bytes" %
+        (output_name, (len(signed) + block_size - 1) // block_size,
+         block_size, len(tree)))
+
+
+if __name__ == "__main__":
+  main(sys.argv[1:])
@@ -41,6 +41,54 @@
 #error asl;dfafsd
 #endif
 
+/*
+ * libubi_open() hands out one descriptor for the whole process, and what it
+ * reads from sysfs about UBI devices and volumes is cached there: a single
+ * query otherwise costs a dozen or so sysfs reads, and looking a volume up by
+ * name costs that many per volume.
+ *
+ * The cache is dropped whenever this library changes something (attach,
+ * detach, volume create, remove, rename or resize), and whenever the set of
+ * devices and volumes in sysfs changes under us (e.g. in another process),
+ * which is checked with one readdir() per query.  That check is only a hint:
+ * older kernels' sysfs reuses inode numbers, so a device detached and
+ * re-attached elsewhere can look unchanged.  So the cache is also dropped
+ * when the last user closes the descriptor, and lasts only as long as
+ * someone holds it open.
+ *
+ * A volume's data size, corrupted flag and name are never served from the
+ * cache: the first two change as an update is written through the volume's
+ * own fd, and the name is what callers find a volume to write to by.  They
+ * are re-read on every query, and so is a device's MTD number when
+ * mtd_num2ubi_dev() finds it; a mismatch drops the cache and looks again.
+ */
+struct dev_cache {
+	int valid;			/* @info has been read */
+	int vols_valid;			/* and so have all the volumes */
+	struct ubi_dev_info info;
+	int vol_slots;			/* entries in @vols and @vol_present */
+	struct ubi_vol_info *vols;	/* indexed by volume ID */
+	char *vol_present;
+};
+
+struct libubi_cached {
+	struct libubi lib;		/* must come first */
+	int refs;
+	unsigned long long fingerprint;	/* of the UBI sysfs class directory */
+	int info_valid;
+	struct ubi_info info;
+	int dev_slots;
+	struct dev_cache *devs;		/* indexed by UBI device number */
+};
+
+static struct libubi_cached *shared_lib;
+
+static int read_info(struct libubi *lib, struct ubi_info *info);
+static int read_dev_info1(struct libubi *lib, int dev_num,
+			  struct ubi_dev_info *info);
+static int read_vol_info1(struct libubi *lib, int dev_num, int vol_id,
+			  struct ubi_vol_info *info);
+
 /**
  * mkpath - compose full path from 2 given components.
  * @path: the first component
@@ -325,7 +373,7 @@ static int vol_read_data(const char *patt, int dev_num, int vol_id, void *buf,
 }
 
 /**
- * dev_get_major - get major and minor numbers of an UBI device.
+ * read_dev_major - read major and minor numbers of an UBI device.
  * @lib: libubi descriptor
  * @dev_num: UBI device number
  * @major: major number is returned here
@@ -333,7 +381,8 @@ static int vol_read_data(const char *patt, int dev_num, int vol_id, void *buf,
  *
  * This function returns zero in case of succes and %-1 in case of failure.
  */
-static int dev_get_major(struct libubi *lib, int dev_num, int *major, int *minor)
+static int read_dev_major(struct libubi *lib, int dev_num, int *major,
+			  int *minor)
 {
 	char file[strlen(lib->dev_dev) + 50];
 
@@ -341,6 +390,36 @@ static int dev_get_major(struct libubi *lib, int dev_num, int *major, int *minor
 	return read_major(file, major, minor);
 }
 
+static void cache_check(struct libubi_cached *c);
+static struct dev_cache *cached_dev(struct libubi_cached *c, int dev_num);
+
+/**
+ * dev_get_major - get major and minor numbers of an UBI device, from the
+ *                 cache if possible.
+ * @lib: libubi descriptor
+ * @dev_num: UBI device number
+ * @major: major number is returned here
+ * @minor: minor number is returned here
+ *
+ * This function returns zero in case of succes and %-1 in case of failure.
+ */
+static int dev_get_major(struct libubi *lib, int dev_num, int *major, int *minor)
+{
+	struct libubi_cached *c = (struct libubi_cached *)lib;
+	struct dev_cache *d;
+
+	/* A device detached and re-attached under the same number may well
+	 * have a different major, so make sure this one is still current.
+	 */
+	cache_check(c);
+	d = cached_dev(c, dev_num);
+	if (!d)
+		return -1;
+	*major = d->info.major;
+	*minor = d->info.minor;
+	return 0;
+}
+
 /**
  * vol_get_major - get major and minor numbers of an UBI volume.
  * @lib: libubi descriptor
@@ -424,6 +503,7 @@ static int vol_node2nums(struct libubi *lib, const char *node, int *dev_num,
 		errno = ENODEV;
 		return -1;
 	}
+	close(fd);
 
 	*dev_num = i;
 	*vol_id = minor - 1;
@@ -491,40 +571,198 @@ static int dev_node2num(struct libubi *lib, const char *node, int *dev_num)
 	return -1;
 }
 
+/**
+ * cache_flush - forget everything cached about UBI devices and volumes.
+ * @desc: libubi descriptor
+ */
+static void cache_flush(libubi_t desc)
+{
+	struct libubi_cached *c = desc;
+	int i;
+
+	if (!c)
+		return;
+
+	c->info_valid = 0;
+	for (i = 0; i < c->dev_slots; i++) {
+		free(c->devs[i].vols);
+		free(c->devs[i].vol_present);
+	}
+	free(c->devs);
+	c->devs = NULL;
+	c->dev_slots = 0;
+}
+
+/**
+ * cache_check - drop the cache if UBI devices or volumes have come or gone.
+ * @c: libubi descriptor
+ *
+ * Every device and volume has an entry in the UBI sysfs class directory, and
+ * a re-created one gets a new inode number, so a hash of the names and inode
+ * numbers there changes whenever the cache might be out of date.
+ */
+static void cache_check(struct libubi_cached *c)
+{
+	unsigned long long h = 14695981039346656037ULL;
+	struct dirent *dirent;
+	const char *p;
+	DIR *dir;
+
+	dir = opendir(c->lib.sysfs_ubi);
+	if (!dir) {
+		cache_flush(c);
+		return;
+	}
+	while ((dirent = readdir(dir))) {
+		for (p = dirent->d_name; *p; p++)
+			h = (h ^ (unsigned char)*p) * 1099511628211ULL;
+		h = (h ^ (unsigned long long)dirent->d_ino) * 1099511628211ULL;
+	}
+	closedir(dir);
+
+	if (h != c->fingerprint) {
+		cache_flush(c);
+		c->fingerprint = h;
+	}
+}
+
+/**
+ * cached_dev - get the cache entry for an UBI device, reading its information
+ *              if need be.
+ * @c: libubi descriptor
+ * @dev_num: UBI device number
+ *
+ * Returns %NULL if the device information cannot be read, with errno set.
+ */
+static struct dev_cache *cached_dev(struct libubi_cached *c, int dev_num)
+{
+	struct dev_cache *d;
+
+	if (dev_num < 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (dev_num >= c->dev_slots) {
+		int n = dev_num + 1;
+
+		d = realloc(c->devs, n * sizeof(struct dev_cache));
+		if (!d)
+			return NULL;
+		memset(d + c->dev_slots, 0,
+		       (n - c->dev_slots) * sizeof(struct dev_cache));
+		c->devs = d;
+		c->dev_slots = n;
+	}
+
+	d = &c->devs[dev_num];
+	if (!d->valid) {
+		if (read_dev_info1(&c->lib, dev_num, &d->info))
+			return NULL;
+		d->valid = 1;
+	}
+	return d;
+}
+
+/**
+ * cached_vols - read the information of every volume of an UBI device.
+ * @c: libubi descriptor
+ * @d: the device's cache entry
+ *
+ * Returns %0 in case of success and %-1 in case of failure.
+ */
+static int cached_vols(struct libubi_cached *c, struct dev_cache *d)
+{
+	int i, n = d->info.highest_vol_id + 1;
+
+	if (d->vols_valid)
+		return 0;
+
+	if (n > d->vol_slots) {
+		struct ubi_vol_info *vols;
+		char *present;
+
+		vols = realloc(d->vols, n * sizeof(struct ubi_vol_info));
+		if (!vols)
+			return -1;
+		d->vols = vols;
+		present = realloc(d->vol_present, n);
+		if (!present)
+			return -1;
+		d->vol_present = present;
+		d->vol_slots = n;
+	}
+	memset(d->vol_present, 0, d->vol_slots);
+
+	for (i = d->info.lowest_vol_id; i < n && d->info.vol_count; i++) {
+		if (read_vol_info1(&c->lib, d->info.dev_num, i, &d->vols[i])) {
+			if (errno == ENOENT)
+				continue;
+			return -1;
+		}
+		d->vol_present[i] = 1;
+	}
+
+	d->vols_valid = 1;
+	return 0;
+}
+
 int mtd_num2ubi_dev(libubi_t desc, int mtd_num, int *dev_num)
 {
 	struct ubi_info info;
-	int i, ret, mtd_num1;
-	struct libubi *lib = desc;
+	int i, mtd_num1, flushed = 0;
+	struct libubi_cached *c = desc;
 
+retry:
 	if (ubi_get_info(desc, &info))
 		return -1;
 
 	for (i = info.lowest_dev_num; i <= info.highest_dev_num; i++) {
-		ret = dev_read_int(lib->dev_mtd_num, i, &mtd_num1);
-		if (ret) {
+		struct dev_cache *d = cached_dev(c, i);
+
+		if (!d) {
 			if (errno == ENOENT)
 				continue;
 			return -1;
 		}
 
-		if (mtd_num1 == mtd_num) {
-			errno = 0;
-			*dev_num = i;
-			return 0;
+		if (d->info.mtd_num != mtd_num)
+			continue;
+
+		/* The caller is about to use this device, so make sure the
+		 * cache isn't describing one since detached and replaced.
+		 */
+		if (dev_read_int(c->lib.dev_mtd_num, i, &mtd_num1) ||
+		    mtd_num1 != mtd_num) {
+			if (flushed)
+				continue;
+			cache_flush(c);
+			flushed = 1;
+			goto retry;
 		}
+		errno = 0;
+		*dev_num = i;
+		return 0;
 	}
 
 	errno = 0;
 	return -1;
 }
 
+static void free_lib(struct libubi *lib);
+
 libubi_t libubi_open(void)
 {
 	int fd, version;
 	struct libubi *lib;
 
-	lib = calloc(1, sizeof(struct libubi));
+	if (shared_lib) {
+		if (shared_lib->refs++ == 0)
+			cache_flush(shared_lib);
+		return (libubi_t)shared_lib;
+	}
+
+	lib = calloc(1, sizeof(struct libubi_cached));
 	if (!lib)
 		return NULL;
 
@@ -644,17 +882,37 @@ libubi_t libubi_open(void)
 		goto out_error;
 	}
 
+	shared_lib = (struct libubi_cached *)lib;
+	shared_lib->refs = 1;
 	return lib;
 
 out_error:
-	libubi_close((libubi_t)lib);
+	free_lib(lib);
 	return NULL;
 }
 
+/*
+ * The shared descriptor outlives its users, so the next libubi_open() can
+ * reuse it, but not what it has cached: once nobody holds it, another
+ * process (the updater, say) may detach and re-attach devices, and an old
+ * kernel's sysfs can hand the new ones the same inode numbers, which
+ * cache_check() would not notice.
+ */
 void libubi_close(libubi_t desc)
 {
-	struct libubi *lib = (struct libubi *)desc;
+	struct libubi_cached *c = desc;
+
+	if (c == shared_lib) {
+		if (c->refs > 0 && --c->refs == 0)
+			cache_flush(c);
+		return;
+	}
+	free_lib(desc);
+}
 
+static void free_lib(struct libubi *lib)
+{
+	cache_flush(lib);
 	free(lib->vol_name);
 	free(lib->vol_corrupted);
 	free(lib->vol_eb_size);
@@ -726,6 +984,7 @@ int ubi_attach_mtd(libubi_t desc, const char *node,
 	r.vid_hdr_offset = req->vid_hdr_offset;
 
 	ret = do_attach(node, &r);
+	cache_flush(desc);
 	if (ret == 0)
 		req->dev_num = r.ubi_num;
 
@@ -795,6 +1054,7 @@ int ubi_attach(libubi_t desc, const char *node, struct ubi_attach_request *req)
 		return -1;
 
 	ret = do_attach(node, &r);
+	cache_flush(desc);
 	if (ret == 0)
 		req->dev_num = r.ubi_num;
 
@@ -834,12 +1094,11 @@ int ubi_remove_dev(libubi_t desc, const char *node, int ubi_dev)
 {
 	int fd, ret;
 
-	desc = desc;
-
 	fd = open(node, O_RDONLY);
 	if (fd == -1)
 		return sys_errmsg("cannot open \"%s\"", node);
 	ret = ioctl(fd, UBI_IOCDET, &ubi_dev);
+	cache_flush(desc);
 	if (ret == -1)
 		goto out_close;
 
@@ -904,6 +1163,7 @@ int ubi_probe_node(libubi_t desc, const char *node)
 	fd = open(file, O_RDONLY);
 	if (fd == -1)
 		goto out_not_ubi;
+	close(fd);
 
 	return 2;
 
@@ -915,10 +1175,23 @@ out_not_ubi:
 }
 
 int ubi_get_info(libubi_t desc, struct ubi_info *info)
+{
+	struct libubi_cached *c = desc;
+
+	cache_check(c);
+	if (!c->info_valid) {
+		if (read_info(&c->lib, &c->info))
+			return -1;
+		c->info_valid = 1;
+	}
+	*info = c->info;
+	return 0;
+}
+
+static int read_info(struct libubi *lib, struct ubi_info *info)
 {
 	DIR *sysfs_ubi;
 	struct dirent *dirent;
-	struct libubi *lib = (struct libubi *)desc;
 
 	memset(info, 0, sizeof(struct ubi_info));
 
@@ -1016,6 +1289,7 @@ int ubi_mkvol(libubi_t desc, const char *node, struct ubi_mkvol_request *req)
 		{ sys_errmsg("cannot open \"%s\"", node); return -3;}
 
 	ret = ioctl(fd, UBI_IOCMKVOL, &r);
+	cache_flush(desc);
 	if (ret == -1) {
 		close(fd);
 		//return ret;
@@ -1044,6 +1318,7 @@ int ubi_rmvol(libubi_t desc, const char *node, int vol_id)
 		return sys_errmsg("cannot open \"%s\"", node);
 
 	ret = ioctl(fd, UBI_IOCRMVOL, &vol_id);
+	cache_flush(desc);
 	if (ret == -1) {
 		close(fd);
 		return ret;
@@ -1070,6 +1345,7 @@ int ubi_rnvols(libubi_t desc, const char *node, struct ubi_rnvol_req *rnvol)
 		return -1;
 
 	ret = ioctl(fd, UBI_IOCRNVOL, rnvol);
+	cache_flush(desc);
 	if (ret == -1) {
 		close(fd);
 		return ret;
@@ -1100,13 +1376,13 @@ int ubi_rsvol(libubi_t desc, const char *node, int vol_id, long long bytes)
 	req.vol_id = vol_id;
 
 	ret = ioctl(fd, UBI_IOCRSVOL, &req);
+	cache_flush(desc);
 	close(fd);
 	return ret;
 }
 
 int ubi_update_start(libubi_t desc, int fd, long long bytes)
 {
-	desc = desc;
 	if (ioctl(fd, UBI_IOCVOLUP, &bytes))
 		return -1;
 	return 0;
@@ -1116,7 +1392,6 @@ int ubi_leb_change_start(libubi_t desc, int fd, int lnum, int bytes, int dtype)
 {
 	struct ubi_leb_change_req req;
 
-	desc = desc;
 	memset(&req, 0, sizeof(struct ubi_leb_change_req));
 	req.lnum = lnum;
 	req.bytes = bytes;
@@ -1144,10 +1419,23 @@ static int dev_present(struct libubi *lib, int dev_num)
 }
 
 int ubi_get_dev_info1(libubi_t desc, int dev_num, struct ubi_dev_info *info)
+{
+	struct libubi_cached *c = desc;
+	struct dev_cache *d;
+
+	cache_check(c);
+	d = cached_dev(c, dev_num);
+	if (!d)
+		return -1;
+	*info = d->info;
+	return 0;
+}
+
+static int read_dev_info1(struct libubi *lib, int dev_num,
+			  struct ubi_dev_info *info)
 {
 	DIR *sysfs_ubi;
 	struct dirent *dirent;
-	struct libubi *lib = (struct libubi *)desc;
 
 	memset(info, 0, sizeof(struct ubi_dev_info));
 	info->dev_num = dev_num;
@@ -1197,7 +1485,7 @@ int ubi_get_dev_info1(libubi_t desc, int dev_num, struct ubi_dev_info *info)
 	if (info->lowest_vol_id == INT_MAX)
 		info->lowest_vol_id = 0;
 
-	if (dev_get_major(lib, dev_num, &info->major, &info->minor))
+	if (read_dev_major(lib, dev_num, &info->major, &info->minor))
 		return -1;
 
 	if (dev_read_int(lib->dev_mtd_num, dev_num, &info->mtd_num))
@@ -1247,11 +1535,58 @@ int ubi_get_dev_info(libubi_t desc, const char *node, struct ubi_dev_info *info)
 	return ubi_get_dev_info1(desc, dev_num, info);
 }
 
+/**
+ * read_vol_state - re-read the parts of a cached volume's information that
+ *                  writing to it changes, and its name.
+ * @lib: libubi descriptor
+ * @info: a copy of the cached information, updated in place
+ *
+ * The name is what callers look volumes up by before opening them to write,
+ * so it is checked against sysfs rather than trusted from the cache.
+ *
+ * This function returns %0 in case of success and %-1 in case of failure.
+ */
+static int read_vol_state(struct libubi *lib, struct ubi_vol_info *info)
+{
+	int ret;
+
+	if (vol_read_ll(lib->vol_data_bytes, info->dev_num, info->vol_id,
+			&info->data_bytes))
+		return -1;
+	if (vol_read_int(lib->vol_corrupted, info->dev_num, info->vol_id,
+			 &info->corrupted))
+		return -1;
+	ret = vol_read_data(lib->vol_name, info->dev_num, info->vol_id,
+			    &info->name, UBI_VOL_NAME_MAX + 2);
+	if (ret < 0)
+		return -1;
+	info->name[ret - 1] = '\0';
+	return 0;
+}
+
 int ubi_get_vol_info1(libubi_t desc, int dev_num, int vol_id,
 		      struct ubi_vol_info *info)
+{
+	struct libubi_cached *c = desc;
+	struct dev_cache *d;
+
+	cache_check(c);
+	d = cached_dev(c, dev_num);
+	if (!d || cached_vols(c, d))
+		return read_vol_info1(&c->lib, dev_num, vol_id, info);
+
+	if (vol_id < 0 || vol_id >= d->vol_slots || !d->vol_present[vol_id]) {
+		errno = ENOENT;
+		return -1;
+	}
+	*info = d->vols[vol_id];
+	return read_vol_state(&c->lib, info);
+}
+
+static int read_vol_info1(struct libubi *lib, int dev_num, int vol_id,
+			  struct ubi_vol_info *info)
 {
 	int ret;
-	struct libubi *lib = (struct libubi *)desc;
 	char buf[50];
 
 	memset(info, 0, sizeof(struct ubi_vol_info));
@@ -1325,9 +1660,10 @@ int ubi_get_vol_info(libubi_t desc, const char *node, struct ubi_vol_info *info)
 int ubi_get_vol_info1_nm(libubi_t desc, int dev_num, const char *name,
 			 struct ubi_vol_info *info)
 {
-	int i, err;
+	int i, flushed = 0;
 	unsigned int nlen = strlen(name);
-	struct ubi_dev_info dev_info;
+	struct libubi_cached *c = desc;
+	struct dev_cache *d;
 
 	if (nlen == 0) {
 		errmsg("bad \"name\" input parameter");
@@ -1335,21 +1671,30 @@ int ubi_get_vol_info1_nm(libubi_t desc, int dev_num, const char *name,
 		return -1;
 	}
 
-	err = ubi_get_dev_info1(desc, dev_num, &dev_info);
-	if (err)
-		return err;
+retry:
+	cache_check(c);
+	d = cached_dev(c, dev_num);
+	if (!d || cached_vols(c, d))
+		return -1;
 
-	for (i = dev_info.lowest_vol_id;
-	     i <= dev_info.highest_vol_id; i++) {
-		err = ubi_get_vol_info1(desc, dev_num, i, info);
-		if (err == -1) {
-			if (errno == ENOENT)
-				continue;
-			return -1;
+	for (i = d->info.lowest_vol_id; i <= d->info.highest_vol_id; i++) {
+		if (!d->vol_present[i])
+			continue;
+
+		if (!strcmp(name, d->vols[i].name)) {
+			*info = d->vols[i];
+			if (read_vol_state(&c->lib, info) == 0 &&
+			    !strcmp(name, info->name))
+				return 0;
+			/* Renamed or re-created since it was cached; look again
+			 * with nothing cached, unless that's what this was.
+			 */
+			if (flushed)
+				break;
+			cache_flush(c);
+			flushed = 1;
+			goto retry;
 		}
-
-		if (nlen == strlen(info->name) && !strcmp(name, info->name))
-			return 0;
 	}
 
 	errno = ENOENT;
@@ -1372,6 +1717,16 @@ int ubi_leb_unmap(int fd, int lnum)
 	return ioctl(fd, UBI_IOCEBUNMAP, &lnum);
 }
 
+/*
+ * Unlike ubi_leb_unmap(), this waits for the physical eraseblock to be
+ * erased, so the old contents can't come back after an unclean reboot or
+ * a detach.
+ */
+int ubi_leb_erase(int fd, int lnum)
+{
+	return ioctl(fd, UBI_IOCEBER, &lnum);
+}
+
 int ubi_is_mapped(int fd, int lnum)
 {
 	return ioctl(fd, UBI_IOCEBISMAP, &lnum);
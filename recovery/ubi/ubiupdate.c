@@ -0,0 +1,229 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <libubi.h>
+
+#include "ubiupdate.h"
+
+/* Older kernels want the data type of a changed LEB (UBI_UNKNOWN); newer
+ * ones have dropped it from their headers and ignore it.
+ */
+#define LEB_CHANGE_DTYPE 3
+
+struct UbiUpdateContext {
+	libubi_t libubi;
+	int fd;
+	int dynamic;
+	int leb_size;
+	int min_io_size;
+	int rsvd_lebs;
+	long long bytes;		/* promised to ubi_update_open() */
+	int lnum;			/* next LEB to write */
+	char *buf;			/* one LEB, for dynamic volumes */
+	int buf_len;
+	int error;
+	long long start_us;
+	UbiUpdateStats stats;
+};
+
+static long long now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static int write_all(int fd, const char *data, size_t len)
+{
+	while (len > 0) {
+		ssize_t n = write(fd, data, len);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		data += n;
+		len -= n;
+	}
+	return 0;
+}
+
+UbiUpdateContext *ubi_update_open(libubi_t libubi, const char *node,
+				  long long bytes)
+{
+	struct ubi_vol_info vol_info;
+	struct ubi_dev_info dev_info;
+	UbiUpdateContext *ctx;
+
+	if (ubi_get_vol_info(libubi, node, &vol_info) ||
+	    ubi_get_dev_info1(libubi, vol_info.dev_num, &dev_info))
+		return NULL;
+
+	if (bytes < 0 || bytes > vol_info.rsvd_bytes) {
+		fprintf(stderr, "%lld bytes won't fit in %s (%lld bytes)\n",
+			bytes, node, vol_info.rsvd_bytes);
+		errno = ENOSPC;
+		return NULL;
+	}
+
+	ctx = calloc(1, sizeof(UbiUpdateContext));
+	if (!ctx)
+		return NULL;
+	ctx->libubi = libubi;
+	ctx->dynamic = vol_info.type == UBI_DYNAMIC_VOLUME;
+	ctx->leb_size = vol_info.leb_size;
+	ctx->min_io_size = dev_info.min_io_size > 0 ? dev_info.min_io_size : 1;
+	ctx->rsvd_lebs = vol_info.rsvd_lebs;
+	ctx->bytes = bytes;
+	ctx->start_us = now_us();
+
+	ctx->fd = open(node, O_RDWR);
+	if (ctx->fd < 0) {
+		free(ctx);
+		return NULL;
+	}
+
+	if (ctx->dynamic) {
+		ctx->buf = malloc(ctx->leb_size);
+		if (!ctx->buf)
+			goto fail;
+	} else if (ubi_update_start(libubi, ctx->fd, bytes)) {
+		fprintf(stderr, "can't start update of %s: %s\n",
+			node, strerror(errno));
+		goto fail;
+	}
+	return ctx;
+
+fail:
+	close(ctx->fd);
+	free(ctx);
+	return NULL;
+}
+
+/* Write out the buffered LEB, less any trailing 0xff (which is what
+ * unwritten flash reads as anyway), or erase it if that's all there is.
+ */
+static int flush_leb(UbiUpdateContext *ctx)
+{
+	int len = ctx->buf_len;
+
+	while (len > 0 && (unsigned char)ctx->buf[len - 1] == 0xff)
+		len--;
+	len = (len + ctx->min_io_size - 1) / ctx->min_io_size *
+	      ctx->min_io_size;
+	if (len > ctx->leb_size)
+		len = ctx->leb_size;
+	if (len > ctx->buf_len)
+		memset(ctx->buf + ctx->buf_len, 0xff, len - ctx->buf_len);
+
+	if (len == 0) {
+		if (ubi_leb_erase(ctx->fd, ctx->lnum))
+			return -1;
+		ctx->stats.lebs_erased++;
+	} else {
+		if (ubi_leb_change_start(ctx->libubi, ctx->fd, ctx->lnum, len,
+					 LEB_CHANGE_DTYPE) ||
+		    write_all(ctx->fd, ctx->buf, len))
+			return -1;
+		ctx->stats.lebs_written++;
+	}
+	ctx->lnum++;
+	ctx->buf_len = 0;
+	return 0;
+}
+
+ssize_t ubi_update_write(UbiUpdateContext *ctx, const void *data, size_t len)
+{
+	const char *p = data;
+	size_t left = len;
+
+	if (ctx->error)
+		return -1;
+	if (ctx->stats.bytes + (long long)len > ctx->bytes) {
+		errno = EINVAL;
+		ctx->error = 1;
+		return -1;
+	}
+
+	if (!ctx->dynamic) {
+		if (write_all(ctx->fd, p, len)) {
+			ctx->error = 1;
+			return -1;
+		}
+		ctx->stats.bytes += len;
+		return len;
+	}
+
+	while (left > 0) {
+		size_t n = ctx->leb_size - ctx->buf_len;
+
+		if (n > left)
+			n = left;
+		memcpy(ctx->buf + ctx->buf_len, p, n);
+		ctx->buf_len += n;
+		p += n;
+		left -= n;
+		if (ctx->buf_len == ctx->leb_size && flush_leb(ctx)) {
+			ctx->error = 1;
+			return -1;
+		}
+	}
+	ctx->stats.bytes += len;
+	return len;
+}
+
+int ubi_update_close(UbiUpdateContext *ctx, UbiUpdateStats *stats)
+{
+	int result = ctx->error ? -1 : 0;
+
+	if (!ctx->error && ctx->stats.bytes != ctx->bytes) {
+		fprintf(stderr, "UBI update ended after %lld of %lld bytes\n",
+			ctx->stats.bytes, ctx->bytes);
+		result = -1;
+	}
+
+	if (ctx->dynamic && result == 0) {
+		if (ctx->buf_len > 0 && flush_leb(ctx))
+			result = -1;
+		/* Whatever the volume held beyond the new data goes too. */
+		while (result == 0 && ctx->lnum < ctx->rsvd_lebs) {
+			if (ubi_leb_erase(ctx->fd, ctx->lnum++))
+				result = -1;
+			else
+				ctx->stats.lebs_erased++;
+		}
+	} else if (!ctx->dynamic) {
+		ctx->stats.lebs_written = (ctx->stats.bytes + ctx->leb_size - 1) /
+					  ctx->leb_size;
+	}
+
+	if (close(ctx->fd))
+		result = -1;
+	ctx->stats.elapsed_us = now_us() - ctx->start_us;
+	if (stats)
+		*stats = ctx->stats;
+	free(ctx->buf);
+	free(ctx);
+	return result;
+}
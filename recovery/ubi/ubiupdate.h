@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UBI_UBIUPDATE_H_
+#define UBI_UBIUPDATE_H_
+
+#include <sys/types.h>
+#include <libubi.h>
+
+/*
+ * Replace the contents of a UBI volume with a stream of data, written as it
+ * arrives.
+ *
+ * A dynamic volume is written one LEB at a time with atomic LEB changes;
+ * LEBs that would hold nothing but 0xff are erased instead, as are any
+ * past the end of the data.  Each LEB is either old or new after a power
+ * cut, but the volume as a whole may be a mix of both, just as with
+ * write_raw_image on MTD.
+ *
+ * Those LEBs are erased with ubi_leb_erase(), which waits for the erase
+ * to finish, not just unmapped: an unmap only schedules the erase, and
+ * if the device is detached or the system reboots before it happens, the
+ * old data can reappear in the LEB.  So once ubi_update_close() returns
+ * 0, the volume holds exactly the new data.
+ *
+ * A static volume has to be written with a volume update, which the kernel
+ * marks so that an interrupted one leaves the volume flagged as corrupted.
+ */
+
+typedef struct UbiUpdateContext UbiUpdateContext;
+
+typedef struct {
+	long long bytes;		/* data written so far */
+	int lebs_written;
+	int lebs_erased;		/* all 0xff, or past the end */
+	long long elapsed_us;		/* from open to close */
+} UbiUpdateStats;
+
+/* Start writing "bytes" bytes to the volume at "node" (e.g. /dev/ubi0_1).
+ * Returns NULL with errno set if the volume can't be opened or is too small.
+ */
+UbiUpdateContext *ubi_update_open(libubi_t libubi, const char *node,
+				  long long bytes);
+
+/* Returns "len", or -1 if the data couldn't be written (or there is more of
+ * it than was promised to ubi_update_open()).
+ */
+ssize_t ubi_update_write(UbiUpdateContext *ctx, const void *data, size_t len);
+
+/* Write out what is left and free the context.  Returns 0 if everything
+ * was written, and -1 otherwise.  "stats" may be NULL.
+ */
+int ubi_update_close(UbiUpdateContext *ctx, UbiUpdateStats *stats);
+
+/* Unmap a LEB and wait for its old physical eraseblock to be erased
+ * (UBI_IOCEBER).  Part of libubi.c, which libubi.h doesn't declare.
+ */
+int ubi_leb_erase(int fd, int lnum);
+
+#endif  /* UBI_UBIUPDATE_H_ */
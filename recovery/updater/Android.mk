@@ -6,7 +6,8 @@ updater_src_files := \
 	install.c \
 	updater.c \
 	../ubi/ubiutils-common.c \
-	../ubi/libubi.c
+	../ubi/libubi.c \
+	../ubi/ubiupdate.c
 
 #
 # Build a statically-linked binary to include in OTA packages
@@ -25,12 +26,20 @@ LOCAL_CFLAGS += -DUDEV_SETTLE_HACK
 ifeq ($(TARGET_USERIMAGES_USE_EXT4), true)
 LOCAL_CFLAGS += -DUSE_EXT4
 LOCAL_C_INCLUDES += system/extras/ext4_utils
-LOCAL_STATIC_LIBRARIES += libext4_utils libz
+LOCAL_STATIC_LIBRARIES += libext4_utils
 endif
 
 LOCAL_STATIC_LIBRARIES += $(TARGET_RECOVERY_UPDATER_LIBS) $(TARGET_RECOVERY_UPDATER_EXTRA_LIBS)
-LOCAL_STATIC_LIBRARIES += libapplypatch libedify libmtdutils libminzip libz
-LOCAL_STATIC_LIBRARIES += libmincrypt libbz
+LOCAL_STATIC_LIBRARIES += libapplypatch libedify libmtdutils libminzip
+ifeq ($(TARGET_MINZIP_USE_LIBDEFLATE),true)
+LOCAL_STATIC_LIBRARIES += libdeflate
+endif
+ifeq ($(TARGET_MINZIP_USE_ZLIB_NG),true)
+LOCAL_STATIC_LIBRARIES += libz_ng
+else
+LOCAL_STATIC_LIBRARIES += libz
+endif
+LOCAL_STATIC_LIBRARIES += librecovery_crypto libbz
 LOCAL_STATIC_LIBRARIES += libminelf
 LOCAL_STATIC_LIBRARIES += libfw_env libcutils libstdc++ libc
 
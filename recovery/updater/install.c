@@ -31,7 +31,7 @@
 #include "cutils/misc.h"
 #include "cutils/properties.h"
 #include "edify/expr.h"
-#include "mincrypt/sha.h"
+#include "crypto/sha1.h"
 #include "minzip/DirUtil.h"
 #include "minelf/Retouch.h"
 #include "mtdutils/mounts.h"
@@ -40,6 +40,7 @@
 #include "applypatch/applypatch.h"
 #include "libubi.h"
 #include "ubiutils-common.h"
+#include "ubi/ubiupdate.h"
 
 #include "edify/expr.h"
 #include "updater.h"
@@ -867,6 +868,10 @@ Value* SymlinkFn(const char* name, State* state, int argc, Expr* argv[]) {
 }
 
 
+// set_perm_recursive spreads the top-level subtrees of each path over
+// this many threads; most of the time goes to waiting on inode updates.
+#define SET_PERM_THREADS 4
+
 Value* SetPermFn(const char* name, State* state, int argc, Expr* argv[]) {
     char* result = NULL;
     bool recursive = (strcmp(name, "set_perm_recursive") == 0);
@@ -909,7 +914,11 @@ Value* SetPermFn(const char* name, State* state, int argc, Expr* argv[]) {
         }
 
         for (i = 4; i < argc; ++i) {
-            dirSetHierarchyPermissions(args[i], uid, gid, dir_mode, file_mode);
+            if (dirSetHierarchyPermissionsParallel(args[i], uid, gid,
+                    dir_mode, file_mode, SET_PERM_THREADS) < 0) {
+                fprintf(stderr, "%s: setting permissions under %s failed: %s\n",
+                        name, args[i], strerror(errno));
+            }
         }
     } else {
         int mode = strtoul(args[2], &end, 0);
@@ -1267,6 +1276,106 @@ done:
     return StringValue(result);
 }
 
+static bool UbiUpdateProcessFunction(const unsigned char* data, int dataLen,
+                                     void* cookie) {
+    return ubi_update_write((UbiUpdateContext*) cookie, data, dataLen) ==
+           dataLen;
+}
+
+// write_ubi_image(zip_path, volume)
+//
+//    Streams zip_path from the package into a UBI volume, without
+//    extracting it first.  volume is either a volume device node
+//    ("/dev/ubi0_1") or the name of a volume on an attached UBI
+//    device.  Failing both, the MTD partition of that name is attached
+//    and its first volume written, as mount() does.
+Value* WriteUbiImageFn(const char* name, State* state, int argc, Expr* argv[]) {
+    char* zip_path;
+    char* volume;
+    bool success = false;
+    bool attached = false;
+    char node[64];
+
+    if (argc != 2) {
+        return ErrorAbort(state, "%s() expects 2 args, got %d", name, argc);
+    }
+    if (ReadArgs(state, argv, 2, &zip_path, &volume) < 0) return NULL;
+
+    ZipArchive* za = ((UpdaterInfo*)(state->cookie))->package_zip;
+    const ZipEntry* entry = mzFindZipEntry(za, zip_path);
+    if (entry == NULL) {
+        fprintf(stderr, "%s: no %s in package\n", name, zip_path);
+        goto done;
+    }
+
+    libubi_t libubi = libubi_open();
+    if (!libubi) {
+        fprintf(stderr, "libubi_open fail\n");
+        goto done;
+    }
+
+    if (volume[0] == '/') {
+        snprintf(node, sizeof(node), "%s", volume);
+    } else {
+        struct ubi_info ubi_info;
+        struct ubi_vol_info vol_info;
+        int i;
+
+        node[0] = '\0';
+        if (ubi_get_info(libubi, &ubi_info) == 0) {
+            for (i = ubi_info.lowest_dev_num;
+                 i <= ubi_info.highest_dev_num; ++i) {
+                if (ubi_get_vol_info1_nm(libubi, i, volume, &vol_info) == 0) {
+                    snprintf(node, sizeof(node), "/dev/ubi%d_%d",
+                             vol_info.dev_num, vol_info.vol_id);
+                    break;
+                }
+            }
+        }
+        if (node[0] == '\0') {
+            char* np = node;
+            if (UbiAttach(volume, &np) != 0) {
+                fprintf(stderr, "%s: no UBI volume \"%s\"\n", name, volume);
+                goto done_ubi;
+            }
+            attached = true;
+        }
+    }
+
+    UbiUpdateContext* ctx = ubi_update_open(libubi, node,
+                                            mzGetZipEntryUncompLen(entry));
+    if (ctx == NULL) {
+        fprintf(stderr, "%s: can't write %s: %s\n",
+                name, node, strerror(errno));
+        goto done_detach;
+    }
+
+    success = mzProcessZipEntryContents(za, entry, UbiUpdateProcessFunction,
+                                        ctx);
+    UbiUpdateStats stats;
+    if (ubi_update_close(ctx, &stats) != 0) {
+        success = false;
+    }
+
+    long long ms = stats.elapsed_us / 1000;
+    printf("%s %s: %lld bytes in %lld ms (%.1f MB/s), %d LEBs written, "
+           "%d erased\n", success ? "wrote" : "failed to write", node,
+           stats.bytes, ms,
+           ms > 0 ? stats.bytes / 1048576.0 / (ms / 1000.0) : 0.0,
+           stats.lebs_written, stats.lebs_erased);
+
+done_detach:
+    if (attached) {
+        UbiDetach(node);
+    }
+done_ubi:
+    libubi_close(libubi);
+done:
+    free(zip_path);
+    free(volume);
+    return StringValue(strdup(success ? "t" : ""));
+}
+
 // apply_patch_space(bytes)
 Value* ApplyPatchSpaceFn(const char* name, State* state,
                          int argc, Expr* argv[]) {
@@ -1474,11 +1583,11 @@ Value* RunProgramFn(const char* name, State* state, int argc, Expr* argv[]) {
 }
 
 // Take a sha-1 digest and return it as a newly-allocated hex string.
-static char* PrintSha1(uint8_t* digest) {
-    char* buffer = malloc(SHA_DIGEST_SIZE*2 + 1);
+static char* PrintSha1(const uint8_t* digest) {
+    char* buffer = malloc(SHA1_DIGEST_SIZE*2 + 1);
     int i;
     const char* alphabet = "0123456789abcdef";
-    for (i = 0; i < SHA_DIGEST_SIZE; ++i) {
+    for (i = 0; i < SHA1_DIGEST_SIZE; ++i) {
         buffer[i*2] = alphabet[(digest[i] >> 4) & 0xf];
         buffer[i*2+1] = alphabet[digest[i] & 0xf];
     }
@@ -1486,6 +1595,48 @@ static char* PrintSha1(uint8_t* digest) {
     return buffer;
 }
 
+// Given the digest of sha1_check()'s or package_sha1_check()'s first
+// argument, return the hex string among args[1..argc-1] that matches
+// it, "" if none does, or the digest itself if there are no others.
+// Frees args[1..argc-1] (save the one returned) and args itself.
+static Value* MatchSha1(const char* name, const uint8_t* digest,
+                        int argc, Value** args) {
+    if (argc == 1) {
+        free(args);
+        return StringValue(PrintSha1(digest));
+    }
+
+    int i;
+    uint8_t arg_digest[SHA1_DIGEST_SIZE];
+    for (i = 1; i < argc; ++i) {
+        if (args[i]->type != VAL_STRING) {
+            fprintf(stderr, "%s(): arg %d is not a string; skipping\n",
+                    name, i);
+        } else if (ParseSha1(args[i]->data, arg_digest) != 0) {
+            // Warn about bad args and skip them.
+            fprintf(stderr, "%s(): error parsing \"%s\" as sha-1; skipping\n",
+                    name, args[i]->data);
+        } else if (memcmp(digest, arg_digest, SHA1_DIGEST_SIZE) == 0) {
+            break;
+        }
+        FreeValue(args[i]);
+    }
+    if (i >= argc) {
+        // Didn't match any of the hex strings; return false.
+        free(args);
+        return StringValue(strdup(""));
+    }
+    // Found a match; free all the remaining arguments and return the
+    // matched one.
+    int j;
+    for (j = i+1; j < argc; ++j) {
+        FreeValue(args[j]);
+    }
+    Value* result = args[i];
+    free(args);
+    return result;
+}
+
 // sha1_check(data)
 //    to return the sha1 of the data (given in the format returned by
 //    read_file).
@@ -1505,43 +1656,99 @@ Value* Sha1CheckFn(const char* name, State* state, int argc, Expr* argv[]) {
     }
 
     if (args[0]->size < 0) {
-        fprintf(stderr, "%s(): no file contents received", name);
+        fprintf(stderr, "%s(): no file contents received\n", name);
         return StringValue(strdup(""));
     }
-    uint8_t digest[SHA_DIGEST_SIZE];
-    SHA(args[0]->data, args[0]->size, digest);
+    uint8_t digest[SHA1_DIGEST_SIZE];
+    SHA1(args[0]->data, args[0]->size, digest);
     FreeValue(args[0]);
 
-    if (argc == 1) {
-        return StringValue(PrintSha1(digest));
+    return MatchSha1(name, digest, argc, args);
+}
+
+// package_sha1_check(package_path)
+//    to return the sha1 of the named entry in the update package.
+//
+// package_sha1_check(package_path, sha1_hex, [sha1_hex, ...])
+//    returns the sha1 of the entry if it matches any of the hex
+//    strings passed, or "" if it does not equal any of them.
+//
+// Unlike sha1_check(package_extract_file(...)), the entry is hashed
+// as it is inflated, so it never has to fit in memory.  The entry's
+// CRC is checked in the same pass; a mismatch also returns "".
+Value* PackageSha1CheckFn(const char* name, State* state,
+                          int argc, Expr* argv[]) {
+    if (argc < 1) {
+        return ErrorAbort(state, "%s() expects at least 1 arg", name);
     }
 
-    int i;
-    uint8_t* arg_digest = malloc(SHA_DIGEST_SIZE);
-    for (i = 1; i < argc; ++i) {
-        if (args[i]->type != VAL_STRING) {
-            fprintf(stderr, "%s(): arg %d is not a string; skipping",
-                    name, i);
-        } else if (ParseSha1(args[i]->data, arg_digest) != 0) {
-            // Warn about bad args and skip them.
-            fprintf(stderr, "%s(): error parsing \"%s\" as sha-1; skipping",
-                    name, args[i]->data);
-        } else if (memcmp(digest, arg_digest, SHA_DIGEST_SIZE) == 0) {
-            break;
+    Value** args = ReadValueVarArgs(state, argc, argv);
+    if (args == NULL) {
+        return NULL;
+    }
+
+    uint8_t digest[SHA1_DIGEST_SIZE];
+    bool success = false;
+    if (args[0]->type != VAL_STRING) {
+        fprintf(stderr, "%s(): package_path is not a string\n", name);
+    } else {
+        ZipArchive* za = ((UpdaterInfo*)(state->cookie))->package_zip;
+        const ZipEntry* entry = mzFindZipEntry(za, args[0]->data);
+        if (entry == NULL) {
+            fprintf(stderr, "%s: no %s in package\n", name, args[0]->data);
+        } else {
+            success = mzHashZipEntry(za, entry, digest, NULL);
         }
-        FreeValue(args[i]);
     }
-    if (i >= argc) {
-        // Didn't match any of the hex strings; return false.
+    FreeValue(args[0]);
+
+    if (!success) {
+        int i;
+        for (i = 1; i < argc; ++i) {
+            FreeValue(args[i]);
+        }
+        free(args);
         return StringValue(strdup(""));
     }
-    // Found a match; free all the remaining arguments and return the
-    // matched one.
-    int j;
-    for (j = i+1; j < argc; ++j) {
-        FreeValue(args[j]);
+
+    return MatchSha1(name, digest, argc, args);
+}
+
+static void PackageCheckEntryDone(const ZipEntry* entry, bool intact,
+                                  void* cookie) {
+    if (!intact) {
+        fprintf(stderr, "%s: %.*s is corrupt\n", (const char*)cookie,
+                (int)entry->fileNameLen, entry->fileName);
+    }
+}
+
+// package_check_integrity([threads])
+//   Check the CRC of every entry in the package, using "threads"
+//   threads (by default, one per CPU).  Returns "t" if every entry is
+//   intact, "" otherwise.
+Value* PackageCheckIntegrityFn(const char* name, State* state,
+                               int argc, Expr* argv[]) {
+    if (argc > 1) {
+        return ErrorAbort(state, "%s() expects 0 or 1 args, got %d",
+                          name, argc);
+    }
+    int threads = 0;
+    if (argc == 1) {
+        char* threads_str;
+        if (ReadArgs(state, argv, 1, &threads_str) < 0) {
+            return NULL;
+        }
+        threads = strtol(threads_str, NULL, 10);
+        free(threads_str);
+    }
+
+    ZipArchive* za = ((UpdaterInfo*)(state->cookie))->package_zip;
+    int bad = mzCheckZipArchive(za, threads, PackageCheckEntryDone,
+                                (void*)name);
+    if (bad != 0) {
+        fprintf(stderr, "%s: %d entries failed the check\n", name, bad);
     }
-    return args[i];
+    return StringValue(strdup(bad == 0 ? "t" : ""));
 }
 
 // Read a local file and return its contents (the Value* returned
@@ -1632,6 +1839,7 @@ void RegisterInstallFunctions() {
     RegisterFunction("getprop", GetPropFn);
     RegisterFunction("file_getprop", FileGetPropFn);
     RegisterFunction("write_raw_image", WriteRawImageFn);
+    RegisterFunction("write_ubi_image", WriteUbiImageFn);
 
     RegisterFunction("apply_patch", ApplyPatchFn);
     RegisterFunction("apply_patch_check", ApplyPatchCheckFn);
@@ -1639,6 +1847,8 @@ void RegisterInstallFunctions() {
 
     RegisterFunction("read_file", ReadFileFn);
     RegisterFunction("sha1_check", Sha1CheckFn);
+    RegisterFunction("package_sha1_check", PackageSha1CheckFn);
+    RegisterFunction("package_check_integrity", PackageCheckIntegrityFn);
 
     RegisterFunction("wipe_cache", WipeCacheFn);
 
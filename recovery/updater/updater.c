@@ -14,9 +14,13 @@
  * limitations under the License.
  */
 
+#include <errno.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 #include "edify/expr.h"
 #include "updater.h"
@@ -32,6 +36,88 @@
 // (Note it's "updateR-script", not the older "update-script".)
 #define SCRIPT_NAME "META-INF/com/google/android/updater-script"
 
+// Set by recovery to "fd:size:dev:ino" for a descriptor on the package
+// it has just verified.  Keep in sync with recovery's install.c.
+#define PACKAGE_FD_ENV "UPDATE_PACKAGE_FD"
+
+// Set by recovery, to the hex SHA-256 of the signed part of the hash
+// tree, when it verified the package by its hash tree instead of its
+// whole-file signature.  Keep in sync with recovery's install.c.
+#define PACKAGE_HASH_TREE_ENV "UPDATE_PACKAGE_HASH_TREE"
+
+// Open the archive in the mapped package.  If recovery only verified
+// the package's hash tree, the tree in the package must be that same
+// one, and everything read from the archive is checked against it.
+static int OpenMapped(int fd, MemMapping* map, const char* tree_token,
+                      ZipArchive* za) {
+    BlockHashTree* tree = NULL;
+    if (tree_token[0] != '\0') {
+        char hex[SHA256_DIGEST_SIZE * 2 + 1];
+        hex[0] = '\0';
+        tree = mzLoadHashTree(map->addr, map->length);
+        if (tree != NULL) {
+            uint8_t digest[SHA256_DIGEST_SIZE];
+            int i;
+            mzHashTreeDigest(tree, digest);
+            for (i = 0; i < SHA256_DIGEST_SIZE; ++i) {
+                sprintf(hex + i * 2, "%02x", digest[i]);
+            }
+        }
+        if (strcmp(hex, tree_token) != 0) {
+            fprintf(stderr, "package hash tree isn't the one recovery verified\n");
+            mzFreeHashTree(tree);
+            sysReleaseShmem(map);
+            close(fd);
+            return -1;
+        }
+    }
+    return mzOpenZipArchiveWithHashTree(fd, map, tree, za);
+}
+
+// Open the package through the descriptor recovery verified it with,
+// if there is one and it still refers to the file it describes;
+// otherwise open the path.  Either way the variables are cleared so
+// the programs the script runs don't see them.
+static int OpenPackage(const char* path, ZipArchive* za) {
+    const char* token = getenv(PACKAGE_FD_ENV);
+    const char* tree_env = getenv(PACKAGE_HASH_TREE_ENV);
+    char tree_token[SHA256_DIGEST_SIZE * 2 + 1];
+    int fd = -1;
+    long long size = -1;
+    unsigned long long dev = 0, ino = 0;
+    int parsed = token != NULL &&
+        sscanf(token, "%d:%lld:%llu:%llu", &fd, &size, &dev, &ino) == 4;
+    snprintf(tree_token, sizeof(tree_token), "%s", tree_env ? tree_env : "");
+    unsetenv(PACKAGE_FD_ENV);
+    unsetenv(PACKAGE_HASH_TREE_ENV);
+
+    MemMapping map;
+    if (parsed) {
+        struct stat st;
+        if (fd > STDERR_FILENO && fstat(fd, &st) == 0 &&
+            S_ISREG(st.st_mode) && st.st_size == size &&
+            st.st_dev == dev && st.st_ino == ino) {
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+            if (lseek(fd, 0, SEEK_SET) == 0 &&
+                sysMapFileInShmem(fd, &map) == 0) {
+                return OpenMapped(fd, &map, tree_token, za);
+            }
+            close(fd);
+        }
+        fprintf(stderr, "can't use package fd %d; opening %s\n", fd, path);
+    }
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return errno ? errno : -1;
+    }
+    if (sysMapFileInShmem(fd, &map) != 0) {
+        close(fd);
+        return -1;
+    }
+    return OpenMapped(fd, &map, tree_token, za);
+}
+
 int main(int argc, char** argv) {
     // Various things log information to stdout or stderr more or less
     // at random.  The log file makes more sense if buffering is
@@ -65,10 +151,10 @@ int main(int argc, char** argv) {
     char* package_data = argv[3];
     ZipArchive za;
     int err;
-    err = mzOpenZipArchive(package_data, &za);
+    err = OpenPackage(package_data, &za);
     if (err != 0) {
         fprintf(stderr, "failed to open package %s: %s\n",
-                package_data, strerror(err));
+                package_data, err == -1 ? "bad" : strerror(err));
         return 3;
     }
 
@@ -17,12 +17,176 @@
 #include "common.h"
 #include "verifier.h"
 
-#include "mincrypt/rsa.h"
-#include "mincrypt/sha.h"
+#include "crypto/rsa.h"
+#include "crypto/sha1.h"
+#include "crypto/sha256.h"
 
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// The signed region is hashed straight out of a read-only mapping of
+// the package.  A separate thread touches the pages of the window
+// ahead of the one being hashed, so the storage can be reading the
+// next window while the current one is being hashed; it is held at
+// most PREFAULT_WINDOWS windows ahead so it doesn't evict what the
+// hasher hasn't got to yet.
+
+#define FOOTER_SIZE 6
+#define EOCD_HEADER_SIZE 22
+
+#define PREFAULT_WINDOW_SIZE (1024 * 1024)
+#define PREFAULT_WINDOWS 2
+#define PAGE_SIZE_GUESS 4096
+
+typedef struct {
+    const unsigned char* base;
+    size_t signed_len;
+    size_t prefaulted;        // bytes the prefault thread has touched
+    size_t hashed;            // bytes the hasher has consumed
+    int cancel;               // set by the hasher to stop the thread
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} Prefault;
+
+static void* prefault_thread(void* cookie) {
+    Prefault* pf = (Prefault*)cookie;
+    volatile unsigned char sink = 0;
+
+    for (;;) {
+        pthread_mutex_lock(&pf->lock);
+        while (!pf->cancel && pf->prefaulted < pf->signed_len &&
+               pf->prefaulted >= pf->hashed +
+                                 PREFAULT_WINDOWS * PREFAULT_WINDOW_SIZE) {
+            pthread_cond_wait(&pf->cond, &pf->lock);
+        }
+        size_t start = pf->prefaulted;
+        int done = pf->cancel || start >= pf->signed_len;
+        pthread_mutex_unlock(&pf->lock);
+        if (done) break;
+
+        size_t end = start + PREFAULT_WINDOW_SIZE;
+        if (end > pf->signed_len) end = pf->signed_len;
+        madvise((void*)((uintptr_t)(pf->base + start) &
+                        ~(uintptr_t)(PAGE_SIZE_GUESS - 1)),
+                end - start, MADV_WILLNEED);
+        size_t off;
+        for (off = start; off < end; off += PAGE_SIZE_GUESS) {
+            sink += pf->base[off];
+        }
+
+        pthread_mutex_lock(&pf->lock);
+        pf->prefaulted = end;
+        pthread_cond_broadcast(&pf->cond);
+        pthread_mutex_unlock(&pf->lock);
+    }
+    return NULL;
+}
+
+// Compute the SHA-1 and/or SHA-256 of the first signed_len bytes of
+// the mapping at base, with paging-in overlapped with hashing.  Either
+// context may be NULL if no key needs that digest.
+static void hash_signed_region(const unsigned char* base, size_t signed_len,
+                               SHA1_CTX* sha1_ctx, SHA256_CTX* sha256_ctx) {
+    Prefault pf;
+    pthread_t thread;
+    int have_thread;
+
+    memset(&pf, 0, sizeof(pf));
+    pf.base = base;
+    pf.signed_len = signed_len;
+    pthread_mutex_init(&pf.lock, NULL);
+    pthread_cond_init(&pf.cond, NULL);
+    have_thread = pthread_create(&thread, NULL, prefault_thread, &pf) == 0;
+    if (!have_thread) {
+        LOGI("no prefault thread; hashing without read-ahead\n");
+    }
+
+    double frac = -1.0;
+    size_t so_far = 0;
+    while (so_far < signed_len) {
+        size_t size = PREFAULT_WINDOW_SIZE;
+        if (signed_len - so_far < size) size = signed_len - so_far;
+
+        if (sha1_ctx) SHA1_update(sha1_ctx, base + so_far, size);
+        if (sha256_ctx) SHA256_update(sha256_ctx, base + so_far, size);
+        so_far += size;
+
+        if (have_thread) {
+            pthread_mutex_lock(&pf.lock);
+            pf.hashed = so_far;
+            pthread_cond_broadcast(&pf.cond);
+            pthread_mutex_unlock(&pf.lock);
+        }
+
+        double f = so_far / (double)signed_len;
+        if (f > frac + 0.02 || so_far == signed_len) {
+            ui_set_progress(f);
+            frac = f;
+        }
+    }
+
+    if (have_thread) {
+        pthread_mutex_lock(&pf.lock);
+        pf.cancel = 1;
+        pthread_cond_broadcast(&pf.cond);
+        pthread_mutex_unlock(&pf.lock);
+        pthread_join(thread, NULL);
+    }
+    pthread_cond_destroy(&pf.cond);
+    pthread_mutex_destroy(&pf.lock);
+}
+
+// Signing tools may name the key they used, so a recovery holding
+// several keys can try the right one first.  The hint is
+//
+//   "KID1" (4-byte big-endian key id)
+//
+// placed immediately before the signature, where the key id is the
+// first four bytes of the SHA-1 of the key's big-endian modulus (see
+// RSAKey_precompute).  It only changes the order keys are tried in;
+// it is not covered by the signature, so it's never trusted beyond
+// that.  Returns the index of the first key whose id and signature
+// length match, or numKeys if there isn't one.
+
+#define KEY_ID_HINT_SIZE 8
+
+static unsigned int find_hinted_key(const unsigned char* eocd, size_t eocd_size,
+                                    int signature_start,
+                                    const Certificate* pKeys,
+                                    unsigned int numKeys) {
+    unsigned int i;
+    for (i = 0; i < numKeys; ++i) {
+        const RSAKey* key = &pKeys[i].public_key;
+        int sig_len = key->len * sizeof(uint32_t);
+        if (key->key_id == 0 ||
+            signature_start < FOOTER_SIZE + sig_len + KEY_ID_HINT_SIZE ||
+            eocd_size < EOCD_HEADER_SIZE + FOOTER_SIZE + sig_len +
+                        KEY_ID_HINT_SIZE) {
+            continue;
+        }
+        const unsigned char* hint =
+            eocd + eocd_size - FOOTER_SIZE - sig_len - KEY_ID_HINT_SIZE;
+        uint32_t id = ((uint32_t)hint[4] << 24) | ((uint32_t)hint[5] << 16) |
+                      ((uint32_t)hint[6] << 8) | hint[7];
+        if (memcmp(hint, "KID1", 4) == 0 && id == key->key_id) {
+            LOGI("signature names key %d (id %08x)\n", i, id);
+            return i;
+        }
+    }
+    return numKeys;
+}
+
+static int same_public_key(const RSAKey* a, const RSAKey* b) {
+    return a->len == b->len && a->exponent == b->exponent &&
+           memcmp(a->n, b->n, a->len * sizeof(uint32_t)) == 0;
+}
 
 // Look for an RSA signature embedded in the .ZIP file comment given
 // the path to the zip.  Verify it matches one of the given public
@@ -31,15 +195,54 @@
 // Return VERIFY_SUCCESS, VERIFY_FAILURE (if any error is encountered
 // or no key matches the signature).
 
-int verify_file(const char* path, const RSAPublicKey *pKeys, unsigned int numKeys) {
+int verify_file(const char* path, const Certificate *pKeys, unsigned int numKeys) {
     ui_set_progress(0.0);
 
-    FILE* f = fopen(path, "rb");
-    if (f == NULL) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
         LOGE("failed to open %s (%s)\n", path, strerror(errno));
         return VERIFY_FAILURE;
     }
 
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        LOGE("failed to stat %s (%s)\n", path, strerror(errno));
+        close(fd);
+        return VERIFY_FAILURE;
+    }
+    if (st.st_size == 0) {
+        LOGE("%s is empty\n", path);
+        close(fd);
+        return VERIFY_FAILURE;
+    }
+
+    void* addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        LOGE("failed to map %s (%s)\n", path, strerror(errno));
+        return VERIFY_FAILURE;
+    }
+
+    int result = verify_mapped_file(addr, st.st_size, pKeys, numKeys);
+    munmap(addr, st.st_size);
+    return result;
+}
+
+// Find the whole-file signature footer and the EOCD record it
+// implies, and check that they are consistent.  Fills in the
+// locations everything else is found relative to.  Returns 0 on
+// success, -1 if the package isn't signed this way.
+
+typedef struct {
+    const unsigned char* eocd;
+    size_t eocd_size;
+    int comment_size;
+    int signature_start;
+    size_t signed_len;          // bytes covered by the signature
+} SignedPackage;
+
+static int find_signature(const unsigned char* addr, size_t length,
+                          SignedPackage* pkg) {
     // An archive with a whole-file signature will end in six bytes:
     //
     //   (2-byte signature start) $ff $ff (2-byte comment size)
@@ -49,136 +252,229 @@ int verify_file(const char* path, const RSAPublicKey *pKeys, unsigned int numKey
     // us how far back from the end we have to start reading to find
     // the whole comment.
 
-#define FOOTER_SIZE 6
-
-    if (fseek(f, -FOOTER_SIZE, SEEK_END) != 0) {
-        LOGE("failed to seek in %s (%s)\n", path, strerror(errno));
-        fclose(f);
-        return VERIFY_FAILURE;
-    }
-
-    unsigned char footer[FOOTER_SIZE];
-    if (fread(footer, 1, FOOTER_SIZE, f) != FOOTER_SIZE) {
-        LOGE("failed to read footer from %s (%s)\n", path, strerror(errno));
-        fclose(f);
-        return VERIFY_FAILURE;
+    if (length < FOOTER_SIZE) {
+        LOGE("package is too short for a signature footer\n");
+        return -1;
     }
 
+    const unsigned char* footer = addr + length - FOOTER_SIZE;
     if (footer[2] != 0xff || footer[3] != 0xff) {
-        fclose(f);
-        return VERIFY_FAILURE;
+        return -1;
     }
 
-    int comment_size = footer[4] + (footer[5] << 8);
-    int signature_start = footer[0] + (footer[1] << 8);
+    pkg->comment_size = footer[4] + (footer[5] << 8);
+    pkg->signature_start = footer[0] + (footer[1] << 8);
     LOGI("comment is %d bytes; signature %d bytes from end\n",
-         comment_size, signature_start);
+         pkg->comment_size, pkg->signature_start);
 
-    if (signature_start - FOOTER_SIZE < RSANUMBYTES) {
+// The smallest key we accept is 2048 bits.
+#define MIN_SIGNATURE_SIZE 256
+
+    if (pkg->signature_start - FOOTER_SIZE < MIN_SIGNATURE_SIZE) {
         // "signature" block isn't big enough to contain an RSA block.
         LOGE("signature is too short\n");
-        fclose(f);
-        return VERIFY_FAILURE;
+        return -1;
     }
 
-#define EOCD_HEADER_SIZE 22
-
     // The end-of-central-directory record is 22 bytes plus any
     // comment length.
-    size_t eocd_size = comment_size + EOCD_HEADER_SIZE;
-
-    if (fseek(f, -eocd_size, SEEK_END) != 0) {
-        LOGE("failed to seek in %s (%s)\n", path, strerror(errno));
-        fclose(f);
-        return VERIFY_FAILURE;
+    pkg->eocd_size = pkg->comment_size + EOCD_HEADER_SIZE;
+    if (pkg->eocd_size > length) {
+        LOGE("comment is larger than the package\n");
+        return -1;
     }
+    const unsigned char* eocd = addr + length - pkg->eocd_size;
+    pkg->eocd = eocd;
 
     // Determine how much of the file is covered by the signature.
     // This is everything except the signature data and length, which
     // includes all of the EOCD except for the comment length field (2
     // bytes) and the comment data.
-    size_t signed_len = ftell(f) + EOCD_HEADER_SIZE - 2;
-
-    unsigned char* eocd = malloc(eocd_size);
-    if (eocd == NULL) {
-        LOGE("malloc for EOCD record failed\n");
-        fclose(f);
-        return VERIFY_FAILURE;
-    }
-    if (fread(eocd, 1, eocd_size, f) != eocd_size) {
-        LOGE("failed to read eocd from %s (%s)\n", path, strerror(errno));
-        fclose(f);
-        return VERIFY_FAILURE;
-    }
+    pkg->signed_len = length - pkg->eocd_size + EOCD_HEADER_SIZE - 2;
 
     // If this is really is the EOCD record, it will begin with the
     // magic number $50 $4b $05 $06.
     if (eocd[0] != 0x50 || eocd[1] != 0x4b ||
         eocd[2] != 0x05 || eocd[3] != 0x06) {
         LOGE("signature length doesn't match EOCD marker\n");
-        fclose(f);
-        return VERIFY_FAILURE;
+        return -1;
     }
 
-    int i;
-    for (i = 4; i < eocd_size-3; ++i) {
-        if (eocd[i  ] == 0x50 && eocd[i+1] == 0x4b &&
-            eocd[i+2] == 0x05 && eocd[i+3] == 0x06) {
+    size_t j;
+    for (j = 4; j < pkg->eocd_size-3; ++j) {
+        if (eocd[j  ] == 0x50 && eocd[j+1] == 0x4b &&
+            eocd[j+2] == 0x05 && eocd[j+3] == 0x06) {
             // if the sequence $50 $4b $05 $06 appears anywhere after
             // the real one, minzip will find the later (wrong) one,
             // which could be exploitable.  Fail verification if
             // this sequence occurs anywhere after the real one.
             LOGE("EOCD marker occurs after start of EOCD\n");
-            fclose(f);
-            return VERIFY_FAILURE;
+            return -1;
         }
     }
+    return 0;
+}
 
-#define BUFFER_SIZE 4096
+// Like verify_file, for a package that is already mapped.  The
+// signature, EOCD and signed region are all read from the mapping.
+// Each key says which digest it signs and how long its signature is;
+// the signed region is hashed once with every digest any of the keys
+// needs.
 
-    SHA_CTX ctx;
-    SHA_init(&ctx);
-    unsigned char* buffer = malloc(BUFFER_SIZE);
-    if (buffer == NULL) {
-        LOGE("failed to alloc memory for sha1 buffer\n");
-        fclose(f);
+int verify_mapped_file(const unsigned char* addr, size_t length,
+                       const Certificate *pKeys, unsigned int numKeys) {
+    ui_set_progress(0.0);
+
+    SignedPackage pkg;
+    if (find_signature(addr, length, &pkg) != 0) {
         return VERIFY_FAILURE;
     }
+    const unsigned char* eocd = pkg.eocd;
+    size_t eocd_size = pkg.eocd_size;
+    int comment_size = pkg.comment_size;
+    int signature_start = pkg.signature_start;
+    size_t signed_len = pkg.signed_len;
 
-    double frac = -1.0;
-    size_t so_far = 0;
-    fseek(f, 0, SEEK_SET);
-    while (so_far < signed_len) {
-        int size = BUFFER_SIZE;
-        if (signed_len - so_far < size) size = signed_len - so_far;
-        if (fread(buffer, 1, size, f) != size) {
-            LOGE("failed to read data from %s (%s)\n", path, strerror(errno));
-            fclose(f);
-            return VERIFY_FAILURE;
+    int need_sha1 = 0;
+    int need_sha256 = 0;
+    unsigned int i;
+    for (i = 0; i < numKeys; ++i) {
+        if (pKeys[i].hash_len == SHA1_DIGEST_SIZE) need_sha1 = 1;
+        if (pKeys[i].hash_len == SHA256_DIGEST_SIZE) need_sha256 = 1;
+    }
+
+    SHA1_CTX sha1_ctx;
+    SHA256_CTX sha256_ctx;
+    SHA1_init(&sha1_ctx);
+    SHA256_init(&sha256_ctx);
+    hash_signed_region(addr, signed_len,
+                       need_sha1 ? &sha1_ctx : NULL,
+                       need_sha256 ? &sha256_ctx : NULL);
+
+    const uint8_t* sha1 = need_sha1 ? SHA1_final(&sha1_ctx) : NULL;
+    const uint8_t* sha256 = need_sha256 ? SHA256_final(&sha256_ctx) : NULL;
+    // Keys that share a modulus and exponent (eg, the same key listed
+    // once for SHA-1 and once for SHA-256) give the same result for
+    // the public operation; do it once and check the padding of each.
+    uint8_t* results = malloc(numKeys * RSA_MAX_NUMBYTES);
+    int* have_result = calloc(numKeys, sizeof(int));
+    if (results == NULL || have_result == NULL) {
+        LOGE("failed to allocate verify buffers\n");
+        free(results);
+        free(have_result);
+        return VERIFY_FAILURE;
+    }
+
+    int verified = 0;
+    unsigned int hinted = find_hinted_key(eocd, eocd_size, signature_start,
+                                          pKeys, numKeys);
+    unsigned int n;
+    for (n = 0; n < numKeys && !verified; ++n) {
+        // The hinted key (if any) goes first, then the rest in order.
+        if (n == 0 && hinted < numKeys) {
+            i = hinted;
+        } else {
+            i = (hinted < numKeys && n <= hinted) ? n - 1 : n;
         }
-        SHA_update(&ctx, buffer, size);
-        so_far += size;
-        double f = so_far / (double)signed_len;
-        if (f > frac + 0.02 || size == so_far) {
-            ui_set_progress(f);
-            frac = f;
+        const Certificate* cert = pKeys + i;
+        const uint8_t* hash;
+        if (cert->hash_len == SHA1_DIGEST_SIZE) {
+            hash = sha1;
+        } else if (cert->hash_len == SHA256_DIGEST_SIZE) {
+            hash = sha256;
+        } else {
+            LOGE("key %d has unsupported hash length %d\n", i, cert->hash_len);
+            continue;
+        }
+
+        // The signature is the last sig_len bytes of the signature
+        // block.  The 6 bytes is the "(signature_start) $ff $ff
+        // (comment_size)" that the signing tool appends after the
+        // signature itself.
+        int sig_len = cert->public_key.len * sizeof(uint32_t);
+        if (signature_start - FOOTER_SIZE < sig_len ||
+            comment_size < sig_len + FOOTER_SIZE) {
+            LOGI("signature too short for key %d\n", i);
+            continue;
         }
+
+        uint8_t* result = results + i * RSA_MAX_NUMBYTES;
+        unsigned int k;
+        for (k = 0; k < numKeys; ++k) {
+            if (have_result[k] && same_public_key(&pKeys[k].public_key,
+                                                  &cert->public_key)) {
+                memcpy(result, results + k * RSA_MAX_NUMBYTES, sig_len);
+                have_result[i] = have_result[k];
+                break;
+            }
+        }
+        if (k == numKeys) {
+            have_result[i] = RSAKey_public_op(
+                &cert->public_key, eocd + eocd_size - FOOTER_SIZE - sig_len,
+                sig_len, result) ? 1 : -1;
+        }
+        if (have_result[i] > 0 &&
+            RSAKey_check_padding(result, sig_len, hash, cert->hash_len)) {
+            LOGI("whole-file signature verified against key %d\n", i);
+            verified = 1;
+        }
+    }
+
+    free(results);
+    free(have_result);
+    if (verified) {
+        return VERIFY_SUCCESS;
     }
-    fclose(f);
-    free(buffer);
+    LOGE("failed to verify whole-file signature\n");
+    return VERIFY_FAILURE;
+}
+
+// Check the signature on the package's hash tree (see
+// minzip/HashTree.h) instead of hashing the whole package.  Only the
+// tree is verified here; the data it describes is checked a block at a
+// time as the archive is read, so installation can start straight
+// away.  On success *pTree is the verified tree, for
+// mzOpenZipArchiveWithHashTree().
+//
+// Return VERIFY_SUCCESS, or VERIFY_FAILURE if the package has no hash
+// tree or no key matches the tree's signature.
+
+int verify_hash_tree(const unsigned char* addr, size_t length,
+                     const Certificate *pKeys, unsigned int numKeys,
+                     BlockHashTree** pTree) {
+    *pTree = NULL;
 
-    const uint8_t* sha1 = SHA_final(&ctx);
+    SignedPackage pkg;
+    if (find_signature(addr, length, &pkg) != 0) {
+        return VERIFY_FAILURE;
+    }
+    BlockHashTree* tree = mzLoadHashTree(addr, length);
+    if (tree == NULL) {
+        LOGI("package has no hash tree\n");
+        return VERIFY_FAILURE;
+    }
+
+    uint8_t sha1[SHA1_DIGEST_SIZE];
+    uint8_t sha256[SHA256_DIGEST_SIZE];
+    SHA1(tree->data, tree->signedLen, sha1);
+    SHA256(tree->data, tree->signedLen, sha256);
+
+    unsigned int i;
     for (i = 0; i < numKeys; ++i) {
-        // The 6 bytes is the "(signature_start) $ff $ff (comment_size)" that
-        // the signing tool appends after the signature itself.
-        if (RSA_verify(pKeys+i, eocd + eocd_size - 6 - RSANUMBYTES,
-                       RSANUMBYTES, sha1)) {
-            LOGI("whole-file signature verified against key %d\n", i);
-            free(eocd);
+        const Certificate* cert = pKeys + i;
+        size_t sig_len = cert->public_key.len * sizeof(uint32_t);
+        if (sig_len != tree->signatureLen) {
+            continue;
+        }
+        const uint8_t* hash = cert->hash_len == SHA1_DIGEST_SIZE ? sha1 : sha256;
+        if (RSAKey_verify(&cert->public_key, tree->signature, sig_len,
+                          hash, cert->hash_len)) {
+            LOGI("hash tree signature verified against key %d\n", i);
+            *pTree = tree;
             return VERIFY_SUCCESS;
         }
     }
-    free(eocd);
-    LOGE("failed to verify whole-file signature\n");
+    LOGE("failed to verify hash tree signature\n");
+    mzFreeHashTree(tree);
     return VERIFY_FAILURE;
 }
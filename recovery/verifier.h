@@ -17,12 +17,40 @@
 #ifndef _RECOVERY_VERIFIER_H
 #define _RECOVERY_VERIFIER_H
 
-#include "mincrypt/rsa.h"
+#include <stddef.h>
+
+#include "crypto/rsa.h"
+#include "minzip/HashTree.h"
+
+/* A public key together with the digest its signatures are made
+ * over.  hash_len is SHA1_DIGEST_SIZE (SHA-1) or SHA256_DIGEST_SIZE
+ * (SHA-256).
+ */
+typedef struct Certificate {
+    int hash_len;
+    RSAKey public_key;
+} Certificate;
 
 /* Look in the file for a signature footer, and verify that it
  * matches one of the given keys.  Return one of the constants below.
  */
-int verify_file(const char* path, const RSAPublicKey *pKeys, unsigned int numKeys);
+int verify_file(const char* path, const Certificate *pKeys, unsigned int numKeys);
+
+/* Like verify_file, for a package the caller has already mapped, so
+ * the same mapping can go on to be parsed as a zip without reading
+ * the package again.
+ */
+int verify_mapped_file(const unsigned char* addr, size_t length,
+                       const Certificate *pKeys, unsigned int numKeys);
+
+/* Verify the signature on the package's hash tree rather than on the
+ * whole file, and return the tree in *pTree so the archive can check
+ * blocks against it as they are read.  Packages without a hash tree
+ * fail; use verify_mapped_file for those.
+ */
+int verify_hash_tree(const unsigned char* addr, size_t length,
+                     const Certificate *pKeys, unsigned int numKeys,
+                     BlockHashTree** pTree);
 
 #define VERIFY_SUCCESS        0
 #define VERIFY_FAILURE        1
@@ -14,49 +14,244 @@
  * limitations under the License.
  */
 
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
 
+#include "crypto/sha1.h"
+#include "crypto/sha256.h"
+#include "minzip/SysUtil.h"
+#include "minzip/Zip.h"
 #include "verifier.h"
 
 // This is build/target/product/security/testkey.x509.pem after being
 // dumped out by dumpkey.jar.
-RSAPublicKey test_key =
-    { 64, 0xc926ad21,
-      { 1795090719, 2141396315, 950055447, -1713398866,
-        -26044131, 1920809988, 546586521, -795969498,
-        1776797858, -554906482, 1805317999, 1429410244,
-        129622599, 1422441418, 1783893377, 1222374759,
-        -1731647369, 323993566, 28517732, 609753416,
-        1826472888, 215237850, -33324596, -245884705,
-        -1066504894, 774857746, 154822455, -1797768399,
-        -1536767878, -1275951968, -1500189652, 87251430,
-        -1760039318, 120774784, 571297800, -599067824,
-        -1815042109, -483341846, -893134306, -1900097649,
-        -1027721089, 950095497, 555058928, 414729973,
-        1136544882, -1250377212, 465547824, -236820568,
-        -1563171242, 1689838846, -404210357, 1048029507,
-        895090649, 247140249, 178744550, -747082073,
-        -1129788053, 109881576, -350362881, 1044303212,
-        -522594267, -1309816990, -557446364, -695002876},
-      { -857949815, -510492167, -1494742324, -1208744608,
-        251333580, 2131931323, 512774938, 325948880,
-        -1637480859, 2102694287, -474399070, 792812816,
-        1026422502, 2053275343, -1494078096, -1181380486,
-        165549746, -21447327, -229719404, 1902789247,
-        772932719, -353118870, -642223187, 216871947,
-        -1130566647, 1942378755, -298201445, 1055777370,
-        964047799, 629391717, -2062222979, -384408304,
-        191868569, -1536083459, -612150544, -1297252564,
-        -1592438046, -724266841, -518093464, -370899750,
-        -739277751, -1536141862, 1323144535, 61311905,
-        1997411085, 376844204, 213777604, -217643712,
-        9135381, 1625809335, -1490225159, -1342673351,
-        1117190829, -57654514, 1825108855, -1281819325,
-        1111251351, -1726129724, 1684324211, -1773988491,
-        367251975, 810756730, -1941182952, 1175080310 }
-    };
+Certificate test_key =
+    { SHA1_DIGEST_SIZE,
+      { 64, 0xc926ad21,
+        { 1795090719, 2141396315, 950055447, -1713398866,
+          -26044131, 1920809988, 546586521, -795969498,
+          1776797858, -554906482, 1805317999, 1429410244,
+          129622599, 1422441418, 1783893377, 1222374759,
+          -1731647369, 323993566, 28517732, 609753416,
+          1826472888, 215237850, -33324596, -245884705,
+          -1066504894, 774857746, 154822455, -1797768399,
+          -1536767878, -1275951968, -1500189652, 87251430,
+          -1760039318, 120774784, 571297800, -599067824,
+          -1815042109, -483341846, -893134306, -1900097649,
+          -1027721089, 950095497, 555058928, 414729973,
+          1136544882, -1250377212, 465547824, -236820568,
+          -1563171242, 1689838846, -404210357, 1048029507,
+          895090649, 247140249, 178744550, -747082073,
+          -1129788053, 109881576, -350362881, 1044303212,
+          -522594267, -1309816990, -557446364, -695002876},
+        { -857949815, -510492167, -1494742324, -1208744608,
+          251333580, 2131931323, 512774938, 325948880,
+          -1637480859, 2102694287, -474399070, 792812816,
+          1026422502, 2053275343, -1494078096, -1181380486,
+          165549746, -21447327, -229719404, 1902789247,
+          772932719, -353118870, -642223187, 216871947,
+          -1130566647, 1942378755, -298201445, 1055777370,
+          964047799, 629391717, -2062222979, -384408304,
+          191868569, -1536083459, -612150544, -1297252564,
+          -1592438046, -724266841, -518093464, -370899750,
+          -739277751, -1536141862, 1323144535, 61311905,
+          1997411085, 376844204, 213777604, -217643712,
+          9135381, 1625809335, -1490225159, -1342673351,
+          1117190829, -57654514, 1825108855, -1281819325,
+          1111251351, -1726129724, 1684324211, -1773988491,
+          367251975, 810756730, -1941182952, 1175080310 },
+        3 } };
+
+// The remaining keys were generated for these tests only and sign
+// testdata/otasigned_*.zip.
+
+// 2048-bit, e=3, signs SHA-256 digests ("v3").
+Certificate test_key_sha256 =
+    { SHA256_DIGEST_SIZE,
+      { 64, 0x439a5a55,
+        { -1240453885, -962249279, -72757909, -2089746375,
+          1263216697, -1285450486, 1350791645, 128698616,
+          -1915229144, -1687122924, 1492726435, -1275819907,
+          -1148461402, -169621317, -473221944, -425501432,
+          1674735301, 2028319982, -1570524856, -555034360,
+          -1784501354, 1288140489, -1597214054, -1825390452,
+          -1898745601, -455321119, -501775455, -699190343,
+          554867001, 1076178032, 2006854298, 1659336134,
+          2011121985, 254688271, 1554450838, -230250971,
+          -174896220, 45019770, 2076243606, 70506209,
+          -2055452785, -650902372, 123037909, 378437558,
+          -1789410555, 1926631969, 98898209, -1135414736,
+          1606221700, -2133407755, 333444602, 1231291855,
+          -134244106, 927799764, 1379611583, -888060436,
+          879846909, -548233837, 627674596, -1764312847,
+          -432902243, 577760707, -1916237329, -887055248},
+        { 506067455, 1487169324, -2067956445, 1818685334,
+          326793326, 1963220879, -1247377014, -1621769773,
+          833959557, 1241558859, -1238039774, 1268268518,
+          -1387917562, 1886394846, -284459960, 396777554,
+          -1569821031, -979671029, 1825843902, 952967738,
+          -141014909, 1702288619, 651018733, 287450880,
+          -1741866289, 68322253, 2006882333, -1798508143,
+          1423065344, -1870956993, -2024481688, 1927870139,
+          80687485, 815702062, 1595078830, -786821785,
+          -432559477, -213012621, 1954424468, -168522588,
+          -1760169814, 286636667, 1037256675, -1807112446,
+          -842341536, 2030028794, 385367768, 1882843127,
+          808779769, 2074671097, 1246590239, 2089647529,
+          -1225384041, 308638343, 1938448871, 2042126278,
+          1125966277, 948913247, -2000351028, -847121505,
+          -467582950, -1317707313, 815609426, 1926335955 },
+        3 } };
+
+// 2048-bit, e=65537, signs SHA-1 digests ("v2").
+Certificate test_key_f4 =
+    { SHA1_DIGEST_SIZE,
+      { 64, 0x6f8fcc25,
+        { -274952109, 29006811, -217327016, -1898314614,
+          55555215, -924845793, -1606563317, -759654116,
+          185455789, -637936995, 1503412764, 634453211,
+          -357724270, -1585931118, -1620815290, 1331872892,
+          1327772366, -1487435861, 976148570, 710705132,
+          -306183387, 1700434314, -1425517483, 3206977,
+          1937629539, 108772382, 316411253, 1697831804,
+          484605812, 1785556811, -310072386, -478585905,
+          1475340964, 1589022259, -1409987243, -245388472,
+          1364576787, 940964606, -220265618, -502253754,
+          -768772410, 2016137840, -856495128, -1743213233,
+          286585594, -412309793, -1685824833, 1824127607,
+          -1469766353, 1119729906, 86442186, -433371172,
+          -1695664493, -821813431, -122686122, 1362673340,
+          779517673, -332482989, 497243594, 725214589,
+          364745502, 6158091, 1287021558, -1123572872},
+        { -1639465030, -1035304010, -689427365, 1274232822,
+          1641678595, 162349123, 708734400, 1442885777,
+          2097807765, -1924908510, 303992277, 2083591640,
+          262921525, 1331725301, 1003676877, -1266772773,
+          297121195, -24087023, 16719589, 897909322,
+          2091127908, 586258175, 34613692, -853940145,
+          501147882, 1033315400, 1956046321, 1358712797,
+          110063684, 1847332840, -912674640, -308963220,
+          -1971161296, 1331906480, 348193437, 1139563013,
+          1642932486, -1619146925, -89433517, 1735937251,
+          -482474424, 429100197, -1284265499, -82624302,
+          1440455405, 306630955, -1785577100, 1792160263,
+          -1661891807, -2025993409, -496318209, 140611150,
+          -864013455, 515996903, -240664020, -1229559665,
+          -1267029816, 580645493, -576985005, 2025316469,
+          1603171020, -936740458, -599538360, 1824036885 },
+        65537 } };
+
+// The same key as test_key_f4, signing SHA-256 digests ("v4").
+Certificate test_key_f4_sha256 =
+    { SHA256_DIGEST_SIZE,
+      { 64, 0x6f8fcc25,
+        { -274952109, 29006811, -217327016, -1898314614,
+          55555215, -924845793, -1606563317, -759654116,
+          185455789, -637936995, 1503412764, 634453211,
+          -357724270, -1585931118, -1620815290, 1331872892,
+          1327772366, -1487435861, 976148570, 710705132,
+          -306183387, 1700434314, -1425517483, 3206977,
+          1937629539, 108772382, 316411253, 1697831804,
+          484605812, 1785556811, -310072386, -478585905,
+          1475340964, 1589022259, -1409987243, -245388472,
+          1364576787, 940964606, -220265618, -502253754,
+          -768772410, 2016137840, -856495128, -1743213233,
+          286585594, -412309793, -1685824833, 1824127607,
+          -1469766353, 1119729906, 86442186, -433371172,
+          -1695664493, -821813431, -122686122, 1362673340,
+          779517673, -332482989, 497243594, 725214589,
+          364745502, 6158091, 1287021558, -1123572872},
+        { -1639465030, -1035304010, -689427365, 1274232822,
+          1641678595, 162349123, 708734400, 1442885777,
+          2097807765, -1924908510, 303992277, 2083591640,
+          262921525, 1331725301, 1003676877, -1266772773,
+          297121195, -24087023, 16719589, 897909322,
+          2091127908, 586258175, 34613692, -853940145,
+          501147882, 1033315400, 1956046321, 1358712797,
+          110063684, 1847332840, -912674640, -308963220,
+          -1971161296, 1331906480, 348193437, 1139563013,
+          1642932486, -1619146925, -89433517, 1735937251,
+          -482474424, 429100197, -1284265499, -82624302,
+          1440455405, 306630955, -1785577100, 1792160263,
+          -1661891807, -2025993409, -496318209, 140611150,
+          -864013455, 515996903, -240664020, -1229559665,
+          -1267029816, 580645493, -576985005, 2025316469,
+          1603171020, -936740458, -599538360, 1824036885 },
+        65537 } };
+
+// 4096-bit, e=65537, signs SHA-256 digests ("v4").
+Certificate test_key_4096 =
+    { SHA256_DIGEST_SIZE,
+      { 128, 0x5b10776f,
+        { 1351956593, -2096732897, 1227413333, -353295971,
+          870282131, 1779588305, -1117456498, -1705502471,
+          -1602969266, 2114760696, 921659946, 85463968,
+          392158670, 1814930480, 1338369817, 1132707133,
+          1653766453, 1830211343, 1690521183, 751665751,
+          435611693, -1089419670, -277884444, 15837506,
+          -729047715, -527832879, 524808514, 1450721005,
+          -225879400, 1702911036, -1729906901, 2093915317,
+          -984872725, -707339908, 1657160459, 332520700,
+          -1099008910, 1845606419, -1486254900, 560981798,
+          2052876083, 482672254, -843485131, 1372450637,
+          254179429, 1337035865, -1869066162, -782975242,
+          -1818744346, 2007475313, -842357022, -2125740152,
+          -1817624430, 1284006857, -2077145665, -590228859,
+          -1871784346, 863525289, -267088409, 1198487503,
+          -784691705, 1875368997, 1543073029, -1648938900,
+          -1102595444, 280918252, 370824074, -1809879630,
+          379527199, 869914466, 858550793, 964870752,
+          1790654404, 95027931, 1277291023, -1204067962,
+          1485269202, -1833098076, 673378131, -593398310,
+          -2033011396, -1105031315, -201749559, -1809309242,
+          1593711189, 21218298, 1865619398, -1557748683,
+          -2124632493, 999272349, 772635499, -20919284,
+          -1550924895, 1362418292, -1368719031, -2027034038,
+          1924605550, 1333806732, -2121026495, -1271058181,
+          -388561082, 2820857, 1157892839, 989284208,
+          -2127649631, 1208130020, -1033044740, -1620448910,
+          -538009743, -1708358259, 1357385055, -189238295,
+          2047866465, -971919211, -1759438175, -317688635,
+          702714856, -1694538771, -1743488840, 1833265637,
+          1969814742, -609307615, 1560895847, 149473738,
+          -773466497, 472478841, -1528558131, -1149897401},
+        { 1813062090, 1652981193, 277015172, 833875054,
+          1768658762, 838205945, -1284378824, 216974342,
+          -183565573, -1498434083, 148840528, 1163447688,
+          1924141628, -1409063765, 1920675872, 2118992734,
+          1789820519, 741062711, -537121334, 459861281,
+          -660286617, 1449084287, -1046791873, -417547095,
+          1428105094, 1344426770, -1828381172, 1633510840,
+          -181784228, -1595369551, -1497480625, 1410521611,
+          375247985, -1729553640, 77596874, -1109734736,
+          -666878717, -1722992138, 563755909, 783721830,
+          2055411988, -50711205, -633208111, -375756790,
+          -1339651587, 1372000968, -591581187, 425871848,
+          -1340903744, -1114644092, -1878472964, 778430542,
+          -329934447, 2122128538, 903500937, -1731040459,
+          -129719653, 1203298428, -506881423, 1747199487,
+          482690400, -283243717, 720949592, 1492226024,
+          1893597849, 1524043583, 590710211, -1241624814,
+          -380766413, 227425211, -1183958412, 695196466,
+          -1381836316, 1182366673, 960505092, 28327913,
+          1814796362, -1778522670, -555185864, -2013595417,
+          107159347, 109616115, -483811447, 576477260,
+          738961757, 1003870665, 445423347, 1307108472,
+          -1703024182, -470322921, -1291815573, 483152420,
+          83654530, -1366476157, 328310471, 800100774,
+          -1499849719, -664198331, -1316190960, -1011294244,
+          -2117461954, 1121646261, -1504234665, -1330162903,
+          885395811, 1034472781, -1808308407, 1659082513,
+          -1828466534, -1955364822, -623529327, 410206027,
+          751219743, -1782497114, -754433966, 1882913873,
+          1982051962, 945308225, -2134413984, 1463612183,
+          1693313605, 16629246, -658511073, -1260156044,
+          964539039, -535749769, 1941967549, 203720146 },
+        65537 } };
 
 void ui_print(const char* fmt, ...) {
     char buf[256];
@@ -71,13 +266,105 @@ void ui_print(const char* fmt, ...) {
 void ui_set_progress(float fraction) {
 }
 
+// Verify the package's hash tree, then read every entry through the
+// archive so every block it touches gets checked against the tree, the
+// way the updater reads the package.
+static int verify_by_hash_tree(const char* path, const Certificate* pKeys,
+                               unsigned int numKeys) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return VERIFY_FAILURE;
+    }
+    MemMapping map;
+    if (sysMapFileInShmem(fd, &map) != 0) {
+        close(fd);
+        return VERIFY_FAILURE;
+    }
+
+    BlockHashTree* tree;
+    if (verify_hash_tree(map.addr, map.length, pKeys, numKeys, &tree) !=
+        VERIFY_SUCCESS) {
+        sysReleaseShmem(&map);
+        close(fd);
+        return VERIFY_FAILURE;
+    }
+
+    ZipArchive zip;
+    if (mzOpenZipArchiveWithHashTree(fd, &map, tree, &zip) != 0) {
+        return VERIFY_FAILURE;
+    }
+    int result = VERIFY_SUCCESS;
+    unsigned int i;
+    for (i = 0; i < mzZipEntryCount(&zip); ++i) {
+        if (!mzIsZipEntryIntact(&zip, mzGetZipEntryAt(&zip, i))) {
+            result = VERIFY_FAILURE;
+            break;
+        }
+    }
+    mzCloseZipArchive(&zip);
+    return result;
+}
+
 int main(int argc, char **argv) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <package>\n", argv[0]);
+    int sha256 = 0;
+    int f4 = 0;
+    int bits4096 = 0;
+    int all = 0;
+    int hash_tree = 0;
+
+    while (argc > 2 && argv[1][0] == '-') {
+        if (strcmp(argv[1], "-sha256") == 0) {
+            sha256 = 1;
+        } else if (strcmp(argv[1], "-f4") == 0) {
+            f4 = 1;
+        } else if (strcmp(argv[1], "-4096") == 0) {
+            bits4096 = 1;
+        } else if (strcmp(argv[1], "-all") == 0) {
+            all = 1;
+        } else if (strcmp(argv[1], "-tree") == 0) {
+            hash_tree = 1;
+        } else {
+            break;
+        }
+        --argc;
+        ++argv;
+    }
+
+    if (argc != 2 || (bits4096 && !(f4 && sha256))) {
+        fprintf(stderr, "Usage: %s [-tree] [-sha256] [-f4] [-4096] <package>\n"
+                "       %s [-tree] -all <package>\n", argv[0], argv[0]);
+        fprintf(stderr, "  (-4096 requires -f4 -sha256)\n");
         return 2;
     }
 
-    int result = verify_file(argv[1], &test_key, 1);
+    // -all tries every test key, the way recovery does with a keys
+    // file listing several.
+    Certificate keys[5];
+    keys[0] = test_key;
+    keys[1] = test_key_sha256;
+    keys[2] = test_key_f4;
+    keys[3] = test_key_f4_sha256;
+    keys[4] = test_key_4096;
+    unsigned int i;
+    for (i = 0; i < sizeof(keys) / sizeof(keys[0]); ++i) {
+        RSAKey_precompute(&keys[i].public_key);
+    }
+
+    Certificate* cert;
+    unsigned int num_keys = 1;
+    if (all) {
+        cert = keys;
+        num_keys = sizeof(keys) / sizeof(keys[0]);
+    } else if (bits4096) {
+        cert = &keys[4];
+    } else if (f4) {
+        cert = sha256 ? &keys[3] : &keys[2];
+    } else {
+        cert = sha256 ? &keys[1] : &keys[0];
+    }
+
+    int result = hash_tree ? verify_by_hash_tree(argv[1], cert, num_keys)
+                           : verify_file(argv[1], cert, num_keys);
     if (result == VERIFY_SUCCESS) {
         printf("SUCCESS\n");
         return 0;
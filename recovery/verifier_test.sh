@@ -65,16 +65,21 @@ cleanup() {
 $ADB push $ANDROID_PRODUCT_OUT/system/bin/verifier_test \
           $WORK_DIR/verifier_test
 
+# Any arguments after the package name are passed to verifier_test
+# to select the test key (-sha256, -f4, -4096, -all) and whether to
+# verify by hash tree (-tree).
 expect_succeed() {
-  testname "$1 (should succeed)"
+  testname "$* (should succeed)"
   $ADB push $DATA_DIR/$1 $WORK_DIR/package.zip
-  run_command $WORK_DIR/verifier_test $WORK_DIR/package.zip || fail
+  shift
+  run_command $WORK_DIR/verifier_test "$@" $WORK_DIR/package.zip || fail
 }
 
 expect_fail() {
-  testname "$1 (should fail)"
+  testname "$* (should fail)"
   $ADB push $DATA_DIR/$1 $WORK_DIR/package.zip
-  run_command $WORK_DIR/verifier_test $WORK_DIR/package.zip && fail
+  shift
+  run_command $WORK_DIR/verifier_test "$@" $WORK_DIR/package.zip && fail
 }
 
 expect_fail unsigned.zip
@@ -85,6 +90,41 @@ expect_fail fake-eocd.zip
 expect_fail alter-metadata.zip
 expect_fail alter-footer.zip
 
+expect_succeed otasigned_sha256.zip -sha256
+expect_succeed otasigned_f4.zip -f4
+expect_succeed otasigned_f4_sha256.zip -f4 -sha256
+expect_succeed otasigned_4096_f4_sha256.zip -4096 -f4 -sha256
+
+# each package only verifies against the key and digest it was signed with
+expect_fail otasigned_sha256.zip
+expect_fail otasigned.zip -sha256
+expect_fail otasigned_f4.zip -f4 -sha256
+expect_fail otasigned_f4_sha256.zip -f4
+expect_fail otasigned_4096_f4_sha256.zip -f4 -sha256
+expect_fail otasigned_f4_sha256.zip -4096 -f4 -sha256
+
+# with every key loaded, each package finds its own; the key id hint
+# in otasigned_4096_keyid.zip moves the 4096-bit key to the front
+expect_succeed otasigned.zip -all
+expect_succeed otasigned_sha256.zip -all
+expect_succeed otasigned_f4.zip -all
+expect_succeed otasigned_f4_sha256.zip -all
+expect_succeed otasigned_4096_f4_sha256.zip -all
+expect_succeed otasigned_4096_keyid.zip -all
+expect_fail otasigned_4096_keyid.zip -f4 -sha256
+expect_fail alter-metadata.zip -all
+expect_fail alter-footer.zip -all
+
+# hash tree: the tree is signed separately from the whole file, and
+# reading the archive through it fails on the block that was changed
+expect_succeed otasigned_tree.zip -sha256
+expect_succeed otasigned_tree.zip -tree -sha256
+expect_succeed otasigned_tree.zip -tree -all
+expect_fail otasigned_tree.zip -tree
+expect_fail otasigned.zip -tree
+expect_fail alter-tree-block.zip -sha256
+expect_fail alter-tree-block.zip -tree -sha256
+
 # --------------- cleanup ----------------------
 
 cleanup